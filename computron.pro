@@ -21,6 +21,13 @@ unix {
     LIBS += -lreadline
     DEFINES += HAVE_READLINE
     DEFINES += HAVE_USLEEP
+    DEFINES += HAVE_MMAP
+    DEFINES += HAVE_PREAD
+}
+
+linux {
+    DEFINES += HAVE_PTHREAD_SETAFFINITY_NP
+    DEFINES += HAVE_FDATASYNC
 }
 
 OBJECTS_DIR = .obj
@@ -34,7 +41,8 @@ FORMS += gui/statewidget.ui
 
 OTHER_FILES += bios/bios.asm
 
-HEADERS += gui/machinewidget.h \
+HEADERS += gui/batchrunner.h \
+           gui/machinewidget.h \
            gui/statewidget.h \
            gui/mainwindow.h \
            gui/palettewidget.h \
@@ -43,12 +51,15 @@ HEADERS += gui/machinewidget.h \
            hw/MemoryProvider.h \
            hw/ROM.h \
            hw/DiskDrive.h \
+           hw/DiskOverlay.h \
            hw/fdc.h \
            hw/ide.h \
            hw/iodevice.h \
            hw/keyboard.h \
            hw/vomctl.h \
            hw/cmos.h \
+           hw/dma.h \
+           hw/pci.h \
            hw/pic.h \
            hw/pit.h \
            hw/vga.h \
@@ -65,6 +76,8 @@ HEADERS += gui/machinewidget.h \
            x86/CPU.h \
            x86/Descriptor.h \
            x86/Instruction.h \
+           x86/InstructionCache.h \
+           x86/PhysicalMemoryMap.h \
            x86/Tasking.h
 
 SOURCES += debug.cpp \
@@ -72,6 +85,7 @@ SOURCES += debug.cpp \
            dump.cpp \
            machine.cpp \
            settings.cpp \
+           snapshot.cpp \
            vmcalls.cpp \
            x86/bcd.cpp \
            x86/bitwise.cpp \
@@ -80,6 +94,8 @@ SOURCES += debug.cpp \
            x86/flags.cpp \
            x86/fpu.cpp \
            x86/Instruction.cpp \
+           x86/InstructionCache.cpp \
+           x86/PhysicalMemoryMap.cpp \
            x86/interrupt.cpp \
            x86/io.cpp \
            x86/jump.cpp \
@@ -90,6 +106,7 @@ SOURCES += debug.cpp \
            x86/stack.cpp \
            x86/string.cpp \
            x86/Tasking.cpp \
+           gui/batchrunner.cpp \
            gui/machinewidget.cpp \
            gui/main.cpp \
            gui/mainwindow.cpp \
@@ -107,7 +124,10 @@ SOURCES += debug.cpp \
            hw/vomctl.cpp \
            hw/iodevice.cpp \
            hw/cmos.cpp \
+           hw/dma.cpp \
+           hw/pci.cpp \
            hw/PS2.cpp \
            hw/MemoryProvider.cpp \
            hw/ROM.cpp \
-           hw/DiskDrive.cpp
+           hw/DiskDrive.cpp \
+           hw/DiskOverlay.cpp
@@ -64,6 +64,9 @@ void vlog(VLogChannel channel, const char* format, ...)
     case LogScreen: prefix = "screen"; break;
     case LogFPU: prefix = "fpu"; break;
     case LogTimer: prefix = "timer"; break;
+    case LogSnapshot: prefix = "snapshot"; break;
+    case LogPCI: prefix = "pci"; break;
+    case LogDMA: prefix = "dma"; break;
     default:
         ASSERT_NOT_REACHED();
     }
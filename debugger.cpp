@@ -28,11 +28,13 @@
 #include "CPU.h"
 #include "pic.h"
 #include "machine.h"
+#include "DiskDrive.h"
 #include "pic.h"
 #include <QDebug>
 #include <QStringBuilder>
 #include <QStringList>
 #include <QLatin1Literal>
+#include <cinttypes>
 #ifdef HAVE_READLINE
 #include <readline/readline.h>
 #endif
@@ -174,6 +176,24 @@ void Debugger::handleCommand(const QString& rawCommand)
         return;
     }
 
+    if (lowerCommand == "tlb")
+        return handleTLB(arguments);
+
+    if (lowerCommand == "icache")
+        return handleInstructionCache(arguments);
+
+    if (lowerCommand == "blocks")
+        return handleBlockCache(arguments);
+
+    if (lowerCommand == "idle")
+        return handleIdleLoops(arguments);
+
+    if (lowerCommand == "snapshot")
+        return handleSnapshot(arguments);
+
+    if (lowerCommand == "disk")
+        return handleDisk(arguments);
+
     if (lowerCommand == "slon") {
         options.stacklog = true;
         return;
@@ -205,13 +225,13 @@ void Debugger::handleIRQ(const QStringList& arguments)
 
     if (arguments[0] == "off") {
         printf("Ignoring all IRQs\n");
-        PIC::setIgnoreAllIRQs(true);
+        PIC::setIgnoreAllIRQs(cpu().machine(), true);
         return;
     }
 
     if (arguments[0] == "on") {
         printf("Allowing all IRQs\n");
-        PIC::setIgnoreAllIRQs(false);
+        PIC::setIgnoreAllIRQs(cpu().machine(), false);
         return;
     }
 
@@ -361,6 +381,134 @@ void Debugger::handleDumpFlatMemory(const QStringList& arguments)
     cpu().dumpFlatMemory(address);
 }
 
+void Debugger::handleTLB(const QStringList& arguments)
+{
+    if (arguments.size() == 1 && arguments.at(0) == "flush") {
+        cpu().flushTLB();
+        return;
+    }
+
+    if (arguments.isEmpty()) {
+        QWORD hits = cpu().tlbHits();
+        QWORD misses = cpu().tlbMisses();
+        QWORD lookups = hits + misses;
+        printf("TLB: %" PRIu64 " hits, %" PRIu64 " misses (%.2f%% hit rate), %" PRIu64 " flushes\n",
+            hits,
+            misses,
+            lookups ? (hits * 100.0) / lookups : 0.0,
+            cpu().tlbFlushes());
+        return;
+    }
+
+    printf("usage: tlb [flush]\n");
+}
+
+void Debugger::handleInstructionCache(const QStringList& arguments)
+{
+    auto& cache = cpu().instructionCache();
+
+    if (arguments.size() == 1 && arguments.at(0) == "flush") {
+        cache.clear();
+        return;
+    }
+
+    if (arguments.isEmpty()) {
+        QWORD lookups = cache.hits() + cache.misses();
+        printf("Instruction cache (%u entries): %" PRIu64 " hits, %" PRIu64 " misses (%.2f%% hit rate), %" PRIu64 " invalidations\n",
+            cache.entryCount(),
+            cache.hits(),
+            cache.misses(),
+            lookups ? (cache.hits() * 100.0) / lookups : 0.0,
+            cache.invalidations());
+        return;
+    }
+
+    printf("usage: icache [flush]\n");
+}
+
+void Debugger::handleBlockCache(const QStringList& arguments)
+{
+    auto& cache = cpu().instructionCache();
+
+    if (arguments.size() == 1 && (arguments.at(0) == "on" || arguments.at(0) == "off")) {
+        cpu().setBlockCacheEnabled(arguments.at(0) == "on");
+        return;
+    }
+
+    if (arguments.isEmpty()) {
+        printf("Block cache: %s\n", cpu().isBlockCacheEnabled() ? "on" : "off");
+        printf("  %u blocks (%u instructions) cached, %" PRIu64 " built, %" PRIu64 " invalidated by writes\n",
+            cache.blockCount(),
+            cache.blockInstructionCount(),
+            cache.blocksBuilt(),
+            cache.blockInvalidations());
+        printf("  %" PRIu64 " block executions, %" PRIu64 " instructions executed from blocks\n",
+            cache.blockExecutions(),
+            cache.blockInstructionsExecuted());
+        return;
+    }
+
+    printf("usage: blocks [on|off]\n");
+}
+
+void Debugger::handleIdleLoops(const QStringList& arguments)
+{
+    if (arguments.size() == 1 && arguments.at(0) == "reset") {
+        cpu().clearIdleLoops();
+        return;
+    }
+
+    if (arguments.isEmpty()) {
+        printf("Idle loop detection: %s\n", options.disableIdleDetection ? "off" : "on");
+        for (auto& it : cpu().idleLoops())
+            printf("    %04x:%08x  idled %" PRIu64 " times\n", it.first.selector(), it.first.offset(), it.second);
+        return;
+    }
+
+    printf("usage: idle [reset]\n");
+}
+
+void Debugger::handleSnapshot(const QStringList& arguments)
+{
+    if (arguments.size() == 1) {
+        if (cpu().machine().saveSnapshot(arguments.at(0)))
+            printf("Saved snapshot to %s\n", qPrintable(arguments.at(0)));
+        else
+            printf("Couldn't save snapshot to %s\n", qPrintable(arguments.at(0)));
+        return;
+    }
+
+    printf("usage: snapshot <filename>\n");
+}
+
+void Debugger::handleDisk(const QStringList& arguments)
+{
+    if (arguments.size() == 1 && arguments.at(0) == "flush") {
+        for (auto* drive : cpu().machine().diskDrives())
+            drive->flush();
+        return;
+    }
+
+    if (arguments.isEmpty()) {
+        for (auto* drive : cpu().machine().diskDrives()) {
+            if (!drive->present())
+                continue;
+            auto statistics = drive->cacheStatistics();
+            QWORD lookups = statistics.hits + statistics.misses;
+            printf("%s: %s%s\n", qPrintable(drive->name()), qPrintable(drive->imagePath()), drive->usesOverlay() ? " (overlay)" : "");
+            printf("    cache: %u sectors, %u dirty\n", drive->cacheSizeInSectors(), statistics.dirtySectors);
+            printf("    %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit rate), %" PRIu64 " written back\n",
+                statistics.hits,
+                statistics.misses,
+                lookups ? statistics.hits * 100.0 / lookups : 0.0,
+                statistics.writeBacks);
+        }
+        return;
+    }
+
+    printf("usage: disk [flush]\n");
+}
+
 void Debugger::handleTracing(const QStringList& arguments)
 {
     if (arguments.size() == 1) {
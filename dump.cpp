@@ -22,11 +22,15 @@
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
+#include <cinttypes>
 #include <stdio.h>
 #include "Common.h"
 #include "CPU.h"
 #include "debug.h"
 #include "Tasking.h"
+#ifdef HAVE_MMAP
+#include <sys/resource.h>
+#endif
 
 unsigned CPU::dumpDisassembledInternal(SegmentDescriptor& descriptor, DWORD offset)
 {
@@ -103,7 +107,12 @@ void CPU::dumpTrace()
         getSF(), getIF(), getDF(), getOF()
     );
 #else
-    printf(
+    // Reading the flags for the trace must not materialize them, or an instruction that
+    // consumes a stale flag would look correct in the autotests.
+    DWORD dirtyFlags = m_dirtyFlags;
+    bool cf = CF, pf = PF, af = AF, zf = ZF, sf = SF, of = OF;
+
+    fprintf(m_traceOutput,
         "%04X:%08X %02X "
         "EAX=%08X EBX=%08X ECX=%08X EDX=%08X ESP=%08X EBP=%08X ESI=%08X EDI=%08X "
         "CR0=%08X CR3=%08X CPL=%u IOPL=%u A20=%u "
@@ -125,6 +134,9 @@ void CPU::dumpTrace()
         x16() ? 16 : 32,
         s16() ? 16 : 32
     );
+
+    m_dirtyFlags = dirtyFlags;
+    CF = cf; PF = pf; AF = af; ZF = zf; SF = sf; OF = of;
 #endif
 }
 #endif
@@ -302,6 +314,37 @@ void CPU::dumpAll()
     dumpDisassembled(cachedDescriptor(SegmentRegisterIndex::CS), currentBaseInstructionPointer());
 }
 
+// Printed at VKILL when running with --bench. Goes to stdout regardless of --no-vlog.
+static long peakResidentKilobytes()
+{
+#ifdef HAVE_MMAP
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+#endif
+    return 0;
+}
+
+void CPU::dumpBenchmarkResults()
+{
+    qint64 elapsedMs = m_benchmarkTimer.elapsed();
+    printf("bench: %" PRIu64 " instructions in %lld ms (%.2f MIPS)\n",
+        m_cycle,
+        (long long)elapsedMs,
+        elapsedMs ? (double)m_cycle / (elapsedMs * 1000.0) : 0.0);
+    printf("bench: faults: %" PRIu64 " signalled, %" PRIu64 " unwound\n", m_signalledFaults, m_unwoundFaults);
+    printf("bench: tlb: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " flushes\n", m_tlbHits, m_tlbMisses, m_tlbFlushes);
+    printf("bench: icache: %" PRIu64 " hits, %" PRIu64 " misses\n", m_instructionCache.hits(), m_instructionCache.misses());
+    printf("bench: memory: %zu KiB guest RAM, allocated in %.3f ms, %ld KiB peak resident\n",
+        m_memorySize / 1024,
+        m_memoryAllocationNanoseconds / 1000000.0,
+        peakResidentKilobytes());
+    printf("bench: halted: %" PRIu64 " ms, %" PRIu64 " wakeups, %.1f%% host CPU while halted\n",
+        m_haltedNanoseconds / 1000000,
+        m_haltWakeups,
+        m_haltedNanoseconds ? 100.0 * m_haltedHostCPUNanoseconds / m_haltedNanoseconds : 0.0);
+}
+
 static inline BYTE n(BYTE b)
 {
     if (b < 0x20 || ((b > 127) && (b < 160)))
@@ -0,0 +1,228 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "batchrunner.h"
+#include "CPU.h"
+#include "machine.h"
+#include "vomctl.h"
+#include <QtCore/QThread>
+#include <cinttypes>
+#include <stdio.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+class BatchRunner::PoolThread final : public QThread {
+public:
+    PoolThread(BatchRunner& runner, unsigned index)
+        : m_runner(runner)
+        , m_index(index)
+    {
+    }
+
+    void run() override { m_runner.runJobs(m_index); }
+
+private:
+    BatchRunner& m_runner;
+    unsigned m_index { 0 };
+};
+
+BatchRunner::BatchRunner(const QStringList& fileNames)
+    : m_jobs(fileNames.size())
+{
+    for (int i = 0; i < fileNames.size(); ++i)
+        m_jobs[i].fileName = fileNames[i];
+}
+
+BatchRunner::BatchRunner(std::vector<OwnPtr<Machine>>&& machines, const QStringList& names)
+    : m_jobs(machines.size())
+{
+    for (size_t i = 0; i < machines.size(); ++i) {
+        m_jobs[i].fileName = names[i];
+        m_jobs[i].machine = std::move(machines[i]);
+    }
+}
+
+BatchRunner::~BatchRunner()
+{
+}
+
+static void pinCurrentThreadToCore(unsigned core)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    CPU_SET(core, &cores);
+    if (int error = pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores))
+        fprintf(stderr, "batch: Couldn't pin thread to core %u: %s\n", core, strerror(error));
+#else
+    UNUSED_PARAM(core);
+#endif
+}
+
+int BatchRunner::run()
+{
+    if (!options.memoryFile.isEmpty()) {
+        fprintf(stderr, "batch: Ignoring --memory-file, machines can't share one file\n");
+        options.memoryFile.clear();
+    }
+
+    unsigned threadCount = m_threadCount ? m_threadCount : qMax(QThread::idealThreadCount(), 1);
+    threadCount = qMin<size_t>(threadCount, m_jobs.size());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    std::vector<OwnPtr<PoolThread>> threads;
+    for (unsigned i = 0; i < threadCount; ++i) {
+        threads.push_back(make<PoolThread>(*this, i));
+        threads.back()->start();
+    }
+    for (auto& thread : threads) {
+        while (!thread->wait(100))
+            shutDownJobsPastTimeout();
+    }
+
+    int failures = 0;
+    for (auto& job : m_jobs) {
+        if (job.status != JobStatus::Finished)
+            ++failures;
+    }
+
+    printReport();
+    printf("batch: %zu jobs on %u threads in %lld ms, %d failed\n",
+        m_jobs.size(), threadCount, (long long)timer.elapsed(), failures);
+    return failures;
+}
+
+void BatchRunner::runJobs(unsigned threadIndex)
+{
+    if (m_pinsThreadsToCores)
+        pinCurrentThreadToCore(threadIndex % qMax(QThread::idealThreadCount(), 1));
+
+    forever {
+        size_t index = m_nextJob++;
+        if (index >= m_jobs.size())
+            return;
+        runJob(m_jobs[index]);
+    }
+}
+
+static const char* toString(BatchRunner::JobStatus status)
+{
+    switch (status) {
+    case BatchRunner::JobStatus::Pending: return "not run";
+    case BatchRunner::JobStatus::Running: return "running";
+    case BatchRunner::JobStatus::Finished: return "ok";
+    case BatchRunner::JobStatus::TimedOut: return "timed out";
+    case BatchRunner::JobStatus::LoadFailed: return "failed to load";
+    case BatchRunner::JobStatus::Crashed: return "crashed";
+    }
+    return "unknown";
+}
+
+// Scripts can't tell the jobs apart in the report, so each one also leaves <image>.status
+// behind, holding how its run ended ("ok" if the guest shut itself down).
+static void writeStatusFile(const QString& fileName, BatchRunner::JobStatus status)
+{
+    FILE* file = fopen(qPrintable(fileName + ".status"), "w");
+    if (!file) {
+        fprintf(stderr, "batch: Couldn't write %s.status\n", qPrintable(fileName));
+        return;
+    }
+    fprintf(file, "%s\n", toString(status));
+    fclose(file);
+}
+
+void BatchRunner::runJob(Job& job)
+{
+    // The machine is built on the thread that runs it, so its memory is first touched there.
+    auto machine = job.machine ? std::move(job.machine) : Machine::createForAutotest(job.fileName);
+    FILE* traceOutput = machine ? fopen(qPrintable(job.fileName + ".out"), "w") : nullptr;
+    if (!traceOutput) {
+        {
+            QMutexLocker locker(&m_mutex);
+            job.status = JobStatus::LoadFailed;
+        }
+        writeStatusFile(job.fileName, JobStatus::LoadFailed);
+        return;
+    }
+
+    CPU& cpu = machine->cpu();
+    cpu.setTraceOutput(traceOutput);
+    machine->vomCtl().setConsoleOutputPath(job.fileName + ".console");
+
+    {
+        QMutexLocker locker(&m_mutex);
+        job.cpu = &cpu;
+        job.status = JobStatus::Running;
+        job.timer.start();
+    }
+
+    cpu.mainLoop();
+
+    JobStatus status;
+    {
+        QMutexLocker locker(&m_mutex);
+        job.elapsedNanoseconds = job.timer.nsecsElapsed();
+        job.instructions = cpu.cycle();
+        job.cpu = nullptr;
+        if (job.status == JobStatus::Running)
+            job.status = machine->didShutDownAfterError() ? JobStatus::Crashed : JobStatus::Finished;
+        status = job.status;
+    }
+
+    cpu.setTraceOutput(stdout);
+    fclose(traceOutput);
+    writeStatusFile(job.fileName, status);
+}
+
+void BatchRunner::shutDownJobsPastTimeout()
+{
+    if (!m_timeoutSeconds)
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    for (auto& job : m_jobs) {
+        if (job.status != JobStatus::Running || job.timer.elapsed() < m_timeoutSeconds * 1000)
+            continue;
+        job.status = JobStatus::TimedOut;
+        job.cpu->queueCommand(CPU::Shutdown);
+    }
+}
+
+void BatchRunner::printReport() const
+{
+    for (auto& job : m_jobs) {
+        double seconds = job.elapsedNanoseconds / 1000000000.0;
+        printf("batch: %s: %s, %" PRIu64 " instructions in %.3f s (%.2f MIPS)\n",
+            qPrintable(job.fileName),
+            toString(job.status),
+            job.instructions,
+            seconds,
+            seconds > 0 ? job.instructions / seconds / 1000000.0 : 0.0);
+    }
+}
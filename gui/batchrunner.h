@@ -0,0 +1,86 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "types.h"
+#include "OwnPtr.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QStringList>
+#include <atomic>
+#include <vector>
+
+class CPU;
+class Machine;
+
+// Runs a list of autotest images concurrently, one Machine per image, on a pool
+// of worker threads. Each machine writes its trace to <image>.out, its port
+// 0x666 console to <image>.console and how its run ended to <image>.status.
+class BatchRunner {
+public:
+    explicit BatchRunner(const QStringList& fileNames);
+    // Runs machines that are already built, e.g. the children of Machine::fork().
+    // Their output files are named after the given names instead of an image.
+    BatchRunner(std::vector<OwnPtr<Machine>>&&, const QStringList& names);
+    ~BatchRunner();
+
+    // 0 means one thread per host core.
+    void setThreadCount(unsigned count) { m_threadCount = count; }
+    void setPinsThreadsToCores(bool pins) { m_pinsThreadsToCores = pins; }
+    // 0 means no timeout.
+    void setTimeoutSeconds(unsigned seconds) { m_timeoutSeconds = seconds; }
+
+    // Returns the number of jobs that didn't shut down cleanly.
+    int run();
+
+    enum class JobStatus { Pending, Running, Finished, TimedOut, LoadFailed, Crashed };
+
+private:
+    class PoolThread;
+
+    struct Job {
+        QString fileName;
+        OwnPtr<Machine> machine;
+        JobStatus status { JobStatus::Pending };
+        QWORD instructions { 0 };
+        qint64 elapsedNanoseconds { 0 };
+        QElapsedTimer timer;
+        // Only set while the job is running, guarded by m_mutex.
+        CPU* cpu { nullptr };
+    };
+
+    void runJobs(unsigned threadIndex);
+    void runJob(Job&);
+    void shutDownJobsPastTimeout();
+    void printReport() const;
+
+    std::vector<Job> m_jobs;
+    std::atomic<size_t> m_nextJob { 0 };
+    QMutex m_mutex;
+
+    unsigned m_threadCount { 0 };
+    bool m_pinsThreadsToCores { false };
+    unsigned m_timeoutSeconds { 0 };
+};
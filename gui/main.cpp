@@ -32,20 +32,29 @@
 #include "machine.h"
 #include "iodevice.h"
 #include "settings.h"
+#include "DiskDrive.h"
+#include "DiskOverlay.h"
+#include "batchrunner.h"
 #include <signal.h>
 
 static void parseArguments(const QStringList& arguments);
+static int runBatch(const QStringList& fileNames);
+static int runForks(const QString& snapshotPath, unsigned count);
 
 RuntimeOptions options;
 
+// The CPU that SIGINT drops into the debugger.
+static CPU* s_interactiveCPU = nullptr;
+
 static void sigint_handler(int)
 {
-    ASSERT(g_cpu);
-    g_cpu->debugger().enter();
+    ASSERT(s_interactiveCPU);
+    s_interactiveCPU->debugger().enter();
 }
 
 void hard_exit(int exitCode)
 {
+    DiskDrive::flushAll();
     exit(exitCode);
 }
 
@@ -67,12 +76,26 @@ int main(int argc, char** argv)
 
     parseArguments(app->arguments());
 
+    if (!options.commitOverlayPath.isEmpty())
+        return DiskOverlay::commit(options.commitOverlayPath) ? 0 : 1;
+
+    if (!options.discardOverlayPath.isEmpty())
+        return DiskOverlay::discard(options.discardOverlayPath) ? 0 : 1;
+
+    if (options.forkCount)
+        return runForks(options.restorePath, options.forkCount);
+
+    if (options.batch || options.autotestPaths.size() > 1)
+        return runBatch(options.autotestPaths);
+
     signal(SIGINT, sigint_handler);
 
     OwnPtr<Machine> machine;
 
-    if (options.autotestPath.length()) {
-        machine = Machine::createForAutotest(options.autotestPath);
+    if (!options.restorePath.isEmpty()) {
+        machine = Machine::createFromSnapshot(options.restorePath);
+    } else if (!options.autotestPaths.isEmpty()) {
+        machine = Machine::createForAutotest(options.autotestPaths.first());
     } else if (options.configPath.length()) {
         machine = Machine::createFromFile(options.configPath);
     } else {
@@ -82,6 +105,8 @@ int main(int argc, char** argv)
     if (!machine)
         return 1;
 
+    s_interactiveCPU = &machine->cpu();
+
     if (options.start_in_debug)
         machine->cpu().debugger().enter();
 
@@ -93,7 +118,7 @@ int main(int argc, char** argv)
 
     if (machine->settings().isForAutotest()) {
         machine->cpu().mainLoop();
-        return 0;
+        return machine->didShutDownAfterError() ? 1 : 0;
     }
 
     MainWindow mainWindow;
@@ -104,6 +129,47 @@ int main(int argc, char** argv)
     return app->exec();
 }
 
+int runBatch(const QStringList& fileNames)
+{
+    BatchRunner runner(fileNames);
+    runner.setThreadCount(options.batchThreads);
+    runner.setPinsThreadsToCores(options.pinBatchThreads);
+    runner.setTimeoutSeconds(options.batchTimeoutSeconds);
+    return runner.run() ? 1 : 0;
+}
+
+int runForks(const QString& snapshotPath, unsigned count)
+{
+    if (snapshotPath.isEmpty()) {
+        fprintf(stderr, "--fork needs a snapshot to fork from, see --restore\n");
+        return 1;
+    }
+
+    auto parent = Machine::createFromSnapshot(snapshotPath);
+    if (!parent)
+        return 1;
+    if (!parent->isForAutotest()) {
+        // The machine is already running on its worker by now.
+        fprintf(stderr, "--fork only works with snapshots of autotest machines\n");
+        hard_exit(1);
+    }
+
+    auto children = parent->fork(count);
+    if (children.empty())
+        return 1;
+
+    QStringList names;
+    for (size_t i = 0; i < children.size(); ++i)
+        names.append(QString("%1.fork%2").arg(snapshotPath).arg(i));
+
+    // Every child gets its own thread unless told otherwise.
+    BatchRunner runner(std::move(children), names);
+    runner.setThreadCount(options.batchThreads ? options.batchThreads : names.size());
+    runner.setPinsThreadsToCores(options.pinBatchThreads);
+    runner.setTimeoutSeconds(options.batchTimeoutSeconds);
+    return runner.run() ? 1 : 0;
+}
+
 void parseArguments(const QStringList& arguments)
 {
     for (auto it = arguments.begin(); it != arguments.end(); ) {
@@ -134,6 +200,62 @@ void parseArguments(const QStringList& arguments)
             options.start_in_debug = true;
         else if (argument == "--no-vlog")
             options.novlog = true;
+        else if (argument == "--block-cache")
+            options.blockCache = true;
+        else if (argument == "--bench")
+            options.benchmark = true;
+        else if (argument == "--unwind-faults")
+            options.unwindFaults = true;
+        else if (argument == "--no-idle-detection")
+            options.disableIdleDetection = true;
+        else if (argument == "--pin-threads")
+            options.pinBatchThreads = true;
+        else if (argument == "--batch") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --batch [list of images]\n");
+                hard_exit(1);
+            }
+            QFile list(*it);
+            if (!list.open(QIODevice::ReadOnly)) {
+                fprintf(stderr, "Couldn't open %s\n", qPrintable(*it));
+                hard_exit(1);
+            }
+            while (!list.atEnd()) {
+                QString fileName = QString::fromLocal8Bit(list.readLine()).trimmed();
+                if (!fileName.isEmpty() && !fileName.startsWith("#"))
+                    options.autotestPaths.append(fileName);
+            }
+            options.batch = true;
+            continue;
+        }
+        else if (argument == "--threads") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --threads [count]\n");
+                hard_exit(1);
+            }
+            options.batchThreads = (*it).toUInt();
+            continue;
+        }
+        else if (argument == "--timeout") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --timeout [seconds]\n");
+                hard_exit(1);
+            }
+            options.batchTimeoutSeconds = (*it).toUInt();
+            continue;
+        }
+        else if (argument == "--fork") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --restore [filename] --fork [count]\n");
+                hard_exit(1);
+            }
+            options.forkCount = (*it).toUInt();
+            continue;
+        }
         else if (argument == "--config") {
             ++it;
             if (it == arguments.end()) {
@@ -143,13 +265,88 @@ void parseArguments(const QStringList& arguments)
             options.configPath = (*it);
             continue;
         }
+        else if (argument == "--restore") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --restore [filename]\n");
+                hard_exit(1);
+            }
+            options.restorePath = (*it);
+            continue;
+        }
+        else if (argument == "--memory-file") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --memory-file [filename]\n");
+                hard_exit(1);
+            }
+            options.memoryFile = (*it);
+            continue;
+        }
+        else if (argument == "--memory-size") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --memory-size [kilobytes]\n");
+                hard_exit(1);
+            }
+            if (!Settings::parseMemorySize(*it, options.memorySize)) {
+                fprintf(stderr, "computron: --memory-size %s is not a size in kilobytes below 4 GiB\n", qPrintable(*it));
+                hard_exit(1);
+            }
+            continue;
+        }
+        else if (argument == "--disk") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --run [filename] --disk [image]\n");
+                hard_exit(1);
+            }
+            options.autotestDiskPath = (*it);
+            continue;
+        }
+        else if (argument == "--disk-overlay") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --run [filename] --disk [image] --disk-overlay [overlay]\n");
+                hard_exit(1);
+            }
+            options.autotestDiskOverlayPath = (*it);
+            continue;
+        }
+        else if (argument == "--floppy") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --run [filename] --floppy [1.44M image]\n");
+                hard_exit(1);
+            }
+            options.autotestFloppyPath = (*it);
+            continue;
+        }
+        else if (argument == "--commit-overlay") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --commit-overlay [filename]\n");
+                hard_exit(1);
+            }
+            options.commitOverlayPath = (*it);
+            continue;
+        }
+        else if (argument == "--discard-overlay") {
+            ++it;
+            if (it == arguments.end()) {
+                fprintf(stderr, "usage: computron --discard-overlay [filename]\n");
+                hard_exit(1);
+            }
+            options.discardOverlayPath = (*it);
+            continue;
+        }
         else if (argument == "--run") {
             ++it;
             if (it == arguments.end()) {
                 fprintf(stderr, "usage: computron --run [filename]\n");
                 hard_exit(1);
             }
-            options.autotestPath = (*it);
+            options.autotestPaths.append(*it);
             continue;
         }
         ++it;
@@ -37,10 +37,7 @@ Worker::~Worker()
 
 void Worker::run()
 {
-    while (true) {
-        m_cpu.mainLoop();
-        msleep(50);
-    }
+    m_cpu.mainLoop();
 }
 
 void Worker::shutdown()
@@ -21,26 +21,583 @@
 // OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 // (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
-
 #include "DiskDrive.h"
+#include "DiskOverlay.h"
+#include "debug.h"
+#include <QtCore/QDataStream>
+#include <QtCore/QSet>
+#include <algorithm>
+#include <string.h>
+#ifdef HAVE_PREAD
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(HAVE_MMAP) && defined(HAVE_PREAD)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static QMutex s_allDrivesMutex;
+static QSet<DiskDrive*>* s_allDrives;
 
 DiskDrive::DiskDrive(const QString& name)
     : m_name(name)
 {
+    QMutexLocker locker(&s_allDrivesMutex);
+    if (!s_allDrives)
+        s_allDrives = new QSet<DiskDrive*>;
+    s_allDrives->insert(this);
 }
 
 DiskDrive::~DiskDrive()
 {
+    {
+        QMutexLocker locker(&s_allDrivesMutex);
+        s_allDrives->remove(this);
+    }
+    QMutexLocker locker(&m_mutex);
+    closeImage();
+}
+
+void DiskDrive::flushAll()
+{
+    QMutexLocker locker(&s_allDrivesMutex);
+    if (!s_allDrives)
+        return;
+    for (auto* drive : *s_allDrives)
+        drive->flush();
 }
 
 void DiskDrive::setConfiguration(Configuration config)
 {
+    QMutexLocker locker(&m_mutex);
+    closeImage();
     m_config = std::move(config);
     m_present = !m_config.imagePath.isEmpty();
+    openImage();
 }
 
 void DiskDrive::setImagePath(const QString& path)
 {
+    QMutexLocker locker(&m_mutex);
+    closeImage();
     m_config.imagePath = path;
     m_present = !m_config.imagePath.isEmpty();
+    openImage();
+}
+
+// The image stays open for as long as it's in the drive, so a sector transfer is a single
+// positional read or write with no path lookup or stdio buffering.
+void DiskDrive::openImage()
+{
+    if (!m_present) {
+        resizeCache(m_cacheKilobytes);
+        return;
+    }
+
+    // With an overlay, the image is never written to.
+    bool wantsWrite = m_config.overlayPath.isEmpty();
+    m_isReadOnly = false;
+#ifdef HAVE_PREAD
+    QByteArray path = m_config.imagePath.toLocal8Bit();
+    m_fd = wantsWrite ? open(path.constData(), O_RDWR | O_CLOEXEC) : -1;
+    if (m_fd < 0) {
+        m_fd = open(path.constData(), O_RDONLY | O_CLOEXEC);
+        m_isReadOnly = m_fd >= 0;
+    }
+    if (m_fd < 0)
+        vlog(LogDisk, "%s: Couldn't open %s: %s", qPrintable(name()), qPrintable(imagePath()), strerror(errno));
+#else
+    m_file.setFileName(m_config.imagePath);
+    if (!wantsWrite || !m_file.open(QIODevice::ReadWrite)) {
+        m_isReadOnly = m_file.open(QIODevice::ReadOnly);
+        if (!m_isReadOnly)
+            vlog(LogDisk, "%s: Couldn't open %s", qPrintable(name()), qPrintable(imagePath()));
+    }
+#endif
+    if (m_isReadOnly && wantsWrite)
+        vlog(LogDisk, "%s: %s is read-only", qPrintable(name()), qPrintable(imagePath()));
+
+    QWORD imageSectors = qMax<QWORD>(sectors(), QFile(imagePath()).size() / bytesPerSector());
+    if (!m_config.overlayPath.isEmpty()) {
+        m_diskOverlay = DiskOverlay::openOrCreate(m_config.overlayPath, imagePath(), bytesPerSector(), imageSectors);
+        if (m_diskOverlay)
+            vlog(LogDisk, "%s: Writing to overlay %s (%llu sectors modified)", qPrintable(name()), qPrintable(m_config.overlayPath), (unsigned long long)m_diskOverlay->modifiedSectorCount());
+    }
+
+    if (m_config.mapping != ImageMapping::None) {
+        if (m_diskOverlay)
+            vlog(LogDisk, "%s: Not mapping %s, it has an overlay", qPrintable(name()), qPrintable(imagePath()));
+        else
+            mapImage();
+    }
+
+    if (m_usesOverlay)
+        createMemoryOverlay();
+
+    // The page cache already does this job for a mapped image.
+    resizeCache(m_mapping ? 0 : m_cacheKilobytes);
+}
+
+// A new image starts with an empty overlay, since the sectors in the old one belong to the old image.
+void DiskDrive::createMemoryOverlay()
+{
+    QWORD imageSectors = qMax<QWORD>(sectors(), QFile(imagePath()).size() / bytesPerSector());
+    m_memoryOverlay = DiskOverlay::createInMemory(bytesPerSector(), imageSectors);
+}
+
+void DiskDrive::closeImage()
+{
+    flushWithLockHeld();
+    unmapImage();
+    m_memoryOverlay.clear();
+    m_diskOverlay.clear();
+#ifdef HAVE_PREAD
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+#else
+    m_file.close();
+#endif
+}
+
+void DiskDrive::mapImage()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_PREAD)
+    struct stat st;
+    if (m_fd < 0 || fstat(m_fd, &st) < 0 || !st.st_size)
+        return;
+
+    bool shared = m_config.mapping == ImageMapping::Shared;
+    if (shared && m_isReadOnly) {
+        vlog(LogDisk, "%s: %s is read-only, writes to it won't be kept", qPrintable(name()), qPrintable(imagePath()));
+        shared = false;
+    }
+
+    void* mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_NORESERVE, m_fd, 0);
+    if (mapping == MAP_FAILED) {
+        vlog(LogDisk, "%s: Couldn't map %s: %s", qPrintable(name()), qPrintable(imagePath()), strerror(errno));
+        return;
+    }
+    m_mapping = static_cast<BYTE*>(mapping);
+    m_mappingSize = st.st_size;
+    m_mappingIsPrivate = !shared;
+    if (m_mappingIsPrivate)
+        m_privatelyWrittenSectors.assign(m_mappingSize / bytesPerSector(), false);
+    vlog(LogDisk, "%s: Mapped %s (%s)", qPrintable(name()), qPrintable(imagePath()), shared ? "shared" : "private");
+#else
+    vlog(LogDisk, "%s: Can't map disk images on this platform, using regular I/O", qPrintable(name()));
+#endif
+}
+
+void DiskDrive::unmapImage()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_PREAD)
+    if (!m_mapping)
+        return;
+    munmap(m_mapping, m_mappingSize);
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_mappingIsPrivate = false;
+    m_privatelyWrittenSectors.clear();
+    ++m_mappingGeneration;
+#endif
+}
+
+// How many of the sectors starting at lba are within the mapping.
+unsigned DiskDrive::mappedSectorCount(DWORD lba, unsigned count) const
+{
+    size_t mappedSectors = m_mappingSize / bytesPerSector();
+    if (lba >= mappedSectors)
+        return 0;
+    return qMin<size_t>(count, mappedSectors - lba);
+}
+
+const BYTE* DiskDrive::mappedSectors(DWORD lba, unsigned count, unsigned& generation) const
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_mapping || mappedSectorCount(lba, count) != count)
+        return nullptr;
+    for (unsigned i = 0; i < count && m_memoryOverlay; ++i) {
+        if (m_memoryOverlay->contains(lba + i))
+            return nullptr;
+    }
+    generation = m_mappingGeneration;
+    return m_mapping + (size_t)lba * bytesPerSector();
+}
+
+// Returns false, copying nothing, if the mapping source points into is gone.
+bool DiskDrive::copyMappedData(const BYTE* source, unsigned generation, BYTE* destination, size_t size) const
+{
+    QMutexLocker locker(&m_mutex);
+    if (generation != m_mappingGeneration)
+        return false;
+    memcpy(destination, source, size);
+    return true;
+}
+
+size_t DiskDrive::readBaseImage(QWORD offset, BYTE* destination, size_t size)
+{
+#ifdef HAVE_PREAD
+    size_t done = 0;
+    while (done < size) {
+        ssize_t nread = pread(m_fd, destination + done, size - done, offset + done);
+        if (nread < 0 && errno == EINTR)
+            continue;
+        if (nread <= 0)
+            break;
+        done += nread;
+    }
+    return done;
+#else
+    if (!m_file.seek(offset))
+        return 0;
+    return qMax<qint64>(m_file.read(reinterpret_cast<char*>(destination), size), 0);
+#endif
+}
+
+size_t DiskDrive::writeBaseImage(QWORD offset, const BYTE* source, size_t size)
+{
+#ifdef HAVE_PREAD
+    size_t done = 0;
+    while (done < size) {
+        ssize_t nwritten = pwrite(m_fd, source + done, size - done, offset + done);
+        if (nwritten < 0 && errno == EINTR)
+            continue;
+        if (nwritten <= 0)
+            break;
+        done += nwritten;
+    }
+    return done;
+#else
+    if (!m_file.seek(offset))
+        return 0;
+    return qMax<qint64>(m_file.write(reinterpret_cast<const char*>(source), size), 0);
+#endif
+}
+
+// The newest copy of a sector is in the in-memory overlay, then the overlay file, then the image.
+DiskOverlay* DiskDrive::overlayContaining(DWORD lba)
+{
+    if (m_memoryOverlay && m_memoryOverlay->contains(lba))
+        return m_memoryOverlay.ptr();
+    if (m_diskOverlay && m_diskOverlay->contains(lba))
+        return m_diskOverlay.ptr();
+    return nullptr;
+}
+
+// Reads unmodified sectors from the image and the others from the overlays, a run at a time.
+unsigned DiskDrive::readImage(DWORD lba, unsigned count, BYTE* destination)
+{
+    if (!m_diskOverlay && !m_memoryOverlay)
+        return readBaseImage((QWORD)lba * bytesPerSector(), destination, (size_t)count * bytesPerSector()) / bytesPerSector();
+
+    unsigned done = 0;
+    while (done < count) {
+        DiskOverlay* overlay = overlayContaining(lba + done);
+        unsigned run = 1;
+        while (done + run < count && overlayContaining(lba + done + run) == overlay)
+            ++run;
+        BYTE* runDestination = destination + (size_t)done * bytesPerSector();
+        unsigned nread;
+        if (overlay)
+            nread = overlay->read(lba + done, run, runDestination);
+        else
+            nread = readBaseImage((QWORD)(lba + done) * bytesPerSector(), runDestination, (size_t)run * bytesPerSector()) / bytesPerSector();
+        done += nread;
+        if (nread < run)
+            break;
+    }
+    return done;
+}
+
+unsigned DiskDrive::writeImage(DWORD lba, unsigned count, const BYTE* source)
+{
+    if (m_memoryOverlay)
+        return m_memoryOverlay->write(lba, count, source);
+    if (m_diskOverlay)
+        return m_diskOverlay->write(lba, count, source);
+    return writeBaseImage((QWORD)lba * bytesPerSector(), source, (size_t)count * bytesPerSector()) / bytesPerSector();
+}
+
+unsigned DiskDrive::readSectors(DWORD lba, unsigned count, BYTE* destination)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_mapping)
+        return readCachedSectors(lba, count, destination);
+
+    size_t transferred = mappedSectorCount(lba, count);
+    memcpy(destination, m_mapping + (size_t)lba * bytesPerSector(), transferred * bytesPerSector());
+    if (!m_memoryOverlay)
+        return transferred;
+
+    // Sectors past the end of the mapping may still have been written to the overlay.
+    memset(destination + transferred * bytesPerSector(), 0, (count - transferred) * bytesPerSector());
+    for (unsigned i = 0; i < count; ++i) {
+        if (!m_memoryOverlay->contains(lba + i))
+            continue;
+        m_memoryOverlay->read(lba + i, 1, destination + (size_t)i * bytesPerSector());
+        transferred = qMax<size_t>(transferred, i + 1);
+    }
+    return transferred;
+}
+
+unsigned DiskDrive::writeSectors(DWORD lba, unsigned count, const BYTE* source)
+{
+    QMutexLocker locker(&m_mutex);
+    // A private mapping keeps writes in its copy-on-write pages, unless they belong in the overlay.
+    if (m_mapping && !m_memoryOverlay) {
+        unsigned transferred = mappedSectorCount(lba, count);
+        memcpy(m_mapping + (size_t)lba * bytesPerSector(), source, transferred * bytesPerSector());
+        if (m_mappingIsPrivate)
+            std::fill_n(m_privatelyWrittenSectors.begin() + lba, transferred, true);
+        return transferred;
+    }
+
+    if (m_cacheSlots.empty() || !isWritable())
+        return writeImage(lba, count, source);
+
+    for (unsigned i = 0; i < count; ++i)
+        insertIntoCache(lba + i, source + i * bytesPerSector(), true);
+    return count;
+}
+
+// Hits are copied out of the cache. Runs of consecutive misses are read from the image
+// with one call each, then added to the cache.
+unsigned DiskDrive::readCachedSectors(DWORD lba, unsigned count, BYTE* destination)
+{
+    if (m_cacheSlots.empty())
+        return readImage(lba, count, destination);
+
+    unsigned transferred = count;
+    unsigned missesStart = 0;
+    auto readMisses = [&] (unsigned missesEnd) {
+        if (missesStart == missesEnd)
+            return;
+        BYTE* missDestination = destination + (size_t)missesStart * bytesPerSector();
+        unsigned missCount = missesEnd - missesStart;
+        unsigned nread = readImage(lba + missesStart, missCount, missDestination);
+        for (unsigned i = 0; i < nread; ++i)
+            insertIntoCache(lba + missesStart + i, missDestination + (size_t)i * bytesPerSector(), false);
+        if (nread < missCount)
+            transferred = qMin(transferred, missesStart + nread);
+    };
+
+    for (unsigned i = 0; i < count; ++i) {
+        BYTE* sector = cachedSector(lba + i);
+        if (!sector) {
+            ++m_cacheStatistics.misses;
+            continue;
+        }
+        ++m_cacheStatistics.hits;
+        // Copy the hit before reading the misses in front of it, since that may evict it.
+        memcpy(destination + (size_t)i * bytesPerSector(), sector, bytesPerSector());
+        readMisses(i);
+        missesStart = i + 1;
+    }
+    readMisses(count);
+    return transferred;
+}
+
+BYTE* DiskDrive::cachedSector(DWORD lba)
+{
+    auto it = m_cacheIndex.constFind(lba);
+    if (it == m_cacheIndex.constEnd())
+        return nullptr;
+    m_cacheSlots[*it].referenced = true;
+    return cacheSlotData(*it);
+}
+
+void DiskDrive::insertIntoCache(DWORD lba, const BYTE* data, bool dirty)
+{
+    unsigned slot;
+    auto it = m_cacheIndex.constFind(lba);
+    if (it != m_cacheIndex.constEnd()) {
+        slot = *it;
+    } else {
+        slot = evictCacheSlot();
+        m_cacheSlots[slot].lba = lba;
+        m_cacheSlots[slot].valid = true;
+        m_cacheSlots[slot].dirty = false;
+        m_cacheIndex.insert(lba, slot);
+    }
+    memcpy(cacheSlotData(slot), data, bytesPerSector());
+    m_cacheSlots[slot].referenced = true;
+    if (dirty)
+        m_cacheSlots[slot].dirty = true;
+}
+
+unsigned DiskDrive::evictCacheSlot()
+{
+    forever {
+        unsigned slot = m_clockHand;
+        m_clockHand = (m_clockHand + 1) % m_cacheSlots.size();
+        auto& cacheSlot = m_cacheSlots[slot];
+        if (!cacheSlot.valid)
+            return slot;
+        if (cacheSlot.referenced) {
+            cacheSlot.referenced = false;
+            continue;
+        }
+        if (cacheSlot.dirty)
+            writeBack(slot);
+        m_cacheIndex.remove(cacheSlot.lba);
+        cacheSlot.valid = false;
+        return slot;
+    }
+}
+
+void DiskDrive::writeBack(unsigned slot)
+{
+    auto& cacheSlot = m_cacheSlots[slot];
+    if (writeImage(cacheSlot.lba, 1, cacheSlotData(slot)) != 1)
+        vlog(LogDisk, "%s: Couldn't write back sector %u to %s", qPrintable(name()), cacheSlot.lba, qPrintable(imagePath()));
+    cacheSlot.dirty = false;
+    ++m_cacheStatistics.writeBacks;
+}
+
+void DiskDrive::flush()
+{
+    QMutexLocker locker(&m_mutex);
+    flushWithLockHeld();
+}
+
+void DiskDrive::flushWithLockHeld()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_PREAD)
+    if (m_mapping && m_config.mapping == ImageMapping::Shared && !m_isReadOnly)
+        msync(m_mapping, m_mappingSize, MS_SYNC);
+#endif
+
+    std::vector<unsigned> dirtySlots;
+    for (unsigned slot = 0; slot < m_cacheSlots.size(); ++slot) {
+        if (m_cacheSlots[slot].valid && m_cacheSlots[slot].dirty)
+            dirtySlots.push_back(slot);
+    }
+    // Write in disk order, a run of consecutive sectors per call.
+    std::sort(dirtySlots.begin(), dirtySlots.end(), [this] (unsigned a, unsigned b) {
+        return m_cacheSlots[a].lba < m_cacheSlots[b].lba;
+    });
+    std::vector<BYTE> run;
+    for (size_t i = 0; i < dirtySlots.size(); ) {
+        size_t end = i + 1;
+        while (end < dirtySlots.size() && m_cacheSlots[dirtySlots[end]].lba == m_cacheSlots[dirtySlots[end - 1]].lba + 1)
+            ++end;
+        run.resize((end - i) * bytesPerSector());
+        for (size_t j = i; j < end; ++j)
+            memcpy(run.data() + (j - i) * bytesPerSector(), cacheSlotData(dirtySlots[j]), bytesPerSector());
+        DWORD lba = m_cacheSlots[dirtySlots[i]].lba;
+        unsigned written = writeImage(lba, end - i, run.data());
+        if (written != end - i)
+            vlog(LogDisk, "%s: Couldn't write back sectors %u-%u to %s", qPrintable(name()), lba + written, lba + (unsigned)(end - i) - 1, qPrintable(imagePath()));
+        for (size_t j = i; j < end; ++j)
+            m_cacheSlots[dirtySlots[j]].dirty = false;
+        m_cacheStatistics.writeBacks += end - i;
+        i = end;
+    }
+
+    // Once per flush, rather than once per sector that's new to the overlay.
+    if (m_diskOverlay)
+        m_diskOverlay->sync();
+}
+
+void DiskDrive::setCacheSize(unsigned kilobytes)
+{
+    QMutexLocker locker(&m_mutex);
+    flushWithLockHeld();
+    m_cacheKilobytes = kilobytes;
+    resizeCache(kilobytes);
+}
+
+// Drops everything in the cache, which must have been flushed.
+void DiskDrive::resizeCache(unsigned kilobytes)
+{
+    unsigned sectors = bytesPerSector() ? (kilobytes * 1024) / bytesPerSector() : 0;
+    m_cacheSlots.assign(sectors, CacheSlot());
+    m_cacheData.assign((size_t)sectors * bytesPerSector(), 0);
+    m_cacheIndex.clear();
+    m_clockHand = 0;
+}
+
+DiskDrive::CacheStatistics DiskDrive::cacheStatistics() const
+{
+    QMutexLocker locker(&m_mutex);
+    CacheStatistics statistics = m_cacheStatistics;
+    statistics.dirtySectors = std::count_if(m_cacheSlots.begin(), m_cacheSlots.end(), [] (const CacheSlot& slot) {
+        return slot.valid && slot.dirty;
+    });
+    return statistics;
+}
+
+void DiskDrive::setUsesOverlay(bool usesOverlay)
+{
+    QMutexLocker locker(&m_mutex);
+    if (usesOverlay == m_usesOverlay)
+        return;
+    // The cache mustn't keep sectors that came from an overlay which is going away.
+    flushWithLockHeld();
+    resizeCache(m_mapping ? 0 : m_cacheKilobytes);
+    m_usesOverlay = usesOverlay;
+    if (!m_usesOverlay)
+        m_memoryOverlay.clear();
+    else if (m_present)
+        createMemoryOverlay();
+}
+
+// Saves the sectors the guest has written that the image files don't have: the in-memory
+// overlay's, and those only in the copy-on-write pages of a private mapping.
+void DiskDrive::saveOverlay(QDataStream& stream)
+{
+    QMutexLocker locker(&m_mutex);
+    // Dirty cached sectors only reach the overlay when they're written back.
+    flushWithLockHeld();
+
+    std::vector<DWORD> savedSectors;
+    for (DWORD lba = 0; m_memoryOverlay && lba < m_memoryOverlay->sectorCount(); ++lba) {
+        if (m_memoryOverlay->contains(lba))
+            savedSectors.push_back(lba);
+    }
+    size_t overlaySectorCount = savedSectors.size();
+    for (DWORD lba = 0; lba < m_privatelyWrittenSectors.size(); ++lba) {
+        if (m_privatelyWrittenSectors[lba] && !(m_memoryOverlay && m_memoryOverlay->contains(lba)))
+            savedSectors.push_back(lba);
+    }
+
+    stream << m_usesOverlay << (quint32)savedSectors.size();
+    QByteArray data(bytesPerSector(), 0);
+    for (size_t i = 0; i < savedSectors.size(); ++i) {
+        DWORD lba = savedSectors[i];
+        if (i < overlaySectorCount)
+            m_memoryOverlay->read(lba, 1, reinterpret_cast<BYTE*>(data.data()));
+        else
+            memcpy(data.data(), m_mapping + (size_t)lba * bytesPerSector(), bytesPerSector());
+        stream << lba << data;
+    }
+}
+
+// Sectors restored from a snapshot go into the in-memory overlay, so every later write to
+// the drive does too.
+void DiskDrive::restoreOverlay(QDataStream& stream)
+{
+    QMutexLocker locker(&m_mutex);
+    bool usesOverlay;
+    quint32 sectorCount;
+    stream >> usesOverlay >> sectorCount;
+    // An overlay already set up by the settings stays on, even if the snapshot had none.
+    m_usesOverlay |= usesOverlay || sectorCount;
+
+    // Cached sectors from before the restore may be older than the overlay's.
+    flushWithLockHeld();
+    resizeCache(m_mapping ? 0 : m_cacheKilobytes);
+    if (m_usesOverlay && m_present)
+        createMemoryOverlay();
+    for (quint32 i = 0; i < sectorCount && stream.status() == QDataStream::Ok; ++i) {
+        DWORD lba;
+        QByteArray data;
+        stream >> lba >> data;
+        if (m_memoryOverlay && (unsigned)data.size() == bytesPerSector())
+            m_memoryOverlay->write(lba, 1, reinterpret_cast<const BYTE*>(data.constData()));
+    }
 }
@@ -24,13 +24,30 @@
 
 #pragma once
 
+#include <QHash>
+#include <QMutex>
 #include <QString>
+#ifndef HAVE_PREAD
+#include <QFile>
+#endif
 #include "types.h"
+#include "OwnPtr.h"
+#include <vector>
+
+class DiskOverlay;
+class QDataStream;
 
 class DiskDrive {
 public:
+    // A mapped image is read straight from the mapping, bypassing the sector cache.
+    // Writes go to private copy-on-write pages, unless the mapping is shared with the file.
+    enum class ImageMapping { None, Private, Shared };
+
     struct Configuration {
         QString imagePath;
+        ImageMapping mapping { ImageMapping::None };
+        // If set, writes go to this DiskOverlay file and the image is opened read-only.
+        QString overlayPath;
         unsigned sectorsPerTrack { 0 };
         unsigned heads { 0 };
         unsigned sectors { 0 };
@@ -62,8 +79,101 @@ public:
     unsigned bytesPerSector() const { return m_config.bytesPerSector; }
     BYTE floppyTypeForCMOS() const { return m_config.floppyTypeForCMOS; }
 
+    // Both return the number of whole sectors transferred.
+    unsigned readSectors(DWORD lba, unsigned count, BYTE* destination);
+    unsigned writeSectors(DWORD lba, unsigned count, const BYTE* source);
+
+    // For zero-copy reads from a mapped image. Returns null unless the whole range is in the
+    // mapping and untouched by the overlay. The pointer dies with the mapping, so it's only
+    // read through copyMappedData(), which checks the generation handed out with it.
+    const BYTE* mappedSectors(DWORD lba, unsigned count, unsigned& generation) const;
+    bool copyMappedData(const BYTE* source, unsigned generation, BYTE* destination, size_t size) const;
+
+    // With an overlay, written sectors are kept in an in-memory DiskOverlay, on top of the
+    // image and any overlay file, and neither of those is ever modified.
+    bool usesOverlay() const { return m_usesOverlay; }
+    void setUsesOverlay(bool);
+    void saveOverlay(QDataStream&);
+    void restoreOverlay(QDataStream&);
+
+    // Sectors read from and written to the image go through a write-back cache.
+    // A size of 0 turns it off and makes writes go straight to the image.
+    void setCacheSize(unsigned kilobytes);
+    unsigned cacheSizeInSectors() const { return m_cacheSlots.size(); }
+
+    struct CacheStatistics {
+        QWORD hits { 0 };
+        QWORD misses { 0 };
+        QWORD writeBacks { 0 };
+        unsigned dirtySectors { 0 };
+    };
+    CacheStatistics cacheStatistics() const;
+
+    // Writes all dirty cached sectors back to the image.
+    void flush();
+
+    // Flushes every drive in the process, e.g. before exiting.
+    static void flushAll();
+
 //private:
+    void openImage();
+    void closeImage();
+    size_t readBaseImage(QWORD offset, BYTE* destination, size_t size);
+    size_t writeBaseImage(QWORD offset, const BYTE* source, size_t size);
+    unsigned readImage(DWORD lba, unsigned count, BYTE* destination);
+    unsigned writeImage(DWORD lba, unsigned count, const BYTE* source);
+    bool isWritable() const { return !m_isReadOnly || m_diskOverlay || m_memoryOverlay; }
+    DiskOverlay* overlayContaining(DWORD lba);
+    void createMemoryOverlay();
+
+    void mapImage();
+    void unmapImage();
+    unsigned mappedSectorCount(DWORD lba, unsigned count) const;
+
+    unsigned readCachedSectors(DWORD lba, unsigned count, BYTE* destination);
+    BYTE* cachedSector(DWORD lba);
+    void insertIntoCache(DWORD lba, const BYTE* data, bool dirty);
+    unsigned evictCacheSlot();
+    void writeBack(unsigned slot);
+    void flushWithLockHeld();
+    void resizeCache(unsigned sectors);
+    BYTE* cacheSlotData(unsigned slot) { return m_cacheData.data() + (size_t)slot * bytesPerSector(); }
+
+    struct CacheSlot {
+        DWORD lba { 0 };
+        bool valid { false };
+        bool dirty { false };
+        bool referenced { false };
+    };
+
     Configuration m_config;
     QString m_name;
     bool m_present { false };
+    bool m_usesOverlay { false };
+    bool m_isReadOnly { false };
+#ifdef HAVE_PREAD
+    int m_fd { -1 };
+#else
+    QFile m_file;
+#endif
+    OwnPtr<DiskOverlay> m_diskOverlay;
+    OwnPtr<DiskOverlay> m_memoryOverlay;
+    BYTE* m_mapping { nullptr };
+    size_t m_mappingSize { 0 };
+    bool m_mappingIsPrivate { false };
+    // Bumped whenever the image is unmapped, so pointers from mappedSectors() can tell.
+    unsigned m_mappingGeneration { 0 };
+    // Sectors written to the copy-on-write pages of a private mapping, which snapshots have to save.
+    std::vector<bool> m_privatelyWrittenSectors;
+
+    // Guards the image, the overlay and the cache. Drives may be flushed from whichever thread exits.
+    mutable QMutex m_mutex;
+
+    // CLOCK replacement: the hand sweeps the slots, sparing and clearing referenced ones.
+    std::vector<CacheSlot> m_cacheSlots;
+    std::vector<BYTE> m_cacheData;
+    QHash<DWORD, unsigned> m_cacheIndex;
+    unsigned m_cacheKilobytes { 0 };
+    unsigned m_clockHand { 0 };
+    CacheStatistics m_cacheStatistics;
 };
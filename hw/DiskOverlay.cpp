@@ -0,0 +1,340 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "DiskOverlay.h"
+#include "debug.h"
+#include <QtCore/QDataStream>
+#include <QtCore/QFileInfo>
+#include <string.h>
+#include <unistd.h>
+
+static const quint32 overlayMagic = 0x564f5443; // "CTOV"
+static const quint32 overlayVersion = 1;
+static const QWORD overlayHeaderSize = 4096;
+static const QWORD overlayPageSize = 4096;
+static const QWORD memoryChunkSize = 64 * 1024;
+
+// Only the data has to reach the disk, not the file's timestamps.
+static bool syncFile(QFile& file)
+{
+#ifdef HAVE_FDATASYNC
+    return fdatasync(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+DiskOverlay::DiskOverlay(const QString& fileName)
+    : m_file(fileName)
+{
+}
+
+DiskOverlay::~DiskOverlay()
+{
+    if (m_file.isOpen())
+        sync();
+}
+
+OwnPtr<DiskOverlay> DiskOverlay::openOrCreate(const QString& fileName, const QString& basePath, unsigned bytesPerSector, QWORD sectorCount)
+{
+    if (!QFile::exists(fileName)) {
+        auto overlay = make<DiskOverlay>(fileName);
+        if (!overlay->create(basePath, bytesPerSector, sectorCount))
+            return nullptr;
+        return overlay;
+    }
+
+    auto overlay = open(fileName);
+    if (!overlay)
+        return nullptr;
+    if (overlay->bytesPerSector() != bytesPerSector || overlay->sectorCount() < sectorCount) {
+        vlog(LogDisk, "Overlay %s doesn't fit %s", qPrintable(fileName), qPrintable(basePath));
+        return nullptr;
+    }
+    // Its sectors would be mixed into the wrong image, and a commit would write them to the other one.
+    if (overlay->basePath() != QFileInfo(basePath).absoluteFilePath()) {
+        vlog(LogDisk, "Overlay %s was made for %s, not %s", qPrintable(fileName), qPrintable(overlay->basePath()), qPrintable(basePath));
+        return nullptr;
+    }
+    return overlay;
+}
+
+OwnPtr<DiskOverlay> DiskOverlay::open(const QString& fileName)
+{
+    auto overlay = make<DiskOverlay>(fileName);
+    if (!overlay->load())
+        return nullptr;
+    return overlay;
+}
+
+OwnPtr<DiskOverlay> DiskOverlay::createInMemory(unsigned bytesPerSector, QWORD sectorCount)
+{
+    auto overlay = make<DiskOverlay>(QString());
+    overlay->m_isInMemory = true;
+    overlay->m_bytesPerSector = bytesPerSector;
+    overlay->m_sectorCount = sectorCount;
+    overlay->computeLayout();
+    return overlay;
+}
+
+void DiskOverlay::computeLayout()
+{
+    m_bitmap.assign((m_sectorCount + 7) / 8, 0);
+    m_dataOffset = (overlayHeaderSize + m_bitmap.size() + overlayPageSize - 1) & ~(overlayPageSize - 1);
+}
+
+bool DiskOverlay::create(const QString& basePath, unsigned bytesPerSector, QWORD sectorCount)
+{
+    m_basePath = QFileInfo(basePath).absoluteFilePath();
+    m_bytesPerSector = bytesPerSector;
+    m_sectorCount = sectorCount;
+    computeLayout();
+
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        vlog(LogDisk, "Couldn't create overlay %s", qPrintable(fileName()));
+        return false;
+    }
+
+    QByteArray header;
+    QDataStream stream(&header, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << overlayMagic << overlayVersion << (quint32)m_bytesPerSector << (quint64)m_sectorCount << m_basePath;
+
+    // Everything past the header starts out as a hole.
+    if ((QWORD)header.size() > overlayHeaderSize || m_file.write(header) != header.size() || !m_file.resize(m_dataOffset + m_sectorCount * m_bytesPerSector)) {
+        vlog(LogDisk, "Couldn't write overlay %s", qPrintable(fileName()));
+        return false;
+    }
+
+    vlog(LogDisk, "Created overlay %s for %s", qPrintable(fileName()), qPrintable(m_basePath));
+    return true;
+}
+
+bool DiskOverlay::load()
+{
+    if (!m_file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        vlog(LogDisk, "Couldn't open overlay %s", qPrintable(fileName()));
+        return false;
+    }
+
+    QByteArray header = m_file.read(overlayHeaderSize);
+    QDataStream stream(header);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic;
+    quint32 version;
+    quint32 bytesPerSector;
+    quint64 sectorCount;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != overlayMagic || version != overlayVersion) {
+        vlog(LogDisk, "%s is not a disk overlay", qPrintable(fileName()));
+        return false;
+    }
+    stream >> bytesPerSector >> sectorCount >> m_basePath;
+    if (stream.status() != QDataStream::Ok || !bytesPerSector) {
+        vlog(LogDisk, "%s has a broken header", qPrintable(fileName()));
+        return false;
+    }
+    m_bytesPerSector = bytesPerSector;
+    m_sectorCount = sectorCount;
+    computeLayout();
+
+    if (!m_file.seek(overlayHeaderSize) || m_file.read(reinterpret_cast<char*>(m_bitmap.data()), m_bitmap.size()) != (qint64)m_bitmap.size()) {
+        vlog(LogDisk, "%s is truncated", qPrintable(fileName()));
+        return false;
+    }
+    return true;
+}
+
+QWORD DiskOverlay::modifiedSectorCount() const
+{
+    QWORD count = 0;
+    for (BYTE bits : m_bitmap)
+        count += __builtin_popcount(bits);
+    return count;
+}
+
+unsigned DiskOverlay::read(DWORD lba, unsigned count, BYTE* destination)
+{
+    if (m_isInMemory) {
+        if (lba >= m_sectorCount)
+            return 0;
+        count = qMin<QWORD>(count, m_sectorCount - lba);
+        readMemory((QWORD)lba * m_bytesPerSector, destination, (size_t)count * m_bytesPerSector);
+        return count;
+    }
+
+    if (!m_file.seek(m_dataOffset + (QWORD)lba * m_bytesPerSector))
+        return 0;
+    qint64 nread = m_file.read(reinterpret_cast<char*>(destination), (qint64)count * m_bytesPerSector);
+    return nread > 0 ? nread / m_bytesPerSector : 0;
+}
+
+unsigned DiskOverlay::write(DWORD lba, unsigned count, const BYTE* source)
+{
+    if (lba >= m_sectorCount)
+        return 0;
+    count = qMin<QWORD>(count, m_sectorCount - lba);
+
+    if (m_isInMemory) {
+        writeMemory((QWORD)lba * m_bytesPerSector, source, (size_t)count * m_bytesPerSector);
+        markWritten(lba, count);
+        return count;
+    }
+
+    // Data goes first, so the bitmap never claims a sector that isn't there.
+    if (!m_file.seek(m_dataOffset + (QWORD)lba * m_bytesPerSector))
+        return 0;
+    qint64 nwritten = m_file.write(reinterpret_cast<const char*>(source), (qint64)count * m_bytesPerSector);
+    if (nwritten <= 0)
+        return 0;
+    unsigned written = nwritten / m_bytesPerSector;
+    markWritten(lba, written);
+    return written;
+}
+
+// The bits only reach the file in sync(), once the data they claim is there.
+void DiskOverlay::markWritten(DWORD lba, unsigned count)
+{
+    for (DWORD sector = lba; sector < lba + count; ++sector) {
+        if (contains(sector))
+            continue;
+        m_bitmap[sector / 8] |= 1 << (sector % 8);
+        size_t index = sector / 8;
+        if (!m_bitmapIsDirty) {
+            m_dirtyBitmapStart = index;
+            m_dirtyBitmapEnd = index + 1;
+            m_bitmapIsDirty = true;
+        } else {
+            m_dirtyBitmapStart = qMin(m_dirtyBitmapStart, index);
+            m_dirtyBitmapEnd = qMax(m_dirtyBitmapEnd, index + 1);
+        }
+    }
+}
+
+void DiskOverlay::readMemory(QWORD offset, BYTE* destination, size_t size) const
+{
+    while (size) {
+        size_t offsetInChunk = offset % memoryChunkSize;
+        size_t piece = qMin<size_t>(size, memoryChunkSize - offsetInChunk);
+        auto it = m_memoryChunks.constFind(offset / memoryChunkSize);
+        if (it != m_memoryChunks.constEnd())
+            memcpy(destination, it->constData() + offsetInChunk, piece);
+        else
+            memset(destination, 0, piece);
+        offset += piece;
+        destination += piece;
+        size -= piece;
+    }
+}
+
+void DiskOverlay::writeMemory(QWORD offset, const BYTE* source, size_t size)
+{
+    while (size) {
+        size_t offsetInChunk = offset % memoryChunkSize;
+        size_t piece = qMin<size_t>(size, memoryChunkSize - offsetInChunk);
+        QByteArray& chunk = m_memoryChunks[offset / memoryChunkSize];
+        if (chunk.isEmpty())
+            chunk.fill(0, memoryChunkSize);
+        memcpy(chunk.data() + offsetInChunk, source, piece);
+        offset += piece;
+        source += piece;
+        size -= piece;
+    }
+}
+
+bool DiskOverlay::sync()
+{
+    if (m_isInMemory)
+        return true;
+
+    // Without the first sync, a crash could leave the new bitmap on disk but not the data it points at.
+    if (!syncFile(m_file)) {
+        vlog(LogDisk, "Couldn't sync overlay %s", qPrintable(fileName()));
+        return false;
+    }
+    if (!m_bitmapIsDirty)
+        return true;
+    qint64 size = m_dirtyBitmapEnd - m_dirtyBitmapStart;
+    if (!m_file.seek(overlayHeaderSize + m_dirtyBitmapStart)
+        || m_file.write(reinterpret_cast<const char*>(&m_bitmap[m_dirtyBitmapStart]), size) != size
+        || !syncFile(m_file)) {
+        vlog(LogDisk, "Couldn't write the bitmap of overlay %s", qPrintable(fileName()));
+        return false;
+    }
+    m_bitmapIsDirty = false;
+    return true;
+}
+
+bool DiskOverlay::commit(const QString& fileName)
+{
+    auto overlay = open(fileName);
+    if (!overlay)
+        return false;
+
+    QFile base(overlay->basePath());
+    if (!base.open(QIODevice::ReadWrite)) {
+        vlog(LogDisk, "Couldn't open %s for writing", qPrintable(overlay->basePath()));
+        return false;
+    }
+
+    // Copy runs of consecutive modified sectors in one go.
+    std::vector<BYTE> buffer;
+    QWORD committed = 0;
+    for (QWORD lba = 0; lba < overlay->sectorCount(); ) {
+        if (!overlay->contains(lba)) {
+            ++lba;
+            continue;
+        }
+        QWORD end = lba;
+        while (end < overlay->sectorCount() && overlay->contains(end) && end - lba < 2048)
+            ++end;
+        unsigned count = end - lba;
+        buffer.resize((size_t)count * overlay->bytesPerSector());
+        if (overlay->read(lba, count, buffer.data()) != count
+            || !base.seek(lba * overlay->bytesPerSector())
+            || base.write(reinterpret_cast<const char*>(buffer.data()), buffer.size()) != (qint64)buffer.size()) {
+            vlog(LogDisk, "Couldn't commit sectors %llu-%llu of %s", (unsigned long long)lba, (unsigned long long)end - 1, qPrintable(fileName));
+            return false;
+        }
+        committed += count;
+        lba = end;
+    }
+
+    // The overlay is the only other copy of these sectors, so they must be on disk before it goes.
+    if (!base.flush() || fsync(base.handle()) < 0) {
+        vlog(LogDisk, "Couldn't write %s", qPrintable(overlay->basePath()));
+        return false;
+    }
+    vlog(LogDisk, "Committed %llu sectors from %s to %s", (unsigned long long)committed, qPrintable(fileName), qPrintable(overlay->basePath()));
+    overlay.clear();
+    return QFile::remove(fileName);
+}
+
+bool DiskOverlay::discard(const QString& fileName)
+{
+    if (!open(fileName))
+        return false;
+    vlog(LogDisk, "Discarding %s", qPrintable(fileName));
+    return QFile::remove(fileName);
+}
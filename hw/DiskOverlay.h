@@ -0,0 +1,94 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include "types.h"
+#include "OwnPtr.h"
+#include <vector>
+
+// A sparse file holding the sectors written to a disk image, so the image itself is never
+// modified. It has a 4 KiB header, a bitmap of the sectors present, and then the sector data
+// at the same offsets it has in the image. Unwritten sectors are holes, so creating an
+// overlay takes the same time however large the image is.
+// An overlay can also live in memory, for machines whose writes must not outlive them.
+class DiskOverlay {
+public:
+    // Creates the overlay if it doesn't exist yet.
+    static OwnPtr<DiskOverlay> openOrCreate(const QString& fileName, const QString& basePath, unsigned bytesPerSector, QWORD sectorCount);
+    static OwnPtr<DiskOverlay> open(const QString& fileName);
+    static OwnPtr<DiskOverlay> createInMemory(unsigned bytesPerSector, QWORD sectorCount);
+
+    // Copies the overlay's sectors into its base image, then deletes the overlay.
+    static bool commit(const QString& fileName);
+    // Deletes the overlay, after checking that it is one.
+    static bool discard(const QString& fileName);
+
+    explicit DiskOverlay(const QString& fileName);
+    ~DiskOverlay();
+
+    QString fileName() const { return m_file.fileName(); }
+    bool isInMemory() const { return m_isInMemory; }
+    QString basePath() const { return m_basePath; }
+    unsigned bytesPerSector() const { return m_bytesPerSector; }
+    QWORD sectorCount() const { return m_sectorCount; }
+    QWORD modifiedSectorCount() const;
+
+    bool contains(DWORD lba) const { return lba < m_sectorCount && (m_bitmap[lba / 8] & (1 << (lba % 8))); }
+
+    // Both return the number of whole sectors transferred. Only read sectors the overlay contains.
+    unsigned read(DWORD lba, unsigned count, BYTE* destination);
+    unsigned write(DWORD lba, unsigned count, const BYTE* source);
+
+    // Puts the sectors written so far on disk, then the bitmap bits that claim them.
+    // Until then a crash loses them, but never leaves the bitmap pointing at garbage.
+    bool sync();
+
+private:
+    bool create(const QString& basePath, unsigned bytesPerSector, QWORD sectorCount);
+    bool load();
+    void computeLayout();
+    void markWritten(DWORD lba, unsigned count);
+    void readMemory(QWORD offset, BYTE* destination, size_t size) const;
+    void writeMemory(QWORD offset, const BYTE* source, size_t size);
+
+    QFile m_file;
+    QString m_basePath;
+    unsigned m_bytesPerSector { 0 };
+    QWORD m_sectorCount { 0 };
+    QWORD m_dataOffset { 0 };
+    std::vector<BYTE> m_bitmap;
+    // The bytes of m_bitmap that have changed since the last sync(), if m_bitmapIsDirty.
+    bool m_bitmapIsDirty { false };
+    size_t m_dirtyBitmapStart { 0 };
+    size_t m_dirtyBitmapEnd { 0 };
+
+    // An in-memory overlay's sectors, at their offsets in the image, allocated a chunk at a time.
+    bool m_isInMemory { false };
+    QHash<QWORD, QByteArray> m_memoryChunks;
+};
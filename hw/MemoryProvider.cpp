@@ -63,6 +63,6 @@ DWORD MemoryProvider::readMemory32(DWORD address)
 
 void MemoryProvider::setSize(DWORD size)
 {
-    RELEASE_ASSERT((size % 16384) == 0);
+    RELEASE_ASSERT((size % 4096) == 0);
     m_size = size;
 }
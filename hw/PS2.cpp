@@ -26,6 +26,7 @@
 #include "Common.h"
 #include "CPU.h"
 #include "machine.h"
+#include <QtCore/QDataStream>
 
 //#define PS2_DEBUG
 
@@ -45,6 +46,16 @@ void PS2::reset()
     machine().cpu().setA20Enabled(false);
 }
 
+void PS2::saveState(QDataStream& stream) const
+{
+    stream << m_controlPortA;
+}
+
+void PS2::restoreState(QDataStream& stream)
+{
+    stream >> m_controlPortA;
+}
+
 BYTE PS2::in8(WORD port)
 {
     if (port == 0x92) {
@@ -29,6 +29,7 @@
 #include "CPU.h"
 #include "debug.h"
 #include <QtCore/QMutexLocker>
+#include <QtCore/QDataStream>
 
 BusMouse::BusMouse(Machine& machine)
     : IODevice("BusMouse", machine, 5)
@@ -57,6 +58,20 @@ void BusMouse::reset()
     m_deltaY = 0;
 }
 
+void BusMouse::saveState(QDataStream& stream) const
+{
+    QMutexLocker locker(&m_mutex);
+    stream << m_interrupts << m_command << m_buttons << m_interruptValue;
+    stream << m_currentX << m_currentY << m_lastX << m_lastY << m_deltaX << m_deltaY;
+}
+
+void BusMouse::restoreState(QDataStream& stream)
+{
+    QMutexLocker locker(&m_mutex);
+    stream >> m_interrupts >> m_command >> m_buttons >> m_interruptValue;
+    stream >> m_currentX >> m_currentY >> m_lastX >> m_lastY >> m_deltaX >> m_deltaY;
+}
+
 void BusMouse::out8(WORD port, BYTE data)
 {
     switch (port) {
@@ -150,8 +165,6 @@ void BusMouse::buttonReleaseEvent(WORD x, WORD y, Button button)
 
 BYTE BusMouse::in8(WORD port)
 {
-    static BYTE interrupt_val = 0x01;
-
     BYTE ret = 0;
 
     QMutexLocker locker(&m_mutex);
@@ -191,10 +204,10 @@ BYTE BusMouse::in8(WORD port)
 
     case 0x23e:
         // Stolen from NeXTStep-on-QEMU patches
-        ret = interrupt_val;
-        interrupt_val = (interrupt_val << 1) & 0xff;
-        if (interrupt_val == 0)
-            interrupt_val = 1;
+        ret = m_interruptValue;
+        m_interruptValue = (m_interruptValue << 1) & 0xff;
+        if (m_interruptValue == 0)
+            m_interruptValue = 1;
         break;
 
     case 0x23f:
@@ -33,6 +33,8 @@ public:
     virtual ~BusMouse();
 
     virtual void reset() override;
+    virtual void saveState(QDataStream&) const override;
+    virtual void restoreState(QDataStream&) override;
     virtual void out8(WORD port, BYTE data) override;
     virtual BYTE in8(WORD port) override;
 
@@ -42,12 +44,11 @@ public:
     void buttonPressEvent(WORD x, WORD y, Button button);
     void buttonReleaseEvent(WORD x, WORD y, Button button);
 
-    static BusMouse* the();
-
 private:
     bool m_interrupts { true };
     BYTE m_command { 0 };
     BYTE m_buttons { 0 };
+    BYTE m_interruptValue { 0x01 };
 
     WORD m_currentX { 0 };
     WORD m_currentY { 0 };
@@ -56,5 +57,5 @@ private:
     WORD m_deltaX { 0 };
     WORD m_deltaY { 0 };
 
-    QMutex m_mutex;
+    mutable QMutex m_mutex;
 };
@@ -29,6 +29,7 @@
 #include "DiskDrive.h"
 #include <QtCore/QDate>
 #include <QtCore/QTime>
+#include <QtCore/QDataStream>
 
 //#define CMOS_DEBUG
 
@@ -67,6 +68,18 @@ void CMOS::reset()
     m_ram[FloppyDriveTypes] = (machine().floppy0().floppyTypeForCMOS() << 4) | machine().floppy1().floppyTypeForCMOS();
 }
 
+void CMOS::saveState(QDataStream& stream) const
+{
+    stream << m_registerIndex;
+    stream.writeRawData(reinterpret_cast<const char*>(m_ram), sizeof(m_ram));
+}
+
+void CMOS::restoreState(QDataStream& stream)
+{
+    stream >> m_registerIndex;
+    stream.readRawData(reinterpret_cast<char*>(m_ram), sizeof(m_ram));
+}
+
 bool CMOS::inBinaryClockMode() const
 {
     return m_ram[StatusRegisterB] & 0x04;
@@ -54,6 +54,8 @@ public:
     ~CMOS();
 
     void reset() override;
+    void saveState(QDataStream&) const override;
+    void restoreState(QDataStream&) override;
     void out8(WORD port, BYTE data) override;
     BYTE in8(WORD port) override;
 
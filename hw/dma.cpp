@@ -1,176 +1,345 @@
-/*
- * Copyright (C) 2003-2011 Andreas Kling <kling@webkit.org>
- *
- * Redistribution and use in source and binary forms, with or without
- * modification, are permitted provided that the following conditions
- * are met:
- * 1. Redistributions of source code must retain the above copyright
- *    notice, this list of conditions and the following disclaimer.
- * 2. Redistributions in binary form must reproduce the above copyright
- *    notice, this list of conditions and the following disclaimer in the
- *    documentation and/or other materials provided with the distribution.
- *
- * THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
- * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
- * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
- * PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
- * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
- * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
- * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
- * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
- * OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
- * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
- * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
- */
-
-#include "Common.h"
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "dma.h"
+#include "CPU.h"
 #include "debug.h"
+#include "machine.h"
+#include <QtCore/QDataStream>
 #include <string.h>
 
-#define DMA_CHANNELS 8
-
-struct dma_channel_t
-{
-    WORD count;
-    bool next_count_write_is_msb;
-    bool next_count_read_is_msb;
+//#define DMA_DEBUG
+
+// Registers of one controller. The first one decodes them at 00h-0Fh, the second at every
+// other port from C0h.
+enum Register {
+    Status = 0x8,
+    Command = 0x8,
+    Request = 0x9,
+    SingleMask = 0xa,
+    Mode = 0xb,
+    ClearFlipFlop = 0xc,
+    Temporary = 0xd,
+    MasterClear = 0xd,
+    ClearMask = 0xe,
+    AllMask = 0xf,
+};
 
-    WORD address;
-    bool next_address_write_is_msb;
-    bool next_address_read_is_msb;
+enum ModeBits {
+    AutoInitialize = 0x10,
+    AddressDecrement = 0x20,
+    ModeSelectMask = 0xc0,
+    CascadeMode = 0xc0,
 };
 
-static dma_channel_t dma1_channel[DMA_CHANNELS];
-static dma_channel_t dma2_channel[DMA_CHANNELS];
+static const BYTE ControllerDisable = 0x04;
 
-static void dma_ch_count_write(VCpu* cpu, WORD port, BYTE data);
-static BYTE dma_ch_count_read(VCpu* cpu, WORD port);
-static void dma_ch_address_write(VCpu* cpu, WORD port, BYTE data);
-static BYTE dma_ch_address_read(VCpu* cpu, WORD port);
+// Offset of each channel's page register from 80h.
+static const BYTE pageRegisterForChannel[8] = { 0x7, 0x3, 0x1, 0x2, 0xf, 0xb, 0x9, 0xa };
 
-void dma_init()
+static const char* toString(unsigned transferType)
 {
-    for (int i = 0; i < DMA_CHANNELS; ++i) {
-        memset(&dma1_channel[i], 0, sizeof(dma_channel_t));
-        memset(&dma2_channel[i], 0, sizeof(dma_channel_t));
+    switch (transferType) {
+    case 0: return "verify";
+    case 1: return "write";
+    case 2: return "read";
     }
-
-    vm_listen(0x000, dma_ch_address_read, dma_ch_address_write);
-    vm_listen(0x001, dma_ch_count_read, dma_ch_count_write);
-    vm_listen(0x002, dma_ch_address_read, dma_ch_address_write);
-    vm_listen(0x003, dma_ch_count_read, dma_ch_count_write);
-    vm_listen(0x004, dma_ch_address_read, dma_ch_address_write);
-    vm_listen(0x005, dma_ch_count_read, dma_ch_count_write);
-    vm_listen(0x006, dma_ch_address_read, dma_ch_address_write);
-    vm_listen(0x007, dma_ch_count_read, dma_ch_count_write);
+    return "invalid";
 }
 
-void dma_ch_count_write(VCpu*, WORD port, BYTE data)
+DMA::DMA(Machine& machine)
+    : IODevice("DMA", machine)
 {
-    dma_channel_t* c;
-    BYTE channel, chip = 0;
+    for (WORD port = 0x00; port <= 0x0f; ++port)
+        listen(port, IODevice::ReadWrite);
 
-    switch (port) {
-    case 0x001: channel = 0; break;
-    case 0x003: channel = 1; break;
-    case 0x005: channel = 2; break;
-    case 0x007: channel = 3; break;
-    default:
-        vlog(VM_DMAMSG, "Unknown channel for port %03X", port);
-        return;
+    // D6h is VomCtl's, which passes writes on, so the second controller's (write-only) mode register still works.
+    for (WORD port = 0xc0; port <= 0xde; port += 2) {
+        if (port != 0xd6)
+            listen(port, IODevice::ReadWrite);
     }
 
-    c = &dma1_channel[channel];
-
-    if (c->next_count_write_is_msb)
-        c->count |= (data << 8);
-    else
-        c->count |= (data & 0xFF);
+    // 80h is the POST code port.
+    for (WORD port = 0x81; port <= 0x8f; ++port)
+        listen(port, IODevice::ReadWrite);
 
-    vlog(VM_DMAMSG, "Write DMA-%u channel %u count (%s), data: %02X", chip, channel, c->next_count_write_is_msb ? "MSB" : "LSB", data);
+    reset();
+}
 
-    c->next_count_write_is_msb = !c->next_count_write_is_msb;
+DMA::~DMA()
+{
 }
 
-BYTE dma_ch_count_read(VCpu*, WORD port)
+void DMA::reset()
 {
-    dma_channel_t* c;
-    BYTE data;
-    BYTE channel, chip;
+    for (auto& controller : m_controllers)
+        controller = Controller();
+    memset(m_pageRegisters, 0, sizeof(m_pageRegisters));
 
-    if (port == 0x001) {
-        channel = 0;
-        chip = 1;
-    }
-    else
-        vlog(VM_DMAMSG, "Unknown channel for port %03X", port);
+    // Our BIOS doesn't touch the controllers, so leave the cascade set up the way a PC BIOS would.
+    channel(4).mode = CascadeMode;
+    channel(4).masked = false;
+}
 
-    c = (chip == 1) ? &dma1_channel[channel] : &dma2_channel[channel];
+void DMA::saveState(QDataStream& stream) const
+{
+    for (auto& controller : m_controllers) {
+        for (auto& c : controller.channels) {
+            stream << c.baseAddress << c.baseCount << c.currentAddress << c.currentCount;
+            stream << c.mode << c.masked << c.reachedTerminalCount;
+        }
+        stream << controller.command << controller.status << controller.request << controller.flipFlop;
+    }
+    stream.writeRawData(reinterpret_cast<const char*>(m_pageRegisters), sizeof(m_pageRegisters));
+}
 
-    if (c->next_count_read_is_msb)
-        data = c->count >> 8;
-    else
-        data = c->count & 0xFF;
+void DMA::restoreState(QDataStream& stream)
+{
+    for (auto& controller : m_controllers) {
+        for (auto& c : controller.channels) {
+            stream >> c.baseAddress >> c.baseCount >> c.currentAddress >> c.currentCount;
+            stream >> c.mode >> c.masked >> c.reachedTerminalCount;
+        }
+        stream >> controller.command >> controller.status >> controller.request >> controller.flipFlop;
+    }
+    stream.readRawData(reinterpret_cast<char*>(m_pageRegisters), sizeof(m_pageRegisters));
+}
 
-    vlog(VM_DMAMSG, "Read DMA-%u channel %u count (%s), data: %02X", chip, channel, c->next_count_read_is_msb ? "MSB" : "LSB", data);
+DWORD DMA::physicalAddress(unsigned channelIndex, WORD address) const
+{
+    DWORD page = m_pageRegisters[pageRegisterForChannel[channelIndex]];
+    // Word channels count words, and the lowest page bit is replaced by the top address bit.
+    if (channelIndex >= 4)
+        return ((page & 0xfe) << 16) | ((DWORD)address << 1);
+    return (page << 16) | address;
+}
 
-    c->next_count_read_is_msb = !c->next_count_read_is_msb;
-    return data;
+bool DMA::reachedTerminalCount(unsigned channelIndex) const
+{
+    ASSERT(channelIndex < 8);
+    return channel(channelIndex).reachedTerminalCount;
 }
 
-void dma_ch_address_write(VCpu*, WORD port, BYTE data)
+// Hands copy(address, offset, size) the runs of guest memory that size bytes of the channel's
+// transfer map to, and updates the channel's address and count the way the 8237 would have after
+// moving them one unit at a time. The address wraps within its page without carrying, so a run
+// ends at the page boundary. Counting down, every unit is a run of its own.
+template<typename Callback>
+DWORD DMA::transfer(unsigned channelIndex, TransferType type, DWORD size, Callback copy)
 {
-    dma_channel_t* c;
-    BYTE channel, chip = 0;
+    ASSERT(channelIndex < 8);
+    auto& controller = m_controllers[channelIndex >> 2];
+    auto& c = channel(channelIndex);
+    c.reachedTerminalCount = false;
 
-    switch (port) {
-    case 0x000: channel = 0; break;
-    case 0x002: channel = 1; break;
-    case 0x004: channel = 2; break;
-    case 0x006: channel = 3; break;
-    default:
-        vlog(VM_DMAMSG, "Unknown channel for port %03X", port);
-        return;
+    if (c.masked || (controller.command & ControllerDisable) || (c.mode & ModeSelectMask) == CascadeMode)
+        return 0;
+
+    if (c.transferType() != type && c.transferType() != TransferType::Verify) {
+        vlog(LogDMA, "Channel %u is set up for %s transfers, the device wanted %s", channelIndex, toString((unsigned)c.transferType()), toString((unsigned)type));
+        return 0;
     }
 
-    c = &dma1_channel[channel];
+    unsigned unitSize = channelIndex >= 4 ? 2 : 1;
+    bool decrement = c.mode & AddressDecrement;
+    DWORD units = size / unitSize;
+    DWORD done = 0;
+    while (done < units) {
+        DWORD chunk = qMin<DWORD>(units - done, (DWORD)c.currentCount + 1);
+        chunk = decrement ? 1 : qMin<DWORD>(chunk, 0x10000 - c.currentAddress);
+        if (c.transferType() != TransferType::Verify) {
+            DWORD address = physicalAddress(channelIndex, c.currentAddress);
+            if (!copy(PhysicalAddress(address), done * unitSize, chunk * unitSize))
+                vlog(LogDMA, "Channel %u: No memory at %08x", channelIndex, address);
+        }
+        done += chunk;
+        c.currentAddress = decrement ? c.currentAddress - 1 : c.currentAddress + chunk;
+        c.currentCount -= chunk;
+        if (c.currentCount == 0xffff) {
+            c.reachedTerminalCount = true;
+            controller.status |= 1 << (channelIndex & 3);
+            if (c.mode & AutoInitialize) {
+                c.currentAddress = c.baseAddress;
+                c.currentCount = c.baseCount;
+            } else {
+                c.masked = true;
+            }
+            break;
+        }
+    }
+
+#ifdef DMA_DEBUG
+    vlog(LogDMA, "Channel %u: Moved %u of %u bytes%s", channelIndex, done * unitSize, size, c.reachedTerminalCount ? ", terminal count" : "");
+#endif
+    return done * unitSize;
+}
 
-    if (c->next_address_write_is_msb)
-        c->address |= data << 8;
-    else
-        c->address |= data & 0xFF;
+DWORD DMA::transferToMemory(unsigned channelIndex, const BYTE* source, DWORD size)
+{
+    auto& cpu = machine().cpu();
+    return transfer(channelIndex, TransferType::ToMemory, size, [&] (PhysicalAddress address, DWORD offset, DWORD chunk) {
+        cpu.copyToPhysicalMemory(address, source + offset, chunk);
+        return true;
+    });
+}
 
-    vlog(VM_DMAMSG, "Write DMA-%u channel %u address (%s), data: %02X", chip, channel, c->next_address_write_is_msb ? "MSB" : "LSB", data);
+DWORD DMA::transferFromMemory(unsigned channelIndex, BYTE* destination, DWORD size)
+{
+    auto& cpu = machine().cpu();
+    return transfer(channelIndex, TransferType::FromMemory, size, [&] (PhysicalAddress address, DWORD offset, DWORD chunk) {
+        if (cpu.copyFromPhysicalMemory(address, destination + offset, chunk))
+            return true;
+        memset(destination + offset, IODevice::JunkValue, chunk);
+        return false;
+    });
+}
 
-    c->next_address_write_is_msb = !c->next_address_write_is_msb;
+void DMA::masterClear(Controller& controller)
+{
+    controller.command = 0;
+    controller.status = 0;
+    controller.request = 0;
+    controller.flipFlop = false;
+    for (auto& c : controller.channels)
+        c.masked = true;
 }
 
-BYTE dma_ch_address_read(VCpu*, WORD port)
+BYTE DMA::readRegister(unsigned controllerIndex, unsigned reg)
 {
-    dma_channel_t* c;
-    BYTE data;
-    BYTE channel, chip = 0;
+    auto& controller = m_controllers[controllerIndex];
+
+    if (reg < 8) {
+        auto& c = controller.channels[reg >> 1];
+        WORD value = (reg & 1) ? c.currentCount : c.currentAddress;
+        BYTE data = controller.flipFlop ? mostSignificant<BYTE>(value) : leastSignificant<BYTE>(value);
+        controller.flipFlop = !controller.flipFlop;
+        return data;
+    }
 
-    switch (port) {
-    case 0x000: channel = 0; break;
-    case 0x002: channel = 1; break;
-    case 0x004: channel = 2; break;
-    case 0x006: channel = 3; break;
-    default:
-        vlog(VM_DMAMSG, "Unknown channel for port %03X", port);
+    switch (reg) {
+    case Status: {
+        BYTE data = controller.status | (controller.request << 4);
+        controller.status = 0;
+        return data;
+    }
+    case Temporary:
+        // Only memory-to-memory transfers go through it, and we don't do those.
         return 0;
+    case AllMask: {
+        BYTE data = 0xf0;
+        for (unsigned i = 0; i < 4; ++i) {
+            if (controller.channels[i].masked)
+                data |= 1 << i;
+        }
+        return data;
+    }
     }
 
-    c = &dma1_channel[channel];
+    vlog(LogDMA, "DMA-%u: Read from write-only register %x", controllerIndex, reg);
+    return IODevice::JunkValue;
+}
 
-    if (c->next_address_read_is_msb)
-        data = c->address >> 8;
-    else
-        data = c->address & 0xFF;
+void DMA::writeRegister(unsigned controllerIndex, unsigned reg, BYTE data)
+{
+    auto& controller = m_controllers[controllerIndex];
+
+    if (reg < 8) {
+        auto& c = controller.channels[reg >> 1];
+        WORD& base = (reg & 1) ? c.baseCount : c.baseAddress;
+        if (controller.flipFlop)
+            base = weld<WORD>(data, leastSignificant<BYTE>(base));
+        else
+            base = weld<WORD>(mostSignificant<BYTE>(base), data);
+        controller.flipFlop = !controller.flipFlop;
+        // Programming the base programs the current register too.
+        if (reg & 1)
+            c.currentCount = c.baseCount;
+        else
+            c.currentAddress = c.baseAddress;
+        return;
+    }
 
-    vlog(VM_DMAMSG, "Read DMA-%u channel %u address (%s), data: %02X", chip, channel, c->next_address_read_is_msb ? "MSB" : "LSB", data);
+    unsigned channelIndex = data & 3;
+    switch (reg) {
+    case Command:
+        controller.command = data;
+        break;
+    case Request:
+        if (data & 0x04)
+            controller.request |= 1 << channelIndex;
+        else
+            controller.request &= ~(1 << channelIndex);
+        break;
+    case SingleMask:
+        controller.channels[channelIndex].masked = data & 0x04;
+        break;
+    case Mode:
+        controller.channels[channelIndex].mode = data & 0xfc;
+#ifdef DMA_DEBUG
+        vlog(LogDMA, "Channel %u mode: %02x (%s)", controllerIndex * 4 + channelIndex, data & 0xfc, toString((data >> 2) & 3));
+#endif
+        break;
+    case ClearFlipFlop:
+        controller.flipFlop = false;
+        break;
+    case MasterClear:
+        masterClear(controller);
+        break;
+    case ClearMask:
+        for (auto& c : controller.channels)
+            c.masked = false;
+        break;
+    case AllMask:
+        for (unsigned i = 0; i < 4; ++i)
+            controller.channels[i].masked = data & (1 << i);
+        break;
+    }
+}
 
-    c->next_address_read_is_msb = !c->next_address_read_is_msb;
-    return 1;
-    return data;
+BYTE DMA::in8(WORD port)
+{
+    if (port <= 0x0f)
+        return readRegister(0, port);
+    if (port >= 0xc0 && port <= 0xdf)
+        return readRegister(1, (port - 0xc0) >> 1);
+    if (port >= 0x81 && port <= 0x8f)
+        return m_pageRegisters[port & 0xf];
+    return IODevice::in8(port);
+}
+
+void DMA::out8(WORD port, BYTE data)
+{
+#ifdef DMA_DEBUG
+    vlog(LogDMA, "out8 %03x, %02x", port, data);
+#endif
+    if (port <= 0x0f)
+        return writeRegister(0, port, data);
+    if (port >= 0xc0 && port <= 0xdf)
+        return writeRegister(1, (port - 0xc0) >> 1, data);
+    if (port >= 0x81 && port <= 0x8f) {
+        m_pageRegisters[port & 0xf] = data;
+        return;
+    }
+    IODevice::out8(port, data);
 }
@@ -0,0 +1,89 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "iodevice.h"
+
+// The two cascaded 8237A DMA controllers of a PC/AT and their page registers. Channels 0-3 move
+// bytes, channels 5-7 move words and channel 4 cascades the first controller into the second.
+// A device moves everything it has with one call, like a device holding DREQ through a block or
+// demand transfer would, and the return value says how much the channel took before it reached
+// terminal count or was masked. CPU thread only.
+class DMA final : public IODevice {
+public:
+    explicit DMA(Machine&);
+    ~DMA();
+
+    void reset() override;
+    void saveState(QDataStream&) const override;
+    void restoreState(QDataStream&) override;
+    BYTE in8(WORD port) override;
+    void out8(WORD port, BYTE data) override;
+
+    // For channels programmed for write transfers (device to memory.) Returns the number of bytes moved.
+    DWORD transferToMemory(unsigned channel, const BYTE* source, DWORD size);
+    // For channels programmed for read transfers (memory to device.) Returns the number of bytes moved.
+    DWORD transferFromMemory(unsigned channel, BYTE* destination, DWORD size);
+
+    // Whether the last transfer on the channel ended at terminal count.
+    bool reachedTerminalCount(unsigned channel) const;
+
+private:
+    enum class TransferType { Verify = 0, ToMemory = 1, FromMemory = 2, Invalid = 3 };
+
+    struct Channel {
+        WORD baseAddress { 0 };
+        WORD baseCount { 0 };
+        WORD currentAddress { 0 };
+        WORD currentCount { 0 };
+        BYTE mode { 0 };
+        bool masked { true };
+        bool reachedTerminalCount { false };
+
+        TransferType transferType() const { return static_cast<TransferType>((mode >> 2) & 3); }
+    };
+
+    struct Controller {
+        Channel channels[4];
+        BYTE command { 0 };
+        // Terminal count in bits 0-3, requests in bits 4-7.
+        BYTE status { 0 };
+        BYTE request { 0 };
+        bool flipFlop { false };
+    };
+
+    Channel& channel(unsigned index) { return m_controllers[index >> 2].channels[index & 3]; }
+    const Channel& channel(unsigned index) const { return m_controllers[index >> 2].channels[index & 3]; }
+    DWORD physicalAddress(unsigned channel, WORD address) const;
+
+    template<typename Callback> DWORD transfer(unsigned channel, TransferType, DWORD size, Callback);
+
+    BYTE readRegister(unsigned controllerIndex, unsigned reg);
+    void writeRegister(unsigned controllerIndex, unsigned reg, BYTE data);
+    void masterClear(Controller&);
+
+    Controller m_controllers[2];
+    BYTE m_pageRegisters[16];
+};
@@ -26,8 +26,11 @@
 #include "fdc.h"
 #include "pic.h"
 #include "debug.h"
+#include "dma.h"
 #include "machine.h"
 #include "DiskDrive.h"
+#include <QtCore/QDataStream>
+#include <vector>
 
 #define FDC_NEC765
 #define FDC_DEBUG
@@ -46,6 +49,16 @@
 
 #define DATA_REGISTER_READY 0x80
 
+#define FDC_ST0_ABNORMAL_TERMINATION (1 << 6)
+#define FDC_ST0_NOT_READY            (1 << 3)
+
+#define FDC_ST1_END_OF_CYLINDER      (1 << 7)
+#define FDC_ST1_OVERRUN              (1 << 4)
+#define FDC_ST1_NO_DATA              (1 << 2)
+#define FDC_ST1_NOT_WRITABLE         (1 << 1)
+
+static const unsigned fdcDMAChannel = 2;
+
 enum FDCCommand {
     SenseInterruptStatus = 0x08,
     SpecifyStepAndHeadLoad = 0x03,
@@ -182,7 +195,8 @@ void FDC::resetController(ResetSource resetSource)
     d->enabled = false;
     setUsingDMA(false);
     setDataDirection(DataDirection::ToFDC);
-    d->mainStatusRegister = 0;
+    // Ready for a command.
+    d->mainStatusRegister = FDC_MSR_RQM;
 
     d->commandSize = 0;
     d->command.clear();
@@ -214,6 +228,38 @@ void FDC::reset()
     resetController(ResetSource::Hardware);
 }
 
+void FDC::saveState(QDataStream& stream) const
+{
+    for (auto& drive : d->drive) {
+        stream << drive.motor << drive.cylinder << drive.head << drive.sector;
+        stream << drive.stepRateTime << drive.headLoadTime << drive.headUnloadTime;
+        stream << drive.bytesPerSector << drive.endOfTrack << drive.gap3Length << drive.dataLength;
+        stream << drive.digitalInputRegister;
+    }
+    stream << d->driveIndex << d->enabled << (int)d->dataRate << d->dataDirection << d->mainStatusRegister;
+    stream.writeRawData(reinterpret_cast<const char*>(d->statusRegister), sizeof(d->statusRegister));
+    stream << d->hasPendingReset << d->command << d->commandSize << d->commandResult;
+    stream << d->configureData << d->precompensationStartNumber << d->perpendicularModeConfig;
+    stream << d->lock << d->expectedSenseInterruptCount;
+}
+
+void FDC::restoreState(QDataStream& stream)
+{
+    for (auto& drive : d->drive) {
+        stream >> drive.motor >> drive.cylinder >> drive.head >> drive.sector;
+        stream >> drive.stepRateTime >> drive.headLoadTime >> drive.headUnloadTime;
+        stream >> drive.bytesPerSector >> drive.endOfTrack >> drive.gap3Length >> drive.dataLength;
+        stream >> drive.digitalInputRegister;
+    }
+    int dataRate;
+    stream >> d->driveIndex >> d->enabled >> dataRate >> d->dataDirection >> d->mainStatusRegister;
+    d->dataRate = static_cast<FDCDataRate>(dataRate);
+    stream.readRawData(reinterpret_cast<char*>(d->statusRegister), sizeof(d->statusRegister));
+    stream >> d->hasPendingReset >> d->command >> d->commandSize >> d->commandResult;
+    stream >> d->configureData >> d->precompensationStartNumber >> d->perpendicularModeConfig;
+    stream >> d->lock >> d->expectedSenseInterruptCount;
+}
+
 BYTE FDC::in8(WORD port)
 {
     BYTE data = 0;
@@ -278,6 +324,11 @@ static bool isReadDataCommand(BYTE b)
     return (b & 0x1f) == 0x06;
 }
 
+static bool isWriteDataCommand(BYTE b)
+{
+    return (b & 0x3f) == 0x05;
+}
+
 void FDC::out8(WORD port, BYTE data)
 {
 #ifdef FDC_DEBUG
@@ -321,7 +372,7 @@ void FDC::out8(WORD port, BYTE data)
             d->mainStatusRegister &= FDC_MSR_DIO;
             d->mainStatusRegister |= FDC_MSR_RQM | FDC_MSR_CMDBSY;
             // Determine the command length
-            if (isReadDataCommand(data)) {
+            if (isReadDataCommand(data) || isWriteDataCommand(data)) {
                 d->commandSize = 9;
             } else {
                 switch (data) {
@@ -385,27 +436,134 @@ void FDC::resetControllerSoon()
     executeCommandSoon();
 }
 
-void FDC::executeReadDataCommand()
+// Reads or writes from the given sector up to EOT, on to the other side with MT set, and moves all
+// of it through DMA channel 2 in one go. The channel's terminal count decides where it really ends.
+void FDC::executeDataTransferCommand(bool isWrite)
 {
-    d->driveIndex = d->command[1] & 3;
+    bool multiTrack = d->command[0] & 0x80;
+    BYTE driveIndex = d->command[1] & 3;
+    BYTE cylinder = d->command[2];
+    BYTE head = d->command[3];
+    BYTE sector = d->command[4];
+    BYTE sizeCode = d->command[5];
+    BYTE endOfTrack = d->command[6];
+    vlog(LogFDC, "%s { drive:%u, C:%u H:%u, S:%u / bpS:%u, EOT:%u, g3l:%u, dl:%u, MT:%u }",
+        isWrite ? "WriteData" : "ReadData",
+        driveIndex,
+        cylinder,
+        head,
+        sector,
+        128 << (sizeCode & 7),
+        endOfTrack,
+        d->command[7],
+        d->command[8],
+        multiTrack
+    );
+
+    DiskDrive* disk = driveIndex == 0 ? &machine().floppy0() : driveIndex == 1 ? &machine().floppy1() : nullptr;
+    if (!disk || !disk->present()) {
+        finishDataTransfer(FDC_ST0_ABNORMAL_TERMINATION | FDC_ST0_NOT_READY, 0, cylinder, head, sector);
+        return;
+    }
+
+    d->driveIndex = driveIndex;
     d->currentDrive().head = (d->command[1] >> 2) & 1;
-    d->currentDrive().cylinder = d->command[2];
-    d->currentDrive().head = d->command[3];
-    d->currentDrive().sector = d->command[4];
-    d->currentDrive().bytesPerSector = d->command[5];
-    d->currentDrive().endOfTrack = d->command[6];
+    d->currentDrive().cylinder = cylinder;
+    d->currentDrive().sector = sector;
+    d->currentDrive().bytesPerSector = sizeCode;
+    d->currentDrive().endOfTrack = endOfTrack;
     d->currentDrive().gap3Length = d->command[7];
     d->currentDrive().dataLength = d->command[8];
-    vlog(LogFDC, "ReadData { drive:%u, C:%u H:%u, S:%u / bpS:%u, EOT:%u, g3l:%u, dl:%u }",
-        d->driveIndex,
-        d->currentDrive().cylinder,
-        d->currentDrive().head,
-        d->currentDrive().sector,
-        128 << d->currentDrive().bytesPerSector,
-        d->currentDrive().endOfTrack,
-        d->currentDrive().gap3Length,
-        d->currentDrive().dataLength
-    );
+
+    if (!usingDMA()) {
+        vlog(LogFDC, "Non-DMA data transfers aren't supported");
+        finishDataTransfer(FDC_ST0_ABNORMAL_TERMINATION, FDC_ST1_OVERRUN, cylinder, head, sector);
+        return;
+    }
+
+    // Sectors are numbered from 1, so R=0 never matches a sector ID.
+    unsigned sectorSize = 128u << (sizeCode & 7);
+    unsigned lastSector = qMin<unsigned>(endOfTrack, disk->sectorsPerTrack());
+    if (!sector || sector > lastSector || head >= disk->heads() || sectorSize != disk->bytesPerSector()
+        || cylinder >= disk->sectors() / (disk->sectorsPerTrack() * disk->heads())) {
+        vlog(LogFDC, "No such sector");
+        finishDataTransfer(FDC_ST0_ABNORMAL_TERMINATION, FDC_ST1_NO_DATA, cylinder, head, sector);
+        return;
+    }
+
+    unsigned sectorsOnFirstSide = lastSector - sector + 1;
+    unsigned count = sectorsOnFirstSide;
+    if (multiTrack && !(head & 1) && disk->heads() > 1)
+        count += lastSector;
+    DWORD lba = disk->toLBA(cylinder, head, sector);
+    if ((QWORD)lba + count > disk->sectors()) {
+        vlog(LogFDC, "Sectors %u-%u are past the end of the disk", lba, lba + count - 1);
+        finishDataTransfer(FDC_ST0_ABNORMAL_TERMINATION, FDC_ST1_NO_DATA, cylinder, head, sector);
+        return;
+    }
+
+    auto& dma = machine().dma();
+    std::vector<BYTE> buffer(count * sectorSize);
+    unsigned sectorsAvailable = count;
+    unsigned sectorsMoved;
+    bool diskFailed;
+    if (isWrite) {
+        // A sector the channel ran out in the middle of is padded with zeroes.
+        DWORD moved = dma.transferFromMemory(fdcDMAChannel, buffer.data(), buffer.size());
+        sectorsMoved = (moved + sectorSize - 1) / sectorSize;
+        diskFailed = disk->writeSectors(lba, sectorsMoved, buffer.data()) < sectorsMoved;
+    } else {
+        sectorsAvailable = disk->readSectors(lba, count, buffer.data());
+        DWORD moved = dma.transferToMemory(fdcDMAChannel, buffer.data(), sectorsAvailable * sectorSize);
+        sectorsMoved = (moved + sectorSize - 1) / sectorSize;
+        diskFailed = sectorsAvailable < count && sectorsMoved == sectorsAvailable;
+    }
+
+    BYTE st0 = 0;
+    BYTE st1 = 0;
+    if (diskFailed) {
+        st0 = FDC_ST0_ABNORMAL_TERMINATION;
+        st1 = isWrite ? FDC_ST1_NOT_WRITABLE : FDC_ST1_NO_DATA;
+    } else if (!dma.reachedTerminalCount(fdcDMAChannel)) {
+        // Either the channel stopped taking data, or we got to EOT before it reached terminal count.
+        st0 = FDC_ST0_ABNORMAL_TERMINATION;
+        st1 = sectorsMoved < count ? FDC_ST1_OVERRUN : FDC_ST1_END_OF_CYLINDER;
+    }
+
+    // The result has the ID of the sector after the last one transferred.
+    unsigned nextSector = sector + sectorsMoved;
+    BYTE nextHead = head;
+    BYTE nextCylinder = cylinder;
+    if (sectorsMoved > sectorsOnFirstSide) {
+        nextHead ^= 1;
+        nextSector = 1 + sectorsMoved - sectorsOnFirstSide;
+    }
+    if (nextSector > lastSector) {
+        nextSector = 1;
+        if (!multiTrack || (nextHead & 1))
+            ++nextCylinder;
+        if (multiTrack)
+            nextHead ^= 1;
+    }
+
+    vlog(LogFDC, "%s %u of %u sectors at LBA %u", isWrite ? "Wrote" : "Read", sectorsMoved, count, lba);
+    finishDataTransfer(st0, st1, nextCylinder, nextHead, nextSector);
+}
+
+void FDC::finishDataTransfer(BYTE st0, BYTE st1, BYTE cylinder, BYTE head, BYTE sector)
+{
+    d->statusRegister[0] = st0 | ((head & 1) << 2) | (d->command[1] & 3);
+    d->statusRegister[1] = st1;
+    d->statusRegister[2] = 0;
+    d->commandResult.append(d->statusRegister[0]);
+    d->commandResult.append(d->statusRegister[1]);
+    d->commandResult.append(d->statusRegister[2]);
+    d->commandResult.append(cylinder);
+    d->commandResult.append(head);
+    d->commandResult.append(sector);
+    d->commandResult.append(d->command[5]);
+    vlog(LogFDC, "Raise IRQ (data transfer done, ST0=%02x ST1=%02x)", d->statusRegister[0], st1);
+    raiseIRQ();
 }
 
 void FDC::executeCommandSoon()
@@ -446,7 +604,9 @@ void FDC::executeCommandInternal()
     d->commandResult.clear();
 
     if (isReadDataCommand(d->command[0]))
-        return executeReadDataCommand();
+        return executeDataTransferCommand(false);
+    if (isWriteDataCommand(d->command[0]))
+        return executeDataTransferCommand(true);
 
     switch (d->command[0]) {
     case SpecifyStepAndHeadLoad:
@@ -33,6 +33,8 @@ public:
     virtual ~FDC();
 
     virtual void reset() override;
+    virtual void saveState(QDataStream&) const override;
+    virtual void restoreState(QDataStream&) override;
     virtual BYTE in8(WORD port) override;
     virtual void out8(WORD port, BYTE data) override;
 
@@ -51,7 +53,8 @@ private:
     void executeCommandSoon();
     void executeCommand();
     void executeCommandInternal();
-    void executeReadDataCommand();
+    void executeDataTransferCommand(bool isWrite);
+    void finishDataTransfer(BYTE st0, BYTE st1, BYTE cylinder, BYTE head, BYTE sector);
 
     struct Private;
     OwnPtr<Private> d;
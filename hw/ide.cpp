@@ -26,10 +26,32 @@
 #include "debug.h"
 #include "ide.h"
 #include "machine.h"
+#include "CPU.h"
 #include "DiskDrive.h"
+#include <QtCore/QDataStream>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
 
 #define IDE_DEBUG
 
+// The largest block SET MULTIPLE MODE accepts, advertised in IDENTIFY.
+static const unsigned maximumMultipleSectorCount = 16;
+
+enum ErrorBits {
+    ABRT = 0x04,
+    IDNF = 0x10,
+};
+
+enum BusMasterBits {
+    BusMasterStart = 0x01,
+    BusMasterReadFromDisk = 0x08,
+    BusMasterActive = 0x01,
+    BusMasterError = 0x02,
+    BusMasterInterrupt = 0x04,
+    BusMasterDriveDMACapable = 0x60,
+};
+
 struct IDEController
 {
     DiskDrive& drive() { return *drivePtr; }
@@ -44,9 +66,19 @@ struct IDEController
     BYTE error { 0 };
     bool inLBAMode { false };
 
+    // Sectors per DRQ block for READ/WRITE MULTIPLE, 0 while multiple mode is off.
+    unsigned multipleSectorCount { 0 };
+    // Sectors per DRQ block for the command in progress. The guest gets an IRQ for each block.
+    unsigned blockSectorCount { 1 };
+
     void identify(IDE&);
     void readSectors(IDE&);
     void writeSectors();
+    void setMultipleMode(IDE&);
+    void runTransfer();
+
+    // A sector count of 0 means 256.
+    unsigned sectorsToTransfer() const { return sectorCount ? sectorCount : 256; }
 
     DWORD lba()
     {
@@ -56,14 +88,54 @@ struct IDEController
         return drive().toLBA(cylinderIndex, headIndex, sectorIndex);
     }
 
-    template<typename T> T readFromSectorBuffer();
+    template<typename T> T readFromSectorBuffer(IDE&);
     template<typename T> void writeToSectorBuffer(IDE&, T);
-
-    QByteArray m_readBuffer;
+    DWORD readFromSectorBufferInBulk(IDE&, unsigned elementSize, BYTE* destination, DWORD count);
+    DWORD writeToSectorBufferInBulk(IDE&, unsigned elementSize, const BYTE* source, DWORD count);
+    void didFillWriteBuffer(IDE&);
+    void didMoveData(IDE&, int oldIndex, int newIndex, int size);
+    int bytesLeftInBlock(int index, int size);
+
+    // What the guest reads from the data port. Points into m_readBuffer, straight into the
+    // drive's image when it's mapped, or is null while there's nothing to read.
+    const BYTE* m_readData { nullptr };
+    int m_readDataSize { 0 };
     int m_readBufferIndex { 0 };
+    QByteArray m_readBuffer;
+    bool m_readDataIsMapped { false };
+    unsigned m_readDataMappingGeneration { 0 };
+
+    void setReadData(const BYTE* data, int size)
+    {
+        m_readData = data;
+        m_readDataSize = size;
+        m_readBufferIndex = 0;
+        m_readDataIsMapped = false;
+    }
+
+    bool copyReadData(BYTE* destination, int size);
 
     QByteArray m_writeBuffer;
     int m_writeBufferIndex { 0 };
+
+    // READ/WRITE SECTORS hit the disk on the IDE's I/O thread. The guest sees BSY from the
+    // moment the transfer starts until IDE::finishTransfer() has run on the CPU thread.
+    enum class TransferState { Idle, Queued, Running, Done };
+    TransferState transferState { TransferState::Idle }; // Guarded by IDE::Private::ioMutex.
+    bool busy { false };
+    bool transferIsWrite { false };
+    DWORD transferLBA { 0 };
+    unsigned transferCount { 0 };
+    unsigned transferResult { 0 };
+
+    // READ/WRITE DMA. The command waits for the bus master to be started (and a read for
+    // its data), then the whole transfer goes through the PRD table in one go.
+    enum class DMAPhase { None, Command, Writing };
+    DMAPhase dmaPhase { DMAPhase::None };
+    bool dmaDataReady { false };
+    BYTE busMasterCommand { 0 };
+    BYTE busMasterStatus { 0 };
+    DWORD prdTableAddress { 0 };
 };
 
 void IDEController::identify(IDE& ide)
@@ -73,37 +145,77 @@ void IDEController::identify(IDE& ide)
     data[1] = drive().sectors() / (drive().sectorsPerTrack() * drive().heads());
     data[3] = drive().heads();
     data[6] = drive().sectorsPerTrack();
+    data[47] = 0x8000 | maximumMultipleSectorCount;
+    data[48] = 0x0001; // 32-bit data port I/O.
+    data[49] = 0x0100; // DMA.
+    data[63] = 0x0407; // Multiword DMA modes 0-2, mode 2 selected.
+    if (multipleSectorCount)
+        data[59] = 0x0100 | multipleSectorCount;
     m_readBuffer.resize(512);
     memcpy(m_readBuffer.data(), data, sizeof(data));
     strcpy(m_readBuffer.data() + 54, "oCpmtuor niDks");
-    m_readBufferIndex = 0;
+    setReadData(reinterpret_cast<const BYTE*>(m_readBuffer.constData()), m_readBuffer.size());
     ide.raiseIRQ();
 }
 
 void IDEController::readSectors(IDE& ide)
 {
-    vlog(LogIDE, "ide%u: Read sectors (LBA: %u, count: %u)", controllerIndex, lba(), sectorCount);
-    FILE* f = fopen(qPrintable(drive().imagePath()), "rb");
-    RELEASE_ASSERT(f);
-    m_readBuffer.resize(drive().bytesPerSector() * sectorCount);
-    int result;
-    result = fseek(f, lba() * drive().bytesPerSector(), SEEK_SET);
-    ASSERT(result != -1);
-    result = fread(m_readBuffer.data(), drive().bytesPerSector(), sectorCount, f);
-    ASSERT(result != -1);
-    result = fclose(f);
-    ASSERT(result != -1);
-    m_readBufferIndex = 0;
-    ide.raiseIRQ();
+    vlog(LogIDE, "ide%u: Read sectors (LBA: %u, count: %u, block: %u)", controllerIndex, lba(), sectorsToTransfer(), blockSectorCount);
+    int size = drive().bytesPerSector() * sectorsToTransfer();
+    unsigned generation;
+    if (auto* mappedData = drive().mappedSectors(lba(), sectorsToTransfer(), generation)) {
+        // Nothing to wait for.
+        setReadData(mappedData, size);
+        m_readDataIsMapped = true;
+        m_readDataMappingGeneration = generation;
+        ide.raiseIRQ();
+        return;
+    }
+    m_readBuffer.resize(size);
+    setReadData(nullptr, 0);
+    transferIsWrite = false;
+    ide.startTransfer(*this);
 }
 
 void IDEController::writeSectors()
 {
-    vlog(LogIDE, "ide%u: Write sectors (LBA: %u, count: %u)", controllerIndex, lba(), sectorCount);
-    m_writeBuffer.resize(drive().bytesPerSector() * sectorCount);
+    vlog(LogIDE, "ide%u: Write sectors (LBA: %u, count: %u, block: %u)", controllerIndex, lba(), sectorsToTransfer(), blockSectorCount);
+    m_writeBuffer.resize(drive().bytesPerSector() * sectorsToTransfer());
     m_writeBufferIndex = 0;
 }
 
+void IDEController::setMultipleMode(IDE& ide)
+{
+    // 0 turns multiple mode off. Anything else has to be a power of two we can do.
+    if (sectorCount > maximumMultipleSectorCount || (sectorCount & (sectorCount - 1))) {
+        vlog(LogIDE, "ide%u: Rejecting multiple mode with %u sectors per block", controllerIndex, sectorCount);
+        error = ABRT;
+    } else {
+        vlog(LogIDE, "ide%u: Multiple mode with %u sectors per block", controllerIndex, sectorCount);
+        multipleSectorCount = sectorCount;
+    }
+    ide.raiseIRQ();
+}
+
+// The first block of a read is announced when the data arrives, and the last block of a
+// write is acknowledged when it's on disk. Every block boundary in between gets an IRQ.
+void IDEController::didMoveData(IDE& ide, int oldIndex, int newIndex, int size)
+{
+    if (newIndex >= size)
+        return;
+    int blockSize = blockSectorCount * drive().bytesPerSector();
+    if (oldIndex / blockSize != newIndex / blockSize)
+        ide.raiseIRQ();
+}
+
+// Bulk copies stop at the end of the current block, so each block gets its own IRQ, and
+// a REP INS/OUTS ends its round there to let the CPU take it before the next block.
+int IDEController::bytesLeftInBlock(int index, int size)
+{
+    int blockSize = blockSectorCount * drive().bytesPerSector();
+    return qMin(size - index, blockSize - index % blockSize);
+}
+
 template<typename T>
 void IDEController::writeToSectorBuffer(IDE& ide, T data)
 {
@@ -119,43 +231,120 @@ void IDEController::writeToSectorBuffer(IDE& ide, T data)
     T* bufferPtr = reinterpret_cast<T*>(&m_writeBuffer.data()[m_writeBufferIndex]);
     *bufferPtr = data;
     m_writeBufferIndex += sizeof(T);
-    if (m_writeBufferIndex < m_writeBuffer.size())
-        return;
+    didMoveData(ide, m_writeBufferIndex - sizeof(T), m_writeBufferIndex, m_writeBuffer.size());
+    if (m_writeBufferIndex == m_writeBuffer.size())
+        didFillWriteBuffer(ide);
+}
+
+void IDEController::didFillWriteBuffer(IDE& ide)
+{
     vlog(LogIDE, "ide%u: Got all sector data, flushing to disk!", controllerIndex);
-    FILE* f = fopen(qPrintable(drive().imagePath()), "rb+");
-    RELEASE_ASSERT(f);
-    int result;
-    result = fseek(f, lba() * drive().bytesPerSector(), SEEK_SET);
-    ASSERT(result != -1);
-    result = fwrite(m_writeBuffer.data(), drive().bytesPerSector(), sectorCount, f);
-    ASSERT(result != -1);
-    result = fclose(f);
-    ASSERT(result != -1);
-    ide.raiseIRQ();
+    transferIsWrite = true;
+    ide.startTransfer(*this);
+}
+
+// Copies the next size bytes of read data, and returns false if they're gone. Mapped data
+// goes through the drive, which knows whether the mapping still exists.
+bool IDEController::copyReadData(BYTE* destination, int size)
+{
+    if (!m_readDataIsMapped) {
+        memcpy(destination, &m_readData[m_readBufferIndex], size);
+        return true;
+    }
+    if (drive().copyMappedData(&m_readData[m_readBufferIndex], m_readDataMappingGeneration, destination, size))
+        return true;
+    vlog(LogIDE, "ide%u: The image went away during a read", controllerIndex);
+    error = ABRT;
+    setReadData(nullptr, 0);
+    return false;
+}
+
+// Copies as many whole elements as the current block has left, or none.
+DWORD IDEController::readFromSectorBufferInBulk(IDE& ide, unsigned elementSize, BYTE* destination, DWORD count)
+{
+    count = qMin<DWORD>(count, bytesLeftInBlock(m_readBufferIndex, m_readDataSize) / elementSize);
+    if (!count || !copyReadData(destination, count * elementSize))
+        return 0;
+    m_readBufferIndex += count * elementSize;
+    didMoveData(ide, m_readBufferIndex - count * elementSize, m_readBufferIndex, m_readDataSize);
+    return count;
+}
+
+DWORD IDEController::writeToSectorBufferInBulk(IDE& ide, unsigned elementSize, const BYTE* source, DWORD count)
+{
+    count = qMin<DWORD>(count, bytesLeftInBlock(m_writeBufferIndex, m_writeBuffer.size()) / elementSize);
+    if (!count)
+        return 0;
+    memcpy(&m_writeBuffer.data()[m_writeBufferIndex], source, count * elementSize);
+    m_writeBufferIndex += count * elementSize;
+    didMoveData(ide, m_writeBufferIndex - count * elementSize, m_writeBufferIndex, m_writeBuffer.size());
+    if (m_writeBufferIndex == m_writeBuffer.size())
+        didFillWriteBuffer(ide);
+    return count;
+}
+
+// Runs on the I/O thread. The CPU thread leaves the buffers alone while the controller is busy.
+void IDEController::runTransfer()
+{
+    if (transferIsWrite)
+        transferResult = drive().writeSectors(transferLBA, transferCount, reinterpret_cast<const BYTE*>(m_writeBuffer.constData()));
+    else
+        transferResult = drive().readSectors(transferLBA, transferCount, reinterpret_cast<BYTE*>(m_readBuffer.data()));
 }
 
 template<typename T>
-T IDEController::readFromSectorBuffer()
+T IDEController::readFromSectorBuffer(IDE& ide)
 {
-    if (m_readBufferIndex >= m_readBuffer.size()) {
+    if (m_readBufferIndex >= m_readDataSize) {
         vlog(LogIDE, "ide%u: No data left in read buffer!");
         return 0;
     }
-    if ((m_readBufferIndex + static_cast<int>(sizeof(T))) > m_readBuffer.size()) {
+    if ((m_readBufferIndex + static_cast<int>(sizeof(T))) > m_readDataSize) {
         vlog(LogIDE, "ide%u: Not enough data left in read buffer!");
         ASSERT_NOT_REACHED();
         return 0;
     }
-    const T* data = reinterpret_cast<T*>(&m_readBuffer.data()[m_readBufferIndex]);
+    T data;
+    if (!copyReadData(reinterpret_cast<BYTE*>(&data), sizeof(T)))
+        return 0;
     m_readBufferIndex += sizeof(T);
-    return *data;
+    didMoveData(ide, m_readBufferIndex - sizeof(T), m_readBufferIndex, m_readDataSize);
+    return data;
 }
 
 static const int gNumControllers = 2;
 
+class IDE::IOThread final : public QThread {
+public:
+    explicit IOThread(IDE& ide)
+        : m_ide(ide)
+    {
+    }
+
+    void run() override { m_ide.runIOThread(); }
+
+private:
+    IDE& m_ide;
+};
+
 struct IDE::Private
 {
     IDEController controller[gNumControllers];
+
+    QMutex ioMutex;
+    // Signalled when a transfer is queued or done, and when the I/O thread should exit.
+    QWaitCondition ioCondition;
+    bool ioThreadShouldExit { false };
+    OwnPtr<IOThread> ioThread;
+
+    bool hasTransfersInFlight() const
+    {
+        for (auto& c : controller) {
+            if (c.transferState == IDEController::TransferState::Queued || c.transferState == IDEController::TransferState::Running)
+                return true;
+        }
+        return false;
+    }
 };
 
 IDE::IDE(Machine& machine)
@@ -181,21 +370,85 @@ IDE::IDE(Machine& machine)
 
     listen(0x3f6, IODevice::ReadOnly);
 
+    for (WORD port = busMasterBase; port < busMasterBase + busMasterPortCount; ++port)
+        listen(port, IODevice::ReadWrite);
+
     reset();
 }
 
 IDE::~IDE()
 {
+    if (!d->ioThread)
+        return;
+    {
+        QMutexLocker locker(&d->ioMutex);
+        d->ioThreadShouldExit = true;
+        d->ioCondition.wakeAll();
+    }
+    d->ioThread->wait();
 }
 
 void IDE::reset()
 {
+     // Let in-flight transfers finish; their completions find idle controllers and do nothing.
+     waitForAsyncWork();
+
+     QMutexLocker locker(&d->ioMutex);
      d->controller[0] = IDEController();
      d->controller[0].controllerIndex = 0;
      d->controller[0].drivePtr = &machine().fixed0();
      d->controller[1] = IDEController();
      d->controller[1].controllerIndex = 1;
      d->controller[1].drivePtr = &machine().fixed1();
+     // Firmware sets these to say the drives can do DMA.
+     d->controller[0].busMasterStatus = BusMasterDriveDMACapable;
+     d->controller[1].busMasterStatus = BusMasterDriveDMACapable;
+}
+
+void IDE::saveState(QDataStream& stream) const
+{
+    for (auto& controller : d->controller) {
+        // Machine::saveSnapshot() has already finished all transfers, so the only thing a busy
+        // controller can be doing is waiting for the bus master.
+        ASSERT(!controller.busy || controller.dmaPhase == IDEController::DMAPhase::Command);
+        stream << controller.cylinderIndex << controller.sectorIndex << controller.headIndex;
+        stream << controller.sectorCount << controller.error << controller.inLBAMode;
+        stream << controller.multipleSectorCount << controller.blockSectorCount;
+        stream << controller.busy << controller.transferIsWrite << (int)controller.dmaPhase << controller.dmaDataReady;
+        stream << controller.busMasterCommand << controller.busMasterStatus << controller.prdTableAddress;
+        if (controller.dmaDataReady) {
+            stream << controller.m_readBuffer << controller.m_readBufferIndex;
+        } else {
+            QByteArray readData(controller.m_readDataSize, 0);
+            if (controller.m_readDataIsMapped)
+                controller.drivePtr->copyMappedData(controller.m_readData, controller.m_readDataMappingGeneration, reinterpret_cast<BYTE*>(readData.data()), readData.size());
+            else if (controller.m_readData)
+                memcpy(readData.data(), controller.m_readData, readData.size());
+            stream << readData << controller.m_readBufferIndex;
+        }
+        stream << controller.m_writeBuffer << controller.m_writeBufferIndex;
+    }
+}
+
+void IDE::restoreState(QDataStream& stream)
+{
+    for (auto& controller : d->controller) {
+        stream >> controller.cylinderIndex >> controller.sectorIndex >> controller.headIndex;
+        stream >> controller.sectorCount >> controller.error >> controller.inLBAMode;
+        stream >> controller.multipleSectorCount >> controller.blockSectorCount;
+        int dmaPhase;
+        stream >> controller.busy >> controller.transferIsWrite >> dmaPhase >> controller.dmaDataReady;
+        controller.dmaPhase = static_cast<IDEController::DMAPhase>(dmaPhase);
+        stream >> controller.busMasterCommand >> controller.busMasterStatus >> controller.prdTableAddress;
+        int readBufferIndex;
+        stream >> controller.m_readBuffer >> readBufferIndex;
+        if (controller.dmaDataReady)
+            controller.setReadData(nullptr, 0);
+        else
+            controller.setReadData(reinterpret_cast<const BYTE*>(controller.m_readBuffer.constData()), controller.m_readBuffer.size());
+        controller.m_readBufferIndex = readBufferIndex;
+        stream >> controller.m_writeBuffer >> controller.m_writeBufferIndex;
+    }
 }
 
 void IDE::out8(WORD port, BYTE data)
@@ -204,6 +457,11 @@ void IDE::out8(WORD port, BYTE data)
     vlog(LogIDE, "out8 %03x, %02x", port, data);
 #endif
 
+    if (isBusMasterPort(port)) {
+        writeBusMasterRegister(port, data);
+        return;
+    }
+
     const int controllerIndex = (((port) & 0x1F0) == 0x170);
     IDEController& controller = d->controller[controllerIndex];
 
@@ -236,6 +494,10 @@ void IDE::out8(WORD port, BYTE data)
     case 0x7:
         // FIXME: ...
         vlog(LogIDE, "Controller %d received command %02X", controllerIndex, data);
+        if (controller.busy) {
+            vlog(LogIDE, "Controller %d is busy, ignoring command", controllerIndex);
+            break;
+        }
         executeCommand(controller, data);
         break;
     default:
@@ -245,6 +507,9 @@ void IDE::out8(WORD port, BYTE data)
 
 BYTE IDE::in8(WORD port)
 {
+    if (isBusMasterPort(port))
+        return readBusMasterRegister(port);
+
     int controllerIndex = (((port) & 0x1F0) == 0x170);
     IDEController& controller = d->controller[controllerIndex];
 
@@ -256,7 +521,7 @@ BYTE IDE::in8(WORD port)
 
     switch (port & 0xF) {
     case 0:
-        return controller.readFromSectorBuffer<BYTE>();
+        return controller.readFromSectorBuffer<BYTE>(*this);
     case 0x1:
         vlog(LogIDE, "Controller %d error queried: %02X", controllerIndex, controller.error);
         return controller.error;
@@ -287,12 +552,16 @@ BYTE IDE::in8(WORD port)
 
 WORD IDE::in16(WORD port)
 {
+    // The bus master registers are built from 8-bit accesses.
+    if (isBusMasterPort(port))
+        return IODevice::in16(port);
+
     int controllerIndex = (((port) & 0x1f0) == 0x170);
     IDEController& controller = d->controller[controllerIndex];
 
     switch (port & 0xF) {
     case 0:
-        return controller.readFromSectorBuffer<WORD>();
+        return controller.readFromSectorBuffer<WORD>(*this);
     default:
         return IODevice::in16(port);
     }
@@ -300,14 +569,17 @@ WORD IDE::in16(WORD port)
 
 DWORD IDE::in32(WORD port)
 {
+    if (isBusMasterPort(port))
+        return IODevice::in32(port);
+
     int controllerIndex = (((port) & 0x1f0) == 0x170);
     IDEController& controller = d->controller[controllerIndex];
 
     switch (port & 0xF) {
     case 0:
-        return controller.readFromSectorBuffer<DWORD>();
+        return controller.readFromSectorBuffer<DWORD>(*this);
     default:
-        return IODevice::in16(port);
+        return IODevice::in32(port);
     }
 }
 
@@ -317,6 +589,9 @@ void IDE::out16(WORD port, WORD data)
     vlog(LogIDE, "out16 %03x, %04x", port, data);
 #endif
 
+    if (isBusMasterPort(port))
+        return IODevice::out16(port, data);
+
     const int controllerIndex = (((port) & 0x1F0) == 0x170);
     IDEController& controller = d->controller[controllerIndex];
 
@@ -335,6 +610,9 @@ void IDE::out32(WORD port, DWORD data)
     vlog(LogIDE, "out32 %03x, %08x", port, data);
 #endif
 
+    if (isBusMasterPort(port))
+        return IODevice::out32(port, data);
+
     const int controllerIndex = (((port) & 0x1F0) == 0x170);
     IDEController& controller = d->controller[controllerIndex];
 
@@ -343,12 +621,31 @@ void IDE::out32(WORD port, DWORD data)
         controller.writeToSectorBuffer<DWORD>(*this, data);
         break;
     default:
-        return IODevice::out16(port, data);
+        return IODevice::out32(port, data);
     }
 }
 
+DWORD IDE::inString(WORD port, unsigned elementSize, BYTE* destination, DWORD count)
+{
+    if ((port & 0xF) != 0 || isBusMasterPort(port))
+        return 0;
+    int controllerIndex = (((port) & 0x1f0) == 0x170);
+    return d->controller[controllerIndex].readFromSectorBufferInBulk(*this, elementSize, destination, count);
+}
+
+DWORD IDE::outString(WORD port, unsigned elementSize, const BYTE* source, DWORD count)
+{
+    if ((port & 0xF) != 0 || isBusMasterPort(port))
+        return 0;
+    int controllerIndex = (((port) & 0x1f0) == 0x170);
+    return d->controller[controllerIndex].writeToSectorBufferInBulk(*this, elementSize, source, count);
+}
+
 void IDE::executeCommand(IDEController& controller, BYTE command)
 {
+    controller.error = 0;
+    controller.blockSectorCount = 1;
+
     switch (command) {
     case 0x20:
     case 0x21:
@@ -357,6 +654,36 @@ void IDE::executeCommand(IDEController& controller, BYTE command)
     case 0x30:
         controller.writeSectors();
         break;
+    case 0xC4:
+    case 0xC5:
+        if (!controller.multipleSectorCount) {
+            vlog(LogIDE, "Controller %u got %s MULTIPLE without multiple mode", controller.controllerIndex, command == 0xC4 ? "READ" : "WRITE");
+            controller.error = ABRT;
+            raiseIRQ();
+            break;
+        }
+        controller.blockSectorCount = controller.multipleSectorCount;
+        if (command == 0xC4)
+            controller.readSectors(*this);
+        else
+            controller.writeSectors();
+        break;
+    case 0xC6:
+        controller.setMultipleMode(*this);
+        break;
+    case 0xC8:
+    case 0xC9:
+        startDMA(controller, false);
+        break;
+    case 0xCA:
+    case 0xCB:
+        startDMA(controller, true);
+        break;
+    case 0xEF:
+        // SET FEATURES. Transfer modes and caching make no difference here.
+        vlog(LogIDE, "Controller %u: Set features", controller.controllerIndex);
+        raiseIRQ();
+        break;
     case 0xEC:
         controller.identify(*this);
         break;
@@ -373,11 +700,277 @@ void IDE::executeCommand(IDEController& controller, BYTE command)
     }
 }
 
+void IDE::startTransfer(IDEController& controller)
+{
+    controller.transferLBA = controller.lba();
+    controller.transferCount = controller.sectorsToTransfer();
+#ifndef CT_DETERMINISTIC
+    if (!machine().isForAutotest()) {
+        controller.busy = true;
+        QMutexLocker locker(&d->ioMutex);
+        if (!d->ioThread) {
+            d->ioThread = make<IOThread>(*this);
+            d->ioThread->start();
+        }
+        controller.transferState = IDEController::TransferState::Queued;
+        d->ioCondition.wakeAll();
+        return;
+    }
+#endif
+    // Instruction counts have to be reproducible, so the transfer is done before the OUT is.
+    // Autotest traces show every instruction of a status poll, so the same goes for them.
+    controller.runTransfer();
+    finishTransfer(controller);
+}
+
+void IDE::finishTransfer(IDEController& controller)
+{
+    if (controller.transferResult != controller.transferCount) {
+        // The sectors aren't in the image (or the host couldn't get at them), so fail the command.
+        vlog(LogIDE, "ide%u: %s of %u sectors at LBA %u failed after %u",
+            controller.controllerIndex,
+            controller.transferIsWrite ? "Write" : "Read",
+            controller.transferCount,
+            controller.transferLBA,
+            controller.transferResult);
+        controller.error = IDNF | ABRT;
+        if (controller.dmaPhase != IDEController::DMAPhase::None) {
+            finishDMA(controller, false);
+            return;
+        }
+        controller.busy = false;
+        controller.setReadData(nullptr, 0);
+        controller.m_writeBufferIndex = controller.m_writeBuffer.size();
+        raiseIRQ();
+        return;
+    }
+    if (controller.dmaPhase == IDEController::DMAPhase::Writing) {
+        finishDMA(controller, true);
+        return;
+    }
+    if (controller.dmaPhase == IDEController::DMAPhase::Command) {
+        controller.dmaDataReady = true;
+        runDMA(controller);
+        return;
+    }
+    controller.busy = false;
+    if (!controller.transferIsWrite)
+        controller.setReadData(reinterpret_cast<const BYTE*>(controller.m_readBuffer.constData()), controller.m_readBuffer.size());
+    raiseIRQ();
+}
+
+void IDE::runIOThread()
+{
+    QMutexLocker locker(&d->ioMutex);
+    forever {
+        IDEController* queued = nullptr;
+        for (auto& controller : d->controller) {
+            if (controller.transferState == IDEController::TransferState::Queued) {
+                queued = &controller;
+                break;
+            }
+        }
+        if (!queued) {
+            if (d->ioThreadShouldExit)
+                return;
+            d->ioCondition.wait(&d->ioMutex);
+            continue;
+        }
+
+        queued->transferState = IDEController::TransferState::Running;
+        locker.unlock();
+        queued->runTransfer();
+        locker.relock();
+        queued->transferState = IDEController::TransferState::Done;
+        d->ioCondition.wakeAll();
+        scheduleCompletion();
+    }
+}
+
+void IDE::completeAsyncWork()
+{
+    for (auto& controller : d->controller) {
+        {
+            QMutexLocker locker(&d->ioMutex);
+            if (controller.transferState != IDEController::TransferState::Done)
+                continue;
+            controller.transferState = IDEController::TransferState::Idle;
+        }
+        finishTransfer(controller);
+    }
+}
+
+void IDE::waitForAsyncWork()
+{
+    QMutexLocker locker(&d->ioMutex);
+    while (d->hasTransfersInFlight())
+        d->ioCondition.wait(&d->ioMutex);
+}
+
+BYTE IDE::readBusMasterRegister(WORD port)
+{
+    auto& controller = d->controller[(port - busMasterBase) / 8];
+    switch ((port - busMasterBase) & 7) {
+    case 0:
+        return controller.busMasterCommand;
+    case 2:
+        return controller.busMasterStatus;
+    case 4:
+    case 5:
+    case 6:
+    case 7:
+        return controller.prdTableAddress >> (((port - busMasterBase) & 3) * 8);
+    default:
+        return 0;
+    }
+}
+
+void IDE::writeBusMasterRegister(WORD port, BYTE data)
+{
+    auto& controller = d->controller[(port - busMasterBase) / 8];
+    switch ((port - busMasterBase) & 7) {
+    case 0: {
+        bool wasStarted = controller.busMasterCommand & BusMasterStart;
+        controller.busMasterCommand = data & (BusMasterStart | BusMasterReadFromDisk);
+        if (!(data & BusMasterStart)) {
+            // Stopping doesn't abort the drive's side of the command, it only stops the copying.
+            controller.busMasterStatus &= ~BusMasterActive;
+        } else if (!wasStarted) {
+            controller.busMasterStatus |= BusMasterActive;
+            runDMA(controller);
+        }
+        break;
+    }
+    case 2:
+        // Error and interrupt are cleared by writing 1s to them.
+        controller.busMasterStatus &= ~(data & (BusMasterError | BusMasterInterrupt));
+        controller.busMasterStatus = (controller.busMasterStatus & ~BusMasterDriveDMACapable) | (data & BusMasterDriveDMACapable);
+        break;
+    case 4:
+    case 5:
+    case 6:
+    case 7: {
+        unsigned shift = ((port - busMasterBase) & 3) * 8;
+        controller.prdTableAddress = (controller.prdTableAddress & ~((DWORD)0xff << shift)) | ((DWORD)data << shift);
+        controller.prdTableAddress &= ~3;
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+// Feeds the regions of the channel's PRD table to copy(address, offset, size) until size bytes are
+// covered. Fails if the table or guest memory runs out first. tableExhausted tells whether the
+// transfer ended exactly at the end of the table; if it didn't, the bus master stays active.
+template<typename Callback>
+static bool walkPRDTable(CPU& cpu, DWORD tableAddress, DWORD size, bool& tableExhausted, Callback copy)
+{
+    // A table can't cross a 64 KiB boundary, which limits it to 8192 entries.
+    static const unsigned maximumEntries = 8192;
+
+    DWORD offset = 0;
+    tableExhausted = false;
+    for (unsigned i = 0; i < maximumEntries && offset < size; ++i) {
+        BYTE entry[8];
+        if (!cpu.copyFromPhysicalMemory(PhysicalAddress(tableAddress + i * 8), entry, sizeof(entry)))
+            return false;
+        DWORD address = weld<DWORD>(weld<WORD>(entry[3], entry[2]), weld<WORD>(entry[1], entry[0])) & ~1;
+        DWORD count = weld<WORD>(entry[5], entry[4]) & ~1;
+        if (!count)
+            count = 0x10000;
+        bool isLast = entry[7] & 0x80;
+        DWORD chunk = qMin(count, size - offset);
+        if (!copy(PhysicalAddress(address), offset, chunk))
+            return false;
+        offset += chunk;
+        if (isLast) {
+            tableExhausted = chunk == count;
+            break;
+        }
+    }
+    return offset == size;
+}
+
+void IDE::startDMA(IDEController& controller, bool isWrite)
+{
+    vlog(LogIDE, "ide%u: %s DMA (LBA: %u, count: %u)", controller.controllerIndex, isWrite ? "Write" : "Read", controller.lba(), controller.sectorsToTransfer());
+    int size = controller.drive().bytesPerSector() * controller.sectorsToTransfer();
+    controller.busy = true;
+    controller.dmaPhase = IDEController::DMAPhase::Command;
+    controller.dmaDataReady = false;
+    controller.transferIsWrite = isWrite;
+    if (isWrite) {
+        // The data comes from the bus master, not the data port.
+        controller.m_writeBuffer.resize(size);
+        controller.m_writeBufferIndex = size;
+    } else {
+        // Start reading right away, the bus master can be started while the disk works.
+        controller.m_readBuffer.resize(size);
+        controller.setReadData(nullptr, 0);
+        startTransfer(controller);
+    }
+    runDMA(controller);
+}
+
+void IDE::runDMA(IDEController& controller)
+{
+    if (controller.dmaPhase != IDEController::DMAPhase::Command || !(controller.busMasterCommand & BusMasterStart))
+        return;
+
+    auto& cpu = machine().cpu();
+    bool tableExhausted;
+    if (controller.transferIsWrite) {
+        BYTE* buffer = reinterpret_cast<BYTE*>(controller.m_writeBuffer.data());
+        bool ok = walkPRDTable(cpu, controller.prdTableAddress, controller.m_writeBuffer.size(), tableExhausted, [&] (PhysicalAddress address, DWORD offset, DWORD size) {
+            return cpu.copyFromPhysicalMemory(address, buffer + offset, size);
+        });
+        if (!ok) {
+            finishDMA(controller, false);
+            return;
+        }
+        controller.dmaPhase = IDEController::DMAPhase::Writing;
+        startTransfer(controller);
+        return;
+    }
+
+    if (!controller.dmaDataReady)
+        return;
+    const BYTE* buffer = reinterpret_cast<const BYTE*>(controller.m_readBuffer.constData());
+    bool ok = walkPRDTable(cpu, controller.prdTableAddress, controller.m_readBuffer.size(), tableExhausted, [&] (PhysicalAddress address, DWORD offset, DWORD size) {
+        cpu.copyToPhysicalMemory(address, buffer + offset, size);
+        return true;
+    });
+    finishDMA(controller, ok, tableExhausted);
+}
+
+void IDE::finishDMA(IDEController& controller, bool succeeded, bool tableExhausted)
+{
+    if (!succeeded) {
+        vlog(LogIDE, "ide%u: DMA failed, PRD table at %08x", controller.controllerIndex, controller.prdTableAddress);
+        controller.error |= ABRT;
+        controller.busMasterStatus |= BusMasterError;
+    }
+    controller.busy = false;
+    controller.dmaPhase = IDEController::DMAPhase::None;
+    controller.dmaDataReady = false;
+    controller.busMasterStatus |= BusMasterInterrupt;
+    if (tableExhausted || !succeeded)
+        controller.busMasterStatus &= ~BusMasterActive;
+    raiseIRQ();
+}
+
 IDE::Status IDE::status(const IDEController& controller) const
 {
+    // The other bits aren't valid while BSY is set.
+    if (controller.busy)
+        return BUSY;
+
     // FIXME: ...
     unsigned status = INDEX | DRDY;
-    if (controller.m_readBufferIndex < controller.m_readBuffer.size()) {
+    if (controller.error)
+        status |= ERROR;
+    if (controller.m_readBufferIndex < controller.m_readDataSize) {
         status |= DRQ;
     }
     if (controller.m_writeBufferIndex < controller.m_writeBuffer.size()) {
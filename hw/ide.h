@@ -43,21 +43,45 @@ public:
         BUSY  = 0x80
     };
 
+    // The PIIX bus master registers, 8 per channel. PCI reports them in the IDE function's BAR4.
+    static const WORD busMasterBase = 0xc000;
+    static const unsigned busMasterPortCount = 16;
+
     explicit IDE(Machine&);
     virtual ~IDE();
 
     virtual void reset() override;
+    virtual void saveState(QDataStream&) const override;
+    virtual void restoreState(QDataStream&) override;
+    virtual void completeAsyncWork() override;
+    virtual void waitForAsyncWork() override;
     virtual BYTE in8(WORD port) override;
     virtual WORD in16(WORD port) override;
     virtual DWORD in32(WORD port) override;
     virtual void out8(WORD port, BYTE data) override;
     virtual void out16(WORD port, WORD data) override;
     virtual void out32(WORD port, DWORD data) override;
+    virtual DWORD inString(WORD port, unsigned elementSize, BYTE* destination, DWORD count) override;
+    virtual DWORD outString(WORD port, unsigned elementSize, const BYTE* source, DWORD count) override;
 
 private:
+    friend struct IDEController;
+    class IOThread;
+
     void executeCommand(IDEController&, BYTE);
     Status status(const IDEController&) const;
 
+    void startTransfer(IDEController&);
+    void finishTransfer(IDEController&);
+    void runIOThread();
+
+    static bool isBusMasterPort(WORD port) { return port >= busMasterBase && port < busMasterBase + busMasterPortCount; }
+    BYTE readBusMasterRegister(WORD port);
+    void writeBusMasterRegister(WORD port, BYTE data);
+    void startDMA(IDEController&, bool isWrite);
+    void runDMA(IDEController&);
+    void finishDMA(IDEController&, bool succeeded, bool tableExhausted = true);
+
     struct Private;
     OwnPtr<Private> d;
 };
@@ -31,7 +31,6 @@
 //#define IODEVICE_DEBUG
 //#define IRQ_DEBUG
 
-QSet<WORD> IODevice::s_ignorePorts;
 
 IODevice::IODevice(const char* name, Machine& machine, int irq)
     : m_machine(machine)
@@ -114,16 +113,6 @@ DWORD IODevice::in32(WORD port)
     return weld<DWORD>(in16(port + 2), in16(port));
 }
 
-void IODevice::ignorePort(WORD port)
-{
-    s_ignorePorts.insert(port);
-}
-
-bool IODevice::shouldIgnorePort(WORD port)
-{
-    return s_ignorePorts.contains(port);
-}
-
 void IODevice::raiseIRQ()
 {
     ASSERT(m_irq != -1);
@@ -135,6 +124,11 @@ void IODevice::raiseIRQ()
     PIC::raiseIRQ(machine(), m_irq);
 }
 
+void IODevice::scheduleCompletion()
+{
+    machine().scheduleDeviceCompletion(*this);
+}
+
 void IODevice::lowerIRQ()
 {
     ASSERT(m_irq != -1);
@@ -29,6 +29,7 @@
 #include <QList>
 
 class Machine;
+class QDataStream;
 
 class IODevice {
 public:
@@ -44,6 +45,16 @@ public:
 
     virtual void reset() = 0;
 
+    // Machine snapshots. Only called while the CPU is stopped between two instructions.
+    virtual void saveState(QDataStream&) const { }
+    virtual void restoreState(QDataStream&) { }
+
+    // Work a device hands to another thread ends with scheduleCompletion(), after which the
+    // CPU thread calls completeAsyncWork() between two instructions to deliver the result.
+    virtual void completeAsyncWork() { }
+    // Blocks until the device has no work in flight on other threads.
+    virtual void waitForAsyncWork() { }
+
     template<typename T> T in(WORD port);
     template<typename T> void out(WORD port, T data);
 
@@ -54,14 +65,21 @@ public:
     virtual void out16(WORD port, WORD data);
     virtual void out32(WORD port, DWORD data);
 
-    static bool shouldIgnorePort(WORD port);
-    static void ignorePort(WORD port);
+    // Fast path for REP INS/OUTS. A device with a buffer behind a data port can move up to count
+    // elements of elementSize bytes at once, lowest address first, and return how many it moved.
+    // Returning 0 makes the CPU fall back to one in()/out() per element. Moving fewer than count
+    // ends the CPU's REP round there, so IRQs raised along the way get in before the rest.
+    virtual DWORD inString(WORD, unsigned /*elementSize*/, BYTE* /*destination*/, DWORD /*count*/) { return 0; }
+    virtual DWORD outString(WORD, unsigned /*elementSize*/, const BYTE* /*source*/, DWORD /*count*/) { return 0; }
 
     QList<WORD> ports() const;
 
     enum { JunkValue = 0xff };
 
 protected:
+    // May be called from any thread.
+    void scheduleCompletion();
+
     enum ListenMask {
         ReadOnly = 1,
         WriteOnly = 2,
@@ -74,8 +92,6 @@ private:
     const char* m_name { nullptr };
     int m_irq { 0 };
     QList<WORD> m_ports;
-
-    static QSet<WORD> s_ignorePorts;
 };
 
 template<typename T> inline T IODevice::in(WORD port)
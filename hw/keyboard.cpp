@@ -28,6 +28,7 @@
 #include "pic.h"
 #include "debug.h"
 #include "machine.h"
+#include <QtCore/QDataStream>
 
 //#define KBD_DEBUG
 
@@ -89,6 +90,19 @@ void Keyboard::reset()
     m_ram[0] |= CCB_KEYBOARD_INTERRUPT_ENABLE;
 }
 
+void Keyboard::saveState(QDataStream& stream) const
+{
+    stream << m_systemControlPortData << m_command << m_hasCommand << m_lastWasCommand << m_leds << m_enabled;
+    stream.writeRawData(reinterpret_cast<const char*>(m_ram), sizeof(m_ram));
+}
+
+void Keyboard::restoreState(QDataStream& stream)
+{
+    stream >> m_systemControlPortData >> m_command >> m_hasCommand >> m_lastWasCommand >> m_leds >> m_enabled;
+    stream.readRawData(reinterpret_cast<char*>(m_ram), sizeof(m_ram));
+    emit ledsChanged(m_leds);
+}
+
 BYTE Keyboard::in8(WORD port)
 {
     extern BYTE kbd_pop_raw();
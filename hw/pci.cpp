@@ -0,0 +1,240 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "pci.h"
+#include "debug.h"
+#include "ide.h"
+#include "machine.h"
+#include <QtCore/QDataStream>
+#include <string.h>
+
+//#define PCI_DEBUG
+
+enum ConfigRegister {
+    VendorID = 0x00,
+    DeviceID = 0x02,
+    Command = 0x04,
+    Status = 0x06,
+    ProgIF = 0x09,
+    SubClass = 0x0a,
+    ClassCode = 0x0b,
+    CacheLineSize = 0x0c,
+    LatencyTimer = 0x0d,
+    HeaderType = 0x0e,
+    BAR0 = 0x10,
+    InterruptLine = 0x3c,
+    InterruptPin = 0x3d,
+};
+
+static void set16(BYTE* config, unsigned offset, WORD value)
+{
+    config[offset] = leastSignificant<BYTE>(value);
+    config[offset + 1] = mostSignificant<BYTE>(value);
+}
+
+static void set32(BYTE* config, unsigned offset, DWORD value)
+{
+    set16(config, offset, leastSignificant<WORD>(value));
+    set16(config, offset + 2, mostSignificant<WORD>(value));
+}
+
+static DWORD get32(const BYTE* config, unsigned offset)
+{
+    return weld<DWORD>(weld<WORD>(config[offset + 3], config[offset + 2]), weld<WORD>(config[offset + 1], config[offset]));
+}
+
+PCI::PCI(Machine& machine)
+    : IODevice("PCI", machine)
+{
+    for (WORD port = 0xcf8; port <= 0xcff; ++port)
+        listen(port, IODevice::ReadWrite);
+
+    reset();
+}
+
+PCI::~PCI()
+{
+}
+
+void PCI::reset()
+{
+    m_configAddress = 0;
+    m_functions.clear();
+
+    auto addFunction = [this] (BYTE device, BYTE function, WORD vendorID, WORD deviceID, DWORD classCode, BYTE headerType) -> Function& {
+        Function f;
+        f.device = device;
+        f.function = function;
+        memset(f.config, 0, sizeof(f.config));
+        memset(f.writable, 0, sizeof(f.writable));
+        memset(f.bars, 0, sizeof(f.bars));
+        set16(f.config, VendorID, vendorID);
+        set16(f.config, DeviceID, deviceID);
+        f.config[ProgIF] = classCode & 0xff;
+        f.config[SubClass] = (classCode >> 8) & 0xff;
+        f.config[ClassCode] = (classCode >> 16) & 0xff;
+        f.config[HeaderType] = headerType;
+        set16(f.writable, Command, 0x0147);
+        f.writable[CacheLineSize] = 0xff;
+        f.writable[LatencyTimer] = 0xff;
+        f.writable[InterruptLine] = 0xff;
+        m_functions.push_back(f);
+        return m_functions.back();
+    };
+
+    // 440FX host bridge.
+    auto& hostBridge = addFunction(0, 0, 0x8086, 0x1237, 0x060000, 0x00);
+    set16(hostBridge.config, Command, 0x0006);
+
+    // PIIX3 ISA bridge. It's multi-function, the IDE controller is function 1.
+    auto& isaBridge = addFunction(1, 0, 0x8086, 0x7000, 0x060100, 0x80);
+    set16(isaBridge.config, Command, 0x0007);
+
+    // PIIX3 IDE in legacy mode (ports 1F0h/170h, IRQ 14) with bus mastering.
+    auto& ide = addFunction(1, 1, 0x8086, 0x7010, 0x010180, 0x00);
+    set16(ide.config, Command, 0x0005);
+    set16(ide.config, Status, 0x0280);
+    ide.bars[4] = IDE::busMasterBase | 1;
+    set32(ide.config, BAR0 + 4 * 4, ide.bars[4]);
+    set32(ide.writable, BAR0 + 4 * 4, ~(DWORD)(IDE::busMasterPortCount - 1));
+    // IDETIM for both channels, with the decode enable bit set so drivers see them as enabled.
+    set16(ide.config, 0x40, 0x8000);
+    set16(ide.config, 0x42, 0x8000);
+    memset(ide.writable + 0x40, 0xff, 0x10);
+}
+
+void PCI::saveState(QDataStream& stream) const
+{
+    stream << m_configAddress;
+    for (auto& function : m_functions)
+        stream.writeRawData(reinterpret_cast<const char*>(function.config), sizeof(function.config));
+}
+
+void PCI::restoreState(QDataStream& stream)
+{
+    stream >> m_configAddress;
+    for (auto& function : m_functions)
+        stream.readRawData(reinterpret_cast<char*>(function.config), sizeof(function.config));
+}
+
+PCI::Function* PCI::selectedFunction()
+{
+    // Enable bit, bus 0 only.
+    if (!(m_configAddress & 0x80000000) || (m_configAddress & 0x00ff0000))
+        return nullptr;
+    BYTE device = (m_configAddress >> 11) & 0x1f;
+    BYTE function = (m_configAddress >> 8) & 0x7;
+    for (auto& f : m_functions) {
+        if (f.device == device && f.function == function)
+            return &f;
+    }
+    return nullptr;
+}
+
+DWORD PCI::readConfig(WORD port, unsigned size)
+{
+    auto* function = selectedFunction();
+    if (!function)
+        return 0xffffffff;
+    unsigned offset = (m_configAddress & 0xfc) + (port & 3);
+    DWORD data = 0;
+    for (unsigned i = 0; i < size && offset + i < 256; ++i)
+        data |= (DWORD)function->config[offset + i] << (i * 8);
+#ifdef PCI_DEBUG
+    vlog(LogPCI, "Read %u bytes at %02x.%u+%02x: %x", size, function->device, function->function, offset, data);
+#endif
+    return data;
+}
+
+void PCI::writeConfig(WORD port, unsigned size, DWORD data)
+{
+    auto* function = selectedFunction();
+    if (!function)
+        return;
+    unsigned offset = (m_configAddress & 0xfc) + (port & 3);
+#ifdef PCI_DEBUG
+    vlog(LogPCI, "Write %u bytes at %02x.%u+%02x: %x", size, function->device, function->function, offset, data);
+#endif
+    for (unsigned i = 0; i < size && offset + i < 256; ++i) {
+        BYTE& byte = function->config[offset + i];
+        BYTE mask = function->writable[offset + i];
+        byte = (byte & ~mask) | ((data >> (i * 8)) & mask);
+    }
+
+    // Sizing writes all-ones and reads back the mask. Anything else puts the BAR back.
+    for (unsigned bar = 0; bar < 6; ++bar) {
+        unsigned barOffset = BAR0 + bar * 4;
+        if (!function->bars[bar] || offset >= barOffset + 4 || offset + size <= barOffset)
+            continue;
+        DWORD value = get32(function->config, barOffset);
+        DWORD mask = get32(function->writable, barOffset);
+        if ((value & mask) == mask || value == function->bars[bar])
+            continue;
+        vlog(LogPCI, "%02x.%u: Can't move BAR%u to %08x, leaving it at %08x", function->device, function->function, bar, value, function->bars[bar]);
+        set32(function->config, barOffset, function->bars[bar]);
+    }
+}
+
+BYTE PCI::in8(WORD port)
+{
+    if (port >= 0xcfc)
+        return readConfig(port, 1);
+    return m_configAddress >> ((port & 3) * 8);
+}
+
+WORD PCI::in16(WORD port)
+{
+    if (port >= 0xcfc)
+        return readConfig(port, 2);
+    return m_configAddress >> ((port & 3) * 8);
+}
+
+DWORD PCI::in32(WORD port)
+{
+    if (port >= 0xcfc)
+        return readConfig(port, 4);
+    return m_configAddress;
+}
+
+void PCI::out8(WORD port, BYTE data)
+{
+    // Byte writes to the address register are configuration mechanism #2 probes, which we don't do.
+    if (port >= 0xcfc)
+        writeConfig(port, 1, data);
+}
+
+void PCI::out16(WORD port, WORD data)
+{
+    if (port >= 0xcfc)
+        writeConfig(port, 2, data);
+}
+
+void PCI::out32(WORD port, DWORD data)
+{
+    if (port >= 0xcfc) {
+        writeConfig(port, 4, data);
+        return;
+    }
+    m_configAddress = data & 0x80fffffc;
+}
@@ -0,0 +1,66 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "iodevice.h"
+#include <vector>
+
+// PCI configuration mechanism #1 (ports CF8h and CFCh-CFFh) for a fixed set of functions on
+// bus 0: a 440FX host bridge and a PIIX3 with its IDE function, whose bus master registers
+// live in IDE. Firmware normally assigns BARs; here they come preassigned and can be sized
+// by the guest, but not moved.
+class PCI final : public IODevice {
+public:
+    explicit PCI(Machine&);
+    ~PCI();
+
+    void reset() override;
+    void saveState(QDataStream&) const override;
+    void restoreState(QDataStream&) override;
+    BYTE in8(WORD port) override;
+    WORD in16(WORD port) override;
+    DWORD in32(WORD port) override;
+    void out8(WORD port, BYTE data) override;
+    void out16(WORD port, WORD data) override;
+    void out32(WORD port, DWORD data) override;
+
+private:
+    struct Function {
+        BYTE device { 0 };
+        BYTE function { 0 };
+        BYTE config[256];
+        // Bits the guest may change.
+        BYTE writable[256];
+        // Where the BARs are, and where they go back to after being sized.
+        DWORD bars[6];
+    };
+
+    Function* selectedFunction();
+    DWORD readConfig(WORD port, unsigned size);
+    void writeConfig(WORD port, unsigned size, DWORD data);
+
+    DWORD m_configAddress { 0 };
+    std::vector<Function> m_functions;
+};
@@ -27,28 +27,47 @@
 #include "pic.h"
 #include "debug.h"
 #include "machine.h"
+#include <QtCore/QDataStream>
 
 //#define PIC_DEBUG
 
-// FIXME: This should not be global.
-std::atomic<WORD> PIC::s_pendingRequests;
-static bool s_ignoringIRQs = false;
+bool PIC::isIgnoringAllIRQs(Machine& machine)
+{
+    return machine.masterPIC().m_ignoringIRQs;
+}
+
+void PIC::setIgnoreAllIRQs(Machine& machine, bool b)
+{
+    machine.masterPIC().m_ignoringIRQs = b;
+    updatePendingRequests(machine);
+}
 
-bool PIC::isIgnoringAllIRQs()
+bool PIC::hasPendingIRQ(Machine& machine)
 {
-    return s_ignoringIRQs;
+    return machine.masterPIC().m_pendingRequests;
 }
 
-void PIC::setIgnoreAllIRQs(bool b)
+// Whether any IRQ line could still get through to the CPU, i.e. something could end an idle wait.
+bool PIC::hasUnmaskedIRQ(Machine& machine)
 {
-    s_ignoringIRQs = b;
+    if (isIgnoringAllIRQs(machine))
+        return false;
+    BYTE masterIMR = machine.masterPIC().getIMR();
+    if ((masterIMR | 0x04) != 0xff)
+        return true;
+    // IRQ 2 is the cascade, so it only counts if some slave line is unmasked too.
+    return !(masterIMR & 0x04) && machine.slavePIC().getIMR() != 0xff;
 }
 
 void PIC::updatePendingRequests(Machine& machine)
 {
     WORD masterRequests = (machine.masterPIC().getIRR() & ~machine.masterPIC().getIMR());
     WORD slaveRequests = (machine.slavePIC().getIRR() & ~machine.slavePIC().getIMR());
-    s_pendingRequests = masterRequests | (slaveRequests << 8);
+    WORD pendingRequests = masterRequests | (slaveRequests << 8);
+    machine.masterPIC().m_pendingRequests = pendingRequests;
+    machine.cpu().setIRQRequested(pendingRequests && !isIgnoringAllIRQs(machine));
+    if (pendingRequests)
+        machine.cpu().wakeFromHalt();
 }
 
 PIC::PIC(bool isMaster, Machine& machine)
@@ -75,7 +94,23 @@ void PIC::reset()
     m_icw2Expected = false;
     m_icw4Expected = false;
     m_readISR = false;
-    s_pendingRequests = 0;
+    m_pendingRequests = 0;
+    machine().cpu().setIRQRequested(false);
+}
+
+void PIC::saveState(QDataStream& stream) const
+{
+    stream << m_isrBase << m_irqBase;
+    stream << m_isr << m_irr << m_imr;
+    stream << m_icw2Expected << m_icw4Expected << m_readISR;
+}
+
+void PIC::restoreState(QDataStream& stream)
+{
+    stream >> m_isrBase >> m_irqBase;
+    stream >> m_isr >> m_irr >> m_imr;
+    stream >> m_icw2Expected >> m_icw4Expected >> m_readISR;
+    updatePendingRequests(machine());
 }
 
 void PIC::dumpMask()
@@ -152,7 +187,7 @@ void PIC::out8(WORD port, BYTE data)
 
     vlog(LogPIC, "Write PIC ICW on port %04X (data: %02X)", port, data);
     vlog(LogPIC, "I can't handle that request, better quit!");
-    hard_exit(1);
+    machine().shutDownAfterError();
 }
 
 BYTE PIC::in8(WORD port)
@@ -216,15 +251,14 @@ bool PIC::isIRQRaised(Machine& machine, BYTE num)
 
 void PIC::serviceIRQ(CPU& cpu)
 {
-    if (s_ignoringIRQs)
+    Machine& machine = cpu.machine();
+    if (isIgnoringAllIRQs(machine))
         return;
 
-    WORD pendingRequestsCopy = s_pendingRequests;
+    WORD pendingRequestsCopy = machine.masterPIC().m_pendingRequests;
     if (!pendingRequestsCopy)
         return;
 
-    Machine& machine = cpu.machine();
-
     BYTE irqToService = 0xFF;
 
     for (int i = 0; i < 16; ++i) {
@@ -35,6 +35,8 @@ public:
     ~PIC();
 
     virtual void reset() override;
+    virtual void saveState(QDataStream&) const override;
+    virtual void restoreState(QDataStream&) override;
     void out8(WORD port, BYTE data) override;
     BYTE in8(WORD port) override;
 
@@ -52,9 +54,10 @@ public:
     static void raiseIRQ(Machine&, BYTE num);
     static void lowerIRQ(Machine&, BYTE num);
     static bool isIRQRaised(Machine&, BYTE num);
-    static bool isIgnoringAllIRQs();
-    static void setIgnoreAllIRQs(bool);
-    static bool hasPendingIRQ() { return s_pendingRequests; }
+    static bool isIgnoringAllIRQs(Machine&);
+    static void setIgnoreAllIRQs(Machine&, bool);
+    static bool hasPendingIRQ(Machine&);
+    static bool hasUnmaskedIRQ(Machine&);
 
 private:
     static void updatePendingRequests(Machine&);
@@ -71,5 +74,7 @@ private:
     bool m_icw4Expected { false };
     bool m_readISR { false };
 
-    static std::atomic<WORD> s_pendingRequests;
+    // Machine-wide interrupt state, only used on the master PIC.
+    std::atomic<WORD> m_pendingRequests { 0 };
+    bool m_ignoringIRQs { false };
 };
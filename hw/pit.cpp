@@ -26,6 +26,7 @@
 #include "debug.h"
 #include "pic.h"
 #include "pit.h"
+#include <QtCore/QDataStream>
 #include <math.h>
 #include <QElapsedTimer>
 #include <QThread>
@@ -41,6 +42,8 @@ struct CounterInfo {
     WORD startValue { 0xffff };
     WORD reload { 0xffff };
     WORD value();
+    SIGNED_QWORD nanosecondsUntilRollover() const;
+    bool raisesIRQ() const;
     BYTE mode { 0 };
     DecrementMode decrementMode { DecrementBinary };
     WORD latchedValue { 0xffff };
@@ -85,6 +88,36 @@ void PIT::reset()
     d->counter[2] = CounterInfo();
 }
 
+void PIT::saveState(QDataStream& stream) const
+{
+    stream << d->frequency;
+    for (CounterInfo counter : d->counter) {
+        // Counters run on host time, so save where each one is right now and restart it from there.
+        bool running = counter.qtimer.isValid();
+        stream << running << (running ? counter.value() : counter.startValue) << counter.reload << counter.mode;
+        stream << (int)counter.decrementMode << counter.latchedValue << (int)counter.accessState << counter.format;
+    }
+}
+
+void PIT::restoreState(QDataStream& stream)
+{
+    stream >> d->frequency;
+    for (auto& counter : d->counter) {
+        bool running;
+        int decrementMode;
+        int accessState;
+        stream >> running >> counter.startValue >> counter.reload >> counter.mode;
+        stream >> decrementMode >> counter.latchedValue >> accessState >> counter.format;
+        counter.decrementMode = static_cast<DecrementMode>(decrementMode);
+        counter.accessState = static_cast<CounterAccessState>(accessState);
+        counter.rolledOver = false;
+        if (running)
+            counter.qtimer.start();
+        else
+            counter.qtimer.invalidate();
+    }
+}
+
 WORD CounterInfo::value()
 {
     double nsec = qtimer.nsecsElapsed() / 1000;
@@ -112,11 +145,31 @@ WORD CounterInfo::value()
     return currentValue;
 }
 
+// The inverse of value(): how much host time is left before it next wraps around.
+// Once past startValue, it wraps every reload ticks.
+SIGNED_QWORD CounterInfo::nanosecondsUntilRollover() const
+{
+    double ticksLeft = startValue - (qtimer.nsecsElapsed() / 1000) * baseFrequency;
+    if (ticksLeft <= 0) {
+        double period = reload ? reload : 0x10000;
+        ticksLeft = period - fmod(-ticksLeft, period);
+    }
+    return ceil(ticksLeft / baseFrequency * 1000);
+}
+
+// Modes 0, 2 and 3 all raise the IRQ as the counter wraps.
+bool CounterInfo::raisesIRQ() const
+{
+    return mode == 0 || mode == 2 || mode == 3;
+}
+
 void CounterInfo::check(PIT& pit)
 {
+    if (!qtimer.isValid())
+        return;
     value();
     if (rolledOver) {
-        if (mode == 0)
+        if (raisesIRQ())
             pit.raiseIRQ();
         rolledOver = false;
     }
@@ -125,12 +178,14 @@ void CounterInfo::check(PIT& pit)
 void PIT::reconfigureTimer(BYTE index)
 {
     auto& counter = d->counter[index];
+    // Counting restarts from the newly written count.
+    counter.startValue = counter.reload;
     counter.qtimer.start();
 }
 
 void PIT::boot()
 {
-    d->timerId = startTimer(5);
+    d->timerId = startTimer(checkIntervalMilliseconds);
 
     // FIXME: This should be done by the BIOS instead.
     reconfigureTimer(0);
@@ -139,14 +194,28 @@ void PIT::boot()
 }
 
 void PIT::timerEvent(QTimerEvent*)
+{
+    checkCounters();
+}
+
+void PIT::checkCounters()
 {
 #ifndef CT_DETERMINISTIC
+    // Only counter 0 is wired to an IRQ; 1 was DRAM refresh and 2 drives the speaker.
     d->counter[0].check(*this);
-    d->counter[1].check(*this);
-    d->counter[2].check(*this);
 #endif
 }
 
+SIGNED_QWORD PIT::nanosecondsUntilNextIRQ() const
+{
+#ifndef CT_DETERMINISTIC
+    auto& counter = d->counter[0];
+    if (counter.qtimer.isValid() && counter.raisesIRQ())
+        return counter.nanosecondsUntilRollover();
+#endif
+    return -1;
+}
+
 BYTE PIT::readCounter(BYTE index)
 {
     auto& counter = d->counter[index];
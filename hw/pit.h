@@ -35,11 +35,21 @@ public:
     virtual ~PIT();
 
     virtual void reset() override;
+    virtual void saveState(QDataStream&) const override;
+    virtual void restoreState(QDataStream&) override;
     virtual BYTE in8(WORD port) override;
     virtual void out8(WORD port, BYTE data) override;
 
     void boot();
 
+    // Counters are checked for rollover (and IRQ 0 raised) this often.
+    static const int checkIntervalMilliseconds = 5;
+    void checkCounters();
+
+    // How long until counter 0 next wraps around and raises IRQ 0, or -1 if it isn't
+    // running in a mode that raises it.
+    SIGNED_QWORD nanosecondsUntilNextIRQ() const;
+
 private:
     friend class CPU;
 
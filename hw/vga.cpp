@@ -32,6 +32,7 @@
 #include <QtCore/QMutexLocker>
 #include <QtGui/QColor>
 #include <QtGui/QBrush>
+#include <QtCore/QDataStream>
 
 struct RGBColor {
     BYTE red;
@@ -180,6 +181,45 @@ void VGA::reset()
     setPaletteDirty(true);
 }
 
+void VGA::saveState(QDataStream& stream) const
+{
+    stream.writeRawData(reinterpret_cast<const char*>(d->memory), 0x40000);
+    stream.writeRawData(reinterpret_cast<const char*>(d->latch), sizeof(d->latch));
+    stream << d->currentRegister << d->graphicsControllerAddressRegister << d->currentSequencer;
+    stream.writeRawData(reinterpret_cast<const char*>(d->ioRegister), sizeof(d->ioRegister));
+    stream.writeRawData(reinterpret_cast<const char*>(d->ioRegister2), sizeof(d->ioRegister2));
+    stream.writeRawData(reinterpret_cast<const char*>(d->ioSequencer), sizeof(d->ioSequencer));
+    stream << d->paletteIndex << d->paletteSource << d->columns << d->rows;
+    stream << d->dac_data_read_index << d->dac_data_read_subindex << d->dac_data_write_index << d->dac_data_write_subindex;
+    stream << d->next3C0IsIndex;
+    stream.writeRawData(reinterpret_cast<const char*>(d->paletteRegister), sizeof(d->paletteRegister));
+    for (auto& color : d->colorRegister)
+        stream << color.red << color.green << color.blue;
+    stream << d->statusRegister << d->miscellaneousOutputRegister;
+}
+
+void VGA::restoreState(QDataStream& stream)
+{
+    stream.readRawData(reinterpret_cast<char*>(d->memory), 0x40000);
+    stream.readRawData(reinterpret_cast<char*>(d->latch), sizeof(d->latch));
+    stream >> d->currentRegister >> d->graphicsControllerAddressRegister >> d->currentSequencer;
+    stream.readRawData(reinterpret_cast<char*>(d->ioRegister), sizeof(d->ioRegister));
+    stream.readRawData(reinterpret_cast<char*>(d->ioRegister2), sizeof(d->ioRegister2));
+    stream.readRawData(reinterpret_cast<char*>(d->ioSequencer), sizeof(d->ioSequencer));
+    stream >> d->paletteIndex >> d->paletteSource >> d->columns >> d->rows;
+    stream >> d->dac_data_read_index >> d->dac_data_read_subindex >> d->dac_data_write_index >> d->dac_data_write_subindex;
+    stream >> d->next3C0IsIndex;
+    stream.readRawData(reinterpret_cast<char*>(d->paletteRegister), sizeof(d->paletteRegister));
+    for (auto& color : d->colorRegister)
+        stream >> color.red >> color.green >> color.blue;
+    stream >> d->statusRegister >> d->miscellaneousOutputRegister;
+
+    synchronizeColors();
+    setPaletteDirty(true);
+    emit paletteChanged();
+    machine().notifyScreen();
+}
+
 void VGA::out8(WORD port, BYTE data)
 {
     machine().notifyScreen();
@@ -524,7 +564,8 @@ void VGA::writeMemory8(DWORD address, BYTE value)
             break;
         default:
             vlog(LogVGA, "Gaah, unsupported raster op %d in mode 2 :(\n", DRAWOP);
-            hard_exit(1);
+            machine().shutDownAfterError();
+            return;
         }
     } else if (WRITE_MODE == 0) {
 
@@ -610,7 +651,8 @@ void VGA::writeMemory8(DWORD address, BYTE value)
             break;
         default:
             vlog(LogVGA, "Unsupported raster operation %d", DRAWOP);
-            hard_exit(0);
+            machine().shutDownAfterError();
+            return;
         }
     } else if(WRITE_MODE == 1) {
         new_val[0] = d->latch[0];
@@ -619,9 +661,7 @@ void VGA::writeMemory8(DWORD address, BYTE value)
         new_val[3] = d->latch[3];
     } else {
         vlog(LogVGA, "Unsupported 6845 write mode %d", WRITE_MODE);
-        hard_exit(1);
-
-        /* This is just here to make GCC stop worrying about accessing new_val[] uninitialized. */
+        machine().shutDownAfterError();
         return;
     }
 
@@ -648,7 +688,7 @@ BYTE VGA::readMemory8(DWORD address)
 
     if (READ_MODE != 0) {
         vlog(LogVGA, "ZOMG! READ_MODE = %u", READ_MODE);
-        hard_exit(1);
+        machine().shutDownAfterError();
     }
 
     d->latch[0] = d->plane[0][address];
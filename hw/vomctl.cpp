@@ -26,12 +26,16 @@
 #include "CPU.h"
 #include "Common.h"
 #include "debug.h"
+#include "dma.h"
 #include "machine.h"
+#include <QtCore/QDataStream>
 #include <stdio.h>
 
 struct VomCtl::Private
 {
     QString consoleWriteBuffer;
+    QString consoleOutputPath { QLatin1String("out.txt") };
+    FILE* consoleOutput { nullptr };
 };
 
 VomCtl::VomCtl(Machine& machine)
@@ -57,6 +61,17 @@ VomCtl::VomCtl(Machine& machine)
 
 VomCtl::~VomCtl()
 {
+    if (d->consoleOutput)
+        fclose(d->consoleOutput);
+}
+
+void VomCtl::setConsoleOutputPath(const QString& path)
+{
+    if (d->consoleOutput) {
+        fclose(d->consoleOutput);
+        d->consoleOutput = nullptr;
+    }
+    d->consoleOutputPath = path;
 }
 
 void VomCtl::reset()
@@ -65,6 +80,16 @@ void VomCtl::reset()
     d->consoleWriteBuffer = QString();
 }
 
+void VomCtl::saveState(QDataStream& stream) const
+{
+    stream << m_registerIndex << d->consoleWriteBuffer;
+}
+
+void VomCtl::restoreState(QDataStream& stream)
+{
+    stream >> m_registerIndex >> d->consoleWriteBuffer;
+}
+
 BYTE VomCtl::in8(WORD port)
 {
     switch (port) {
@@ -99,6 +124,8 @@ void VomCtl::out8(WORD port, BYTE data)
     case 0xD6: // VOMCTL_REGISTER
         //vlog(LogVomCtl, "Select register %02X", data);
         m_registerIndex = data;
+        // It's also the second DMA controller's mode register, which can only be written.
+        machine().dma().out8(port, data);
         break;
     case 0xD7: // VOMCTL_CONSOLE_WRITE
         d->consoleWriteBuffer += QChar::fromLatin1(data);
@@ -113,10 +140,11 @@ void VomCtl::out8(WORD port, BYTE data)
         vm_call8(machine().cpu(), port, data);
         break;
     case 0x666:
-        {
-            static FILE* fp = fopen("out.txt", "w");
-            fputc(data, fp);
-            fflush(fp);
+        if (!d->consoleOutput)
+            d->consoleOutput = fopen(qPrintable(d->consoleOutputPath), "w");
+        if (d->consoleOutput) {
+            fputc(data, d->consoleOutput);
+            fflush(d->consoleOutput);
         }
         break;
     default:
@@ -33,9 +33,14 @@ public:
     virtual ~VomCtl();
 
     virtual void reset() override;
+    virtual void saveState(QDataStream&) const override;
+    virtual void restoreState(QDataStream&) override;
     virtual void out8(WORD port, BYTE data) override;
     virtual BYTE in8(WORD port) override;
 
+    // Where bytes written to port 0x666 end up. The file is created on first write.
+    void setConsoleOutputPath(const QString&);
+
 private:
     BYTE m_registerIndex;
 
@@ -31,6 +31,7 @@
 
 #include "types.h"
 #include <QString>
+#include <QStringList>
 
 #define CRASH() __builtin_trap()
 #define ALWAYS_INLINE __attribute__ ((always_inline)) inline
@@ -60,8 +61,25 @@ struct RuntimeOptions {
     bool crashOnGPF { false };
     bool crashOnException { false };
     bool stacklog { false };
-    QString autotestPath;
+    bool blockCache { false };
+    bool benchmark { false };
+    bool unwindFaults { false };
+    bool disableIdleDetection { false };
+    bool batch { false };
+    bool pinBatchThreads { false };
+    unsigned batchThreads { 0 };
+    unsigned batchTimeoutSeconds { 0 };
+    unsigned forkCount { 0 };
+    unsigned memorySize { 0 };
+    QStringList autotestPaths;
     QString configPath;
+    QString memoryFile;
+    QString restorePath;
+    QString autotestDiskPath;
+    QString autotestDiskOverlayPath;
+    QString autotestFloppyPath;
+    QString commitOverlayPath;
+    QString discardOverlayPath;
 #ifdef DISASSEMBLE_EVERYTHING
     bool disassembleEverything { false };
 #endif
@@ -60,6 +60,9 @@ enum VLogChannel {
     LogDump,
     LogScreen,
     LogTimer,
+    LogSnapshot,
+    LogPCI,
+    LogDMA,
 };
 
 void vlog(VLogChannel channel, const char *format, ...);
@@ -60,6 +60,12 @@ private:
     void handleDumpFlatMemory(const QStringList&);
     void handleTracing(const QStringList&);
     void handleIRQ(const QStringList&);
+    void handleTLB(const QStringList&);
+    void handleInstructionCache(const QStringList&);
+    void handleBlockCache(const QStringList&);
+    void handleIdleLoops(const QStringList&);
+    void handleSnapshot(const QStringList&);
+    void handleDisk(const QStringList&);
     void handleDumpUnassembled(const QStringList&);
     void handleSelector(const QStringList&);
     void handleStack(const QStringList&);
@@ -31,16 +31,21 @@
 #include "Common.h"
 #include "ROM.h"
 #include <QHash>
+#include <QMutex>
 #include <QSet>
+#include <QVector>
+#include <vector>
 
 class IODevice;
 class BusMouse;
 class CMOS;
 class DiskDrive;
+class DMA;
 class FDC;
 class IDE;
 class Keyboard;
 class PIC;
+class PCI;
 class PIT;
 class PS2;
 class Settings;
@@ -49,6 +54,8 @@ class VGA;
 class VomCtl;
 class Worker;
 class MachineWidget;
+class QDataStream;
+class QFile;
 
 class IODevicePass {
     friend IODevice;
@@ -61,6 +68,7 @@ class Machine : public QObject
 public:
     static OwnPtr<Machine> createFromFile(const QString& fileName);
     static OwnPtr<Machine> createForAutotest(const QString& fileName);
+    static OwnPtr<Machine> createFromSnapshot(const QString& fileName);
 
     explicit Machine(const QString& name, OwnPtr<Settings>&&, QObject* parent = nullptr);
     virtual ~Machine();
@@ -75,12 +83,14 @@ public:
     PIC& masterPIC() { return *m_masterPIC; }
     PIC& slavePIC() { return *m_slavePIC; }
     CMOS& cmos() { return *m_cmos; }
+    DMA& dma() { return *m_dma; }
     Settings& settings() { return *m_settings; }
 
     DiskDrive& floppy0();
     DiskDrive& floppy1();
     DiskDrive& fixed0();
     DiskDrive& fixed1();
+    QVector<DiskDrive*> diskDrives();
 
     bool isForAutotest() PURE;
 
@@ -92,6 +102,26 @@ public:
 
     void forEachIODevice(std::function<void(IODevice&)>);
 
+    // May be called from any thread. Has the CPU thread call the device's completeAsyncWork()
+    // between two instructions.
+    void scheduleDeviceCompletion(IODevice&);
+    // Called by the CPU when it sees PendingWork::DeviceCompletion.
+    void runDeviceCompletions();
+    // Waits for every device's work on other threads and delivers the results. CPU thread only.
+    void finishAsyncWork();
+
+    // Must be called on the CPU thread, between two instructions (e.g. from the debugger.)
+    bool saveSnapshot(const QString& fileName);
+
+    // Clones this machine into independent children that resume from its current state.
+    // Same calling rules as saveSnapshot(). Guest RAM is shared copy-on-write and every child
+    // writes to its own in-memory disk overlay, so a child costs only what it dirties.
+    // Children of autotest machines are returned idle, to be run with CPU::mainLoop() on a
+    // thread of the caller's choosing. Other children start their own Worker, like any machine.
+    // Children read unmodified sectors from the image files, so the parent shouldn't write to
+    // its disks while they run unless it uses overlays too.
+    std::vector<OwnPtr<Machine>> fork(unsigned count);
+
     IODevice* inputDeviceForPort(WORD port);
     IODevice* outputDeviceForPort(WORD port);
 
@@ -100,6 +130,15 @@ public:
     void registerDevice(IODevicePass, IODevice&);
     void unregisterDevice(IODevicePass, IODevice&);
 
+    // Stops this machine, and only this one, when the guest does something we can't emulate.
+    // CPU thread only. The current instruction finishes first.
+    void shutDownAfterError();
+    bool didShutDownAfterError() const { return m_didShutDownAfterError; }
+
+    // Ports that are expected to be poked without a device behind them.
+    void ignorePort(WORD port) { m_ignoredPorts.insert(port); }
+    bool shouldIgnorePort(WORD port) const { return m_ignoredPorts.contains(port); }
+
 public slots:
     void start();
     void stop();
@@ -115,6 +154,12 @@ private:
 
     void applySettings();
 
+    bool restoreSnapshot(const QString& fileName);
+    bool restoreForkedState(const QByteArray& state, QFile& memory);
+    void saveState(QDataStream&);
+    bool restoreState(QDataStream&, const QString& sourceName);
+    QVector<IODevice*> snapshotDevices();
+
     Worker& worker() { return *m_worker; }
 
     IODevice* inputDeviceForPortSlowCase(WORD port);
@@ -130,8 +175,10 @@ private:
     OwnPtr<PIT> m_pit;
     OwnPtr<BusMouse> m_busMouse;
     OwnPtr<CMOS> m_cmos;
+    OwnPtr<DMA> m_dma;
     OwnPtr<FDC> m_fdc;
     OwnPtr<IDE> m_ide;
+    OwnPtr<PCI> m_pci;
     OwnPtr<Keyboard> m_keyboard;
     OwnPtr<PIC> m_masterPIC;
     OwnPtr<PIC> m_slavePIC;
@@ -147,12 +194,19 @@ private:
 
     QSet<IODevice*> m_allDevices;
 
+    QMutex m_deviceCompletionMutex;
+    QVector<IODevice*> m_devicesWithCompletions;
+
     IODevice* m_fastInputDevices[1024];
     IODevice* m_fastOutputDevices[1024];
 
     QHash<WORD, IODevice*> m_allInputDevices;
     QHash<WORD, IODevice*> m_allOutputDevices;
 
+    QSet<WORD> m_ignoredPorts;
+
+    bool m_didShutDownAfterError { false };
+
     QVector<ROM*> m_roms;
 };
 
@@ -30,6 +30,8 @@
 #include "OwnPtr.h"
 #include "DiskDrive.h"
 
+class QByteArray;
+class QFile;
 class QStringList;
 
 class Settings
@@ -41,6 +43,9 @@ public:
     unsigned memorySize() const { return m_memorySize; }
     void setMemorySize(unsigned size) { m_memorySize = size; }
 
+    // Parses a RAM size in kilobytes, refusing anything that wouldn't fit below 4 GiB.
+    static bool parseMemorySize(const QString& kilobytes, unsigned& bytes);
+
     WORD entryCS() const { return m_entryCS; }
     WORD entryIP() const { return m_entryIP; }
     WORD entryDS() const { return m_entryDS; }
@@ -51,9 +56,26 @@ public:
     QHash<DWORD, QString> romImages() const { return m_romImages; }
     QString keymap() const { return m_keymap; }
 
+    // Size of each disk drive's sector cache.
+    unsigned diskCacheSize() const { return m_diskCacheSize; }
+
     bool isForAutotest() const { return m_forAutotest; }
     void setForAutotest(bool b) { m_forAutotest = b; }
 
+    // If set, the machine resumes from this snapshot instead of booting.
+    QString snapshotPath() const { return m_snapshotPath; }
+    void setSnapshotPath(const QString& path) { m_snapshotPath = path; }
+
+    // If set, the machine resumes from the state of the machine it was forked from instead.
+    // Both belong to Machine::fork() and are only used while the machine is being built.
+    const QByteArray* forkedState() const { return m_forkedState; }
+    QFile* forkedMemory() const { return m_forkedMemory; }
+    void setForkedState(const QByteArray* state, QFile* memory) { m_forkedState = state; m_forkedMemory = memory; }
+
+    // If set, disk writes are kept in memory and never reach the image files.
+    bool usesDiskOverlays() const { return m_usesDiskOverlays; }
+    void setUsesDiskOverlays(bool b) { m_usesDiskOverlays = b; }
+
     Settings() { }
     ~Settings() { }
 
@@ -72,6 +94,9 @@ private:
     bool handleFixedDisk(const QStringList&);
     bool handleFloppyDisk(const QStringList&);
     bool handleKeymap(const QStringList&);
+    bool handleDiskCache(const QStringList&);
+
+    static void configureFixedDisk(DiskDrive::Configuration&, const QString& fileName, unsigned sizeInKiB);
 
     DiskDrive::Configuration m_floppy0;
     DiskDrive::Configuration m_floppy1;
@@ -81,11 +106,16 @@ private:
     QHash<DWORD, QString> m_files;
     QHash<DWORD, QString> m_romImages;
     QString m_keymap;
+    QString m_snapshotPath;
+    const QByteArray* m_forkedState { nullptr };
+    QFile* m_forkedMemory { nullptr };
     unsigned m_memorySize { 0 };
+    unsigned m_diskCacheSize { 1024 };
     WORD m_entryCS { 0 };
     WORD m_entryIP { 0 };
     WORD m_entryDS { 0 };
     WORD m_entrySS { 0 };
     WORD m_entrySP { 0 };
     bool m_forAutotest { false };
+    bool m_usesDiskOverlays { false };
 };
@@ -27,8 +27,10 @@
 #include "CPU.h"
 #include "DiskDrive.h"
 #include "iodevice.h"
+#include "dma.h"
 #include "fdc.h"
 #include "ide.h"
+#include "pci.h"
 #include "PS2.h"
 #include "busmouse.h"
 #include "keyboard.h"
@@ -79,51 +81,64 @@ Machine::Machine(const QString& name, OwnPtr<Settings>&& settings, QObject* pare
     if (!m_settings->isForAutotest()) {
         // FIXME: Move this somewhere else.
         // Mitigate spam about uninteresting ports.
-        IODevice::ignorePort(0x220);
-        IODevice::ignorePort(0x221);
-        IODevice::ignorePort(0x222);
-        IODevice::ignorePort(0x223);
-        IODevice::ignorePort(0x201); // Gameport.
-        IODevice::ignorePort(0x80); // Linux outb_p() uses this for small delays.
-        IODevice::ignorePort(0x330); // MIDI
-        IODevice::ignorePort(0x331); // MIDI
-        IODevice::ignorePort(0x334); // SCSI (BusLogic)
-
-        IODevice::ignorePort(0x237);
-        IODevice::ignorePort(0x337);
-
-        IODevice::ignorePort(0x322);
-
-        IODevice::ignorePort(0x0C8F);
-        IODevice::ignorePort(0x1C8F);
-        IODevice::ignorePort(0x2C8F);
-        IODevice::ignorePort(0x3C8F);
-        IODevice::ignorePort(0x4C8F);
-        IODevice::ignorePort(0x5C8F);
-        IODevice::ignorePort(0x6C8F);
-        IODevice::ignorePort(0x7C8F);
-        IODevice::ignorePort(0x8C8F);
-        IODevice::ignorePort(0x9C8F);
-        IODevice::ignorePort(0xAC8F);
-        IODevice::ignorePort(0xBC8F);
-        IODevice::ignorePort(0xCC8F);
-        IODevice::ignorePort(0xDC8F);
-        IODevice::ignorePort(0xEC8F);
-        IODevice::ignorePort(0xFC8F);
+        ignorePort(0x220);
+        ignorePort(0x221);
+        ignorePort(0x222);
+        ignorePort(0x223);
+        ignorePort(0x201); // Gameport.
+        ignorePort(0x80); // Linux outb_p() uses this for small delays.
+        ignorePort(0x330); // MIDI
+        ignorePort(0x331); // MIDI
+        ignorePort(0x334); // SCSI (BusLogic)
+
+        ignorePort(0x237);
+        ignorePort(0x337);
+
+        ignorePort(0x322);
+
+        ignorePort(0x0C8F);
+        ignorePort(0x1C8F);
+        ignorePort(0x2C8F);
+        ignorePort(0x3C8F);
+        ignorePort(0x4C8F);
+        ignorePort(0x5C8F);
+        ignorePort(0x6C8F);
+        ignorePort(0x7C8F);
+        ignorePort(0x8C8F);
+        ignorePort(0x9C8F);
+        ignorePort(0xAC8F);
+        ignorePort(0xBC8F);
+        ignorePort(0xCC8F);
+        ignorePort(0xDC8F);
+        ignorePort(0xEC8F);
+        ignorePort(0xFC8F);
     }
 
     m_masterPIC = make<PIC>(true, *this);
     m_slavePIC = make<PIC>(false, *this);
     m_busMouse = make<BusMouse>(*this);
     m_cmos = make<CMOS>(*this);
+    m_dma = make<DMA>(*this);
     m_fdc = make<FDC>(*this);
     m_ide = make<IDE>(*this);
+    m_pci = make<PCI>(*this);
     m_keyboard = make<Keyboard>(*this);
     m_ps2 = make<PS2>(*this);
     m_vomCtl = make<VomCtl>(*this);
     m_pit = make<PIT>(*this);
     m_vga = make<VGA>(*this);
 
+    if (m_settings->forkedState()) {
+        if (!restoreForkedState(*m_settings->forkedState(), *m_settings->forkedMemory())) {
+            vlog(LogSnapshot, "Couldn't resume from the forked machine's state");
+            hard_exit(1);
+        }
+        m_settings->setForkedState(nullptr, nullptr);
+    } else if (!m_settings->snapshotPath().isEmpty() && !restoreSnapshot(m_settings->snapshotPath())) {
+        vlog(LogSnapshot, "Couldn't resume from %s", qPrintable(m_settings->snapshotPath()));
+        hard_exit(1);
+    }
+
     if (!m_settings->isForAutotest()) {
         m_worker = make<Worker>(cpu());
 
@@ -139,6 +154,10 @@ Machine::Machine(const QString& name, OwnPtr<Settings>&& settings, QObject* pare
 
 Machine::~Machine()
 {
+    // The disk drives go away before the devices that may still be using them on other threads.
+    forEachIODevice([] (IODevice& device) {
+        device.waitForAsyncWork();
+    });
     qDeleteAll(m_roms);
 }
 
@@ -172,6 +191,11 @@ void Machine::applySettings()
     m_floppy1->setConfiguration(settings().floppy1());
     m_fixed0->setConfiguration(settings().fixed0());
     m_fixed1->setConfiguration(settings().fixed1());
+
+    for (auto* drive : diskDrives()) {
+        drive->setUsesOverlay(settings().usesDiskOverlays());
+        drive->setCacheSize(settings().diskCacheSize());
+    }
 }
 
 bool Machine::loadFile(DWORD address, const QString& fileName)
@@ -191,6 +215,7 @@ bool Machine::loadFile(DWORD address, const QString& fileName)
 
     // FIXME: Don't overrun the CPU's memory buffer.
     memcpy(memoryPointer, fileContents.constData(), fileContents.size());
+    cpu().didModifyMemory(LinearAddress(address), fileContents.size());
     return true;
 }
 
@@ -235,6 +260,12 @@ void Machine::onWorkerFinished()
     // FIXME: Implement.
 }
 
+void Machine::shutDownAfterError()
+{
+    m_didShutDownAfterError = true;
+    cpu().queueCommand(CPU::Shutdown);
+}
+
 bool Machine::isForAutotest()
 {
     return settings().isForAutotest();
@@ -253,6 +284,37 @@ void Machine::forEachIODevice(std::function<void (IODevice &)> function)
     }
 }
 
+void Machine::scheduleDeviceCompletion(IODevice& device)
+{
+    {
+        QMutexLocker locker(&m_deviceCompletionMutex);
+        if (!m_devicesWithCompletions.contains(&device))
+            m_devicesWithCompletions.append(&device);
+    }
+    cpu().setPendingWork(CPU::PendingWork::DeviceCompletion);
+    cpu().wakeFromHalt();
+}
+
+void Machine::runDeviceCompletions()
+{
+    QVector<IODevice*> devices;
+    {
+        QMutexLocker locker(&m_deviceCompletionMutex);
+        devices.swap(m_devicesWithCompletions);
+    }
+    for (auto* device : devices)
+        device->completeAsyncWork();
+}
+
+void Machine::finishAsyncWork()
+{
+    forEachIODevice([] (IODevice& device) {
+        device.waitForAsyncWork();
+    });
+    cpu().clearPendingWork(CPU::PendingWork::DeviceCompletion);
+    runDeviceCompletions();
+}
+
 void Machine::resetAllIODevices()
 {
     forEachIODevice([] (IODevice& device) {
@@ -294,6 +356,11 @@ void Machine::unregisterDevice(IODevicePass, IODevice& device)
     m_allDevices.remove(&device);
 }
 
+QVector<DiskDrive*> Machine::diskDrives()
+{
+    return { m_floppy0.ptr(), m_floppy1.ptr(), m_fixed0.ptr(), m_fixed1.ptr() };
+}
+
 DiskDrive& Machine::floppy0()
 {
     return *m_floppy0;
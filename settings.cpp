@@ -104,6 +104,20 @@ bool Settings::handleROMImage(const QStringList& arguments)
     return true;
 }
 
+bool Settings::parseMemorySize(const QString& kilobytes, unsigned& bytes)
+{
+    // The top page of the 32-bit physical address space is as far as guest RAM can go.
+    static const unsigned maximumKilobytes = 0xFFFFF000 / 1024;
+
+    bool ok;
+    unsigned size = kilobytes.toUInt(&ok);
+    if (!ok || size > maximumKilobytes)
+        return false;
+
+    bytes = size * 1024;
+    return true;
+}
+
 bool Settings::handleMemorySize(const QStringList& arguments)
 {
     // memory-size <size>
@@ -111,12 +125,11 @@ bool Settings::handleMemorySize(const QStringList& arguments)
     if (arguments.count() != 1)
         return false;
 
-    bool ok;
-    unsigned size = arguments.at(0).toUInt(&ok);
-    if (!ok)
+    unsigned size;
+    if (!parseMemorySize(arguments.at(0), size))
         return false;
 
-    setMemorySize(size * 1024);
+    setMemorySize(size);
     return true;
 }
 
@@ -136,11 +149,47 @@ bool Settings::handleKeymap(const QStringList& arguments)
     return true;
 }
 
+// Options that can follow a fixed-disk or floppy-disk line:
+//     mmap                 map the image privately, so the guest's writes are thrown away
+//     mmap-shared          map the image and keep the guest's writes
+//     overlay=<path>       keep the guest's writes in a DiskOverlay file, created if needed
+static bool parseDiskOptions(const QStringList& options, DiskDrive::Configuration& config)
+{
+    for (auto& option : options) {
+        if (option == QLatin1String("mmap"))
+            config.mapping = DiskDrive::ImageMapping::Private;
+        else if (option == QLatin1String("mmap-shared"))
+            config.mapping = DiskDrive::ImageMapping::Shared;
+        else if (option.startsWith(QLatin1String("overlay=")) && option.length() > 8)
+            config.overlayPath = option.mid(8);
+        else
+            return false;
+    }
+    return true;
+}
+
+bool Settings::handleDiskCache(const QStringList& arguments)
+{
+    // disk-cache <size>
+
+    if (arguments.count() != 1)
+        return false;
+
+    bool ok;
+    unsigned size = arguments.at(0).toUInt(&ok);
+    if (!ok)
+        return false;
+
+    vlog(LogConfig, "Disk cache: %u KiB per drive", size);
+    m_diskCacheSize = size;
+    return true;
+}
+
 bool Settings::handleFixedDisk(const QStringList& arguments)
 {
-    // fixed-disk <index> <path/to/file> <size>
+    // fixed-disk <index> <path/to/file> <size> [options...]
 
-    if (arguments.count() != 3)
+    if (arguments.count() < 3)
         return false;
 
     bool ok;
@@ -159,20 +208,24 @@ bool Settings::handleFixedDisk(const QStringList& arguments)
     vlog(LogConfig, "Fixed disk %u: %s (%ld KiB)", index, qPrintable(fileName), size);
 
     DiskDrive::Configuration& config = index == 0 ? m_fixed0 : m_fixed1;
+    configureFixedDisk(config, fileName, size);
+    return parseDiskOptions(arguments.mid(3), config);
+}
+
+void Settings::configureFixedDisk(DiskDrive::Configuration& config, const QString& fileName, unsigned sizeInKiB)
+{
     config.imagePath = fileName;
     config.sectorsPerTrack = 63;
     config.heads = 16;
     config.bytesPerSector = 512;
-    config.sectors = (size * 1024) / config.bytesPerSector;
-
-    return true;
+    config.sectors = (sizeInKiB * 1024) / config.bytesPerSector;
 }
 
 bool Settings::handleFloppyDisk(const QStringList& arguments)
 {
-    // floppy-disk <index> <type> <path/to/file>
+    // floppy-disk <index> <type> <path/to/file> [options...]
 
-    if (arguments.count() != 3)
+    if (arguments.count() < 3)
         return false;
 
     bool ok;
@@ -203,6 +256,8 @@ bool Settings::handleFloppyDisk(const QStringList& arguments)
     config.sectors = ft->sectors;
     config.floppyTypeForCMOS = ft->mediaType;
     config.bytesPerSector = ft->bytesPerSector;
+    if (!parseDiskOptions(arguments.mid(3), config))
+        return false;
 
     vlog(LogConfig, "Floppy %u: %s (%uspt, %uh, %us (%ub))", index, qPrintable(fileName), config.sectorsPerTrack, config.heads, config.sectors, config.bytesPerSector);
     return true;
@@ -215,6 +270,7 @@ OwnPtr<Settings> Settings::createForAutotest(const QString& fileName)
     static const WORD autotestEntryDS = 0x1000;
     static const WORD autotestEntrySS = 0x9000;
     static const WORD autotestEntrySP = 0x1000;
+    static const unsigned autotestMemorySize = 8192 * 1024;
 
     auto settings = make<Settings>();
 
@@ -223,8 +279,18 @@ OwnPtr<Settings> Settings::createForAutotest(const QString& fileName)
     settings->m_entryDS = autotestEntryDS;
     settings->m_entrySS = autotestEntrySS;
     settings->m_entrySP = autotestEntrySP;
+    settings->m_memorySize = options.memorySize ? options.memorySize : autotestMemorySize;
     settings->m_files.insert(realModeAddressToPhysicalAddress(autotestEntryCS, autotestEntryIP).get(), fileName);
 
+    if (!options.autotestDiskPath.isEmpty()) {
+        QFile disk(options.autotestDiskPath);
+        configureFixedDisk(settings->m_fixed0, options.autotestDiskPath, disk.size() / 1024);
+        settings->m_fixed0.overlayPath = options.autotestDiskOverlayPath;
+    }
+
+    if (!options.autotestFloppyPath.isEmpty())
+        settings->handleFloppyDisk(QStringList() << QLatin1String("0") << QLatin1String("1.44M") << options.autotestFloppyPath);
+
     settings->m_forAutotest = true;
     return settings;
 }
@@ -276,6 +342,8 @@ OwnPtr<Settings> Settings::createFromFile(const QString& fileName)
             success = settings->handleFloppyDisk(arguments);
         else if (command == QLatin1String("keymap"))
             success = settings->handleKeymap(arguments);
+        else if (command == QLatin1String("disk-cache"))
+            success = settings->handleDiskCache(arguments);
 
         if (!success) {
             vlog(LogConfig, "Failed parsing %s:%u %s", qPrintable(fileName), lineNumber, qPrintable(line));
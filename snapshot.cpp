@@ -0,0 +1,462 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "machine.h"
+#include "settings.h"
+#include "CPU.h"
+#include "Common.h"
+#include "DiskDrive.h"
+#include "debug.h"
+#include "dma.h"
+#include "fdc.h"
+#include "ide.h"
+#include "pci.h"
+#include "PS2.h"
+#include "busmouse.h"
+#include "keyboard.h"
+#include "pic.h"
+#include "pit.h"
+#include "vga.h"
+#include "cmos.h"
+#include "vomctl.h"
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryFile>
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+// Snapshot file layout:
+//
+//     header        magic, version, machine name, whether it's an autotest machine, RAM size and RAM offset
+//     CPU state     registers and cached segment descriptors
+//     device state  one (name, blob) pair per I/O device, in snapshotDevices() order
+//     disk overlays one (name, overlay) pair per disk drive, in diskDrives() order
+//     guest RAM     starts at the next page boundary, so it can be mapped straight from the file
+//
+// Everything but the RAM goes through QDataStream. All-zero RAM pages are left as holes in the file.
+
+static const quint32 snapshotMagic = 0x43544d53; // "CTMS"
+static const quint32 snapshotVersion = 6;
+static const QWORD snapshotPageSize = 4096;
+
+static void prepareStream(QDataStream& stream)
+{
+    stream.setVersion(QDataStream::Qt_5_0);
+}
+
+QVector<IODevice*> Machine::snapshotDevices()
+{
+    return {
+        m_masterPIC.ptr(),
+        m_slavePIC.ptr(),
+        m_pit.ptr(),
+        m_cmos.ptr(),
+        m_dma.ptr(),
+        m_fdc.ptr(),
+        m_ide.ptr(),
+        m_pci.ptr(),
+        m_keyboard.ptr(),
+        m_ps2.ptr(),
+        m_vga.ptr(),
+        m_busMouse.ptr(),
+        m_vomCtl.ptr(),
+    };
+}
+
+bool Machine::saveSnapshot(const QString& fileName)
+{
+    // Transfers still running on I/O threads would be missing from the device state.
+    finishAsyncWork();
+
+    // The snapshot refers to the disk images, so they have to be up to date.
+    for (auto* drive : diskDrives())
+        drive->flush();
+
+    // Never write over the target in place: it may be the very snapshot our RAM is mapped from.
+    // Build the new one next to it and rename it into place once it's complete.
+    QTemporaryFile file(fileName + QLatin1String(".XXXXXX"));
+    if (!file.open()) {
+        vlog(LogSnapshot, "Couldn't create a temporary file for %s", qPrintable(fileName));
+        return false;
+    }
+
+    QDataStream stream(&file);
+    prepareStream(stream);
+
+    stream << snapshotMagic << snapshotVersion << m_name << isForAutotest();
+    stream << (quint64)cpu().memorySize();
+    qint64 memoryOffsetPosition = file.pos();
+    stream << (quint64)0;
+
+    saveState(stream);
+
+    QWORD memoryOffset = (file.pos() + snapshotPageSize - 1) & ~(snapshotPageSize - 1);
+    file.seek(memoryOffsetPosition);
+    stream << (quint64)memoryOffset;
+
+    if (stream.status() != QDataStream::Ok || !cpu().saveMemory(file, memoryOffset) || !file.flush() || fsync(file.handle()) < 0) {
+        vlog(LogSnapshot, "Couldn't write %s", qPrintable(fileName));
+        return false;
+    }
+
+    if (rename(qPrintable(file.fileName()), qPrintable(fileName)) < 0) {
+        vlog(LogSnapshot, "Couldn't rename %s to %s", qPrintable(file.fileName()), qPrintable(fileName));
+        return false;
+    }
+    file.setAutoRemove(false);
+
+    vlog(LogSnapshot, "Saved %s", qPrintable(fileName));
+    return true;
+}
+
+// The CPU state, device state and disk overlays, everything but guest RAM.
+void Machine::saveState(QDataStream& stream)
+{
+    cpu().saveState(stream);
+
+    for (auto* device : snapshotDevices()) {
+        QByteArray state;
+        QDataStream deviceStream(&state, QIODevice::WriteOnly);
+        prepareStream(deviceStream);
+        device->saveState(deviceStream);
+        stream << QByteArray(device->name()) << state;
+    }
+
+    for (auto* drive : diskDrives()) {
+        stream << drive->name();
+        drive->saveOverlay(stream);
+    }
+}
+
+bool Machine::restoreState(QDataStream& stream, const QString& sourceName)
+{
+    cpu().restoreState(stream);
+
+    for (auto* device : snapshotDevices()) {
+        QByteArray name;
+        QByteArray state;
+        stream >> name >> state;
+        if (name != device->name()) {
+            vlog(LogSnapshot, "%s has state for %s where %s was expected", qPrintable(sourceName), name.constData(), device->name());
+            return false;
+        }
+        QDataStream deviceStream(state);
+        prepareStream(deviceStream);
+        device->restoreState(deviceStream);
+    }
+
+    for (auto* drive : diskDrives()) {
+        QString name;
+        stream >> name;
+        if (name != drive->name()) {
+            vlog(LogSnapshot, "%s has an overlay for %s where %s was expected", qPrintable(sourceName), qPrintable(name), qPrintable(drive->name()));
+            return false;
+        }
+        drive->restoreOverlay(stream);
+    }
+
+    if (stream.status() != QDataStream::Ok) {
+        vlog(LogSnapshot, "%s is truncated", qPrintable(sourceName));
+        return false;
+    }
+    return true;
+}
+
+static OwnPtr<Settings> createSettings(const QString& machineName, bool isForAutotest)
+{
+    return isForAutotest ? Settings::createForAutotest(machineName) : Settings::createFromFile(machineName);
+}
+
+struct SnapshotHeader {
+    QString machineName;
+    bool isForAutotest { false };
+    quint64 memorySize { 0 };
+    quint64 memoryOffset { 0 };
+};
+
+static bool readSnapshotHeader(QDataStream& stream, const QString& fileName, SnapshotHeader& header)
+{
+    quint32 magic;
+    quint32 version;
+    stream >> magic >> version;
+    if (stream.status() != QDataStream::Ok || magic != snapshotMagic) {
+        vlog(LogSnapshot, "%s is not a snapshot", qPrintable(fileName));
+        return false;
+    }
+    if (version != snapshotVersion) {
+        vlog(LogSnapshot, "%s has version %u, expected %u", qPrintable(fileName), version, snapshotVersion);
+        return false;
+    }
+    stream >> header.machineName >> header.isForAutotest >> header.memorySize >> header.memoryOffset;
+    return stream.status() == QDataStream::Ok;
+}
+
+OwnPtr<Machine> Machine::createFromSnapshot(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        vlog(LogSnapshot, "Couldn't open %s", qPrintable(fileName));
+        return nullptr;
+    }
+
+    QDataStream stream(&file);
+    prepareStream(stream);
+    SnapshotHeader header;
+    if (!readSnapshotHeader(stream, fileName, header))
+        return nullptr;
+
+    // The snapshot doesn't include ROMs or disk images, so the machine is first built from its original settings.
+    auto settings = createSettings(header.machineName, header.isForAutotest);
+    if (!settings)
+        return nullptr;
+    settings->setSnapshotPath(fileName);
+    return make<Machine>(header.machineName, std::move(settings));
+}
+
+std::vector<OwnPtr<Machine>> Machine::fork(unsigned count)
+{
+    // Transfers still running on I/O threads would be missing from the device state.
+    finishAsyncWork();
+
+    // Children read the sectors they haven't written from the image files.
+    for (auto* drive : diskDrives())
+        drive->flush();
+
+    // The children copy the rest of the state from memory, but guest RAM goes into a file
+    // that each of them maps privately, so pages are shared until written. The file can
+    // go away once they're all built.
+    QByteArray state;
+    QDataStream stream(&state, QIODevice::WriteOnly);
+    prepareStream(stream);
+    stream << (quint64)cpu().memorySize();
+    saveState(stream);
+
+    QTemporaryFile memory(QDir::tempPath() + QLatin1String("/computron-fork-XXXXXX"));
+    if (!memory.open() || !cpu().saveMemory(memory, 0) || !memory.flush()) {
+        vlog(LogSnapshot, "Couldn't write guest RAM for the children to %s", qPrintable(memory.fileName()));
+        return { };
+    }
+
+    // Building a CPU makes it current on this thread, which is the parent's.
+    CPU* currentCPU = g_cpu;
+
+    std::vector<OwnPtr<Machine>> children;
+    for (unsigned i = 0; i < count; ++i) {
+        auto settings = createSettings(m_name, isForAutotest());
+        if (!settings)
+            break;
+        settings->setForkedState(&state, &memory);
+        settings->setUsesDiskOverlays(true);
+        children.push_back(make<Machine>(m_name, std::move(settings)));
+    }
+
+    g_cpu = currentCPU;
+
+    vlog(LogSnapshot, "Forked %zu children", children.size());
+    return children;
+}
+
+bool Machine::restoreSnapshot(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        vlog(LogSnapshot, "Couldn't open %s", qPrintable(fileName));
+        return false;
+    }
+
+    QDataStream stream(&file);
+    prepareStream(stream);
+    SnapshotHeader header;
+    if (!readSnapshotHeader(stream, fileName, header))
+        return false;
+
+    if (!restoreState(stream, fileName))
+        return false;
+
+    if (!cpu().loadMemory(file, header.memoryOffset, header.memorySize)) {
+        vlog(LogSnapshot, "Couldn't load guest RAM from %s", qPrintable(fileName));
+        return false;
+    }
+
+    vlog(LogSnapshot, "Restored %s", qPrintable(fileName));
+    return true;
+}
+
+bool Machine::restoreForkedState(const QByteArray& state, QFile& memory)
+{
+    QDataStream stream(state);
+    prepareStream(stream);
+    quint64 memorySize;
+    stream >> memorySize;
+    if (!restoreState(stream, memory.fileName()))
+        return false;
+
+    if (!cpu().loadMemory(memory, 0, memorySize)) {
+        vlog(LogSnapshot, "Couldn't load guest RAM from %s", qPrintable(memory.fileName()));
+        return false;
+    }
+    return true;
+}
+
+void CPU::saveState(QDataStream& stream) const
+{
+    auto saveDescriptor = [&stream] (const Descriptor& descriptor) {
+        stream << descriptor.m_high << descriptor.m_low << descriptor.m_segmentBase << descriptor.m_segmentLimit;
+        stream << descriptor.m_DPL << descriptor.m_type;
+        stream << descriptor.m_G << descriptor.m_D << descriptor.m_P << descriptor.m_AVL << descriptor.m_DT;
+        stream << descriptor.m_effectiveLimit << descriptor.m_index << descriptor.m_isGlobal << descriptor.m_RPL << (int)descriptor.m_error;
+    };
+
+    for (auto& reg : m_generalPurposeRegister)
+        stream << reg.fullDWORD;
+    stream << m_EIP << getEFlags();
+
+    for (int i = 0; i < 6; ++i) {
+        stream << *m_segmentMap[i];
+        saveDescriptor(m_descriptor[i]);
+    }
+
+    stream << GDTR.base.get() << GDTR.limit;
+    stream << IDTR.base.get() << IDTR.limit;
+    stream << LDTR.selector << LDTR.base.get() << LDTR.limit;
+    stream << TR.selector << TR.base.get() << TR.limit << TR.is32Bit;
+
+    stream << m_CR0 << m_CR1 << m_CR2 << m_CR3 << m_CR4 << m_CR5 << m_CR6 << m_CR7;
+    stream << m_DR0 << m_DR1 << m_DR2 << m_DR3 << m_DR4 << m_DR5 << m_DR6 << m_DR7;
+
+    stream << m_a20Enabled << (quint64)m_cycle << (m_state == Halted);
+}
+
+void CPU::restoreState(QDataStream& stream)
+{
+    auto restoreDescriptor = [&stream] (Descriptor& descriptor) {
+        int error;
+        stream >> descriptor.m_high >> descriptor.m_low >> descriptor.m_segmentBase >> descriptor.m_segmentLimit;
+        stream >> descriptor.m_DPL >> descriptor.m_type;
+        stream >> descriptor.m_G >> descriptor.m_D >> descriptor.m_P >> descriptor.m_AVL >> descriptor.m_DT;
+        stream >> descriptor.m_effectiveLimit >> descriptor.m_index >> descriptor.m_isGlobal >> descriptor.m_RPL >> error;
+        descriptor.m_error = static_cast<Descriptor::Error>(error);
+    };
+    auto restoreLinearAddress = [&stream] (LinearAddress& address) {
+        DWORD value;
+        stream >> value;
+        address = LinearAddress(value);
+    };
+
+    for (auto& reg : m_generalPurposeRegister)
+        stream >> reg.fullDWORD;
+    DWORD eflags;
+    stream >> m_EIP >> eflags;
+    setEFlags(eflags);
+
+    for (int i = 0; i < 6; ++i) {
+        stream >> *m_segmentMap[i];
+        restoreDescriptor(m_descriptor[i]);
+    }
+
+    restoreLinearAddress(GDTR.base);
+    stream >> GDTR.limit;
+    restoreLinearAddress(IDTR.base);
+    stream >> IDTR.limit;
+    stream >> LDTR.selector;
+    restoreLinearAddress(LDTR.base);
+    stream >> LDTR.limit;
+    stream >> TR.selector;
+    restoreLinearAddress(TR.base);
+    stream >> TR.limit >> TR.is32Bit;
+
+    stream >> m_CR0 >> m_CR1 >> m_CR2 >> m_CR3 >> m_CR4 >> m_CR5 >> m_CR6 >> m_CR7;
+    stream >> m_DR0 >> m_DR1 >> m_DR2 >> m_DR3 >> m_DR4 >> m_DR5 >> m_DR6 >> m_DR7;
+
+    quint64 cycle;
+    bool halted;
+    stream >> m_a20Enabled >> cycle >> halted;
+    m_cycle = cycle;
+    // Let the main loop start a fresh timeslice.
+    m_timesliceEnd = m_cycle;
+
+    // Snapshots are taken between two instructions. One taken in HLT has EIP past it already,
+    // and mainLoop() goes back to waiting for an interrupt.
+    m_state = halted ? Halted : Alive;
+    m_segmentPrefix = SegmentRegisterIndex::None;
+    m_hasPendingFault = false;
+    clearPendingWork(PendingWork::Uninterruptible);
+    saveBaseAddress();
+
+    updateDefaultSizes();
+    updateStackSize();
+    updateCodeSegmentCache();
+    m_effectiveAddressSize32 = m_addressSize32;
+    m_effectiveOperandSize32 = m_operandSize32;
+
+    flushTLB();
+    m_instructionCache.clear();
+    recomputeMainLoopNeedsSlowStuff();
+}
+
+bool CPU::saveMemory(QFile& file, QWORD offset) const
+{
+    for (size_t page = 0; page < m_memorySize; page += snapshotPageSize) {
+        const BYTE* data = m_memory + page;
+        size_t size = qMin<size_t>(snapshotPageSize, m_memorySize - page);
+        if (std::all_of(data, data + size, [] (BYTE b) { return b == 0; }))
+            continue;
+        if (!file.seek(offset + page) || file.write(reinterpret_cast<const char*>(data), size) != (qint64)size)
+            return false;
+    }
+    return file.resize(offset + m_memorySize);
+}
+
+// With mmap, the snapshot's RAM image is mapped copy-on-write: resuming costs the same no matter
+// how big the guest is, and only pages the guest writes to get a private copy.
+bool CPU::loadMemory(QFile& file, QWORD offset, size_t size)
+{
+    // A short file would fault on mapped pages past its end, or come back as a short read.
+    if (size % PhysicalMemoryMap::pageSize || (QWORD)file.size() < offset + size)
+        return false;
+#ifdef HAVE_MMAP
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, file.handle(), offset);
+    if (memory == MAP_FAILED)
+        return false;
+    releaseMemory();
+    m_memory = static_cast<BYTE*>(memory);
+#else
+    BYTE* memory = allocateMemory(size);
+    if (!file.seek(offset) || file.read(reinterpret_cast<char*>(memory), size) != (qint64)size) {
+        delete [] memory;
+        return false;
+    }
+    releaseMemory();
+    m_memory = memory;
+#endif
+    m_memorySize = size;
+    m_instructionCache.setMemorySize(m_memorySize);
+    rebuildPhysicalMemoryMap();
+    return true;
+}
@@ -0,0 +1,84 @@
+[bits 16]
+
+; READ DATA over DMA channel 2, ending every way it can. Each command's result bytes
+; end up in EAX (ST0, ST1, ST2, C) and EBX (H, R, N), so the trace shows them.
+; runtest.sh attaches a blank 1.44M floppy as drive 0.
+
+%define BUFFER 0x20000
+
+cli
+cld
+mov ax, cs
+mov es, ax
+
+; Drive 0 with its motor on, DMA enabled.
+mov dx, 0x3f2
+mov al, 0x1c
+out dx, al
+
+; Normal termination: MT from the last sector of head 0 onto head 1. The channel reaches
+; terminal count after 2 sectors, so the result is the ID after those, C=0 H=1 R=2.
+mov cx, 2 * 512 - 1
+call dma_setup
+mov si, read_multitrack
+call command
+
+; Overrun: terminal count masked the channel, so it takes nothing. C=2 H=0 R=5 is unchanged.
+mov si, read_overrun
+call command
+
+; End of cylinder: EOT comes before terminal count. Without MT, the next ID is on the next cylinder.
+mov cx, 8 * 512 - 1
+call dma_setup
+mov si, read_end_of_cylinder
+call command
+
+; No data: sectors are numbered from 1, and a 1.44M disk has 80 cylinders.
+mov si, read_sector_zero
+call command
+mov si, read_cylinder_80
+call command
+
+db 0xf1
+
+; Points channel 2 at BUFFER for CX + 1 bytes towards memory, and unmasks it.
+dma_setup:
+mov al, 0x06
+out 0x0a, al
+out 0x0c, al
+mov al, 0
+out 0x04, al
+out 0x04, al
+mov al, BUFFER >> 16
+out 0x81, al
+mov al, cl
+out 0x05, al
+mov al, ch
+out 0x05, al
+mov al, 0x46
+out 0x0b, al
+mov al, 0x02
+out 0x0a, al
+ret
+
+; Sends the 9 command bytes at SI, then reads the 7 result bytes. The FDC finishes
+; each command before the next port access, so there's no need to poll the MSR.
+command:
+mov dx, 0x3f5
+mov cx, 9
+rep outsb
+mov di, result
+mov cx, 7
+rep insb
+mov eax, [result]
+mov ebx, [result + 4]
+ret
+
+;                        cmd   drv   C     H     R     N     EOT   GPL   DTL
+read_multitrack:      db 0xc6, 0x00, 0x00, 0x00, 0x12, 0x02, 0x12, 0x1b, 0xff
+read_overrun:         db 0x46, 0x00, 0x02, 0x00, 0x05, 0x02, 0x12, 0x1b, 0xff
+read_end_of_cylinder: db 0x46, 0x00, 0x01, 0x00, 0x11, 0x02, 0x12, 0x1b, 0xff
+read_sector_zero:     db 0x46, 0x00, 0x00, 0x00, 0x00, 0x02, 0x12, 0x1b, 0xff
+read_cylinder_80:     db 0x46, 0x00, 0x50, 0x00, 0x01, 0x02, 0x12, 0x1b, 0xff
+
+result: times 8 db 0
@@ -0,0 +1,131 @@
+[bits 16]
+
+; READ DMA and WRITE DMA through the PIIX bus master at C000h, with the PRD tables at the end.
+; The last two characters of sectors read end up in BX and BP, so the trace shows them.
+; runtest.sh attaches a scratch hard disk as fixed0, in which sector n holds n in decimal,
+; zero-padded to 511 digits and ending in a newline. This test only writes sector 300.
+
+%define BUS_MASTER 0xc000
+
+cli
+cld
+mov ax, 0x2000
+mov es, ax
+mov ax, 0x3000
+mov fs, ax
+
+; LBA mode, master.
+mov dx, 0x1f6
+mov al, 0xe0
+out dx, al
+
+; READ DMA of sectors 4660-4661 into both regions of the table. The drive is busy until the
+; bus master starts, and the bus master is done at the end of the table.
+mov eax, 0x10000 + two_regions
+mov bx, 0x09c8
+mov cl, 2
+mov si, 4660
+call dma
+call stop_dma
+mov bx, [es:509]
+mov bp, [fs:509]
+
+; READ DMA of sector 4662 only needs the first region, so the bus master stays active.
+mov eax, 0x10000 + two_regions
+mov bx, 0x09c8
+mov cl, 1
+mov si, 4662
+call dma
+call stop_dma
+mov bx, [es:509]
+
+; A table too short for two sectors fails both the bus master and the command.
+mov eax, 0x10000 + first_region
+mov bx, 0x09c8
+mov cl, 2
+mov si, 4660
+call dma
+mov dx, 0x1f1
+in al, dx
+call stop_dma
+
+; WRITE DMA of the second region, which holds sector 4661, to sector 300. READ SECTORS gets
+; it back.
+mov eax, 0x10000 + second_region
+mov bx, 0x01ca
+mov cl, 1
+mov si, 300
+call dma
+call stop_dma
+mov dx, 0x1f2
+mov al, 1
+out dx, al
+call set_lba
+mov al, 0x20
+out dx, al
+mov dx, 0x1f0
+mov di, 0x1000
+mov cx, 256
+rep insw
+mov bx, [es:0x1000 + 509]
+
+db 0xf1
+
+; Points the bus master at the PRD table at EAX, sends the DMA command in BL for CL sectors
+; at the LBA in SI, and starts the bus master with the command in BH. The drive's status is
+; in AL before the start, and after it, with the bus master's in AH.
+dma:
+mov dx, BUS_MASTER + 4
+out dx, eax
+mov dx, 0x1f2
+mov al, cl
+out dx, al
+call set_lba
+mov al, bl
+out dx, al
+in al, dx
+mov dx, BUS_MASTER
+mov al, bh
+out dx, al
+mov dx, BUS_MASTER + 2
+in al, dx
+mov ah, al
+mov dx, 0x1f7
+in al, dx
+ret
+
+; Acknowledges the bus master's interrupt and error, and stops it. Its status is left in AH.
+stop_dma:
+mov dx, BUS_MASTER + 2
+mov al, 0x66
+out dx, al
+mov dx, BUS_MASTER
+mov al, 0
+out dx, al
+mov dx, BUS_MASTER + 2
+in al, dx
+mov ah, al
+ret
+
+; Points the drive at the LBA in SI, and leaves DX at the command register.
+set_lba:
+mov dx, 0x1f3
+mov ax, si
+out dx, al
+mov dx, 0x1f4
+mov al, ah
+out dx, al
+mov dx, 0x1f5
+mov al, 0
+out dx, al
+mov dx, 0x1f7
+ret
+
+align 4
+;              address    bytes, flags
+two_regions:   dd 0x20000
+               dw 512,    0
+second_region: dd 0x30000
+               dw 512,    0x8000
+first_region:  dd 0x20000
+               dw 512,    0x8000
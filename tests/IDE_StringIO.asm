@@ -0,0 +1,141 @@
+[bits 16]
+
+; REP INS/OUTS on the IDE data port copy whole DRQ blocks between the sector buffer and
+; memory at once: in multiple mode with 32-bit I/O, and with a transfer split between
+; instructions of different sizes. Each command's status ends up in AL, and the last two
+; characters of sectors read in BX and BP, so the trace shows them. runtest.sh attaches a
+; scratch hard disk as fixed0, in which sector n holds n in decimal, zero-padded to 511
+; digits and ending in a newline. This test only writes sectors 4666-4667.
+
+%define BUFFER_SEGMENT 0x2000
+
+cli
+cld
+mov ax, BUFFER_SEGMENT
+mov es, ax
+
+; LBA mode, master.
+mov dx, 0x1f6
+mov al, 0xe0
+out dx, al
+
+; SET MULTIPLE only takes powers of two: 3 is aborted, 4 is taken.
+mov dx, 0x1f2
+mov al, 3
+out dx, al
+mov dx, 0x1f7
+mov al, 0xc6
+out dx, al
+in al, dx
+mov dx, 0x1f1
+in al, dx
+mov dx, 0x1f2
+mov al, 4
+out dx, al
+mov dx, 0x1f7
+mov al, 0xc6
+out dx, al
+in al, dx
+
+; READ MULTIPLE of sectors 4660-4667 is two blocks of 4, and one REP INSD takes both.
+mov dx, 0x1f2
+mov al, 8
+out dx, al
+mov si, 4660
+call set_lba
+mov al, 0xc4
+out dx, al
+in al, dx
+mov dx, 0x1f0
+mov di, 0
+mov cx, 8 * 128
+rep insd
+mov dx, 0x1f7
+in al, dx
+mov bx, [es:509]
+mov bp, [es:7 * 512 + 509]
+
+; READ SECTORS of 4662-4663: REP INSW for a sector and a half, which leaves DRQ set, then
+; REP INSB for the rest.
+mov dx, 0x1f2
+mov al, 2
+out dx, al
+mov si, 4662
+call set_lba
+mov al, 0x20
+out dx, al
+mov dx, 0x1f0
+mov cx, 384
+rep insw
+mov dx, 0x1f7
+in al, dx
+mov dx, 0x1f0
+mov cx, 256
+rep insb
+mov dx, 0x1f7
+in al, dx
+mov bx, [es:0x1000 + 509]
+mov bp, [es:0x1200 + 509]
+
+; WRITE MULTIPLE of sectors 4660-4661 over 4666-4667 with REP OUTSD, and read them back
+; with READ MULTIPLE, which is half a block.
+mov dx, 0x1f2
+mov al, 2
+out dx, al
+mov si, 4666
+call set_lba
+mov al, 0xc5
+out dx, al
+in al, dx
+push ds
+push es
+pop ds
+mov si, 0
+mov dx, 0x1f0
+mov cx, 2 * 128
+rep outsd
+pop ds
+mov dx, 0x1f7
+in al, dx
+
+mov dx, 0x1f2
+mov al, 2
+out dx, al
+mov si, 4666
+call set_lba
+mov al, 0xc4
+out dx, al
+mov dx, 0x1f0
+mov di, 0x2000
+mov cx, 2 * 128
+rep insd
+mov bx, [es:0x2000 + 509]
+mov bp, [es:0x2200 + 509]
+
+; Sector 8192 is past the end of the disk, so there's no data, only IDNF and ABRT.
+mov dx, 0x1f2
+mov al, 1
+out dx, al
+mov si, 8192
+call set_lba
+mov al, 0x20
+out dx, al
+in al, dx
+mov dx, 0x1f1
+in al, dx
+
+db 0xf1
+
+; Points the drive at the LBA in SI, and leaves DX at the command register.
+set_lba:
+mov dx, 0x1f3
+mov ax, si
+out dx, al
+mov dx, 0x1f4
+mov al, ah
+out dx, al
+mov dx, 0x1f5
+mov al, 0
+out dx, al
+mov dx, 0x1f7
+ret
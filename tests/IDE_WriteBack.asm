@@ -0,0 +1,109 @@
+[bits 16]
+
+; WRITE SECTORS to sector 100, which only puts it in the drive's write-back cache. It's read
+; back from there, then again once enough other sectors have gone through the cache to evict
+; it, which writes it to the image first. The last two characters of each sector read end up
+; in BX, so the trace shows them. runtest.sh attaches a scratch hard disk as fixed0, in which
+; sector n holds n in decimal, zero-padded to 511 digits and ending in a newline.
+
+%define BUFFER_SEGMENT 0x2000
+
+cli
+cld
+mov ax, BUFFER_SEGMENT
+mov es, ax
+
+; A sector of 'W's.
+mov ax, 0x5757
+mov di, 0
+mov cx, 256
+rep stosw
+
+; LBA mode, master.
+mov dx, 0x1f6
+mov al, 0xe0
+out dx, al
+
+mov dx, 0x1f2
+mov al, 1
+out dx, al
+mov si, 100
+call set_lba
+mov al, 0x30
+out dx, al
+in al, dx
+
+push ds
+push es
+pop ds
+mov si, 0
+mov dx, 0x1f0
+mov cx, 256
+rep outsw
+pop ds
+mov dx, 0x1f7
+in al, dx
+
+mov si, 100
+call read_sector
+
+; 3072 other sectors, 128 at a time, are more than the 2048 sectors the cache holds.
+mov cx, 24
+mov si, 1024
+evict:
+push cx
+mov dx, 0x1f2
+mov al, 128
+out dx, al
+call set_lba
+mov al, 0x20
+out dx, al
+mov dx, 0x1f0
+mov di, 0
+mov cx, 128 * 128
+rep insd
+lea si, [si + 128]
+pop cx
+loop evict
+
+; Now sector 100 comes from the image, like the untouched sector after it.
+mov si, 100
+call read_sector
+mov bp, bx
+mov si, 101
+call read_sector
+
+db 0xf1
+
+; Points the drive at the LBA in SI, and leaves DX at the command register.
+set_lba:
+mov dx, 0x1f3
+mov ax, si
+out dx, al
+mov dx, 0x1f4
+mov al, ah
+out dx, al
+mov dx, 0x1f5
+mov al, 0
+out dx, al
+mov dx, 0x1f7
+ret
+
+; READ SECTORS of the sector at SI into BUFFER_SEGMENT:0000. The status before and after
+; reading the data is in AL, and the sector's last two characters before the newline in BX.
+read_sector:
+mov dx, 0x1f2
+mov al, 1
+out dx, al
+call set_lba
+mov al, 0x20
+out dx, al
+in al, dx
+mov dx, 0x1f0
+mov di, 0
+mov cx, 256
+rep insw
+mov dx, 0x1f7
+in al, dx
+mov bx, [es:509]
+ret
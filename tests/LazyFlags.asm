@@ -0,0 +1,61 @@
+[bits 16]
+
+; CF, OF and AF are computed on demand. Every way the guest can observe them
+; must see the same values an eager implementation would have produced.
+
+cli
+
+mov word [es:6*4], ud_handler
+mov [es:6*4+2], cs
+mov word [es:0x40*4], int_handler
+mov [es:0x40*4+2], cs
+
+; PUSHF
+mov al, 0x7f
+add al, 1
+pushf
+pop bx
+
+; INC keeps the carry from the ADD before it
+mov al, 0xff
+add al, 1
+inc al
+pushf
+pop cx
+
+; Jcc/SETcc/ADC
+mov al, 1
+mov bl, 2
+cmp al, bl
+setb dl
+setl dh
+mov ah, 0
+adc ah, 0
+
+; LAHF
+mov al, 0x10
+sub al, 1
+lahf
+
+; INT
+mov al, 0x80
+add al, 0x80
+int 0x40
+
+; #UD
+mov al, 0x08
+add al, 0x08
+ud2
+
+db 0xf1
+
+int_handler:
+mov bp, sp
+mov si, [bp+4]
+iret
+
+ud_handler:
+mov bp, sp
+mov di, [bp+4]
+add word [bp], 2
+iret
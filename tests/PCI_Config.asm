@@ -0,0 +1,77 @@
+[bits 16]
+
+; Configuration mechanism #1: the function and register selected through CF8h answer at
+; CFCh-CFFh. Every read ends up in EAX, so the trace shows it.
+
+cli
+
+; The host bridge, the ISA bridge with its multi-function header type, and the IDE function
+; with its class code: mass storage, IDE, bus master capable.
+mov eax, 0x80000000
+call read_config
+mov eax, 0x80000800
+call read_config
+mov eax, 0x8000080c
+call read_config
+mov eax, 0x80000900
+call read_config
+mov eax, 0x80000908
+call read_config
+
+; Smaller reads get the bytes the low bits of the port point at.
+mov dx, 0xcfe
+in ax, dx
+mov dx, 0xcfd
+in al, dx
+
+; The address register drops the reserved bits, and the low bits of the register number.
+mov eax, 0xff000923
+mov dx, 0xcf8
+out dx, eax
+in eax, dx
+
+; There's no device 2, and nothing at all without the enable bit.
+mov eax, 0x80001000
+call read_config
+mov eax, 0x00000900
+call read_config
+
+; Only the writable bits of the IDE function's command register change.
+mov eax, 0x80000904
+mov ebx, 0xffffffff
+call write_config
+mov eax, 0x80000904
+mov ebx, 0x00000005
+call write_config
+
+; BAR4 is the bus master's 16 ports. Sizing reads back the mask, and the BAR can be put
+; back afterwards, but not moved.
+mov eax, 0x80000920
+mov ebx, 0xffffffff
+call write_config
+mov eax, 0x80000920
+mov ebx, 0x0000c001
+call write_config
+mov eax, 0x80000920
+mov ebx, 0x0000d001
+call write_config
+
+db 0xf1
+
+; Selects the register at the address in EAX, and reads it into EAX.
+read_config:
+mov dx, 0xcf8
+out dx, eax
+mov dx, 0xcfc
+in eax, dx
+ret
+
+; Writes EBX to the register at the address in EAX, and reads it back into EAX.
+write_config:
+mov dx, 0xcf8
+out dx, eax
+mov dx, 0xcfc
+mov eax, ebx
+out dx, eax
+in eax, dx
+ret
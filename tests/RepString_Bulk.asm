@@ -0,0 +1,46 @@
+[bits 16]
+
+; REP MOVS/STOS move whole runs at once, but a run has to end where the
+; elements stop being contiguous in host memory. Each case reads back the
+; bytes on both sides of the cut, so the trace shows them.
+
+cli
+mov ax, 0x2000
+mov es, ax
+
+; DF=1 across a page boundary: the first run ends at 2000:1000, the lowest
+; byte of its page, and the rest goes downwards from 2000:0FFF.
+std
+mov si, source + 7
+mov di, 0x1003
+mov cx, 8
+rep movsb
+cld
+mov dx, [es:0x0ffc]
+mov ax, [es:0x0ffe]
+mov bx, [es:0x1000]
+mov bp, [es:0x1002]
+
+; The second word straddles 2000:1FFF and 2000:2000, so it's moved on its own
+; between two runs.
+mov si, words
+mov di, 0x1ffd
+mov cx, 3
+rep movsw
+mov ax, [es:0x1ffd]
+mov bx, [es:0x1fff]
+mov dx, [es:0x2001]
+
+; DI wraps around from FFFF to 0000 part-way, instead of running on into 3000:0000.
+mov al, 0x5a
+mov di, 0xfffe
+mov cx, 4
+rep stosb
+mov bx, [es:0xfffe]
+mov dx, [es:0x0000]
+mov bp, [es:0x0002]
+
+db 0xf1
+
+source: db 1, 2, 3, 4, 5, 6, 7, 8
+words:  dw 0x1111, 0x2222, 0x3333
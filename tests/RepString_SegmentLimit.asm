@@ -0,0 +1,54 @@
+[bits 16]
+
+; REP STOSB into a 16-byte segment. The bulk run has to stop at the limit, and
+; the #GP for the first byte past it leaves CX and DI at that byte, so the
+; instruction can be restarted. The handler shows the IP it would return to in
+; DX and the last byte written in BL.
+
+cli
+lgdt [gdtr]
+lidt [idtr]
+mov eax, 1
+mov cr0, eax
+jmp 0x08:protected
+
+protected:
+mov ax, 0x18
+mov ss, ax
+mov ax, 0x10
+mov es, ax
+mov di, 0
+mov al, 0xaa
+mov cx, 0x20
+rep stosb
+db 0xf1
+
+gp_handler:
+mov bp, sp
+mov dx, [bp + 2]
+mov bl, [es:0x0f]
+db 0xf1
+
+gdtr: dw gdt_end - gdt - 1
+      dd 0x10000 + gdt
+idtr: dw 14 * 8 - 1
+      dd 0x10000 + idt
+
+align 8
+gdt:  dq 0
+      ; 0x08: 16-bit code at 0x10000, limit 0xffff
+      dw 0xffff, 0x0000
+      db 0x01, 0x9a, 0x00, 0x00
+      ; 0x10: data at 0x20000, limit 0x0f
+      dw 0x000f, 0x0000
+      db 0x02, 0x92, 0x00, 0x00
+      ; 0x18: stack at 0x90000, limit 0xffff
+      dw 0xffff, 0x0000
+      db 0x09, 0x92, 0x00, 0x00
+gdt_end:
+
+; Only #GP has a gate: a 16-bit interrupt gate to gp_handler.
+idt:  times 13 dq 0
+      dw gp_handler, 0x08
+      db 0x00, 0x86
+      dw 0
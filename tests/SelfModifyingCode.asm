@@ -0,0 +1,27 @@
+[bits 16]
+
+; Decoded instructions are cached by physical address, so writing over code
+; that has already run must throw the stale decoding away.
+
+cli
+
+; Every iteration patches the immediate of the MOV below with CL, so BL must
+; follow CX down. By the last iterations the loop has run often enough to be a
+; cached block (with --block-cache), which the store invalidates under itself.
+mov cx, 65
+warm:
+mov [patched + 1], cl
+patched:
+mov bl, 0
+loop warm
+
+; Replace a whole instruction with two different ones: MOV AL, 1 becomes INC AX, INC AX.
+call subroutine
+mov word [subroutine], 0x4040
+call subroutine
+
+db 0xf1
+
+subroutine:
+mov al, 1
+ret
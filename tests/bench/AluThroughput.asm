@@ -0,0 +1,30 @@
+; A tight real mode loop of flag-setting ALU instructions, where nearly every
+; CF/OF/AF result is overwritten before anything reads it. Measures the lazy
+; flags path; compare the MIPS figure against an older build.
+;
+;   bash bench.sh AluThroughput.asm
+
+%define ITERATIONS 1000000
+
+[bits 16]
+
+    cli
+    mov ecx, ITERATIONS
+    xor eax, eax
+    xor ebx, ebx
+    mov edx, 0x12345678
+.loop:
+    add eax, edx
+    adc ebx, eax
+    sub ax, bx
+    sbb dl, al
+    inc esi
+    dec edi
+    cmp eax, ebx
+    add bl, 0x7f
+    sub eax, 3
+    cmp dx, 0x8000
+    dec ecx
+    jnz .loop
+
+    db 0xf1
@@ -0,0 +1,50 @@
+; Sequential single-sector reads over a 16 MiB hard disk image, issued straight
+; through the BIOS INT 13h VM call. Measures the per-request cost of disk I/O.
+; Needs an image passed with --disk; "make disk" creates one. Without a disk
+; it stops at the first read.
+;
+;   bash bench.sh DiskRead.asm --disk disk.img
+
+%define PASSES 4
+%define CYLINDERS 32
+%define HEADS 16
+%define SECTORS_PER_TRACK 63
+
+[bits 16]
+
+    cli
+    mov ax, 0x2000
+    mov es, ax
+    xor bx, bx
+    mov bp, PASSES
+.pass:
+    xor di, di
+.cylinder:
+    xor dh, dh
+.head:
+    mov si, 1
+.sector:
+    ; CH = cylinder, CL = sector, DH = head, DL = first fixed disk, AL = count.
+    mov ax, di
+    mov ch, al
+    mov ax, si
+    mov cl, al
+    mov dl, 0x80
+    mov ax, 0x0201
+    out 0xE2, al
+    jc .done
+
+    inc si
+    cmp si, SECTORS_PER_TRACK
+    jbe .sector
+    inc dh
+    cmp dh, HEADS
+    jb .head
+    inc di
+    cmp di, CYLINDERS
+    jb .cylinder
+    dec bp
+    jnz .pass
+
+.done:
+    db 0xf1
@@ -0,0 +1,137 @@
+; Reads a 1.44M floppy image a cylinder (both sides, 18 KiB) at a time with READ DATA,
+; the way floppy drivers do: the FDC hands each cylinder to DMA channel 2, which copies
+; it into memory in one go. The channel is auto-initialized, so it's only set up once.
+;
+;   bash bench.sh FloppyReadDMA.asm --floppy floppy.img
+
+%define PASSES 16
+%define CYLINDERS 80
+%define BYTES_PER_CYLINDER 2 * 18 * 512
+%define BUFFER 0x20000
+
+[bits 16]
+
+    cli
+    cld
+    mov ax, BUFFER >> 4
+    mov es, ax
+
+    ; The controller can't tell us there's no disk, so ask the BIOS VM call first.
+    xor bx, bx
+    mov cx, 0x0001
+    xor dx, dx
+    mov ax, 0x0201
+    out 0xE2, al
+    jc .done
+
+    ; Channel 2: single mode, auto-initialize, towards memory.
+    mov al, 0x06
+    out 0x0A, al
+    out 0x0C, al
+    xor al, al
+    out 0x04, al
+    out 0x04, al
+    mov al, BUFFER >> 16
+    out 0x81, al
+    out 0x0C, al
+    mov al, (BYTES_PER_CYLINDER - 1) & 0xFF
+    out 0x05, al
+    mov al, (BYTES_PER_CYLINDER - 1) >> 8
+    out 0x05, al
+    mov al, 0x56
+    out 0x0B, al
+    mov al, 0x02
+    out 0x0A, al
+
+    ; Drive 0 with its motor on, DMA and interrupts enabled.
+    mov dx, 0x3F2
+    mov al, 0x1C
+    out dx, al
+
+    mov bp, PASSES
+.pass:
+    xor di, di
+.read:
+    ; Seek, then sense the interrupt.
+    mov al, 0x0F
+    call fdc_command
+    xor al, al
+    call fdc_command
+    mov ax, di
+    call fdc_command
+    mov al, 0x08
+    call fdc_command
+    mov cx, 2
+    call fdc_results
+
+    ; READ DATA, multi-track, MFM, from head 0 sector 1 through sector 18 of head 1.
+    mov al, 0xE6
+    call fdc_command
+    xor al, al
+    call fdc_command
+    mov ax, di
+    call fdc_command
+    xor al, al
+    call fdc_command
+    mov al, 1
+    call fdc_command
+    mov al, 2
+    call fdc_command
+    mov al, 18
+    call fdc_command
+    mov al, 0x1B
+    call fdc_command
+    mov al, 0xFF
+    call fdc_command
+
+    ; ST0 comes first. Stop unless the command terminated normally.
+    mov cx, 7
+    call fdc_results
+    test bl, 0xC0
+    jnz .done
+
+    inc di
+    cmp di, CYLINDERS
+    jb .read
+    dec bp
+    jnz .pass
+
+.done:
+    db 0xf1
+
+; Sends AL to the data register once the FDC wants a byte.
+fdc_command:
+    mov ah, al
+    mov dx, 0x3F4
+.wait:
+    in al, dx
+    and al, 0xC0
+    cmp al, 0x80
+    jne .wait
+    inc dx
+    mov al, ah
+    out dx, al
+    ret
+
+; Reads CX result bytes, and returns the first one in BL.
+fdc_results:
+    call fdc_result
+    mov bl, al
+    dec cx
+    jz .end
+.next:
+    call fdc_result
+    loop .next
+.end:
+    ret
+
+fdc_result:
+    mov dx, 0x3F4
+.wait:
+    in al, dx
+    and al, 0xC0
+    cmp al, 0xC0
+    jne .wait
+    inc dx
+    in al, dx
+    ret
@@ -0,0 +1,90 @@
+; Like IDERead.asm, but with 64-sector READ DMA commands: the PIIX bus master
+; copies each 32 KiB straight into memory through a one-entry PRD table.
+;
+;   bash bench.sh IDEReadDMA.asm --disk disk.img
+
+%define PASSES 4
+%define TOTAL_SECTORS 32768
+%define SECTORS_PER_READ 64
+%define BUS_MASTER 0xC000
+%define PRD_TABLE 0x10000
+%define BUFFER 0x20000
+
+[bits 16]
+
+    cli
+    cld
+    mov ax, 0x2000
+    mov es, ax
+
+    ; The controller can't tell us there's no disk, so ask the BIOS VM call first.
+    xor bx, bx
+    mov cx, 0x0001
+    xor dh, dh
+    mov dl, 0x80
+    mov ax, 0x0201
+    out 0xE2, al
+    jc .done
+
+    ; One PRD entry covering the whole transfer, marked as the last one.
+    mov ax, PRD_TABLE >> 4
+    mov ds, ax
+    mov dword [0], BUFFER
+    mov word [4], SECTORS_PER_READ * 512
+    mov word [6], 0x8000
+
+    mov dx, BUS_MASTER + 4
+    mov eax, PRD_TABLE
+    out dx, eax
+
+    mov bp, PASSES
+.pass:
+    xor si, si
+.read:
+    ; LBA mode, master. SI holds LBA bits 0-15, the rest are zero.
+    mov dx, 0x1F6
+    mov al, 0xE0
+    out dx, al
+    mov dx, 0x1F2
+    mov al, SECTORS_PER_READ
+    out dx, al
+    mov dx, 0x1F3
+    mov ax, si
+    out dx, al
+    mov dx, 0x1F4
+    mov al, ah
+    out dx, al
+    mov dx, 0x1F5
+    xor al, al
+    out dx, al
+    mov dx, 0x1F7
+    mov al, 0xC8
+    out dx, al
+
+    ; Start the bus master, towards memory.
+    mov dx, BUS_MASTER
+    mov al, 0x09
+    out dx, al
+
+    ; Wait for the interrupt bit, then stop the bus master and acknowledge.
+    mov dx, BUS_MASTER + 2
+.wait:
+    in al, dx
+    test al, 0x04
+    jz .wait
+    test al, 0x02
+    jnz .done
+    mov al, 0x06
+    out dx, al
+    mov dx, BUS_MASTER
+    xor al, al
+    out dx, al
+
+    add si, SECTORS_PER_READ
+    cmp si, TOTAL_SECTORS
+    jb .read
+    dec bp
+    jnz .pass
+
+.done:
+    db 0xf1
@@ -0,0 +1,83 @@
+; Like IDERead.asm, but with 64-sector READ MULTIPLE commands in 16-sector
+; blocks, and the data moved by 32-bit REP INSD. Compare the two to see what
+; multiple mode and doubleword PIO save per megabyte.
+;
+;   bash bench.sh IDEReadMultiple.asm --disk disk.img
+
+%define PASSES 4
+%define TOTAL_SECTORS 32768
+%define SECTORS_PER_READ 64
+%define SECTORS_PER_BLOCK 16
+
+[bits 16]
+
+    cli
+    cld
+    mov ax, 0x2000
+    mov es, ax
+
+    ; The controller can't tell us there's no disk, so ask the BIOS VM call first.
+    xor bx, bx
+    mov cx, 0x0001
+    xor dh, dh
+    mov dl, 0x80
+    mov ax, 0x0201
+    out 0xE2, al
+    jc .done
+
+    ; SET MULTIPLE MODE.
+    mov dx, 0x1F6
+    mov al, 0xE0
+    out dx, al
+    mov dx, 0x1F2
+    mov al, SECTORS_PER_BLOCK
+    out dx, al
+    mov dx, 0x1F7
+    mov al, 0xC6
+    out dx, al
+    in al, dx
+    test al, 0x01
+    jnz .done
+
+    mov bp, PASSES
+.pass:
+    xor si, si
+.read:
+    ; LBA mode, master. SI holds LBA bits 0-15, the rest are zero.
+    mov dx, 0x1F2
+    mov al, SECTORS_PER_READ
+    out dx, al
+    mov dx, 0x1F3
+    mov ax, si
+    out dx, al
+    mov dx, 0x1F4
+    mov al, ah
+    out dx, al
+    mov dx, 0x1F5
+    xor al, al
+    out dx, al
+    mov dx, 0x1F7
+    mov al, 0xC4
+    out dx, al
+
+    ; Wait for BSY to clear, then expect DRQ.
+.wait:
+    in al, dx
+    test al, 0x80
+    jnz .wait
+    test al, 0x08
+    jz .done
+
+    mov dx, 0x1F0
+    xor di, di
+    mov cx, SECTORS_PER_READ * 128
+    rep insd
+
+    add si, SECTORS_PER_READ
+    cmp si, TOTAL_SECTORS
+    jb .read
+    dec bp
+    jnz .pass
+
+.done:
+    db 0xf1
@@ -0,0 +1,40 @@
+; An idle guest: the PIT raises IRQ 0 and the CPU spends the rest of its time
+; in HLT. The interesting figure is the host CPU usage while halted, which
+; should stay close to zero.
+;
+;   bash bench.sh IdleHalt.asm
+
+%define TICKS 200
+
+[bits 16]
+
+    cli
+    xor ax, ax
+    mov es, ax
+    mov word [es:0x08 * 4], timer_handler
+    mov word [es:0x08 * 4 + 2], cs
+
+    ; PIT counter 0, LSB then MSB, mode 0.
+    mov al, 0x30
+    out 0x43, al
+    mov al, 0xff
+    out 0x40, al
+    out 0x40, al
+
+    xor cx, cx
+    sti
+.idle:
+    hlt
+    cmp cx, TICKS
+    jb .idle
+
+    cli
+    db 0xf1
+
+timer_handler:
+    inc cx
+    push ax
+    mov al, 0x20
+    out 0x20, al
+    pop ax
+    iret
@@ -0,0 +1,43 @@
+; Like IdleHalt, but the guest busy-waits on a tick counter in memory instead
+; of using HLT, the way BIOS keyboard and delay loops do. With idle loop
+; detection the host CPU usage while idle should stay low; compare against
+; --no-idle-detection.
+;
+;   bash bench.sh IdlePoll.asm
+
+%define TICKS 200
+
+[bits 16]
+
+    cli
+    xor ax, ax
+    mov es, ax
+    mov word [es:0x08 * 4], timer_handler
+    mov word [es:0x08 * 4 + 2], cs
+    mov word [ticks], 0
+
+    ; PIT counter 0, LSB then MSB, mode 0.
+    mov al, 0x30
+    out 0x43, al
+    mov al, 0xff
+    out 0x40, al
+    out 0x40, al
+
+    sti
+.poll:
+    cmp word [ticks], TICKS
+    jb .poll
+
+    cli
+    db 0xf1
+
+timer_handler:
+    inc word [cs:ticks]
+    push ax
+    mov al, 0x20
+    out 0x20, al
+    pop ax
+    iret
+
+ticks:
+    dw 0
@@ -0,0 +1,111 @@
+; Enters 32-bit protected mode with paging and takes a large number of page faults:
+; first on data reads, then on instruction fetches. The #PF handler simply maps the
+; faulting page back in and returns, so the faulting instruction gets retried.
+;
+; Compare fault delivery strategies with:
+;   bash bench.sh PageFaultStorm.asm
+;   bash bench.sh PageFaultStorm.asm --unwind-faults
+
+%define LOAD_BASE       0x10000
+%define PAGE_DIRECTORY  0x20000
+%define PAGE_TABLE      0x21000
+%define DATA_PAGE       0x30000
+%define CODE_PAGE       0x31000
+%define ITERATIONS      100000
+
+[bits 16]
+
+    cli
+    lgdt [gdtr]
+    lidt [idtr]
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:(LOAD_BASE + pm32)
+
+[bits 32]
+pm32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov esp, 0x90000
+
+    ; Point IDT vector 14 at our #PF handler.
+    mov eax, LOAD_BASE + pf_handler
+    mov [LOAD_BASE + idt + 14 * 8], ax
+    shr eax, 16
+    mov [LOAD_BASE + idt + 14 * 8 + 6], ax
+
+    ; Identity map the first 4 MB.
+    mov edi, PAGE_TABLE
+    mov eax, 0x003
+    mov ecx, 1024
+.map:
+    mov [edi], eax
+    add eax, 0x1000
+    add edi, 4
+    loop .map
+    mov dword [PAGE_DIRECTORY], PAGE_TABLE | 0x003
+
+    mov byte [CODE_PAGE], 0xc3          ; ret
+
+    mov eax, PAGE_DIRECTORY
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80000000
+    mov cr0, eax
+
+    mov ecx, ITERATIONS
+.dataFaults:
+    and dword [PAGE_TABLE + (DATA_PAGE >> 12) * 4], ~1
+    invlpg [DATA_PAGE]
+    mov eax, [DATA_PAGE]
+    dec ecx
+    jnz .dataFaults
+
+    mov ecx, ITERATIONS
+.fetchFaults:
+    and dword [PAGE_TABLE + (CODE_PAGE >> 12) * 4], ~1
+    invlpg [CODE_PAGE]
+    mov eax, CODE_PAGE
+    call eax
+    dec ecx
+    jnz .fetchFaults
+
+    db 0xf1
+
+pf_handler:
+    push eax
+    mov eax, cr2
+    shr eax, 12
+    or dword [PAGE_TABLE + eax * 4], 1
+    pop eax
+    add esp, 4                          ; error code
+    iretd
+
+align 8
+gdt:
+    dq 0
+    dw 0xffff, 0x0000
+    db 0x00, 0x9a, 0xcf, 0x00           ; 0x08: flat 32-bit code
+    dw 0xffff, 0x0000
+    db 0x00, 0x92, 0xcf, 0x00           ; 0x10: flat 32-bit data
+gdt_end:
+
+align 8
+idt:
+%rep 32
+    dw 0x0000, 0x0008
+    db 0x00, 0x8e
+    dw 0x0000
+%endrep
+idt_end:
+
+gdtr:
+    dw gdt_end - gdt - 1
+    dd LOAD_BASE + gdt
+
+idtr:
+    dw idt_end - idt - 1
+    dd LOAD_BASE + idt
@@ -0,0 +1,9 @@
+; Does nothing at all, so that the --bench summary is all startup cost:
+; how long guest RAM took to allocate and how much of it ended up resident.
+; Run it with a big guest to see that untouched RAM stays free:
+;
+;   bash bench.sh Startup.asm --memory-size 1048576
+
+[bits 16]
+
+    db 0xf1
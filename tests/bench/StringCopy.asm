@@ -0,0 +1,48 @@
+; REP MOVSD and REP STOSD over a 64 KiB buffer, forwards and backwards,
+; plus an overlapping REP MOVSB that has to replicate a byte pattern.
+; Measures the bulk string instruction path.
+;
+;   bash bench.sh StringCopy.asm
+
+%define ITERATIONS 2000
+
+[bits 16]
+
+    cli
+    mov ax, 0x2000
+    mov ds, ax
+    mov ax, 0x3000
+    mov es, ax
+    mov bp, ITERATIONS
+.loop:
+    cld
+    xor si, si
+    xor di, di
+    mov cx, 0x4000
+    rep movsd
+
+    xor di, di
+    mov eax, 0xdeadbeef
+    mov cx, 0x4000
+    rep stosd
+
+    std
+    mov si, 0xfffc
+    mov di, 0xfffc
+    mov cx, 0x4000
+    rep movsd
+    cld
+
+    push ds
+    push es
+    pop ds
+    xor si, si
+    mov di, 1
+    mov cx, 0x1000
+    rep movsb
+    pop ds
+
+    dec bp
+    jnz .loop
+
+    db 0xf1
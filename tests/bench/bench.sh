@@ -0,0 +1,21 @@
+#!/bin/bash
+
+if [ "$1" = "" ] ; then
+	echo "usage: $0 <benchmark.asm> [computron arguments]"
+	exit 1
+fi
+
+PROGRAM="../../computron --no-gui --no-vlog --bench"
+BENCHMARK=$1
+shift
+COMPILED=bench.bin
+
+nasm -f bin -o $COMPILED $BENCHMARK || \
+	{ rm -f $COMPILED
+	  exit 1
+	}
+
+echo "$BENCHMARK $@"
+$PROGRAM "$@" --run $COMPILED
+
+rm -f $COMPILED
@@ -0,0 +1,11 @@
+[bits 16]
+
+; Shows sectors 199-201 with nothing in the sector cache yet, so sector 200 comes from the
+; overlay if runtest.sh attached one that has it, and from the image if not.
+
+cli
+cld
+mov ax, 0x2000
+mov es, ax
+
+%include "read_back.inc"
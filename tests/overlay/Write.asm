@@ -0,0 +1,47 @@
+[bits 16]
+
+; WRITE SECTORS of 'O's to sector 200, then shows it between its neighbours. runtest.sh
+; attaches the scratch disk from ../runtest.sh with a DiskOverlay, and checks that the image
+; only changes once the overlay is committed.
+
+cli
+cld
+mov ax, 0x2000
+mov es, ax
+
+mov ax, 0x4f4f
+mov di, 0
+mov cx, 256
+rep stosw
+
+; LBA mode, master, one sector at LBA 200.
+mov dx, 0x1f6
+mov al, 0xe0
+out dx, al
+mov dx, 0x1f2
+mov al, 1
+out dx, al
+mov dx, 0x1f3
+mov al, 200
+out dx, al
+mov dx, 0x1f4
+mov al, 0
+out dx, al
+mov dx, 0x1f5
+out dx, al
+mov dx, 0x1f7
+mov al, 0x30
+out dx, al
+
+push ds
+push es
+pop ds
+mov si, 0
+mov dx, 0x1f0
+mov cx, 256
+rep outsw
+pop ds
+mov dx, 0x1f7
+in al, dx
+
+%include "read_back.inc"
@@ -0,0 +1,62 @@
+#!/bin/bash
+
+# Runs Write.asm and Read.asm on the scratch hard disk from ../runtest.sh, with and without
+# a DiskOverlay, and checks that the image only changes once the overlay is committed.
+
+COMPUTRON="../../computron --no-gui --no-vlog"
+TMPDIR=`mktemp -d /tmp/computron.XXXXXX || exit 1`
+DISK=$TMPDIR/disk.img
+PRISTINE=$TMPDIR/pristine.img
+COMMITTED=$TMPDIR/committed.img
+OVERLAY=$TMPDIR/disk.overlay
+COMPILED=$TMPDIR/test.bin
+RESULT=$TMPDIR/test.out
+FAILED=0
+
+report() {
+    if [ "$1" = 0 ]; then
+        echo -ne "\033[32;1mPASS\033[0m: "
+    else
+        echo -ne "\033[31;1mFAIL\033[0m: "
+        FAILED=1
+    fi
+    echo "overlay: $2"
+}
+
+# run <test> <expectation> [options], where the options are added to the command line.
+run() {
+    TEST=$1
+    EXPECTATION=$2
+    shift 2
+    nasm -f bin -o $COMPILED $TEST || { rm -rf $TMPDIR; exit 1; }
+    $COMPUTRON --disk $DISK "$@" --run $COMPILED > $RESULT
+    diff -q $EXPECTATION $RESULT > /dev/null
+    report $? "$TEST $*"
+}
+
+seq -f '%0511g' 0 8191 > $PRISTINE
+cp $PRISTINE $DISK
+# What the image should hold once Write.asm's sector is committed.
+cp $PRISTINE $COMMITTED
+head -c 512 /dev/zero | tr '\0' O | dd of=$COMMITTED bs=512 seek=200 conv=notrunc 2>/dev/null
+
+run Write.asm Write.expected --disk-overlay $OVERLAY
+cmp -s $DISK $PRISTINE
+report $? "the write went to the overlay, not the image"
+run Read.asm Read_Modified.expected --disk-overlay $OVERLAY
+
+$COMPUTRON --discard-overlay $OVERLAY && [ ! -e $OVERLAY ]
+report $? "--discard-overlay"
+run Read.asm Read_Unmodified.expected
+cmp -s $DISK $PRISTINE
+report $? "the image is untouched after discarding"
+
+run Write.asm Write.expected --disk-overlay $OVERLAY
+$COMPUTRON --commit-overlay $OVERLAY && [ ! -e $OVERLAY ]
+report $? "--commit-overlay"
+cmp -s $DISK $COMMITTED
+report $? "the image has the committed sector"
+run Read.asm Read_Modified.expected
+
+rm -rf $TMPDIR
+exit $FAILED
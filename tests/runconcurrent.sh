@@ -0,0 +1,43 @@
+#!/bin/bash
+
+# Boots every test in one computron process, each on its own machine and thread,
+# and checks each machine's trace against the expectation.
+
+TMPDIR=`mktemp -d /tmp/computron.XXXXXX || exit 1`
+# Every machine gets the same blank 1.44M floppy as drive 0. The tests only read it.
+FLOPPY=$TMPDIR/floppy.img
+# And the same scratch hard disk as fixed0, see runtest.sh. Tests that write to it keep to
+# sectors no other test reads: IDE_WriteBack.asm writes sector 100, IDE_StringIO.asm sectors
+# 4666-4667, and IDE_DMA.asm sector 300.
+DISK=$TMPDIR/disk.img
+PROGRAM="../computron --no-gui --no-vlog --floppy $FLOPPY --disk $DISK"
+RUN_ARGS=""
+FAILED=0
+
+for TEST in *.asm ; do
+    COMPILED=$TMPDIR/$(basename $TEST .asm).bin
+    nasm -f bin -o $COMPILED $TEST || { rm -rf $TMPDIR; exit 1; }
+    RUN_ARGS="$RUN_ARGS --run $COMPILED"
+done
+
+dd if=/dev/zero of=$FLOPPY bs=1k count=1440 2>/dev/null
+seq -f '%0511g' 0 8191 > $DISK
+
+# A non-zero exit just means some job didn't finish; its .status file says which.
+$PROGRAM $RUN_ARGS
+
+for TEST in *.asm ; do
+    EXPECTATION=$(echo $TEST | sed s/.asm/.expected/)
+    RESULT=$TMPDIR/$(basename $TEST .asm).bin.out
+    STATUS=$TMPDIR/$(basename $TEST .asm).bin.status
+    if [ "$(cat $STATUS 2>/dev/null)" = "ok" ] && diff -q $EXPECTATION $RESULT >/dev/null; then
+        echo -ne "\033[32;1mPASS\033[0m: "
+    else
+        echo -ne "\033[31;1mFAIL\033[0m: "
+        FAILED=1
+    fi
+    echo $TEST
+done
+
+rm -rf $TMPDIR
+exit $FAILED
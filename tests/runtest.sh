@@ -10,7 +10,11 @@ if type -pa colordiff > /dev/null; then
 else
     FANCYDIFF=diff
 fi
-PROGRAM="../computron --no-gui --no-vlog --run"
+# Every test gets a blank 1.44M floppy as drive 0, and a 4 MiB scratch hard disk as fixed0
+# in which sector n holds n in decimal, zero-padded to 511 digits and ending in a newline.
+FLOPPY=tmp.img
+DISK=tmpdisk.img
+PROGRAM="../computron --no-gui --no-vlog --floppy $FLOPPY --disk $DISK --run"
 TEST=$1
 EXPECTATION=$(echo $TEST | sed s/.asm/.expected/)
 COMPILED=tmp.bin
@@ -21,6 +25,8 @@ nasm -f bin -o $COMPILED $TEST || \
 	  exit 1
 	}
 
+dd if=/dev/zero of=$FLOPPY bs=1k count=1440 2>/dev/null
+seq -f '%0511g' 0 8191 > $DISK
 $PROGRAM $COMPILED > $RESULT
 if [ -e $EXPECTATION ]; then
     if diff -q $EXPECTATION $RESULT >/dev/null; then
@@ -35,4 +41,4 @@ else
 fi
 echo $TEST
 
-rm -f $COMPILED $RESULT
+rm -f $COMPILED $RESULT $FLOPPY $DISK
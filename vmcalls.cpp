@@ -68,7 +68,7 @@ void vm_call8(CPU& cpu, WORD port, BYTE data) {
         break;
     default:
         vlog(LogAlert, "vm_call8: Unhandled write, %02X -> %04X", data, port);
-        hard_exit(0);
+        cpu.machine().shutDownAfterError();
         break;
     }
 }
@@ -254,29 +254,31 @@ void vm_handleE6(CPU& cpu)
 }
 
 
-static void bios_disk_read(CPU& cpu, FILE* fp, DiskDrive& drive, WORD cylinder, WORD head, WORD sector, WORD count, WORD segment, WORD offset)
+static unsigned bios_disk_read(CPU& cpu, DiskDrive& drive, WORD cylinder, WORD head, WORD sector, WORD count, WORD segment, WORD offset)
 {
     auto lba = drive.toLBA(cylinder, head, sector);
 
     if (options.disklog)
         vlog(LogDisk, "%s reading %u sectors at %u/%u/%u (LBA %u) to %04x:%04x", qPrintable(drive.name()), count, cylinder, head, sector, lba, segment, offset);
 
-    void* destination = cpu.memoryPointer(LogicalAddress(segment, offset));
-    fread(destination, drive.bytesPerSector(), count, fp);
+    BYTE* destination = cpu.memoryPointer(LogicalAddress(segment, offset));
+    unsigned transferred = drive.readSectors(lba, count, destination);
+    cpu.didModifyMemory(LinearAddress((segment << 4) + offset), count * drive.bytesPerSector());
+    return transferred;
 }
 
-static void bios_disk_write(CPU& cpu, FILE* fp, DiskDrive& drive, WORD cylinder, WORD head, WORD sector, WORD count, WORD segment, WORD offset)
+static unsigned bios_disk_write(CPU& cpu, DiskDrive& drive, WORD cylinder, WORD head, WORD sector, WORD count, WORD segment, WORD offset)
 {
     auto lba = drive.toLBA(cylinder, head, sector);
 
     if (options.disklog)
         vlog(LogDisk, "%s writing %u sectors at %u/%u/%u (LBA %u) from %04x:%04x", qPrintable(drive.name()), count, cylinder, head, sector, lba, segment, offset);
 
-    void* source = cpu.memoryPointer(LogicalAddress(segment, offset));
-    fwrite(source, drive.bytesPerSector(), count, fp);
+    BYTE* source = cpu.memoryPointer(LogicalAddress(segment, offset));
+    return drive.writeSectors(lba, count, source);
 }
 
-static void bios_disk_verify(CPU&, FILE* fp, DiskDrive& drive, WORD cylinder, WORD head, WORD sector, WORD count, WORD segment, WORD offset)
+static unsigned bios_disk_verify(CPU&, DiskDrive& drive, WORD cylinder, WORD head, WORD sector, WORD count, WORD segment, WORD offset)
 {
     auto lba = drive.toLBA(cylinder, head, sector);
 
@@ -284,13 +286,14 @@ static void bios_disk_verify(CPU&, FILE* fp, DiskDrive& drive, WORD cylinder, WO
         vlog(LogDisk, "%s verifying %u sectors at %u/%u/%u (LBA %u)", qPrintable(drive.name()), count, cylinder, head, sector, lba);
 
     BYTE dummy[count * drive.bytesPerSector()];
-    WORD veri = fread(dummy, drive.bytesPerSector(), count, fp);
+    WORD veri = drive.readSectors(lba, count, dummy);
     if (veri != count)
         vlog(LogAlert, "veri != count, something went wrong");
 
     // FIXME: Actually compare something..
     Q_UNUSED(segment);
     Q_UNUSED(offset);
+    return veri;
 }
 
 void bios_disk_call(CPU& cpu, DiskCallFunction function)
@@ -303,8 +306,8 @@ void bios_disk_call(CPU& cpu, DiskCallFunction function)
     BYTE driveIndex = cpu.getDL();
     BYTE head = cpu.getDH();
     WORD sectorCount = cpu.getAL();
-    FILE* fp;
     DWORD lba;
+    unsigned transferred = 0;
 
     DiskDrive* drive { nullptr };
     switch (driveIndex) {
@@ -341,28 +344,26 @@ void bios_disk_call(CPU& cpu, DiskCallFunction function)
         goto epilogue;
     }
 
-    fp = fopen(qPrintable(drive->imagePath()), function == WriteSectors ? "rb+" : "rb");
-    if (!fp) {
-        vlog(LogDisk, "PANIC: Could not access drive %d image!", drive);
-        hard_exit(1);
-    }
-
-    fseek(fp, lba * drive->bytesPerSector(), SEEK_SET);
-
     switch (function) {
     case ReadSectors:
-        bios_disk_read(cpu, fp, *drive, cylinder, head, sector, sectorCount, cpu.getES(), cpu.getBX());
+        transferred = bios_disk_read(cpu, *drive, cylinder, head, sector, sectorCount, cpu.getES(), cpu.getBX());
         break;
     case WriteSectors:
-        bios_disk_write(cpu, fp, *drive, cylinder, head, sector, sectorCount, cpu.getES(), cpu.getBX());
+        transferred = bios_disk_write(cpu, *drive, cylinder, head, sector, sectorCount, cpu.getES(), cpu.getBX());
         break;
     case VerifySectors:
-        bios_disk_verify(cpu, fp, *drive, cylinder, head, sector, sectorCount, cpu.getES(), cpu.getBX());
+        transferred = bios_disk_verify(cpu, *drive, cylinder, head, sector, sectorCount, cpu.getES(), cpu.getBX());
         break;
     }
 
+    if (!transferred && sectorCount) {
+        vlog(LogDisk, "PANIC: Could not access %s image!", qPrintable(drive->name()));
+        cpu.machine().shutDownAfterError();
+        error = FD_TIMEOUT;
+        goto epilogue;
+    }
+
     error = FD_NO_ERROR;
-    fclose(fp);
 
 epilogue:
     if (error == FD_NO_ERROR) {
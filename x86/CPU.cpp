@@ -30,6 +30,12 @@
 #include "pic.h"
 #include "settings.h"
 #include <unistd.h>
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include <time.h>
 #include "pit.h"
 #include "Tasking.h"
 
@@ -75,7 +81,7 @@ static bool shouldLogMemoryRead(PhysicalAddress address)
 }
 #endif
 
-CPU* g_cpu = 0;
+thread_local CPU* g_cpu = nullptr;
 
 DWORD CPU::readRegisterForAddressSize(int registerIndex)
 {
@@ -117,10 +123,17 @@ template void CPU::writeRegister<BYTE>(int, BYTE);
 template void CPU::writeRegister<WORD>(int, WORD);
 template void CPU::writeRegister<DWORD>(int, DWORD);
 
+#ifdef CT_DETERMINISTIC
+// The PIT is driven off the instruction count instead of wall-clock time.
+static const QWORD timesliceLength = 100;
+#else
+static const QWORD timesliceLength = 65536;
+#endif
+
 FLATTEN void CPU::decodeNext()
 {
 #ifdef CT_TRACE
-    if (UNLIKELY(m_isForAutotest))
+    if (UNLIKELY(m_dumpsAutotestTrace))
         dumpTrace();
 #endif
 
@@ -134,12 +147,104 @@ FLATTEN void CPU::decodeNext()
     }
 #endif
 
-    auto insn = Instruction::fromStream(*this, m_operandSize32, m_addressSize32);
+    DWORD offset = currentInstructionPointer();
+    BYTE mode = InstructionCache::modeFor(m_operandSize32, m_addressSize32);
+    PhysicalAddress physicalAddress;
+    bool cacheable = physicalAddressForInstructionCache(physicalAddress);
+    if (UNLIKELY(m_hasPendingFault))
+        return;
+
+    if (cacheable) {
+        if (auto* cachedInsn = m_instructionCache.lookup(physicalAddress, mode)) {
+            unsigned length = cachedInsn->length();
+            if (LIKELY(cachedInstructionFitsInCodeSegment(offset, length))) {
+                Instruction insn = *cachedInsn;
+                adjustInstructionPointer(length);
+                execute(insn);
+                return;
+            }
+        }
+    }
+
+    const BYTE* code = cacheable ? hostPointerForCode(physicalAddress) : nullptr;
+    InstructionFetchWindow window(*this, code, code ? fetchWindowSize(physicalAddress, offset) : 0);
+    auto insn = Instruction::fromStream(window, m_operandSize32, m_addressSize32);
+    window.commit();
     if (!insn.isValid())
         throw InvalidOpcode();
+    if (cacheable)
+        cacheInstruction(physicalAddress, mode, offset, insn);
     execute(insn);
 }
 
+// Returns false if the instruction can't be cached. In that case a fault may be pending.
+ALWAYS_INLINE bool CPU::physicalAddressForInstructionCache(PhysicalAddress& physicalAddress)
+{
+    auto& descriptor = cachedDescriptor(SegmentRegisterIndex::CS);
+    DWORD offset = currentInstructionPointer();
+    if (UNLIKELY(getPE() && !getVM() && offset > descriptor.effectiveLimit())) {
+        if (options.unwindFaults)
+            return false;
+        return signalFault(GeneralProtectionFault(descriptor.index(), "Access outside segment limit"));
+    }
+    if (UNLIKELY(!translateAddressWithoutUnwinding(descriptor.linearAddress(offset), MemoryAccessType::Execute, physicalAddress)))
+        return false;
+#ifdef A20_ENABLED
+    physicalAddress.mask(a20Mask());
+#endif
+    return physicalAddress.get() < m_memorySize;
+}
+
+// Returns a pointer to the code at this physical address, valid up to the end of its page.
+const BYTE* CPU::hostPointerForCode(PhysicalAddress physicalAddress)
+{
+    BYTE* pagePointer = m_physicalMemoryMap.page(physicalAddress).readPointer;
+    if (!pagePointer)
+        return nullptr;
+    return pagePointer + (physicalAddress.get() & 0xfff);
+}
+
+// How many bytes we can fetch from the current instruction pointer before having to worry about
+// the end of the page, the CS limit or 16-bit wrap-around.
+ALWAYS_INLINE unsigned CPU::fetchWindowSize(PhysicalAddress physicalAddress, DWORD offset) const
+{
+    DWORD size = 4096 - (physicalAddress.get() & 0xfff);
+    if (!x32() && 0x10000 - offset < size)
+        size = 0x10000 - offset;
+    if (getPE() && !getVM()) {
+        // physicalAddressForInstructionCache() has already made sure that offset <= limit.
+        DWORD limit = cachedDescriptor(SegmentRegisterIndex::CS).effectiveLimit();
+        if (limit - offset < size)
+            size = limit - offset + 1;
+    }
+    return size;
+}
+
+ALWAYS_INLINE bool CPU::cachedInstructionFitsInCodeSegment(DWORD offset, unsigned length) const
+{
+    // If not, we take the slow path and let it wrap around or fault like it normally would.
+    if (!x32() && offset + length > 0x10000)
+        return false;
+    if (getPE() && !getVM() && offset + length - 1 > cachedDescriptor(SegmentRegisterIndex::CS).effectiveLimit())
+        return false;
+    return true;
+}
+
+void CPU::cacheInstruction(PhysicalAddress physicalAddress, BYTE mode, DWORD offset, const Instruction& insn)
+{
+    unsigned length = insn.length();
+    if (length > InstructionCache::maxInstructionLength)
+        return;
+    if ((physicalAddress.get() & 0xfff) + length > 4096)
+        return;
+    if (physicalAddress.get() + length > m_memorySize)
+        return;
+    if (!cachedInstructionFitsInCodeSegment(offset, length))
+        return;
+    if (m_instructionCache.insert(physicalAddress, mode, insn))
+        dropTLBHostWritePointers(PhysicalAddress(physicalAddress.get() & 0xfffff000));
+}
+
 FLATTEN void CPU::execute(Instruction& insn)
 {
 #ifdef CRASH_ON_OPCODE_00_00
@@ -182,36 +287,122 @@ void CPU::_VKILL(Instruction&)
     }
     vlog(LogCPU, "0xF1: Secret shutdown command received!");
     //dumpAll();
-    hard_exit(0);
+    if (options.benchmark)
+        dumpBenchmarkResults();
+    queueCommand(Shutdown);
 }
 
 void CPU::setMemorySizeAndReallocateIfNeeded(DWORD size)
 {
+    // The physical memory map deals in whole pages, so round up rather than leave a partial page unmapped.
+    if (DWORD partialPage = size % PhysicalMemoryMap::pageSize)
+        size += PhysicalMemoryMap::pageSize - partialPage;
     if (m_memorySize == size)
         return;
-    delete [] m_memory;
+    QElapsedTimer allocationTimer;
+    allocationTimer.start();
+    releaseMemory();
     m_memorySize = size;
-    m_memory = new BYTE[m_memorySize];
-    if (!m_memory) {
+    m_memory = allocateMemory(m_memorySize);
+    if (!m_memory && m_memorySize) {
         vlog(LogInit, "Insufficient memory available.");
         hard_exit(1);
     }
-    memset(m_memory, 0x0, m_memorySize);
+    m_memoryAllocationNanoseconds = allocationTimer.nsecsElapsed();
+    m_instructionCache.setMemorySize(m_memorySize);
+    rebuildPhysicalMemoryMap();
+}
+
+// Guest RAM comes straight from the kernel and is zero-filled a page at a time as the guest touches it,
+// so a big guest doesn't cost anything up front. With --memory-file it's a shared mapping of that file
+// instead (keeping whatever the file held), which other processes can inspect or map copy-on-write.
+BYTE* CPU::allocateMemory(size_t size)
+{
+    if (!size)
+        return nullptr;
+#ifdef HAVE_MMAP
+    void* memory;
+    if (options.memoryFile.isEmpty()) {
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    } else {
+        int fd = open(qPrintable(options.memoryFile), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            vlog(LogInit, "Couldn't open memory file %s", qPrintable(options.memoryFile));
+            return nullptr;
+        }
+        // Grow the file if it's too small, but never cut off what it already holds.
+        struct stat st;
+        if (fstat(fd, &st) < 0 || ((size_t)st.st_size < size && ftruncate(fd, size) < 0)) {
+            vlog(LogInit, "Couldn't resize memory file %s to %zu bytes", qPrintable(options.memoryFile), size);
+            close(fd);
+            return nullptr;
+        }
+        memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+    }
+    if (memory == MAP_FAILED)
+        return nullptr;
+#ifdef MADV_HUGEPAGE
+    madvise(memory, size, MADV_HUGEPAGE);
+#endif
+    return static_cast<BYTE*>(memory);
+#else
+    BYTE* memory = new BYTE[size];
+    memset(memory, 0, size);
+    return memory;
+#endif
+}
+
+void CPU::releaseMemory()
+{
+    if (!m_memory)
+        return;
+#ifdef HAVE_MMAP
+    munmap(m_memory, m_memorySize);
+#else
+    delete [] m_memory;
+#endif
+    m_memory = nullptr;
+}
+
+void CPU::rebuildPhysicalMemoryMap()
+{
+    m_physicalMemoryMap.clear();
+    m_physicalMemoryMap.mapRAM(PhysicalAddress(0), m_memorySize, m_memory);
+    for (auto* provider : m_memoryProviders)
+        m_physicalMemoryMap.mapProvider(*provider);
+    flushTLB();
+}
+
+void CPU::setA20Enabled(bool value)
+{
+    if (m_a20Enabled == value)
+        return;
+    m_a20Enabled = value;
+    // TLB host pointers were computed with the old A20 mask.
+    flushTLB();
+}
+
+void CPU::setControlRegister(int registerIndex, DWORD value)
+{
+    if (registerIndex == 3 || (registerIndex == 0 && ((m_CR0 ^ value) & (CR0::PG | CR0::WP))))
+        flushTLB();
+    *m_controlRegisterMap[registerIndex] = value;
 }
 
 CPU::CPU(Machine& m)
     : m_machine(m)
 {
     m_isForAutotest = machine().isForAutotest();
+    m_dumpsAutotestTrace = m_isForAutotest && !options.benchmark;
+    m_blockCacheEnabled = options.blockCache;
 
     buildOpcodeTablesIfNeeded();
 
-    ASSERT(!g_cpu);
     g_cpu = this;
 
-    setMemorySizeAndReallocateIfNeeded(8192 * 1024);
-
-    memset(m_memoryProviders, 0, sizeof(m_memoryProviders));
+    // Guest RAM is allocated once Machine::applySettings() knows how much there should be.
+    // Allocating a default size here first would truncate a --memory-file to that size.
 
     m_debugger = make<Debugger>(*this);
 
@@ -257,7 +448,9 @@ CPU::CPU(Machine& m)
 void CPU::reset()
 {
     m_a20Enabled = false;
-    m_nextInstructionIsUninterruptible = false;
+    clearPendingWork(PendingWork::Uninterruptible);
+
+    flushTLB();
 
     memset(&m_generalPurposeRegister, 0, sizeof(m_generalPurposeRegister));
     m_CR0 = 0;
@@ -330,6 +523,10 @@ void CPU::reset()
     m_lastOpSize = ByteSize;
 
     m_cycle = 0;
+    m_timesliceEnd = timesliceLength - 1;
+
+    m_hasPendingFault = false;
+    m_benchmarkTimer.start();
 
     initWatches();
 
@@ -338,8 +535,9 @@ void CPU::reset()
 
 CPU::~CPU()
 {
-    delete [] m_memory;
-    m_memory = nullptr;
+    if (g_cpu == this)
+        g_cpu = nullptr;
+    releaseMemory();
 }
 
 class InstructionExecutionContext {
@@ -350,36 +548,324 @@ private:
     CPU& m_cpu;
 };
 
-FLATTEN void CPU::executeOneInstruction()
+// Runs one instruction with execute() and delivers the fault it raised, be it thrown or signalled.
+// Returns false if the instruction didn't complete.
+template<typename Callback>
+ALWAYS_INLINE bool CPU::runInstruction(Callback execute)
 {
     try {
         InstructionExecutionContext context(*this);
-        decodeNext();
-    } catch(Exception e) {
-        dumpDisassembled(cachedDescriptor(SegmentRegisterIndex::CS), m_baseEIP, 3);
-        raiseException(e);
+        execute();
+    } catch(const Exception& e) {
+        ++m_unwoundFaults;
+        deliverFault(e);
+        return false;
     } catch(HardwareInterruptDuringREP) {
         setEIP(currentBaseInstructionPointer());
+        return false;
     }
+    if (UNLIKELY(m_hasPendingFault)) {
+        ++m_signalledFaults;
+        deliverFault(takePendingFault());
+        return false;
+    }
+    return true;
+}
+
+FLATTEN void CPU::executeOneInstruction()
+{
+    runInstruction([this] { decodeNext(); });
+}
+
+FLATTEN bool CPU::executeBlockInstruction(const Instruction& cachedInsn)
+{
+    return runInstruction([&] {
+#ifdef CT_TRACE
+        if (UNLIKELY(m_dumpsAutotestTrace))
+            dumpTrace();
+#endif
+        Instruction insn = cachedInsn;
+        adjustInstructionPointer(insn.length());
+        execute(insn);
+    });
+}
+
+FLATTEN void CPU::executeBlock()
+{
+    DWORD offset = currentInstructionPointer();
+    BYTE mode = InstructionCache::modeFor(m_operandSize32, m_addressSize32);
+    PhysicalAddress physicalAddress;
+    if (!physicalAddressForBlock(physicalAddress)) {
+        executeOneInstruction();
+        return;
+    }
+
+    auto* block = m_instructionCache.lookupBlock(physicalAddress, mode);
+    if (!block && m_instructionCache.recordBlockEntry(physicalAddress))
+        block = buildBlock(physicalAddress, mode);
+    if (!block || !cachedInstructionFitsInCodeSegment(offset, block->length)) {
+        executeOneInstruction();
+        return;
+    }
+
+    ++block->executions;
+
+    // The block may be thrown away by one of its own instructions, so don't touch it after
+    // an invalidation, and bail whenever the main loop has work to do between instructions.
+    WORD cs = getCS();
+    QWORD blockInvalidations = m_instructionCache.blockInvalidations();
+    QWORD tlbFlushes = m_tlbFlushes;
+    unsigned count = block->instructions.size();
+    unsigned executed = 0;
+    DWORD nextOffset = offset;
+    for (unsigned i = 0; i < count; ++i) {
+        nextOffset += block->instructions[i].length();
+        if (!executeBlockInstruction(block->instructions[i]))
+            break;
+        ++executed;
+        if (UNLIKELY(shouldLeaveStraightLineCode()))
+            break;
+        if (m_instructionCache.blockInvalidations() != blockInvalidations || m_tlbFlushes != tlbFlushes)
+            break;
+        if (getCS() != cs || currentInstructionPointer() != nextOffset)
+            break;
+    }
+    m_instructionCache.didExecuteBlockInstructions(executed);
+}
+
+static bool endsBlock(const Instruction& insn)
+{
+    if (insn.hasSubOp()) {
+        BYTE op = insn.subOp();
+        // Jcc, descriptor table and control/debug register access, CLTS, UD0/1/2.
+        return (op >= 0x80 && op <= 0x8F)
+            || op == 0x00 || op == 0x01 || op == 0x06 || op == 0x0B
+            || (op >= 0x20 && op <= 0x23)
+            || op == 0xB9 || op == 0xFF;
+    }
+    BYTE op = insn.op();
+    // Jcc, LOOP/JCXZ
+    if ((op >= 0x70 && op <= 0x7F) || (op >= 0xE0 && op <= 0xE3))
+        return true;
+    // IN/OUT/INS/OUTS
+    if ((op >= 0xE4 && op <= 0xE7) || (op >= 0xEC && op <= 0xEF) || (op >= 0x6C && op <= 0x6F))
+        return true;
+    switch (op) {
+    case 0x9A: case 0xE8: case 0xE9: case 0xEA: case 0xEB: // CALL, JMP
+    case 0xC2: case 0xC3: case 0xCA: case 0xCB: // RET
+    case 0xCC: case 0xCD: case 0xCE: case 0xCF: // INT, IRET
+    case 0xF1: case 0xF4: // VKILL, HLT
+        return true;
+    case 0xFF: // Indirect CALL/JMP
+        return insn.slash() >= 2 && insn.slash() <= 5;
+    default:
+        return false;
+    }
+}
+
+InstructionBlock* CPU::buildBlock(PhysicalAddress physicalAddress, BYTE mode)
+{
+    const BYTE* code = hostPointerForCode(physicalAddress);
+    if (!code)
+        return nullptr;
+    DWORD bytesLeftInPage = 4096 - (physicalAddress.get() & 0xfff);
+
+    // Decode from a zero-padded copy so that the last instruction can't read past the end of the page.
+    BYTE buffer[4096 + InstructionCache::maxInstructionLength];
+    memcpy(buffer, code, bytesLeftInPage);
+    memset(buffer + bytesLeftInPage, 0, sizeof(buffer) - bytesLeftInPage);
+
+    auto block = make<InstructionBlock>();
+    block->address = physicalAddress.get();
+    block->mode = mode;
+
+    SimpleInstructionStream stream(buffer);
+    while (block->instructions.size() < (int)InstructionCache::maxBlockInstructions) {
+        auto insn = Instruction::fromStream(stream, m_operandSize32, m_addressSize32);
+        if (!insn.isValid())
+            break;
+        unsigned length = insn.length();
+        if (length > InstructionCache::maxInstructionLength || block->length + length > bytesLeftInPage)
+            break;
+        block->instructions.append(insn);
+        block->length += length;
+        if (endsBlock(insn))
+            break;
+    }
+
+    if (block->instructions.isEmpty())
+        return nullptr;
+
+    bool wasCodePage = m_instructionCache.isCodePage(physicalAddress);
+    auto* insertedBlock = m_instructionCache.insertBlock(std::move(block));
+    if (!wasCodePage)
+        dropTLBHostWritePointers(PhysicalAddress(physicalAddress.get() & 0xfffff000));
+    return insertedBlock;
+}
+
+// CPU time used by this thread only, so other machines and the GUI don't count against the halted CPU.
+static QWORD hostCPUTimeNanoseconds()
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) < 0)
+        return 0;
+    return (QWORD)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool CPU::hasWakeupReason() const
+{
+    if (m_shouldHardReboot || m_shouldShutDown || m_debuggerRequest != NoDebuggerRequest || m_debugger->isActive())
+        return true;
+    if (pendingWork() & PendingWork::DeviceCompletion)
+        return true;
+    return (pendingWork() & PendingWork::IRQ) && getIF();
+}
+
+bool CPU::shouldStayHalted() const
+{
+    return state() == CPU::Halted && !hasWakeupReason();
+}
+
+static const unsigned long maximumHaltWaitMilliseconds = 100;
+
+// Never sleep past the PIT's next IRQ. Outside of autotests the PIT also checks its counters
+// off a host timer and wakes us itself, but autotests have nothing else driving it.
+unsigned long CPU::haltWaitMilliseconds() const
+{
+    SIGNED_QWORD nanoseconds = machine().pit().nanosecondsUntilNextIRQ();
+    if (nanoseconds < 0)
+        return maximumHaltWaitMilliseconds;
+    // Round up, and always sleep a little so a pending IRQ masked by IF=0 doesn't make us spin.
+    return qBound<SIGNED_QWORD>(1, (nanoseconds + 999999) / 1000000, maximumHaltWaitMilliseconds);
+}
+
+// Sleeps until someone calls wakeFromHalt(), but never past the next timer IRQ. Returns false on timeout.
+bool CPU::waitForWakeup()
+{
+    bool wasWoken = true;
+    unsigned long timeout = haltWaitMilliseconds();
+    {
+        QMutexLocker locker(&m_haltMutex);
+        if (state() == CPU::Halted ? shouldStayHalted() : !hasWakeupReason())
+            wasWoken = m_haltCondition.wait(&m_haltMutex, timeout);
+    }
+    ++m_haltWakeups;
+
+    // Autotests have no event loop to drive the PIT, so the idle CPU does it instead.
+    if (!wasWoken && m_isForAutotest)
+        machine().pit().checkCounters();
+    return wasWoken;
 }
 
 void CPU::haltedLoop()
 {
+    QElapsedTimer haltedTimer;
+    haltedTimer.start();
+    QWORD hostCPUTimeAtHalt = hostCPUTimeNanoseconds();
+
     while (state() == CPU::Halted) {
-#ifdef HAVE_USLEEP
-        usleep(100);
-#endif
+        if (m_shouldShutDown)
+            break;
         if (m_shouldHardReboot) {
             hardReboot();
-            return;
+            break;
         }
+        if (m_debuggerRequest != NoDebuggerRequest)
+            mainLoopSlowStuff();
         if (debugger().isActive()) {
             saveBaseAddress();
             debugger().doConsole();
         }
-        if (PIC::hasPendingIRQ() && getIF())
-            PIC::serviceIRQ(*this);
+        if (pendingWork() & PendingWork::DeviceCompletion) {
+            clearPendingWork(PendingWork::DeviceCompletion);
+            machine().runDeviceCompletions();
+        }
+        if (pendingWork() & PendingWork::IRQ) {
+            updateIRQPendingWork();
+            if (pendingWork() & PendingWork::IRQ) {
+                PIC::serviceIRQ(*this);
+                continue;
+            }
+        }
+        waitForWakeup();
     }
+
+    m_haltedNanoseconds += haltedTimer.nsecsElapsed();
+    m_haltedHostCPUNanoseconds += hostCPUTimeNanoseconds() - hostCPUTimeAtHalt;
+}
+
+static const unsigned idleLoopMaxInstructions = 16;
+static const unsigned idleLoopIterationsBeforeIdling = 64;
+
+void CPU::detectIdleLoop()
+{
+    auto& candidate = m_idleLoopCandidate;
+    LogicalAddress branch(getBaseCS(), currentBaseInstructionPointer());
+    bool isSameLoop = candidate.branch.selector() == branch.selector() && candidate.branch.offset() == branch.offset()
+        && m_cycle - candidate.cycle <= idleLoopMaxInstructions
+        && m_stores == candidate.stores;
+
+    candidate.cycle = m_cycle;
+    candidate.stores = m_stores;
+
+    DWORD registers[8];
+    for (unsigned i = 0; i < 8; ++i)
+        registers[i] = m_generalPurposeRegister[i].fullDWORD;
+
+    if (!isSameLoop || memcmp(registers, candidate.registers, sizeof(registers))) {
+        candidate.branch = branch;
+        memcpy(candidate.registers, registers, sizeof(registers));
+        candidate.hasFlags = false;
+        candidate.iterations = 0;
+        return;
+    }
+
+    // The registers came back unchanged; only now is it worth materializing the flags.
+    DWORD flags = getEFlags();
+    if (!candidate.hasFlags || flags != candidate.flags) {
+        candidate.flags = flags;
+        candidate.hasFlags = true;
+        candidate.iterations = 0;
+        return;
+    }
+
+    if (++candidate.iterations < idleLoopIterationsBeforeIdling)
+        return;
+    candidate.iterations = 0;
+
+    // With IF=0 or every IRQ masked, nothing would end the wait early; the loop is polling
+    // something like the CMOS UIP bit or the KBC status that changes on its own, so let it spin.
+    if (!getIF() || !PIC::hasUnmaskedIRQ(machine()))
+        return;
+    ++m_idleLoops[candidate.branch];
+
+    // We're in the middle of the branch instruction, so leave the sleeping to handlePendingWork().
+    setPendingWork(PendingWork::IdleLoop);
+}
+
+// The guest has gone around the same short loop many times with IF=1, only reading memory nothing
+// has stored to and I/O ports that keep returning the same value, so it's waiting on an IRQ.
+// Don't let it spin at full host speed, but don't sleep past the next timer IRQ either.
+void CPU::idleUntilWakeup()
+{
+#ifdef CT_DETERMINISTIC
+    // Virtual time is measured in instructions here, so skip straight to the end of the timeslice.
+    if (m_cycle < m_timesliceEnd)
+        m_cycle = m_timesliceEnd;
+#else
+    QElapsedTimer idleTimer;
+    idleTimer.start();
+    QWORD hostCPUTimeAtIdle = hostCPUTimeNanoseconds();
+    waitForWakeup();
+    m_haltedNanoseconds += idleTimer.nsecsElapsed();
+    m_haltedHostCPUNanoseconds += hostCPUTimeNanoseconds() - hostCPUTimeAtIdle;
+#endif
+}
+
+void CPU::wakeFromHalt()
+{
+    QMutexLocker locker(&m_haltMutex);
+    m_haltCondition.wakeAll();
 }
 
 void CPU::queueCommand(Command command)
@@ -394,8 +880,12 @@ void CPU::queueCommand(Command command)
     case HardReboot:
         m_shouldHardReboot = true;
         break;
+    case Shutdown:
+        m_shouldShutDown = true;
+        break;
     }
     recomputeMainLoopNeedsSlowStuff();
+    wakeFromHalt();
 }
 
 void CPU::hardReboot()
@@ -407,17 +897,22 @@ void CPU::hardReboot()
 
 void CPU::makeNextInstructionUninterruptible()
 {
-    m_nextInstructionIsUninterruptible = true;
+    setPendingWork(PendingWork::Uninterruptible);
 }
 
 void CPU::recomputeMainLoopNeedsSlowStuff()
 {
-    m_mainLoopNeedsSlowStuff = m_debuggerRequest != NoDebuggerRequest ||
-                               m_shouldHardReboot ||
-                               options.trace ||
-                               !m_breakpoints.empty() ||
-                               debugger().isActive() ||
-                               !m_watches.isEmpty();
+    bool needsSlowStuff = m_debuggerRequest != NoDebuggerRequest ||
+                          m_shouldHardReboot ||
+                          m_shouldShutDown ||
+                          options.trace ||
+                          !m_breakpoints.empty() ||
+                          debugger().isActive() ||
+                          !m_watches.isEmpty();
+    if (needsSlowStuff)
+        setPendingWork(PendingWork::SlowStuff);
+    else
+        clearPendingWork(PendingWork::SlowStuff);
 }
 
 NEVER_INLINE bool CPU::mainLoopSlowStuff()
@@ -460,24 +955,37 @@ NEVER_INLINE bool CPU::mainLoopSlowStuff()
     return true;
 }
 
-FLATTEN void CPU::mainLoop()
+void CPU::didReachEndOfTimeslice()
 {
-    forever {
-        if (UNLIKELY(m_mainLoopNeedsSlowStuff)) {
-            mainLoopSlowStuff();
-        }
+#ifdef CT_DETERMINISTIC
+    if (getIF())
+        machine().pit().raiseIRQ();
+#endif
+    // Timeslices end whenever (cycle + 1) is a multiple of the timeslice length.
+    m_timesliceEnd = ((m_cycle + 1) / timesliceLength + 1) * timesliceLength - 1;
+}
 
-        executeOneInstruction();
+// Runs between two instructions, whenever the pending work word is non-zero or the timeslice is over.
+NEVER_INLINE void CPU::handlePendingWork()
+{
+    // Completions may raise IRQs, so deliver them before looking at the PIC.
+    if (pendingWork() & PendingWork::DeviceCompletion) {
+        clearPendingWork(PendingWork::DeviceCompletion);
+        machine().runDeviceCompletions();
+    }
 
+    if (pendingWork() & PendingWork::Uninterruptible) {
         // FIXME: An obvious optimization here would be to dispatch next insn directly from whoever put us in this state.
         // Easy to implement: just call executeOneInstruction() in e.g "POP SS"
         // I'll do this once things feel more trustworthy in general.
-        if (UNLIKELY(m_nextInstructionIsUninterruptible)) {
-            m_nextInstructionIsUninterruptible = false;
-            continue;
+        clearPendingWork(PendingWork::Uninterruptible);
+    } else {
+        if (pendingWork() & PendingWork::IdleLoop) {
+            clearPendingWork(PendingWork::IdleLoop);
+            idleUntilWakeup();
         }
 
-        if (UNLIKELY(getTF())) {
+        if (pendingWork() & PendingWork::Trap) {
             // The Trap Flag is set, so we'll execute one instruction and
             // call ISR 1 as soon as it's finished.
             //
@@ -486,14 +994,40 @@ FLATTEN void CPU::mainLoop()
             interrupt(1, InterruptSource::Internal);
         }
 
-        if (PIC::hasPendingIRQ() && getIF())
-            PIC::serviceIRQ(*this);
+        if (pendingWork() & PendingWork::IRQ) {
+            // The PIC sets the bit from any thread without looking at IF, so recompute it here.
+            updateIRQPendingWork();
+            if (pendingWork() & PendingWork::IRQ)
+                PIC::serviceIRQ(*this);
+        }
+
+        if (m_cycle >= m_timesliceEnd)
+            didReachEndOfTimeslice();
+    }
 
-#ifdef CT_DETERMINISTIC
-        if (getIF() && ((cycle() + 1) % 100 == 0)) {
-            machine().pit().raiseIRQ();
+    if (pendingWork() & PendingWork::SlowStuff)
+        mainLoopSlowStuff();
+}
+
+FLATTEN void CPU::mainLoop()
+{
+    g_cpu = this;
+
+    // A restored snapshot may have been taken in HLT.
+    if (state() == CPU::Halted)
+        haltedLoop();
+
+    forever {
+        if (UNLIKELY(shouldLeaveStraightLineCode())) {
+            if (UNLIKELY(m_shouldShutDown))
+                return;
+            handlePendingWork();
         }
-#endif
+
+        if (m_blockCacheEnabled)
+            executeBlock();
+        else
+            executeOneInstruction();
     }
 }
 
@@ -598,14 +1132,14 @@ void CPU::protectedModeFarJump(LogicalAddress address, JumpType type, Gate* gate
     auto descriptor = getDescriptor(selector, SegmentRegisterIndex::CS);
 
     if (descriptor.isNull()) {
-        throw GeneralProtectionFault(0, QString("%1 to null selector").arg(toString(type)));
+        throw GeneralProtectionFault(0, ExceptionReason("%1 to null selector", toString(type)));
     }
 
     if (descriptor.isOutsideTableLimits())
-        throw GeneralProtectionFault(selector, QString("%1 to selector outside table limit").arg(toString(type)));
+        throw GeneralProtectionFault(selector, ExceptionReason("%1 to selector outside table limit", toString(type)));
 
     if (!descriptor.isCode() && !descriptor.isCallGate() && !descriptor.isTaskGate() && !descriptor.isTSS())
-        throw GeneralProtectionFault(selector, QString("%1 to invalid descriptor type").arg(toString(type)));
+        throw GeneralProtectionFault(selector, ExceptionReason("%1 to invalid descriptor type", toString(type)));
 
     if (descriptor.isGate() && gate) {
         dumpDescriptor(*gate);
@@ -629,13 +1163,13 @@ void CPU::protectedModeFarJump(LogicalAddress address, JumpType type, Gate* gate
         }
 
         if (gate.DPL() < getCPL())
-            throw GeneralProtectionFault(selector, QString("%1 to gate with DPL(%2) < CPL(%3)").arg(toString(type)).arg(gate.DPL()).arg(getCPL()));
+            throw GeneralProtectionFault(selector, ExceptionReason("%1 to gate with DPL(%2) < CPL(%3)", toString(type), gate.DPL(), getCPL()));
 
         if (selectorRPL > gate.DPL())
-            throw GeneralProtectionFault(selector, QString("%1 to gate with RPL(%2) > DPL(%3)").arg(toString(type)).arg(selectorRPL).arg(gate.DPL()));
+            throw GeneralProtectionFault(selector, ExceptionReason("%1 to gate with RPL(%2) > DPL(%3)", toString(type), selectorRPL, gate.DPL()));
 
         if (!gate.present()) {
-            throw NotPresent(selector, QString("Gate not present"));
+            throw NotPresent(selector, "Gate not present");
         }
 
         // NOTE: We recurse here, jumping to the gate entry point.
@@ -651,9 +1185,9 @@ void CPU::protectedModeFarJump(LogicalAddress address, JumpType type, Gate* gate
         vlog(LogCPU, "%s to TSS descriptor (%s) -> %08x", toString(type), tssDescriptor.typeName(), tssDescriptor.base());
 #endif
         if (tssDescriptor.DPL() < getCPL())
-            throw GeneralProtectionFault(selector, QString("%1 to TSS descriptor with DPL < CPL").arg(toString(type)));
+            throw GeneralProtectionFault(selector, ExceptionReason("%1 to TSS descriptor with DPL < CPL", toString(type)));
         if (tssDescriptor.DPL() < selectorRPL)
-            throw GeneralProtectionFault(selector, QString("%1 to TSS descriptor with DPL < RPL").arg(toString(type)));
+            throw GeneralProtectionFault(selector, ExceptionReason("%1 to TSS descriptor with DPL < RPL", toString(type)));
         if (!tssDescriptor.present())
             throw NotPresent(selector, "TSS not present");
         taskSwitch(tssDescriptor, type);
@@ -666,14 +1200,14 @@ void CPU::protectedModeFarJump(LogicalAddress address, JumpType type, Gate* gate
     if ((type == JumpType::CALL || type == JumpType::JMP) && !gate) {
         if (codeSegment.conforming()) {
             if (codeSegment.DPL() > getCPL()) {
-                throw GeneralProtectionFault(selector, QString("%1 -> Code segment DPL(%2) > CPL(%3)").arg(toString(type)).arg(codeSegment.DPL()).arg(getCPL()));
+                throw GeneralProtectionFault(selector, ExceptionReason("%1 -> Code segment DPL(%2) > CPL(%3)", toString(type), codeSegment.DPL(), getCPL()));
             }
         } else {
             if (selectorRPL > codeSegment.DPL()) {
-                throw GeneralProtectionFault(selector, QString("%1 -> Code segment RPL(%2) > CPL(%3)").arg(toString(type)).arg(selectorRPL).arg(codeSegment.DPL()));
+                throw GeneralProtectionFault(selector, ExceptionReason("%1 -> Code segment RPL(%2) > CPL(%3)", toString(type), selectorRPL, codeSegment.DPL()));
             }
             if (codeSegment.DPL() != getCPL()) {
-                throw GeneralProtectionFault(selector, QString("%1 -> Code segment DPL(%2) != CPL(%3)").arg(toString(type)).arg(codeSegment.DPL()).arg(getCPL()));
+                throw GeneralProtectionFault(selector, ExceptionReason("%1 -> Code segment DPL(%2) != CPL(%3)", toString(type), codeSegment.DPL(), getCPL()));
             }
         }
     }
@@ -689,7 +1223,7 @@ void CPU::protectedModeFarJump(LogicalAddress address, JumpType type, Gate* gate
     }
 
     if (!codeSegment.present()) {
-        throw NotPresent(selector, QString("Code segment not present"));
+        throw NotPresent(selector, "Code segment not present");
     }
 
     if (offset > codeSegment.effectiveLimit()) {
@@ -723,7 +1257,7 @@ void CPU::protectedModeFarJump(LogicalAddress address, JumpType type, Gate* gate
         }
 
         if (newSSDescriptor.DPL() != descriptor.DPL()) {
-            throw InvalidTSS(newSS, QString("New ss DPL(%1) != code segment DPL(%2)").arg(newSSDescriptor.DPL()).arg(descriptor.DPL()));
+            throw InvalidTSS(newSS, ExceptionReason("New ss DPL(%1) != code segment DPL(%2)", newSSDescriptor.DPL(), descriptor.DPL()));
         }
 
         if (!newSSDescriptor.isData() || !newSSDescriptor.asDataSegmentDescriptor().writable()) {
@@ -816,7 +1350,7 @@ void CPU::protectedFarReturn(WORD stackAdjustment)
     }
 
     if (selectorRPL < getCPL())
-        throw GeneralProtectionFault(selector, QString("RETF with RPL(%1) < CPL(%2)").arg(selectorRPL).arg(getCPL()));
+        throw GeneralProtectionFault(selector, ExceptionReason("RETF with RPL(%1) < CPL(%2)", selectorRPL, getCPL()));
 
     auto& codeSegment = descriptor.asCodeSegmentDescriptor();
 
@@ -904,7 +1438,7 @@ void CPU::_NOP(Instruction&)
 void CPU::_HLT(Instruction&)
 {
     if (getCPL() != 0) {
-        throw GeneralProtectionFault(0, QString("HLT with CPL!=0(%1)").arg(getCPL()));
+        throw GeneralProtectionFault(0, ExceptionReason("HLT with CPL!=0(%1)", getCPL()));
     }
 
     setState(CPU::Halted);
@@ -964,20 +1498,18 @@ template<typename T, class Accessor>
 void CPU::doDEC(Accessor accessor)
 {
     T value = accessor.get();
-    setOF(value == (T)std::numeric_limits<typename std::make_signed<T>::type>::min());
-    accessor.set(--value);
-    adjustFlag32(value, value + 1, 1);
-    updateFlags<T>(value);
+    T result = value - 1;
+    accessor.set(result);
+    recordIncDec(result, value, TypeTrivia<T>::bits, true);
 }
 
 template<typename T, class Accessor>
 void CPU::doINC(Accessor accessor)
 {
     T value = accessor.get();
-    setOF(value == (T)std::numeric_limits<typename std::make_signed<T>::type>::max());
-    accessor.set(++value);
-    adjustFlag32(value, value - 1, 1);
-    updateFlags<T>(value);
+    T result = value + 1;
+    accessor.set(result);
+    recordIncDec(result, value, TypeTrivia<T>::bits, false);
 }
 
 void CPU::_DEC_reg16(Instruction& insn)
@@ -1108,15 +1640,29 @@ void CPU::_LEA_reg16_mem16(Instruction& insn)
 }
 
 // FIXME: Have VGA listen for writes to 0xB8000 somehow?
-inline void CPU::didTouchMemory(DWORD address)
+inline void CPU::didTouchMemory(DWORD address, DWORD size)
 {
+    ++m_stores;
+
+    if (UNLIKELY(m_instructionCache.mayContainCode(address) || m_instructionCache.mayContainCode(address + size - 1)))
+        m_instructionCache.invalidate(PhysicalAddress(address), size);
+
     bool shouldNotifyScreen = false;
-    if (address >= 0xB8000 && address < 0xC0000)
+    if (address < 0xC0000 && address + size > 0xB8000)
         shouldNotifyScreen = true;
     if (shouldNotifyScreen)
         machine().notifyScreen();
 }
 
+void CPU::didModifyMemory(LinearAddress linearAddress, DWORD size)
+{
+    auto physicalAddress = translateAddress(linearAddress, MemoryAccessType::InternalPointer);
+#ifdef A20_ENABLED
+    physicalAddress.mask(a20Mask());
+#endif
+    didTouchMemory(physicalAddress.get(), size);
+}
+
 static const char* toString(CPU::MemoryAccessType type)
 {
     switch (type) {
@@ -1128,13 +1674,134 @@ static const char* toString(CPU::MemoryAccessType type)
     }
 }
 
-ALWAYS_INLINE PhysicalAddress CPU::translateAddress(LinearAddress linearAddress, MemoryAccessType accessType)
+static ALWAYS_INLINE unsigned tlbTagIndex(CPU::MemoryAccessType accessType)
+{
+    switch (accessType) {
+    case CPU::MemoryAccessType::Write: return 1;
+    case CPU::MemoryAccessType::Execute: return 2;
+    default: return 0;
+    }
+}
+
+static ALWAYS_INLINE DWORD tlbTag(LinearAddress linearAddress)
 {
+    // Bit 0 is never set in a page address, so we use it to tell valid tags from empty ones.
+    return (linearAddress.get() & 0xfffff000) | 1;
+}
+
+ALWAYS_INLINE CPU::TLBEntry& CPU::tlbEntry(LinearAddress linearAddress, bool inUserMode)
+{
+    return m_tlb[inUserMode][(linearAddress.get() >> 12) & (tlbSize - 1)];
+}
+
+void CPU::flushTLB()
+{
+    memset(m_tlb, 0, sizeof(m_tlb));
+    ++m_tlbFlushes;
+}
+
+void CPU::invalidateTLBEntry(LinearAddress linearAddress)
+{
+    DWORD tag = tlbTag(linearAddress);
+    for (bool inUserMode : { false, true }) {
+        auto& entry = tlbEntry(linearAddress, inUserMode);
+        for (auto& entryTag : entry.tag) {
+            if (entryTag == tag)
+                entryTag = 0;
+        }
+    }
+}
+
+bool CPU::pageNeedsWriteNotification(PhysicalAddress page) const
+{
+#ifdef A20_ENABLED
+    page.mask(a20Mask());
+#endif
+    // Text mode video memory, and pages we've cached decoded instructions from.
+    if (page.get() >= 0xB8000 && page.get() < 0xC0000)
+        return true;
+    return m_instructionCache.isCodePage(page);
+}
+
+void CPU::dropTLBHostWritePointers(PhysicalAddress page)
+{
+    for (auto& set : m_tlb) {
+        for (auto& entry : set) {
+            if (entry.hostWritePointer == &m_memory[page.get()])
+                entry.hostWritePointer = nullptr;
+        }
+    }
+}
+
+template<typename T>
+ALWAYS_INLINE PhysicalAddress CPU::translateAddress(LinearAddress linearAddress, MemoryAccessType accessType, BYTE*& hostPointer)
+{
+    hostPointer = nullptr;
     if (!getPE() || !getPG())
         return PhysicalAddress(linearAddress.get());
+    auto& entry = tlbEntry(linearAddress, getCPL() == 3);
+    if (LIKELY(entry.tag[tlbTagIndex(accessType)] == tlbTag(linearAddress))) {
+        ++m_tlbHits;
+        DWORD offset = linearAddress.get() & 0xfff;
+        BYTE* pagePointer = accessType == MemoryAccessType::Write ? entry.hostWritePointer : entry.hostPointer;
+        if (pagePointer && offset <= 4096 - sizeof(T))
+            hostPointer = pagePointer + offset;
+        return PhysicalAddress(entry.physicalPage | offset);
+    }
+    ++m_tlbMisses;
     return translateAddressSlowCase(linearAddress, accessType);
 }
 
+ALWAYS_INLINE PhysicalAddress CPU::translateAddress(LinearAddress linearAddress, MemoryAccessType accessType)
+{
+    BYTE* hostPointer;
+    return translateAddress<BYTE>(linearAddress, accessType, hostPointer);
+}
+
+// Like translateAddress(), but a #PF is left pending for the dispatch loop instead of being thrown.
+ALWAYS_INLINE bool CPU::translateAddressWithoutUnwinding(LinearAddress linearAddress, MemoryAccessType accessType, PhysicalAddress& physicalAddress)
+{
+    if (!getPE() || !getPG()) {
+        physicalAddress = PhysicalAddress(linearAddress.get());
+        return true;
+    }
+    auto& entry = tlbEntry(linearAddress, getCPL() == 3);
+    if (LIKELY(entry.tag[tlbTagIndex(accessType)] == tlbTag(linearAddress))) {
+        ++m_tlbHits;
+        physicalAddress = PhysicalAddress(entry.physicalPage | (linearAddress.get() & 0xfff));
+        return true;
+    }
+    ++m_tlbMisses;
+    if (walkPageTables(linearAddress, accessType, physicalAddress))
+        return true;
+    if (UNLIKELY(options.unwindFaults))
+        throw takePendingFault();
+    return false;
+}
+
+ALWAYS_INLINE bool CPU::physicalAddressForBlock(PhysicalAddress& physicalAddress)
+{
+    // Unlike physicalAddressForInstructionCache(), this never faults.
+    // On a TLB miss we simply interpret one instruction, which will fill the TLB.
+    auto& descriptor = cachedDescriptor(SegmentRegisterIndex::CS);
+    DWORD offset = currentInstructionPointer();
+    if (getPE() && !getVM() && offset > descriptor.effectiveLimit())
+        return false;
+    auto linearAddress = descriptor.linearAddress(offset);
+    if (getPE() && getPG()) {
+        auto& entry = tlbEntry(linearAddress, getCPL() == 3);
+        if (entry.tag[tlbTagIndex(MemoryAccessType::Execute)] != tlbTag(linearAddress))
+            return false;
+        physicalAddress = PhysicalAddress(entry.physicalPage | (linearAddress.get() & 0xfff));
+    } else {
+        physicalAddress = PhysicalAddress(linearAddress.get());
+    }
+#ifdef A20_ENABLED
+    physicalAddress.mask(a20Mask());
+#endif
+    return physicalAddress.get() < m_memorySize;
+}
+
 static WORD makePFErrorCode(PageFaultFlags::Flags flags, CPU::MemoryAccessType accessType, bool inUserMode)
 {
     return flags
@@ -1172,7 +1839,48 @@ Exception CPU::PageFault(LinearAddress linearAddress, PageFaultFlags::Flags flag
     return Exception(0xe, error, linearAddress.get(), "Page fault");
 }
 
+bool CPU::signalFault(const Exception& exception)
+{
+    ASSERT(!m_hasPendingFault);
+    m_pendingFault = exception;
+    m_hasPendingFault = true;
+    return false;
+}
+
+// For callers that return to the dispatch loop with the fault pending: with --unwind-faults,
+// it gets thrown right away instead.
+bool CPU::leaveFaultPending(const Exception& exception)
+{
+    signalFault(exception);
+    if (UNLIKELY(options.unwindFaults))
+        throw takePendingFault();
+    return false;
+}
+
+Exception CPU::takePendingFault()
+{
+    ASSERT(m_hasPendingFault);
+    m_hasPendingFault = false;
+    return m_pendingFault;
+}
+
+void CPU::deliverFault(const Exception& e)
+{
+    if (!options.novlog)
+        dumpDisassembled(cachedDescriptor(SegmentRegisterIndex::CS), m_baseEIP, 3);
+    raiseException(e);
+}
+
 PhysicalAddress CPU::translateAddressSlowCase(LinearAddress linearAddress, MemoryAccessType accessType)
+{
+    PhysicalAddress physicalAddress;
+    if (UNLIKELY(!walkPageTables(linearAddress, accessType, physicalAddress)))
+        throw takePendingFault();
+    return physicalAddress;
+}
+
+// Returns false with a #PF pending (see signalFault()) instead of throwing it.
+bool CPU::walkPageTables(LinearAddress linearAddress, MemoryAccessType accessType, PhysicalAddress& physicalAddress)
 {
     ASSERT(getCR3() < m_memorySize);
 
@@ -1190,28 +1898,28 @@ PhysicalAddress CPU::translateAddressSlowCase(LinearAddress linearAddress, Memor
     bool inUserMode = getCPL() == 3;
 
     if (!(pageDirectoryEntry & PageTableEntryFlags::Present)) {
-        throw PageFault(linearAddress, PageFaultFlags::NotPresent, accessType, inUserMode, "PDE", pageDirectoryEntry);
+        return signalFault(PageFault(linearAddress, PageFaultFlags::NotPresent, accessType, inUserMode, "PDE", pageDirectoryEntry));
     }
 
     if (!(pageTableEntry & PageTableEntryFlags::Present)) {
-        throw PageFault(linearAddress, PageFaultFlags::NotPresent, accessType, inUserMode, "PTE", pageDirectoryEntry, pageTableEntry);
+        return signalFault(PageFault(linearAddress, PageFaultFlags::NotPresent, accessType, inUserMode, "PTE", pageDirectoryEntry, pageTableEntry));
     }
 
     if (inUserMode) {
         if (!(pageDirectoryEntry & PageTableEntryFlags::UserSupervisor)) {
-            throw PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PDE", pageDirectoryEntry);
+            return signalFault(PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PDE", pageDirectoryEntry));
         }
         if (!(pageTableEntry & PageTableEntryFlags::UserSupervisor)) {
-            throw PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PTE", pageDirectoryEntry, pageTableEntry);
+            return signalFault(PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PTE", pageDirectoryEntry, pageTableEntry));
         }
     }
 
     if ((inUserMode || getCR0() & CR0::WP) && accessType == MemoryAccessType::Write) {
         if (!(pageDirectoryEntry & PageTableEntryFlags::ReadWrite)) {
-            throw PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PDE", pageDirectoryEntry);
+            return signalFault(PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PDE", pageDirectoryEntry));
         }
         if (!(pageTableEntry & PageTableEntryFlags::ReadWrite)) {
-            throw PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PTE", pageDirectoryEntry, pageTableEntry);
+            return signalFault(PageFault(linearAddress, PageFaultFlags::ProtectionViolation, accessType, inUserMode, "PTE", pageDirectoryEntry, pageTableEntry));
         }
     }
 
@@ -1221,11 +1929,29 @@ PhysicalAddress CPU::translateAddressSlowCase(LinearAddress linearAddress, Memor
     pageDirectoryEntry |= PageTableEntryFlags::Accessed;
     pageTableEntry |= PageTableEntryFlags::Accessed;
 
-    PhysicalAddress physicalAddress((pageTableEntry & 0xfffff000) | offset);
+    DWORD physicalPage = pageTableEntry & 0xfffff000;
+    auto& entry = tlbEntry(linearAddress, inUserMode);
+    DWORD tag = tlbTag(linearAddress);
+    if (entry.physicalPage != physicalPage || (entry.tag[0] != tag && entry.tag[1] != tag && entry.tag[2] != tag)) {
+        entry.tag[0] = 0;
+        entry.tag[1] = 0;
+        entry.tag[2] = 0;
+        entry.physicalPage = physicalPage;
+        PhysicalAddress hostPage(physicalPage);
+#ifdef A20_ENABLED
+        hostPage.mask(a20Mask());
+#endif
+        auto& page = m_physicalMemoryMap.page(hostPage);
+        entry.hostPointer = page.readPointer;
+        entry.hostWritePointer = pageNeedsWriteNotification(PhysicalAddress(physicalPage)) ? nullptr : page.writePointer;
+    }
+    entry.tag[tlbTagIndex(accessType)] = tag;
+
+    physicalAddress = PhysicalAddress(physicalPage | offset);
 #ifdef DEBUG_PAGING
     vlog(LogCPU, "PG=1 Translating %08x {dir=%03x, page=%03x, offset=%03x} => %08x [%08x + %08x]", linearAddress.get(), dir, page, offset, physicalAddress.get(), pageDirectoryEntry, pageTableEntry);
 #endif
-    return physicalAddress;
+    return true;
 }
 
 void CPU::snoop(LinearAddress linearAddress, MemoryAccessType accessType)
@@ -1242,8 +1968,9 @@ void CPU::snoop(SegmentRegisterIndex segreg, DWORD offset, MemoryAccessType acce
     snoop(linearAddress, accessType);
 }
 
+// Returns false with a #GP pending (see leaveFaultPending()). validateAddress() throws it instead.
 template<typename T>
-ALWAYS_INLINE void CPU::validateAddress(const SegmentDescriptor& descriptor, DWORD offset, MemoryAccessType accessType)
+ALWAYS_INLINE bool CPU::checkAddress(const SegmentDescriptor& descriptor, DWORD offset, MemoryAccessType accessType)
 {
     if (!getVM()) {
     if (accessType != MemoryAccessType::Execute) {
@@ -1252,22 +1979,22 @@ ALWAYS_INLINE void CPU::validateAddress(const SegmentDescriptor& descriptor, DWO
                  toString(accessType),
                  offset,
                  descriptor.index());
-            throw GeneralProtectionFault(0, "Access through null selector");
+            return leaveFaultPending(GeneralProtectionFault(0, "Access through null selector"));
         }
     }
 
     switch (accessType) {
     case MemoryAccessType::Read:
         if (descriptor.isCode() && !descriptor.asCodeSegmentDescriptor().readable()) {
-            throw GeneralProtectionFault(0, "Attempt to read from non-readable code segment");
+            return leaveFaultPending(GeneralProtectionFault(0, "Attempt to read from non-readable code segment"));
         }
         break;
     case MemoryAccessType::Write:
         if (!descriptor.isData()) {
-            throw GeneralProtectionFault(0, "Attempt to write to non-data segment");
+            return leaveFaultPending(GeneralProtectionFault(0, "Attempt to write to non-data segment"));
         }
         if (!descriptor.asDataSegmentDescriptor().writable()) {
-            throw GeneralProtectionFault(0, "Attempt to write to non-writable data segment");
+            return leaveFaultPending(GeneralProtectionFault(0, "Attempt to write to non-writable data segment"));
         }
         break;
     case MemoryAccessType::Execute:
@@ -1282,7 +2009,7 @@ ALWAYS_INLINE void CPU::validateAddress(const SegmentDescriptor& descriptor, DWO
 #if 0
     // FIXME: Is this appropriate somehow? Need to figure it out. The code below as-is breaks IRET.
     if (getCPL() > descriptor.DPL()) {
-        throw GeneralProtectionFault(0, QString("Insufficient privilege for access (CPL=%1, DPL=%2)").arg(getCPL()).arg(descriptor.DPL()));
+        throw GeneralProtectionFault(0, ExceptionReason("Insufficient privilege for access (CPL=%1, DPL=%2)", getCPL(), descriptor.DPL()));
     }
 #endif
 
@@ -1299,8 +2026,16 @@ ALWAYS_INLINE void CPU::validateAddress(const SegmentDescriptor& descriptor, DWO
         dumpDescriptor(descriptor);
         //dumpAll();
         //debugger().enter();
-        throw GeneralProtectionFault(descriptor.index(), "Access outside segment limit");
+        return leaveFaultPending(GeneralProtectionFault(descriptor.index(), "Access outside segment limit"));
     }
+    return true;
+}
+
+template<typename T>
+ALWAYS_INLINE void CPU::validateAddress(const SegmentDescriptor& descriptor, DWORD offset, MemoryAccessType accessType)
+{
+    if (UNLIKELY(!checkAddress<T>(descriptor, offset, accessType)))
+        throw takePendingFault();
 }
 
 template<typename T>
@@ -1309,11 +2044,26 @@ ALWAYS_INLINE void CPU::validateAddress(SegmentRegisterIndex segreg, DWORD offse
     validateAddress<T>(cachedDescriptor(segreg), offset, accessType);
 }
 
+// Faults the memory operand of an instruction that reads it before doing anything else, so
+// the handler never runs instead of unwinding out of it half way. Only the first byte is
+// probed; a fault further into the operand still unwinds.
+bool CPU::probeMemoryOperand(SegmentRegisterIndex segreg, DWORD offset)
+{
+    if (!getPE())
+        return true;
+    auto& descriptor = cachedDescriptor(segreg);
+    if (!getVM() && !checkAddress<BYTE>(descriptor, offset, MemoryAccessType::Read))
+        return false;
+    PhysicalAddress physicalAddress;
+    return translateAddressWithoutUnwinding(descriptor.linearAddress(offset), MemoryAccessType::Read, physicalAddress);
+}
+
 template<typename T>
 bool CPU::validatePhysicalAddress(PhysicalAddress physicalAddress, MemoryAccessType accessType)
 {
     UNUSED_PARAM(accessType);
-    if (physicalAddress.get() < m_memorySize)
+    auto& page = m_physicalMemoryMap.page(physicalAddress);
+    if (page.readPointer || page.provider)
         return true;
 #ifdef MEMORY_DEBUGGING
     if (options.memdebug) {
@@ -1330,42 +2080,69 @@ bool CPU::validatePhysicalAddress(PhysicalAddress physicalAddress, MemoryAccessT
 }
 
 template<typename T>
-T CPU::readPhysicalMemory(PhysicalAddress physicalAddress)
+ALWAYS_INLINE T CPU::readPhysicalMemory(PhysicalAddress physicalAddress)
 {
+    auto& page = m_physicalMemoryMap.page(physicalAddress);
+    DWORD offset = physicalAddress.get() & 0xfff;
+    if (LIKELY(page.readPointer && offset <= PhysicalMemoryMap::pageSize - sizeof(T)))
+        return *reinterpret_cast<const T*>(page.readPointer + offset);
+    return readPhysicalMemorySlowCase<T>(physicalAddress);
+}
+
+template<typename T>
+NEVER_INLINE T CPU::readPhysicalMemorySlowCase(PhysicalAddress physicalAddress)
+{
+    if (sizeof(T) > 1 && (physicalAddress.get() & 0xfff) > PhysicalMemoryMap::pageSize - sizeof(T)) {
+        // The two halves may not be backed by the same thing, so go byte by byte.
+        T value = 0;
+        for (unsigned i = 0; i < sizeof(T); ++i)
+            value |= (T)readPhysicalMemory<BYTE>(PhysicalAddress(physicalAddress.get() + i)) << (i * 8);
+        return value;
+    }
     if (!validatePhysicalAddress<T>(physicalAddress, MemoryAccessType::Read))
         return 0;
-    if (auto* provider = memoryProviderForAddress(physicalAddress)) {
-        if (auto* directReadAccessPointer = provider->pointerForDirectReadAccess()) {
-            return *reinterpret_cast<const T*>(&directReadAccessPointer[physicalAddress.get() - provider->baseAddress().get()]);
-        }
-        return provider->read<T>(physicalAddress.get());
-    }
-    return *reinterpret_cast<T*>(&m_memory[physicalAddress.get()]);
+    return m_physicalMemoryMap.page(physicalAddress).provider->read<T>(physicalAddress.get());
 }
 
 template WORD CPU::readPhysicalMemory<WORD>(PhysicalAddress);
 
 template<typename T>
-void CPU::writePhysicalMemory(PhysicalAddress physicalAddress, T data)
+ALWAYS_INLINE void CPU::writePhysicalMemory(PhysicalAddress physicalAddress, T data)
 {
-    if (!validatePhysicalAddress<T>(physicalAddress, MemoryAccessType::Read))
+    auto& page = m_physicalMemoryMap.page(physicalAddress);
+    DWORD offset = physicalAddress.get() & 0xfff;
+    if (LIKELY(page.writePointer && offset <= PhysicalMemoryMap::pageSize - sizeof(T))) {
+        *reinterpret_cast<T*>(page.writePointer + offset) = data;
+        didTouchMemory(physicalAddress.get(), sizeof(T));
         return;
-    if (auto* provider = memoryProviderForAddress(physicalAddress)) {
-        provider->write<T>(physicalAddress.get(), data);
-    } else {
-        *reinterpret_cast<T*>(&m_memory[physicalAddress.get()]) = data;
     }
-    didTouchMemory(physicalAddress.get());
+    writePhysicalMemorySlowCase<T>(physicalAddress, data);
+}
+
+template<typename T>
+NEVER_INLINE void CPU::writePhysicalMemorySlowCase(PhysicalAddress physicalAddress, T data)
+{
+    if (sizeof(T) > 1 && (physicalAddress.get() & 0xfff) > PhysicalMemoryMap::pageSize - sizeof(T)) {
+        for (unsigned i = 0; i < sizeof(T); ++i)
+            writePhysicalMemory<BYTE>(PhysicalAddress(physicalAddress.get() + i), data >> (i * 8));
+        return;
+    }
+    if (!validatePhysicalAddress<T>(physicalAddress, MemoryAccessType::Write))
+        return;
+    if (auto* provider = m_physicalMemoryMap.page(physicalAddress).provider)
+        provider->write<T>(physicalAddress.get(), data);
+    didTouchMemory(physicalAddress.get(), sizeof(T));
 }
 
 template<typename T>
 ALWAYS_INLINE T CPU::readMemory(LinearAddress linearAddress, MemoryAccessType accessType)
 {
-    auto physicalAddress = translateAddress(linearAddress, accessType);
+    BYTE* hostPointer;
+    auto physicalAddress = translateAddress<T>(linearAddress, accessType, hostPointer);
 #ifdef A20_ENABLED
     physicalAddress.mask(a20Mask());
 #endif
-    T value = readPhysicalMemory<T>(physicalAddress);
+    T value = hostPointer ? *reinterpret_cast<const T*>(hostPointer) : readPhysicalMemory<T>(physicalAddress);
 #ifdef MEMORY_DEBUGGING
     if (options.memdebug || shouldLogMemoryRead(physicalAddress)) {
         if (options.novlog)
@@ -1423,7 +2200,8 @@ template LogicalAddress CPU::readLogicalAddress<DWORD>(SegmentRegisterIndex, DWO
 template<typename T>
 void CPU::writeMemory(LinearAddress linearAddress, T value)
 {
-    auto physicalAddress = translateAddress(linearAddress, MemoryAccessType::Write);
+    BYTE* hostPointer;
+    auto physicalAddress = translateAddress<T>(linearAddress, MemoryAccessType::Write, hostPointer);
 #ifdef A20_ENABLED
     physicalAddress.mask(a20Mask());
 #endif
@@ -1435,7 +2213,12 @@ void CPU::writeMemory(LinearAddress linearAddress, T value)
             vlog(LogCPU, "%zu-bit write [A20=%s] 0x%08X, value: %08X", sizeof(T) * 8, isA20Enabled() ? "on" : "off", physicalAddress.get(), value);
     }
 #endif
-    writePhysicalMemory(physicalAddress, value);
+    if (hostPointer) {
+        // Host write pointers skip didTouchMemory(), so count the store here.
+        ++m_stores;
+        *reinterpret_cast<T*>(hostPointer) = value;
+    } else
+        writePhysicalMemory(physicalAddress, value);
 }
 
 template<typename T>
@@ -1460,6 +2243,74 @@ void CPU::writeMemory8(SegmentRegisterIndex segment, DWORD offset, BYTE value) {
 void CPU::writeMemory16(SegmentRegisterIndex segment, DWORD offset, WORD value) { writeMemory(segment, offset, value); }
 void CPU::writeMemory32(SegmentRegisterIndex segment, DWORD offset, DWORD value) { writeMemory(segment, offset, value); }
 
+// A host pointer for linearAddress, or nullptr if reaching it would take a MemoryProvider or anything
+// else that only the regular memory accessors know how to do. Writes only ever get RAM.
+// A #PF is left pending, and also returns nullptr.
+BYTE* CPU::hostPointerForStringRun(LinearAddress linearAddress, MemoryAccessType accessType)
+{
+    PhysicalAddress physicalAddress;
+    if (!translateAddressWithoutUnwinding(linearAddress, accessType, physicalAddress))
+        return nullptr;
+#ifdef A20_ENABLED
+    physicalAddress.mask(a20Mask());
+#endif
+    auto& page = m_physicalMemoryMap.page(physicalAddress);
+    BYTE* pagePointer = accessType == MemoryAccessType::Write ? page.writePointer : page.readPointer;
+    if (!pagePointer)
+        return nullptr;
+    return pagePointer + (physicalAddress.get() & 0xfff);
+}
+
+// How many T-sized string elements, starting at segreg:offset and stepping in the direction of DF,
+// can be accessed in one go through hostPointer. Runs never cross a page, the segment limit or an
+// address size wrap. When the first element can't be done this way, returns 0 and the caller should
+// fall back to the regular accessors, unless the first element faulted: then the fault is pending.
+template<typename T>
+DWORD CPU::stringRunLength(SegmentRegisterIndex segreg, DWORD offset, MemoryAccessType accessType, DWORD maxCount, BYTE*& hostPointer)
+{
+#ifdef MEMORY_DEBUGGING
+    if (options.memdebug)
+        return 0;
+#endif
+    auto& descriptor = cachedDescriptor(segreg);
+    DWORD limit = a32() ? 0xffffffff : 0xffff;
+    if (getPE() && !getVM()) {
+        if (!checkAddress<T>(descriptor, offset, accessType))
+            return 0;
+        limit = std::min(limit, descriptor.effectiveLimit());
+    }
+    if (offset > limit || limit - offset < sizeof(T) - 1)
+        return 0;
+
+    auto linearAddress = descriptor.linearAddress(offset);
+    DWORD offsetInPage = linearAddress.get() & 0xfff;
+    if (offsetInPage > 4096 - sizeof(T))
+        return 0;
+
+    DWORD count;
+    if (getDF())
+        count = std::min(offset, offsetInPage) / sizeof(T) + 1;
+    else
+        count = std::min<QWORD>((QWORD)limit - offset + 1, 4096 - offsetInPage) / sizeof(T);
+    count = std::min(count, maxCount);
+
+    hostPointer = hostPointerForStringRun(linearAddress, accessType);
+    return hostPointer ? count : 0;
+}
+
+template DWORD CPU::stringRunLength<BYTE>(SegmentRegisterIndex, DWORD, MemoryAccessType, DWORD, BYTE*&);
+template DWORD CPU::stringRunLength<WORD>(SegmentRegisterIndex, DWORD, MemoryAccessType, DWORD, BYTE*&);
+template DWORD CPU::stringRunLength<DWORD>(SegmentRegisterIndex, DWORD, MemoryAccessType, DWORD, BYTE*&);
+
+void CPU::didWriteStringRun(const BYTE* hostPointer, DWORD count, DWORD elementSize)
+{
+    DWORD size = count * elementSize;
+    DWORD address = hostPointer - m_memory;
+    if (getDF())
+        address -= size - elementSize;
+    didTouchMemory(address, size);
+}
+
 void CPU::updateDefaultSizes()
 {
 #ifdef VERBOSE_DEBUG
@@ -1536,9 +2387,49 @@ BYTE* CPU::pointerToPhysicalMemory(PhysicalAddress physicalAddress)
     if (!validatePhysicalAddress<BYTE>(physicalAddress, MemoryAccessType::InternalPointer))
         return nullptr;
     didTouchMemory(physicalAddress.get());
-    if (auto* provider = memoryProviderForAddress(physicalAddress))
-        return provider->memoryPointer(physicalAddress.get());
-    return &m_memory[physicalAddress.get()];
+    auto& page = m_physicalMemoryMap.page(physicalAddress);
+    if (page.provider)
+        return page.provider->memoryPointer(physicalAddress.get());
+    return page.writePointer + (physicalAddress.get() & 0xfff);
+}
+
+void CPU::copyToPhysicalMemory(PhysicalAddress address, const BYTE* source, DWORD size)
+{
+    while (size) {
+        DWORD chunk = qMin<DWORD>(size, PhysicalMemoryMap::pageSize - (address.get() & 0xfff));
+        auto& page = m_physicalMemoryMap.page(address);
+        // Like CPU writes, anything aimed at ROM or at nothing is dropped.
+        if (page.provider) {
+            for (DWORD i = 0; i < chunk; ++i)
+                page.provider->writeMemory8(address.get() + i, source[i]);
+        } else if (page.writePointer) {
+            memcpy(page.writePointer + (address.get() & 0xfff), source, chunk);
+        }
+        didTouchMemory(address.get(), chunk);
+        address = PhysicalAddress(address.get() + chunk);
+        source += chunk;
+        size -= chunk;
+    }
+}
+
+bool CPU::copyFromPhysicalMemory(PhysicalAddress address, BYTE* destination, DWORD size)
+{
+    while (size) {
+        DWORD chunk = qMin<DWORD>(size, PhysicalMemoryMap::pageSize - (address.get() & 0xfff));
+        auto& page = m_physicalMemoryMap.page(address);
+        if (page.provider) {
+            for (DWORD i = 0; i < chunk; ++i)
+                destination[i] = page.provider->readMemory8(address.get() + i);
+        } else if (page.readPointer) {
+            memcpy(destination, page.readPointer + (address.get() & 0xfff), chunk);
+        } else {
+            return false;
+        }
+        address = PhysicalAddress(address.get() + chunk);
+        destination += chunk;
+        size -= chunk;
+    }
+    return true;
 }
 
 BYTE* CPU::memoryPointer(SegmentRegisterIndex segreg, DWORD offset)
@@ -1622,22 +2513,21 @@ void CPU::initWatches()
 
 void CPU::registerMemoryProvider(MemoryProvider& provider)
 {
-    if ((provider.baseAddress().get() + provider.size()) > 1048576) {
+    if ((provider.baseAddress().get() % PhysicalMemoryMap::pageSize) || (QWORD)provider.baseAddress().get() + provider.size() > 0x100000000) {
         vlog(LogConfig, "Can't register mapper with length %u @ %08x", provider.size(), provider.baseAddress().get());
         ASSERT_NOT_REACHED();
     }
 
-    for (unsigned i = provider.baseAddress().get() / memoryProviderBlockSize; i < (provider.baseAddress().get() + provider.size()) / memoryProviderBlockSize; ++i) {
-        vlog(LogConfig, "Register memory provider %p as mapper %u", &provider, i);
-        m_memoryProviders[i] = &provider;
-    }
+    vlog(LogConfig, "Register memory provider %p for %08x-%08x", &provider, provider.baseAddress().get(), provider.baseAddress().get() + provider.size() - 1);
+    m_memoryProviders.append(&provider);
+    m_physicalMemoryMap.mapProvider(provider);
+    m_instructionCache.clear();
+    flushTLB();
 }
 
-ALWAYS_INLINE MemoryProvider* CPU::memoryProviderForAddress(PhysicalAddress address)
+MemoryProvider* CPU::memoryProviderForAddress(PhysicalAddress address)
 {
-    if (address.get() >= 1048576)
-        return nullptr;
-    return m_memoryProviders[address.get() / memoryProviderBlockSize];
+    return m_physicalMemoryMap.page(address).provider;
 }
 
 template<typename T>
@@ -1659,7 +2549,7 @@ void CPU::doBOUND(Instruction& insn)
         isWithinBounds ? "yes" : "no");
 #endif
     if (!isWithinBounds)
-        throw BoundRangeExceeded(QString("%1 not within [%2, %3]").arg(arrayIndex).arg(lowerBound).arg(upperBound));
+        throw BoundRangeExceeded(ExceptionReason("%1 not within [%2, %3]", arrayIndex, lowerBound, upperBound));
 }
 
 void CPU::_BOUND(Instruction& insn)
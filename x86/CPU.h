@@ -27,13 +27,23 @@
 #include "Common.h"
 #include "debug.h"
 #include <QtCore/QVector>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QWaitCondition>
+#include <map>
 #include <set>
+#include <type_traits>
 #include "OwnPtr.h"
 #include "Instruction.h"
+#include "InstructionCache.h"
+#include "PhysicalMemoryMap.h"
 #include "Descriptor.h"
 
 class Debugger;
 class Machine;
+class QDataStream;
+class QFile;
 class MemoryProvider;
 class CPU;
 class TSS;
@@ -76,9 +86,79 @@ enum Flags {
 
 struct HardwareInterruptDuringREP { };
 
+// A fault reason is a string literal, optionally with %1-%5 placeholders for numbers or other
+// literals. The QString is only built when somebody asks for it, i.e. when the fault is logged.
+class ExceptionReason {
+public:
+    class Argument {
+    public:
+        Argument() { }
+        Argument(const char* string) : m_kind(Kind::String) { m_string = string; }
+        template<typename T, typename = typename std::enable_if<std::is_integral<T>::value>::type>
+        Argument(T number)
+        {
+            if (std::is_signed<T>::value) {
+                m_kind = Kind::Signed;
+                m_signed = number;
+            } else {
+                m_kind = Kind::Unsigned;
+                m_unsigned = number;
+            }
+        }
+
+        bool isNull() const { return m_kind == Kind::None; }
+        QString applyTo(const QString& format) const
+        {
+            switch (m_kind) {
+            case Kind::String: return format.arg(QString::fromLatin1(m_string));
+            case Kind::Signed: return format.arg(m_signed);
+            case Kind::Unsigned: return format.arg(m_unsigned);
+            case Kind::None: break;
+            }
+            return format;
+        }
+
+    private:
+        enum class Kind : BYTE { None, String, Signed, Unsigned };
+        Kind m_kind { Kind::None };
+        union {
+            const char* m_string;
+            SIGNED_QWORD m_signed;
+            QWORD m_unsigned;
+        };
+    };
+
+    ExceptionReason() { }
+    ExceptionReason(const char* literal) : m_format(literal) { }
+    ExceptionReason(const char* format, Argument a1, Argument a2 = Argument(), Argument a3 = Argument(), Argument a4 = Argument(), Argument a5 = Argument())
+        : m_format(format)
+        , m_arguments { a1, a2, a3, a4, a5 }
+    {
+    }
+
+    QString toString() const
+    {
+        if (!m_format)
+            return QString();
+        QString string = QString::fromLatin1(m_format);
+        for (auto& argument : m_arguments) {
+            if (argument.isNull())
+                break;
+            string = argument.applyTo(string);
+        }
+        return string;
+    }
+
+private:
+    const char* m_format { nullptr };
+    Argument m_arguments[5];
+};
+
 class Exception {
 public:
-    Exception(BYTE num, WORD code, DWORD address, const QString& reason)
+    Exception() { }
+
+    Exception(BYTE num, WORD code, DWORD address, const ExceptionReason& reason)
         : m_num(num)
         , m_code(code)
         , m_address(address)
@@ -87,7 +167,7 @@ public:
     {
     }
 
-    Exception(BYTE num, WORD code, const QString& reason)
+    Exception(BYTE num, WORD code, const ExceptionReason& reason)
         : m_num(num)
         , m_code(code)
         , m_hasCode(true)
@@ -95,7 +175,7 @@ public:
     {
     }
 
-    Exception(BYTE num, const QString& reason)
+    Exception(BYTE num, const ExceptionReason& reason)
         : m_num(num)
         , m_hasCode(false)
         , m_reason(reason)
@@ -108,14 +188,14 @@ public:
     WORD code() const { return m_code; }
     bool hasCode() const { return m_hasCode; }
     DWORD address() const { return m_address; }
-    QString reason() const { return m_reason; }
+    QString reason() const { return m_reason.toString(); }
 
 private:
     BYTE m_num { 0 };
     WORD m_code { 0 };
     DWORD m_address { 0 };
     bool m_hasCode { false };
-    QString m_reason;
+    ExceptionReason m_reason;
 };
 
 union PartAddressableRegister {
@@ -146,7 +226,7 @@ union PartAddressableRegister {
 };
 
 class CPU final : public InstructionStream {
-    friend void buildOpcodeTablesIfNeeded();
+    friend void buildOpcodeTables();
     friend class Debugger;
 public:
     explicit CPU(Machine&);
@@ -186,9 +266,48 @@ public:
 
     void registerMemoryProvider(MemoryProvider&);
     MemoryProvider* memoryProviderForAddress(PhysicalAddress);
+    const PhysicalMemoryMap& physicalMemoryMap() const { return m_physicalMemoryMap; }
 
     void recomputeMainLoopNeedsSlowStuff();
 
+    // Anything that needs the main loop's attention between two instructions sets a bit in
+    // the pending work word. While it's clear, the loop runs straight-line code until the
+    // instruction budget for the current timeslice is used up.
+    struct PendingWork {
+    enum Flags {
+        SlowStuff = 0x01, // Debugger requests, breakpoints, watches, tracing, reboot.
+        Uninterruptible = 0x02, // Don't deliver TF traps or IRQs after the next instruction.
+        Trap = 0x04, // TF is set.
+        IRQ = 0x08, // The PIC has an unmasked request (and IF=1, once the CPU thread rechecks it).
+        DeviceCompletion = 0x10, // A device finished work on another thread, see Machine::scheduleDeviceCompletion().
+        IdleLoop = 0x20, // detectIdleLoop() caught the guest polling; sleep before the next instruction.
+    };
+    };
+    DWORD pendingWork() const { return m_pendingWork.load(std::memory_order_relaxed); }
+    void setPendingWork(DWORD bits) { m_pendingWork.fetch_or(bits, std::memory_order_relaxed); }
+    void clearPendingWork(DWORD bits) { m_pendingWork.fetch_and(~bits, std::memory_order_relaxed); }
+
+    // Called by the PIC, from any thread, whenever it gains or loses an unmasked request it's
+    // willing to deliver. This only ever sets PendingWork::IRQ; the CPU thread clears it again
+    // in updateIRQPendingWork(), so a request racing with IF or another update can't be lost.
+    void setIRQRequested(bool requested)
+    {
+        m_irqRequested.store(requested, std::memory_order_seq_cst);
+        if (requested)
+            m_pendingWork.fetch_or(PendingWork::IRQ, std::memory_order_seq_cst);
+    }
+
+    void flushTLB();
+    void invalidateTLBEntry(LinearAddress);
+    QWORD tlbHits() const { return m_tlbHits; }
+    QWORD tlbMisses() const { return m_tlbMisses; }
+    QWORD tlbFlushes() const { return m_tlbFlushes; }
+
+    InstructionCache& instructionCache() { return m_instructionCache; }
+
+    // Must be called after guest memory has been written through a pointer from memoryPointer().
+    void didModifyMemory(LinearAddress, DWORD size);
+
     QWORD cycle() const { return m_cycle; }
 
     void reset();
@@ -197,6 +316,10 @@ public:
 
     std::set<LogicalAddress>& breakpoints() { return m_breakpoints; }
 
+    // How many times each detected idle loop (keyed by the address of its backward branch) was fast-forwarded.
+    const std::map<LogicalAddress, QWORD>& idleLoops() const { return m_idleLoops; }
+    void clearIdleLoops() { m_idleLoops.clear(); }
+
     enum class MemoryAccessType { Read, Write, Execute, InternalPointer };
 
     enum RegisterIndex8 {
@@ -289,10 +412,18 @@ public:
     void setBaseMemorySize(DWORD size) { m_baseMemorySize = size; }
 
     void setMemorySizeAndReallocateIfNeeded(DWORD);
+    size_t memorySize() const { return m_memorySize; }
+
+    // Machine snapshots (see snapshot.cpp). Guest RAM is stored separately from the rest of the state,
+    // page aligned, so that restoring can map it from the snapshot file instead of reading it.
+    void saveState(QDataStream&) const;
+    void restoreState(QDataStream&);
+    bool saveMemory(QFile&, QWORD offset) const;
+    bool loadMemory(QFile&, QWORD offset, size_t size);
 
     void kill();
 
-    void setA20Enabled(bool value) { m_a20Enabled = value; }
+    void setA20Enabled(bool value);
     bool isA20Enabled() const { return m_a20Enabled; }
 
     DWORD a20Mask() const { return isA20Enabled() ? 0xFFFFFFFF : 0xFFEFFFFF; }
@@ -302,6 +433,7 @@ public:
     void realModeInterrupt(BYTE isr, InterruptSource);
     void protectedModeInterrupt(BYTE isr, InterruptSource, QVariant errorCode);
     void interrupt(BYTE isr, InterruptSource, QVariant errorCode = QVariant());
+    void softwareInterrupt(BYTE isr);
     void interruptToTaskGate(BYTE isr, InterruptSource, QVariant errorCode, Gate&);
 
     void interruptFromVM86Mode(Gate&, DWORD offset, CodeSegmentDescriptor&, InterruptSource, QVariant errorCode);
@@ -309,24 +441,39 @@ public:
     void iretFromVM86Mode();
     void iretFromRealMode();
 
-    Exception GeneralProtectionFault(WORD selector, const QString& reason);
-    Exception StackFault(WORD selector, const QString& reason);
-    Exception NotPresent(WORD selector, const QString& reason);
-    Exception InvalidTSS(WORD selector, const QString& reason);
+    Exception GeneralProtectionFault(WORD selector, const ExceptionReason&);
+    Exception StackFault(WORD selector, const ExceptionReason&);
+    Exception NotPresent(WORD selector, const ExceptionReason&);
+    Exception InvalidTSS(WORD selector, const ExceptionReason&);
     Exception PageFault(LinearAddress, PageFaultFlags::Flags, MemoryAccessType, bool inUserMode, const char* faultTable, DWORD pde, DWORD pte = 0);
-    Exception DivideError(const QString& reason);
-    Exception InvalidOpcode(const QString& reason = QString());
-    Exception BoundRangeExceeded(const QString& reason);
+    Exception DivideError(const ExceptionReason&);
+    Exception InvalidOpcode(const ExceptionReason& = ExceptionReason());
+    Exception BoundRangeExceeded(const ExceptionReason&);
 
     void raiseException(const Exception&);
 
-    void setIF(bool value) { this->IF = value; }
-    void setCF(bool value) { this->CF = value; }
+    // Faults delivered by the dispatch loop without unwinding vs. thrown out of an instruction handler.
+    QWORD signalledFaults() const { return m_signalledFaults; }
+    QWORD unwoundFaults() const { return m_unwoundFaults; }
+
+    void setIF(bool value)
+    {
+        this->IF = value;
+        updateIRQPendingWork();
+    }
+    void setCF(bool value) { m_dirtyFlags &= ~Flag::CF; this->CF = value; }
     void setDF(bool value) { this->DF = value; }
     void setSF(bool value) { m_dirtyFlags &= ~Flag::SF; this->SF = value; }
-    void setAF(bool value) { this->AF = value; }
-    void setTF(bool value) { this->TF = value; }
-    void setOF(bool value) { this->OF = value; }
+    void setAF(bool value) { m_dirtyFlags &= ~Flag::AF; this->AF = value; }
+    void setTF(bool value)
+    {
+        this->TF = value;
+        if (value)
+            setPendingWork(PendingWork::Trap);
+        else
+            clearPendingWork(PendingWork::Trap);
+    }
+    void setOF(bool value) { m_dirtyFlags &= ~Flag::OF; this->OF = value; }
     void setPF(bool value) { m_dirtyFlags &= ~Flag::PF; this->PF = value; }
     void setZF(bool value) { m_dirtyFlags &= ~Flag::ZF; this->ZF = value; }
     void setVIF(bool value) { this->VIF = value; }
@@ -336,12 +483,12 @@ public:
     void setIOPL(unsigned int value) { this->IOPL = value; }
 
     bool getIF() const { return this->IF; }
-    bool getCF() const { return this->CF; }
+    bool getCF() const;
     bool getDF() const { return this->DF; }
     bool getSF() const;
-    bool getAF() const { return this->AF; }
+    bool getAF() const;
     bool getTF() const { return this->TF; }
-    bool getOF() const { return this->OF; }
+    bool getOF() const;
     bool getPF() const;
     bool getZF() const;
 
@@ -382,7 +529,7 @@ public:
     WORD readSegmentRegister(SegmentRegisterIndex segreg) const { return *m_segmentMap[static_cast<int>(segreg)]; }
 
     DWORD getControlRegister(int registerIndex) const { return *m_controlRegisterMap[registerIndex]; }
-    void setControlRegister(int registerIndex, DWORD value) { *m_controlRegisterMap[registerIndex] = value; }
+    void setControlRegister(int registerIndex, DWORD value);
 
     DWORD getDebugRegister(int registerIndex) const { return *m_debugRegisterMap[registerIndex]; }
     void setDebugRegister(int registerIndex, DWORD value) { *m_debugRegisterMap[registerIndex] = value; }
@@ -531,12 +678,47 @@ public:
 
     void executeOneInstruction();
 
-    // CPU main loop - will fetch & decode until stopped
+    // Block cache: hot straight-line code is dispatched from blocks of already decoded instructions.
+    void executeBlock();
+    bool isBlockCacheEnabled() const { return m_blockCacheEnabled; }
+    void setBlockCacheEnabled(bool enabled) { m_blockCacheEnabled = enabled; }
+
+    // CPU main loop - will fetch & decode until a Shutdown command is queued
     void mainLoop();
     bool mainLoopSlowStuff();
+    void handlePendingWork();
+    void didReachEndOfTimeslice();
+    // CPU thread only. PendingWork::IRQ is only kept while IF=1 as well, so code running with
+    // interrupts disabled doesn't drop into handlePendingWork() after every instruction.
+    // The request is checked again after clearing the bit: a setIRQRequested() that missed
+    // the first check sets the bit after our clear, or is seen by the second check.
+    void updateIRQPendingWork()
+    {
+        if (this->IF && m_irqRequested.load(std::memory_order_seq_cst)) {
+            setPendingWork(PendingWork::IRQ);
+            return;
+        }
+        m_pendingWork.fetch_and(~PendingWork::IRQ, std::memory_order_seq_cst);
+        if (this->IF && m_irqRequested.load(std::memory_order_seq_cst))
+            setPendingWork(PendingWork::IRQ);
+    }
+    bool shouldLeaveStraightLineCode() const { return pendingWork() || m_cycle >= m_timesliceEnd; }
 
-    // CPU main loop when halted (HLT) - will do nothing until an IRQ is raised
+    // CPU main loop when halted (HLT) - sleeps until an IRQ is raised or a command is queued
     void haltedLoop();
+    bool shouldStayHalted() const;
+    bool hasWakeupReason() const;
+    bool waitForWakeup();
+    unsigned long haltWaitMilliseconds() const;
+
+    // Called by short jumps and Jcc when they branch backwards. Spots polling loops and idles them.
+    void didTakeBackwardBranch()
+    {
+        if (!options.disableIdleDetection)
+            detectIdleLoop();
+    }
+    void detectIdleLoop();
+    void idleUntilWakeup();
 
     void push32(DWORD value);
     DWORD pop32();
@@ -557,6 +739,11 @@ public:
     template<typename T> T in(WORD port);
     template<typename T> void out(WORD port, T data);
 
+    // Moves a run of elements between memory and the device behind a port, see IODevice::inString().
+    // Returns how many were moved; the caller does the rest one at a time with in()/out().
+    template<typename T> DWORD inString(WORD port, BYTE* destination, DWORD count);
+    template<typename T> DWORD outString(WORD port, const BYTE* source, DWORD count);
+
     BYTE in8(WORD port);
     WORD in16(WORD port);
     DWORD in32(WORD port);
@@ -588,7 +775,8 @@ public:
     void cmpFlags16(DWORD result, WORD dest, WORD src);
     void cmpFlags32(QWORD result, DWORD dest, DWORD src);
 
-    void adjustFlag32(QWORD result, DWORD dest, DWORD src);
+    void recordIncDec(QWORD result, DWORD dest, unsigned opSize, bool isSubtraction);
+    void recordArithmetic(QWORD result, DWORD dest, DWORD src, unsigned opSize, bool isSubtraction);
 
     template<typename T> void cmpFlags(QWORD result, T, T);
 
@@ -611,10 +799,19 @@ public:
 
     template<typename T> bool validatePhysicalAddress(PhysicalAddress, MemoryAccessType);
     template<typename T> void validateAddress(const SegmentDescriptor&, DWORD offset, MemoryAccessType);
+    template<typename T> bool checkAddress(const SegmentDescriptor&, DWORD offset, MemoryAccessType);
     template<typename T> void validateAddress(SegmentRegisterIndex, DWORD offset, MemoryAccessType);
     template<typename T> T readPhysicalMemory(PhysicalAddress);
     template<typename T> void writePhysicalMemory(PhysicalAddress, T);
+    template<typename T> T readPhysicalMemorySlowCase(PhysicalAddress);
+    template<typename T> void writePhysicalMemorySlowCase(PhysicalAddress, T);
     BYTE* pointerToPhysicalMemory(PhysicalAddress);
+
+    // For DMA. These go a page at a time, through the page's MemoryProvider if it has one.
+    // Writes to pages that can't be written are dropped. Reads return false if the range
+    // runs into unmapped memory.
+    void copyToPhysicalMemory(PhysicalAddress, const BYTE* source, DWORD size);
+    bool copyFromPhysicalMemory(PhysicalAddress, BYTE* destination, DWORD size);
     template<typename T> T readMemory(LinearAddress address, MemoryAccessType accessType = MemoryAccessType::Read);
     template<typename T> T readMemory(const SegmentDescriptor&, DWORD offset, MemoryAccessType accessType = MemoryAccessType::Read);
     template<typename T> T readMemory(SegmentRegisterIndex, DWORD offset, MemoryAccessType accessType = MemoryAccessType::Read);
@@ -623,10 +820,11 @@ public:
     template<typename T> void writeMemory(SegmentRegisterIndex, DWORD offset, T);
 
     PhysicalAddress translateAddress(LinearAddress, MemoryAccessType);
+    template<typename T> PhysicalAddress translateAddress(LinearAddress, MemoryAccessType, BYTE*& hostPointer);
     void snoop(LinearAddress, MemoryAccessType);
     void snoop(SegmentRegisterIndex, DWORD offset, MemoryAccessType);
 
-    template<typename T> void validateIOAccess(WORD port);
+    template<typename T> bool checkIOAccess(WORD port);
 
     BYTE readMemory8(LinearAddress);
     BYTE readMemory8(SegmentRegisterIndex, DWORD offset);
@@ -650,6 +848,7 @@ public:
 
     // Dumps registers, flags & stack
     void dumpAll();
+    void dumpBenchmarkResults();
     void dumpStack(ValueSize, unsigned count);
     void dumpWatches();
 
@@ -672,6 +871,7 @@ public:
 #ifdef CT_TRACE
     // Dumps registers (used by --trace)
     void dumpTrace();
+    void setTraceOutput(FILE* output) { m_traceOutput = output; }
 #endif
 
     QVector<WatchedAddress>& watches() { return m_watches; }
@@ -688,8 +888,12 @@ public:
     bool s16() const { return !m_stackSize32; }
     bool s32() const { return m_stackSize32; }
 
-    enum Command { ExitDebugger, EnterDebugger, HardReboot };
+    enum Command { ExitDebugger, EnterDebugger, HardReboot, Shutdown };
     void queueCommand(Command);
+    bool isShuttingDown() const { return m_shouldShutDown; }
+
+    // Wakes the CPU thread if it's sleeping in HLT. Safe to call from any thread.
+    void wakeFromHalt();
 
     static const char* registerName(CPU::RegisterIndex8) PURE;
     static const char* registerName(CPU::RegisterIndex16) PURE;
@@ -770,6 +974,10 @@ protected:
     void _XCHG_reg32_RM32(Instruction&);
 
     template<typename F> void doOnceOrRepeatedly(Instruction&, bool careAboutZF, F);
+    template<typename F, typename B> void doOnceOrRepeatedlyInBulk(Instruction&, F, B);
+    template<typename T> DWORD stringRunLength(SegmentRegisterIndex, DWORD offset, MemoryAccessType, DWORD maxCount, BYTE*& hostPointer);
+    BYTE* hostPointerForStringRun(LinearAddress, MemoryAccessType);
+    void didWriteStringRun(const BYTE* hostPointer, DWORD count, DWORD elementSize);
     template<typename T> void doLODS(Instruction&);
     template<typename T> void doSTOS(Instruction&);
     template<typename T> void doMOVS(Instruction&);
@@ -1056,6 +1264,7 @@ protected:
 
     void _LMSW_RM16(Instruction&);
     void _SMSW_RM16(Instruction&);
+    void _INVLPG(Instruction&);
 
     void _SGDT(Instruction&);
     void _LGDT(Instruction&);
@@ -1255,6 +1464,7 @@ protected:
 private:
     friend class Instruction;
     friend class InstructionExecutionContext;
+    friend class InstructionFetchWindow;
 
     template<typename T> T readInstructionStream();
     BYTE readInstruction8() override;
@@ -1269,9 +1479,36 @@ private:
     void updateCodeSegmentCache();
     void makeNextInstructionUninterruptible();
 
-    void didTouchMemory(DWORD address);
+    void didTouchMemory(DWORD address, DWORD size = 1);
+
+    bool physicalAddressForInstructionCache(PhysicalAddress&);
+    const BYTE* hostPointerForCode(PhysicalAddress);
+    unsigned fetchWindowSize(PhysicalAddress, DWORD offset) const;
+    bool translateAddressWithoutUnwinding(LinearAddress, MemoryAccessType, PhysicalAddress&);
+    bool cachedInstructionFitsInCodeSegment(DWORD offset, unsigned length) const;
+    void cacheInstruction(PhysicalAddress, BYTE mode, DWORD offset, const Instruction&);
+    void dropTLBHostWritePointers(PhysicalAddress page);
+
+    bool physicalAddressForBlock(PhysicalAddress&);
+    InstructionBlock* buildBlock(PhysicalAddress, BYTE mode);
+    template<typename Callback> bool runInstruction(Callback);
+    bool executeBlockInstruction(const Instruction&);
 
     PhysicalAddress translateAddressSlowCase(LinearAddress, MemoryAccessType);
+    bool walkPageTables(LinearAddress, MemoryAccessType, PhysicalAddress&);
+
+    bool signalFault(const Exception&);
+    bool leaveFaultPending(const Exception&);
+    bool probeMemoryOperand(SegmentRegisterIndex, DWORD offset);
+    Exception takePendingFault();
+    void deliverFault(const Exception&);
+
+    struct TLBEntry;
+    TLBEntry& tlbEntry(LinearAddress, bool inUserMode);
+    void rebuildPhysicalMemoryMap();
+    BYTE* allocateMemory(size_t);
+    void releaseMemory();
+    bool pageNeedsWriteNotification(PhysicalAddress page) const;
 
     template<typename T> T doSAR(T, unsigned steps);
     template<typename T> T doRCL(T, unsigned steps);
@@ -1383,16 +1620,64 @@ private:
     std::set<LogicalAddress> m_breakpoints;
 
     bool m_a20Enabled { false };
-    bool m_nextInstructionIsUninterruptible { false };
 
     OwnPtr<Debugger> m_debugger;
 
-    // One MemoryProvider* per 'memoryProviderBlockSize' bytes for the first MB of memory.
-    static const size_t memoryProviderBlockSize = 16384;
-    MemoryProvider* m_memoryProviders[1048576 / memoryProviderBlockSize];
+    // RAM from 0 to m_memorySize, with every registered MemoryProvider mapped on top.
+    PhysicalMemoryMap m_physicalMemoryMap;
+    QVector<MemoryProvider*> m_memoryProviders;
 
     BYTE* m_memory { nullptr };
     size_t m_memorySize { 0 };
+    QWORD m_memoryAllocationNanoseconds { 0 };
+
+    // Software TLB. One direct-mapped set for supervisor accesses and one for user accesses.
+    // Read, write and execute are tagged separately so a hit never skips a check the page walk would make.
+    // hostPointer is set when the page is plain RAM and can be accessed without going through a MemoryProvider.
+    // hostWritePointer additionally requires that writes to the page don't need to be seen by didTouchMemory().
+    struct TLBEntry {
+        DWORD tag[3];
+        DWORD physicalPage;
+        BYTE* hostPointer;
+        BYTE* hostWritePointer;
+    };
+    static const size_t tlbSize = 256;
+    TLBEntry m_tlb[2][tlbSize];
+    QWORD m_tlbHits { 0 };
+    QWORD m_tlbMisses { 0 };
+    QWORD m_tlbFlushes { 0 };
+
+    InstructionCache m_instructionCache;
+
+    // A fault recorded by signalFault(), waiting for the dispatch loop to deliver it.
+    bool m_hasPendingFault { false };
+    Exception m_pendingFault;
+    QWORD m_signalledFaults { 0 };
+    QWORD m_unwoundFaults { 0 };
+
+    // The halted loop sleeps on m_haltCondition; wakeFromHalt() signals it.
+    QMutex m_haltMutex;
+    QWaitCondition m_haltCondition;
+    QWORD m_haltWakeups { 0 };
+    QWORD m_haltedNanoseconds { 0 };
+    QWORD m_haltedHostCPUNanoseconds { 0 };
+
+    // Guest memory writes (by instructions, devices and DMA alike, see didTouchMemory()) and OUTs.
+    // An idle loop is one where this doesn't move.
+    QWORD m_stores { 0 };
+
+    // The loop currently being watched by detectIdleLoop().
+    struct IdleLoopCandidate {
+        LogicalAddress branch;
+        QWORD cycle { 0 };
+        QWORD stores { 0 };
+        DWORD registers[8];
+        DWORD flags { 0 };
+        bool hasFlags { false };
+        unsigned iterations { 0 };
+    };
+    IdleLoopCandidate m_idleLoopCandidate;
+    std::map<LogicalAddress, QWORD> m_idleLoops;
 
     WORD* m_segmentMap[8];
     DWORD* m_controlRegisterMap[8];
@@ -1408,22 +1693,104 @@ private:
 
     enum DebuggerRequest { NoDebuggerRequest, PleaseEnterDebugger, PleaseExitDebugger };
 
-    std::atomic<bool> m_mainLoopNeedsSlowStuff { false };
+    std::atomic<DWORD> m_pendingWork { 0 };
+    std::atomic<bool> m_irqRequested { false };
     std::atomic<DebuggerRequest> m_debuggerRequest { NoDebuggerRequest };
     std::atomic<bool> m_shouldHardReboot { false };
+    std::atomic<bool> m_shouldShutDown { false };
 
     QVector<WatchedAddress> m_watches;
 
     bool m_isForAutotest { false };
+    bool m_dumpsAutotestTrace { false };
+    FILE* m_traceOutput { stdout };
+    bool m_blockCacheEnabled { false };
+    QElapsedTimer m_benchmarkTimer;
 
     QWORD m_cycle { 0 };
+    QWORD m_timesliceEnd { 0 };
 
     mutable DWORD m_dirtyFlags { 0 };
     QWORD m_lastResult { 0 };
     unsigned m_lastOpSize { ByteSize };
+
+    // The last ADD/ADC/SUB/SBB/CMP/INC/DEC, kept apart from m_lastResult so that
+    // logical ops can't clobber it. CF, OF and AF are computed from this on demand.
+    QWORD m_arithmeticResult { 0 };
+    DWORD m_arithmeticDestination { 0 };
+    DWORD m_arithmeticSource { 0 };
+    unsigned m_arithmeticOpSize { ByteSize };
+    bool m_arithmeticIsSubtraction { false };
 };
 
-extern CPU* g_cpu;
+// The CPU whose thread this is, if any. Only used to decorate log output.
+extern thread_local CPU* g_cpu;
+
+// Instruction stream that decodes straight out of host memory for as long as the instruction
+// stays inside the current code page and CS limit. Past that, it falls back to the CPU's
+// regular checked fetches, which take care of page crossing, wrap-around and faults.
+class InstructionFetchWindow {
+public:
+    InstructionFetchWindow(CPU& cpu, const BYTE* data, unsigned size)
+        : m_cpu(cpu)
+        , m_start(data)
+        , m_data(data)
+        , m_remaining(size)
+    {
+    }
+
+    BYTE readInstruction8()
+    {
+        if (UNLIKELY(m_remaining < 1))
+            return readSlowCase<BYTE>();
+        m_remaining -= 1;
+        return *(m_data++);
+    }
+
+    WORD readInstruction16()
+    {
+        if (UNLIKELY(m_remaining < 2))
+            return readSlowCase<WORD>();
+        WORD value = weld<WORD>(m_data[1], m_data[0]);
+        m_data += 2;
+        m_remaining -= 2;
+        return value;
+    }
+
+    DWORD readInstruction32()
+    {
+        if (UNLIKELY(m_remaining < 4))
+            return readSlowCase<DWORD>();
+        DWORD value = weld<DWORD>(weld<WORD>(m_data[3], m_data[2]), weld<WORD>(m_data[1], m_data[0]));
+        m_data += 4;
+        m_remaining -= 4;
+        return value;
+    }
+
+    // Moves EIP past everything consumed directly from the window.
+    void commit()
+    {
+        m_cpu.adjustInstructionPointer(m_data - m_start);
+        m_start = m_data;
+    }
+
+private:
+    template<typename T> T readSlowCase()
+    {
+        commit();
+        m_remaining = 0;
+        if (sizeof(T) == 1)
+            return m_cpu.readInstruction8();
+        if (sizeof(T) == 2)
+            return m_cpu.readInstruction16();
+        return m_cpu.readInstruction32();
+    }
+
+    CPU& m_cpu;
+    const BYTE* m_start { nullptr };
+    const BYTE* m_data { nullptr };
+    unsigned m_remaining { 0 };
+};
 
 // INLINE IMPLEMENTATIONS
 
@@ -1470,22 +1837,22 @@ ALWAYS_INLINE bool CPU::evaluate(BYTE conditionCode) const
     ASSERT(conditionCode <= 0xF);
 
     switch (conditionCode) {
-    case  0: return this->OF;                            // O
-    case  1: return !this->OF;                           // NO
-    case  2: return this->CF;                            // B, C, NAE
-    case  3: return !this->CF;                           // NB, NC, AE
+    case  0: return getOF();                             // O
+    case  1: return !getOF();                            // NO
+    case  2: return getCF();                             // B, C, NAE
+    case  3: return !getCF();                            // NB, NC, AE
     case  4: return getZF();                             // E, Z
     case  5: return !getZF();                            // NE, NZ
-    case  6: return (this->CF | getZF());                // BE, NA
-    case  7: return !(this->CF | getZF());               // NBE, A
+    case  6: return (getCF() | getZF());                 // BE, NA
+    case  7: return !(getCF() | getZF());                // NBE, A
     case  8: return getSF();                             // S
     case  9: return !getSF();                            // NS
     case 10: return getPF();                             // P, PE
     case 11: return !getPF();                            // NP, PO
-    case 12: return getSF() ^ this->OF;                  // L, NGE
-    case 13: return !(getSF() ^ this->OF);               // NL, GE
-    case 14: return (getSF() ^ this->OF) | getZF();      // LE, NG
-    case 15: return !((getSF() ^ this->OF) | getZF());   // NLE, G
+    case 12: return getSF() ^ getOF();                   // L, NGE
+    case 13: return !(getSF() ^ getOF());                // NL, GE
+    case 14: return (getSF() ^ getOF()) | getZF();       // LE, NG
+    case 15: return !((getSF() ^ getOF()) | getZF());    // NLE, G
     }
     return 0;
 }
@@ -1628,7 +1995,10 @@ ALWAYS_INLINE void Instruction::execute(CPU& cpu)
     cpu.setSegmentPrefix(m_segmentPrefix);
     cpu.m_effectiveOperandSize32 = m_o32;
     cpu.m_effectiveAddressSize32 = m_a32;
-    if (m_hasRM)
+    if (m_hasRM) {
         m_modrm.resolve(cpu);
+        if (m_readsMemoryOperandFirst && !m_modrm.isRegister() && UNLIKELY(!cpu.probeMemoryOperand(m_modrm.segment(), m_modrm.offset())))
+            return;
+    }
     (cpu.*m_impl)(*this);
 }
@@ -24,6 +24,7 @@
 
 #include "Instruction.h"
 #include "CPU.h"
+#include <mutex>
 
 enum InstructionFormat {
     InvalidFormat,
@@ -135,6 +136,7 @@ struct InstructionDescriptor {
     const char* mnemonic { nullptr };
     InstructionFormat format { InvalidFormat };
     bool hasRM { false };
+    bool readsMemoryOperandFirst { false };
     unsigned imm1Bytes { 0 };
     unsigned imm2Bytes { 0 };
     InstructionDescriptor* slashes { nullptr };
@@ -373,12 +375,47 @@ static void build0FSlash(BYTE op, BYTE slash, const char* mnemonic, InstructionF
     buildSlash(s_0F_table32, op, slash, mnemonic, format, impl);
 }
 
-void buildOpcodeTablesIfNeeded()
+static void markReadsMemoryOperandFirst(InstructionDescriptor* table, BYTE op)
 {
-    static bool hasBuiltTables = false;
-    if (hasBuiltTables)
+    InstructionDescriptor& d = table[op];
+    if (d.format != MultibyteWithSlash) {
+        d.readsMemoryOperandFirst = true;
         return;
+    }
+    for (unsigned slash = 0; slash < 8; ++slash)
+        d.slashes[slash].readsMemoryOperandFirst = true;
+}
+
+// Instructions that read their RM operand before any other access or side effect. Their #GP
+// and #PF on it are taken before the handler runs, see CPU::probeMemoryOperand().
+static void markInstructionsThatReadMemoryOperandFirst()
+{
+    static const BYTE ops[] = {
+        0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0A, 0x0B, // ADD, OR
+        0x10, 0x11, 0x12, 0x13, 0x18, 0x19, 0x1A, 0x1B, // ADC, SBB
+        0x20, 0x21, 0x22, 0x23, 0x28, 0x29, 0x2A, 0x2B, // AND, SUB
+        0x30, 0x31, 0x32, 0x33, 0x38, 0x39, 0x3A, 0x3B, // XOR, CMP
+        0x62, 0x69, 0x6B, // BOUND, IMUL
+        0x80, 0x81, 0x83, 0x84, 0x85, 0x86, 0x87, 0x8A, 0x8B, // ALU imm, TEST, XCHG, MOV
+        0xC0, 0xC1, 0xC4, 0xC5, 0xD0, 0xD1, 0xD2, 0xD3, // Shifts, LES, LDS
+        0xF6, 0xF7, 0xFE, 0xFF, // TEST/NOT/NEG/MUL/DIV, INC/DEC, CALL/JMP/PUSH
+    };
+    static const BYTE ops0F[] = {
+        0xAF, 0xB2, 0xB4, 0xB5, 0xB6, 0xB7, 0xBC, 0xBD, 0xBE, 0xBF, // IMUL, LSS/LFS/LGS, MOVZX, BSF/BSR, MOVSX
+    };
+    for (BYTE op : ops) {
+        markReadsMemoryOperandFirst(s_table16, op);
+        markReadsMemoryOperandFirst(s_table32, op);
+    }
+    for (BYTE op : ops0F) {
+        markReadsMemoryOperandFirst(s_0F_table16, op);
+        markReadsMemoryOperandFirst(s_0F_table32, op);
+    }
+}
 
+// The tables are shared by every CPU in the process, and never change once built.
+void buildOpcodeTables()
+{
     build(0x00, "ADD",    OP_RM8_reg8,         &CPU::_ADD_RM8_reg8);
     build(0x01, "ADD",    OP_RM16_reg16,       &CPU::_ADD_RM16_reg16,  OP_RM32_reg32,  &CPU::_ADD_RM32_reg32);
     build(0x02, "ADD",    OP_reg8_RM8,         &CPU::_ADD_reg8_RM8);
@@ -715,6 +752,7 @@ void buildOpcodeTablesIfNeeded()
     build0FSlash(0x01, 3, "LIDT",  OP_RM16,      &CPU::_LIDT);
     build0FSlash(0x01, 4, "SMSW",  OP_RM16,      &CPU::_SMSW_RM16);
     build0FSlash(0x01, 6, "LMSW",  OP_RM16,      &CPU::_LMSW_RM16);
+    build0FSlash(0x01, 7, "INVLPG", OP_RM32,     &CPU::_INVLPG);
 
     build0FSlash(0xBA, 4, "BT",    OP_RM16_imm8, &CPU::_BT_RM16_imm8,  OP_RM32_imm8, &CPU::_BT_RM32_imm8);
     build0FSlash(0xBA, 5, "BTS",   OP_RM16_imm8, &CPU::_BTS_RM16_imm8, OP_RM32_imm8, &CPU::_BTS_RM32_imm8);
@@ -794,10 +832,17 @@ void buildOpcodeTablesIfNeeded()
     build0F(0xBF, "0xBF",  OP,             nullptr,       "MOVSX", OP_reg32_RM16,  &CPU::_MOVSX_reg32_RM16);
     build0F(0xFF, "UD0",   OP,             &CPU::_UD0);
 
-    hasBuiltTables = true;
+    markInstructionsThatReadMemoryOperandFirst();
+}
+
+void buildOpcodeTablesIfNeeded()
+{
+    static std::once_flag hasBuiltTables;
+    std::call_once(hasBuiltTables, buildOpcodeTables);
 }
 
-FLATTEN Instruction Instruction::fromStream(InstructionStream& stream, bool o32, bool a32)
+template<typename InstructionStreamType>
+FLATTEN Instruction Instruction::fromStream(InstructionStreamType& stream, bool o32, bool a32)
 {
     return Instruction(stream, o32, a32);
 }
@@ -832,7 +877,20 @@ static SegmentRegisterIndex toSegmentPrefix(BYTE op)
     }
 }
 
-ALWAYS_INLINE Instruction::Instruction(InstructionStream& stream, bool o32, bool a32)
+template<typename InstructionStreamType>
+static ALWAYS_INLINE DWORD readImmediate(InstructionStreamType& stream, unsigned count)
+{
+    switch (count) {
+    case 1: return stream.readInstruction8();
+    case 2: return stream.readInstruction16();
+    case 4: return stream.readInstruction32();
+    }
+    ASSERT_NOT_REACHED();
+    return 0;
+}
+
+template<typename InstructionStreamType>
+ALWAYS_INLINE Instruction::Instruction(InstructionStreamType& stream, bool o32, bool a32)
     : m_a32(a32)
     , m_o32(o32)
 {
@@ -903,27 +961,21 @@ ALWAYS_INLINE Instruction::Instruction(InstructionStream& stream, bool o32, bool
     }
 
     m_impl = m_descriptor->impl;
+    m_readsMemoryOperandFirst = m_descriptor->readsMemoryOperandFirst;
 
     m_imm1Bytes = m_descriptor->imm1BytesForAddressSize(m_a32);
     m_imm2Bytes = m_descriptor->imm2BytesForAddressSize(m_a32);
 
     // Consume immediates if present.
     if (m_imm2Bytes)
-        m_imm2 = stream.readBytes(m_imm2Bytes);
+        m_imm2 = readImmediate(stream, m_imm2Bytes);
     if (m_imm1Bytes)
-        m_imm1 = stream.readBytes(m_imm1Bytes);
+        m_imm1 = readImmediate(stream, m_imm1Bytes);
 }
 
-DWORD InstructionStream::readBytes(unsigned count)
-{
-    switch (count) {
-    case 1: return readInstruction8();
-    case 2: return readInstruction16();
-    case 4: return readInstruction32();
-    }
-    ASSERT_NOT_REACHED();
-    return 0;
-}
+template Instruction Instruction::fromStream(InstructionStream&, bool o32, bool a32);
+template Instruction Instruction::fromStream(SimpleInstructionStream&, bool o32, bool a32);
+template Instruction Instruction::fromStream(InstructionFetchWindow&, bool o32, bool a32);
 
 const char* Instruction::reg8Name() const
 {
@@ -1346,17 +1398,3 @@ QString Instruction::toStringInternal(DWORD origin, bool x32) const
     ASSERT_NOT_REACHED();
     return QString();
 }
-
-WORD SimpleInstructionStream::readInstruction16()
-{
-    BYTE lsb = *(m_data++);
-    BYTE msb = *(m_data++);
-    return weld<WORD>(msb, lsb);
-}
-
-DWORD SimpleInstructionStream::readInstruction32()
-{
-    WORD lsw = readInstruction16();
-    WORD msw = readInstruction16();
-    return weld<DWORD>(msw, lsw);
-}
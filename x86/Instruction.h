@@ -45,12 +45,14 @@ enum Op {
 };
 };
 
+// The decoder is templated on the stream type, so any class with these three
+// functions will do. Deriving from InstructionStream is only needed when the
+// concrete stream type isn't known at the call site.
 class InstructionStream {
 public:
     virtual BYTE readInstruction8() = 0;
     virtual WORD readInstruction16() = 0;
     virtual DWORD readInstruction32() = 0;
-    DWORD readBytes(unsigned count);
 };
 
 class SimpleInstructionStream final : public InstructionStream {
@@ -60,8 +62,18 @@ public:
     { }
 
     virtual BYTE readInstruction8() override { return *(m_data++); }
-    virtual WORD readInstruction16() override;
-    virtual DWORD readInstruction32() override;
+    virtual WORD readInstruction16() override
+    {
+        WORD value = weld<WORD>(m_data[1], m_data[0]);
+        m_data += 2;
+        return value;
+    }
+    virtual DWORD readInstruction32() override
+    {
+        DWORD value = weld<DWORD>(weld<WORD>(m_data[3], m_data[2]), weld<WORD>(m_data[1], m_data[0]));
+        m_data += 4;
+        return value;
+    }
 
 private:
     const BYTE* m_data { nullptr };
@@ -117,9 +129,9 @@ private:
     void resolve16();
     void resolve32();
 
-    void decode(InstructionStream&, bool a32);
-    void decode16(InstructionStream&);
-    void decode32(InstructionStream&);
+    template<typename InstructionStreamType> void decode(InstructionStreamType&, bool a32);
+    void decode16();
+    template<typename InstructionStreamType> void decode32(InstructionStreamType&);
 
     DWORD evaluateSIB();
 
@@ -148,7 +160,8 @@ private:
 
 class Instruction {
 public:
-    static Instruction fromStream(InstructionStream&, bool o32, bool a32);
+    template<typename InstructionStreamType>
+    static Instruction fromStream(InstructionStreamType&, bool o32, bool a32);
     ~Instruction() { }
 
     void execute(CPU&);
@@ -206,7 +219,10 @@ public:
     QString toString(DWORD origin, bool x32) const;
 
 private:
-    Instruction(InstructionStream&, bool o32, bool a32);
+    friend class InstructionCache;
+    Instruction() { }
+    template<typename InstructionStreamType>
+    Instruction(InstructionStreamType&, bool o32, bool a32);
 
     QString toStringInternal(DWORD origin, bool x32) const;
 
@@ -224,6 +240,7 @@ private:
 
     bool m_hasSubOp { false };
     bool m_hasRM { false };
+    bool m_readsMemoryOperandFirst { false };
 
     unsigned m_imm1Bytes { 0 };
     unsigned m_imm2Bytes { 0 };
@@ -0,0 +1,180 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "InstructionCache.h"
+#include <algorithm>
+#include <string.h>
+
+InstructionCache::InstructionCache()
+{
+}
+
+InstructionCache::~InstructionCache()
+{
+}
+
+void InstructionCache::setMemorySize(DWORD size)
+{
+    m_memorySize = size;
+    m_codeLines.fill(false, (size + lineSize - 1) / lineSize);
+    m_codePages.fill(false, (size + 4095) / 4096);
+    m_blocksInPage.fill(0, (size + 4095) / 4096);
+    clear();
+}
+
+void InstructionCache::clear()
+{
+    for (auto& entry : m_entries)
+        entry.mode = emptyMode;
+    for (auto& block : m_blocks)
+        block.clear();
+    m_blocksByLine.clear();
+    memset(m_blockHeat, 0, sizeof(m_blockHeat));
+    m_blockCount = 0;
+    m_blockInstructionCount = 0;
+    m_codeLines.fill(false);
+    m_codePages.fill(false);
+    m_blocksInPage.fill(0);
+}
+
+void InstructionCache::markCode(DWORD address, DWORD length)
+{
+    for (DWORD line = address / lineSize; line <= (address + length - 1) / lineSize; ++line)
+        m_codeLines[line] = true;
+}
+
+bool InstructionCache::insert(PhysicalAddress address, BYTE mode, const Instruction& instruction)
+{
+    unsigned length = instruction.length();
+    ASSERT(length <= maxInstructionLength);
+    ASSERT((address.get() & 0xfff) + length <= 4096);
+    ASSERT(address.get() + length <= m_memorySize);
+
+    auto& entry = m_entries[address.get() & (cacheSize - 1)];
+    entry.address = address.get();
+    entry.mode = mode;
+    entry.length = length;
+    entry.instruction = instruction;
+
+    markCode(address.get(), length);
+
+    DWORD page = address.get() / 4096;
+    if (m_codePages[page])
+        return false;
+    m_codePages[page] = true;
+    return true;
+}
+
+void InstructionCache::invalidate(PhysicalAddress address, DWORD size)
+{
+    if (!size || address.get() >= m_memorySize)
+        return;
+    DWORD lastAddress = std::min<QWORD>((QWORD)address.get() + size, m_memorySize) - 1;
+    for (DWORD line = address.get() / lineSize; line <= lastAddress / lineSize; ++line) {
+        if (m_codeLines[line])
+            invalidateLine(line);
+    }
+}
+
+void InstructionCache::invalidateLine(DWORD line)
+{
+    // Every cached instruction overlapping this line starts at most maxInstructionLength - 1 bytes before it,
+    // and lives in the slot selected by its own address, so this finds all of them.
+    DWORD lineStart = line * lineSize;
+    DWORD lineEnd = lineStart + lineSize;
+    DWORD address = lineStart >= maxInstructionLength ? lineStart - (maxInstructionLength - 1) : 0;
+    for (; address < lineEnd; ++address) {
+        auto& entry = m_entries[address & (cacheSize - 1)];
+        if (entry.mode == emptyMode || entry.address != address)
+            continue;
+        if (entry.address + entry.length <= lineStart)
+            continue;
+        entry.mode = emptyMode;
+        ++m_invalidations;
+    }
+    if (m_blocksInPage[lineStart / 4096])
+        invalidateBlocksInLine(line);
+    m_codeLines[line] = false;
+}
+
+void InstructionCache::invalidateBlocksInLine(DWORD line)
+{
+    QVector<WORD> blockSlots = m_blocksByLine.take(line);
+    for (WORD slot : blockSlots) {
+        removeBlock(slot);
+        ++m_blockInvalidations;
+    }
+}
+
+// Drops the block in this slot, and its entries in m_blocksByLine.
+void InstructionCache::removeBlock(unsigned slot)
+{
+    auto& block = m_blocks[slot];
+    ASSERT(block);
+    for (DWORD line = block->address / lineSize; line <= (block->address + block->length - 1) / lineSize; ++line) {
+        if (!m_blocksByLine.contains(line))
+            continue;
+        QVector<WORD>& blockSlots = m_blocksByLine[line];
+        blockSlots.removeOne(slot);
+        if (blockSlots.isEmpty())
+            m_blocksByLine.remove(line);
+    }
+    --m_blocksInPage[block->address / 4096];
+    --m_blockCount;
+    m_blockInstructionCount -= block->instructions.size();
+    block.clear();
+}
+
+// Heat is kept per block table slot, the same one lookupBlock() and insertBlock() use for this address.
+bool InstructionCache::recordBlockEntry(PhysicalAddress address)
+{
+    auto& heat = m_blockHeat[blockSlotFor(address.get())];
+    if (++heat < blockHeatThreshold)
+        return false;
+    heat = 0;
+    return true;
+}
+
+InstructionBlock* InstructionCache::insertBlock(OwnPtr<InstructionBlock>&& newBlock)
+{
+    ASSERT(!newBlock->instructions.isEmpty());
+    ASSERT((newBlock->address & 0xfff) + newBlock->length <= 4096);
+    ASSERT(newBlock->address + newBlock->length <= m_memorySize);
+
+    unsigned slot = blockSlotFor(newBlock->address);
+    auto& block = m_blocks[slot];
+    if (block)
+        removeBlock(slot);
+
+    block = std::move(newBlock);
+    markCode(block->address, block->length);
+    for (DWORD line = block->address / lineSize; line <= (block->address + block->length - 1) / lineSize; ++line)
+        m_blocksByLine[line].append(slot);
+    m_codePages[block->address / 4096] = true;
+    ++m_blocksInPage[block->address / 4096];
+    ++m_blockCount;
+    m_blockInstructionCount += block->instructions.size();
+    ++m_blocksBuilt;
+    return block.ptr();
+}
@@ -0,0 +1,150 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "Instruction.h"
+#include "OwnPtr.h"
+#include "types.h"
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+// A straight-line run of decoded instructions from a single physical page.
+struct InstructionBlock {
+    DWORD address { 0 };
+    BYTE mode { 0 };
+    DWORD length { 0 };
+    QVector<Instruction> instructions;
+    QWORD executions { 0 };
+};
+
+// Cache of decoded instructions, keyed by physical address and the CS default operand/address size.
+// Cached instructions never cross a page boundary, so the caller only has to translate the first byte.
+// Writes to physical memory must be reported via invalidate() so that self-modifying code keeps working.
+class InstructionCache {
+public:
+    InstructionCache();
+    ~InstructionCache();
+
+    static const unsigned maxInstructionLength = 15;
+
+    void setMemorySize(DWORD);
+    void clear();
+
+    static BYTE modeFor(bool o32, bool a32) { return o32 | (a32 << 1); }
+
+    Instruction* lookup(PhysicalAddress, BYTE mode);
+
+    // Returns true if this is the first instruction cached from this physical page.
+    bool insert(PhysicalAddress, BYTE mode, const Instruction&);
+
+    bool mayContainCode(DWORD address) const { return address < m_memorySize && m_codeLines[address / lineSize]; }
+    void invalidate(PhysicalAddress, DWORD size);
+
+    bool isCodePage(PhysicalAddress address) const { return address.get() < m_memorySize && m_codePages[address.get() / 4096]; }
+
+    // Decoded blocks. Block entry points are profiled, and once one gets hot the caller builds a block for it.
+    static const unsigned maxBlockInstructions = 64;
+    bool recordBlockEntry(PhysicalAddress);
+    InstructionBlock* lookupBlock(PhysicalAddress, BYTE mode);
+    InstructionBlock* insertBlock(OwnPtr<InstructionBlock>&&);
+
+    QWORD hits() const { return m_hits; }
+    QWORD misses() const { return m_misses; }
+    QWORD invalidations() const { return m_invalidations; }
+    unsigned entryCount() const { return cacheSize; }
+
+    unsigned blockCount() const { return m_blockCount; }
+    unsigned blockInstructionCount() const { return m_blockInstructionCount; }
+    QWORD blocksBuilt() const { return m_blocksBuilt; }
+    QWORD blockInvalidations() const { return m_blockInvalidations; }
+    QWORD blockExecutions() const { return m_blockExecutions; }
+    QWORD blockInstructionsExecuted() const { return m_blockInstructionsExecuted; }
+    void didExecuteBlockInstructions(unsigned count) { ++m_blockExecutions; m_blockInstructionsExecuted += count; }
+
+private:
+    static const unsigned cacheSize = 8192;
+    static const unsigned lineSize = 64;
+    static const BYTE emptyMode = 0xff;
+    static const unsigned blockTableSize = 4096;
+    static const WORD blockHeatThreshold = 64;
+
+    struct Entry {
+        DWORD address { 0 };
+        BYTE mode { emptyMode };
+        BYTE length { 0 };
+        Instruction instruction;
+    };
+
+    void invalidateLine(DWORD line);
+    void invalidateBlocksInLine(DWORD line);
+    void removeBlock(unsigned slot);
+    void markCode(DWORD address, DWORD length);
+    static unsigned blockSlotFor(DWORD address) { return (address ^ (address >> 12)) & (blockTableSize - 1); }
+
+    Entry m_entries[cacheSize];
+
+    OwnPtr<InstructionBlock> m_blocks[blockTableSize];
+    WORD m_blockHeat[blockTableSize];
+    // Number of cached blocks per page of physical memory.
+    QVector<WORD> m_blocksInPage;
+    // Block table slots of the cached blocks overlapping each code line, for the lines that have any.
+    QHash<DWORD, QVector<WORD>> m_blocksByLine;
+
+    // One flag per 'lineSize' bytes of physical memory, set if an instruction from that line may be cached.
+    QVector<bool> m_codeLines;
+    // One flag per page of physical memory, set once any instruction from that page has been cached.
+    QVector<bool> m_codePages;
+    DWORD m_memorySize { 0 };
+
+    QWORD m_hits { 0 };
+    QWORD m_misses { 0 };
+    QWORD m_invalidations { 0 };
+
+    unsigned m_blockCount { 0 };
+    unsigned m_blockInstructionCount { 0 };
+    QWORD m_blocksBuilt { 0 };
+    QWORD m_blockInvalidations { 0 };
+    QWORD m_blockExecutions { 0 };
+    QWORD m_blockInstructionsExecuted { 0 };
+};
+
+ALWAYS_INLINE Instruction* InstructionCache::lookup(PhysicalAddress address, BYTE mode)
+{
+    auto& entry = m_entries[address.get() & (cacheSize - 1)];
+    if (LIKELY(entry.mode == mode && entry.address == address.get())) {
+        ++m_hits;
+        return &entry.instruction;
+    }
+    ++m_misses;
+    return nullptr;
+}
+
+ALWAYS_INLINE InstructionBlock* InstructionCache::lookupBlock(PhysicalAddress address, BYTE mode)
+{
+    auto& block = m_blocks[blockSlotFor(address.get())];
+    if (block && block->address == address.get() && block->mode == mode)
+        return block.ptr();
+    return nullptr;
+}
@@ -0,0 +1,81 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "PhysicalMemoryMap.h"
+#include "MemoryProvider.h"
+#include "debug.h"
+
+PhysicalMemoryMap::PhysicalMemoryMap()
+{
+    for (auto& table : m_directory)
+        table = m_unmappedTable;
+}
+
+PhysicalMemoryMap::~PhysicalMemoryMap()
+{
+    clear();
+}
+
+void PhysicalMemoryMap::clear()
+{
+    for (auto& table : m_directory) {
+        if (table != m_unmappedTable)
+            delete [] table;
+        table = m_unmappedTable;
+    }
+}
+
+PhysicalMemoryMap::Page& PhysicalMemoryMap::mutablePage(DWORD pageIndex)
+{
+    auto& table = m_directory[pageIndex / tableSize];
+    if (table == m_unmappedTable)
+        table = new Page[tableSize];
+    return table[pageIndex % tableSize];
+}
+
+void PhysicalMemoryMap::mapRAM(PhysicalAddress baseAddress, DWORD size, BYTE* memory)
+{
+    ASSERT((baseAddress.get() % pageSize) == 0);
+    ASSERT((size % pageSize) == 0);
+    DWORD firstPage = baseAddress.get() / pageSize;
+    for (DWORD i = 0; i < size / pageSize; ++i) {
+        auto& page = mutablePage(firstPage + i);
+        page.readPointer = memory + i * pageSize;
+        page.writePointer = page.readPointer;
+        page.provider = nullptr;
+    }
+}
+
+void PhysicalMemoryMap::mapProvider(MemoryProvider& provider)
+{
+    ASSERT((provider.baseAddress().get() % pageSize) == 0);
+    DWORD firstPage = provider.baseAddress().get() / pageSize;
+    BYTE* directReadAccessPointer = const_cast<BYTE*>(provider.pointerForDirectReadAccess());
+    for (DWORD i = 0; i < provider.size() / pageSize; ++i) {
+        auto& page = mutablePage(firstPage + i);
+        page.readPointer = directReadAccessPointer ? directReadAccessPointer + i * pageSize : nullptr;
+        page.writePointer = nullptr;
+        page.provider = &provider;
+    }
+}
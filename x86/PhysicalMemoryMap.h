@@ -0,0 +1,65 @@
+// Computron x86 PC Emulator
+// Copyright (C) 2003-2018 Andreas Kling <awesomekling@gmail.com>
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+// 1. Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+// 2. Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY ANDREAS KLING ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL ANDREAS KLING OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include "types.h"
+
+class MemoryProvider;
+
+// The whole 4 GiB physical address space at page granularity.
+// A page is plain RAM (read and written through a host pointer), belongs to a MemoryProvider
+// (ROM, MMIO; which may still vend a host pointer for reads) or is unmapped.
+// It's a two-level table so that the sparse upper space stays cheap: every directory slot
+// starts out pointing at one shared table of unmapped pages, and gets its own on first use.
+class PhysicalMemoryMap {
+public:
+    struct Page {
+        BYTE* readPointer { nullptr };
+        BYTE* writePointer { nullptr };
+        MemoryProvider* provider { nullptr };
+    };
+
+    PhysicalMemoryMap();
+    ~PhysicalMemoryMap();
+
+    static const DWORD pageSize = 4096;
+
+    const Page& page(PhysicalAddress address) const
+    {
+        return m_directory[address.get() >> 22][(address.get() >> 12) & (tableSize - 1)];
+    }
+
+    void clear();
+    // size must be a whole number of pages.
+    void mapRAM(PhysicalAddress, DWORD size, BYTE* memory);
+    void mapProvider(MemoryProvider&);
+
+private:
+    Page& mutablePage(DWORD pageIndex);
+
+    static const unsigned tableSize = 1024;
+    Page* m_directory[tableSize];
+    Page m_unmappedTable[tableSize];
+};
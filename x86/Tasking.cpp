@@ -44,7 +44,7 @@ void CPU::_LTR_RM16(Instruction& insn)
     auto descriptor = getDescriptor(selector);
 
     if (getCPL() != 0) {
-        throw GeneralProtectionFault(0, QString("LTR with CPL(%u)!=0").arg(getCPL()));
+        throw GeneralProtectionFault(0, ExceptionReason("LTR with CPL(%1)!=0", getCPL()));
     }
     if (!descriptor.isGlobal()) {
         throw GeneralProtectionFault(selector, "LTR selector must reference GDT");
@@ -155,6 +155,7 @@ void CPU::taskSwitch(TSSDescriptor& incomingTSSDescriptor, JumpType source)
     // First, load all registers from TSS without validating contents.
     if (getPG()) {
         m_CR3 = incomingTSS.getCR3();
+        flushTLB();
     }
 
     LDTR.selector = incomingTSS.getLDT();
@@ -224,7 +225,7 @@ void CPU::taskSwitch(TSSDescriptor& incomingTSSDescriptor, JumpType source)
     if (csDescriptor.isCode()) {
         if (csDescriptor.isNonconformingCode()) {
             if (csDescriptor.DPL() != (getCS() & 3))
-                throw InvalidTSS(getCS(), QString("CS is non-conforming with DPL(%1) != RPL(%2)").arg(csDescriptor.DPL()).arg(getCS() & 3));
+                throw InvalidTSS(getCS(), ExceptionReason("CS is non-conforming with DPL(%1) != RPL(%2)", csDescriptor.DPL(), getCS() & 3));
         } else if (csDescriptor.isConformingCode()) {
             if (csDescriptor.DPL() > (getCS() & 3))
                 throw InvalidTSS(getCS(), "CS is conforming with DPL > RPL");
@@ -241,7 +242,7 @@ void CPU::taskSwitch(TSSDescriptor& incomingTSSDescriptor, JumpType source)
         if (!ssDescriptor.present())
             throw StackFault(getSS(), "SS is not present");
         if (ssDescriptor.DPL() != incomingCPL)
-            throw InvalidTSS(getSS(), QString("SS DPL(%1) != CPL(%2)").arg(ssDescriptor.DPL()).arg(incomingCPL));
+            throw InvalidTSS(getSS(), ExceptionReason("SS DPL(%1) != CPL(%2)", ssDescriptor.DPL(), incomingCPL));
     }
 
     if (!ldtDescriptor.isNull()) {
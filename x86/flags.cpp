@@ -51,9 +51,48 @@ bool CPU::getSF() const
     return SF;
 }
 
-void CPU::adjustFlag32(QWORD result, DWORD src, DWORD dest)
+bool CPU::getCF() const
 {
-    setAF((((result ^ (src ^ dest)) & 0x10) >> 4) & 1);
+    if (m_dirtyFlags & Flag::CF) {
+        // m_arithmeticResult is wider than the operation, so the carry/borrow is the bit right above it.
+        CF = (m_arithmeticResult >> m_arithmeticOpSize) & 1;
+        m_dirtyFlags &= ~Flag::CF;
+    }
+    return CF;
+}
+
+bool CPU::getOF() const
+{
+    if (m_dirtyFlags & Flag::OF) {
+        QWORD result = m_arithmeticResult;
+        QWORD dest = m_arithmeticDestination;
+        QWORD src = m_arithmeticSource;
+        QWORD overflow = m_arithmeticIsSubtraction ? ((result ^ dest) & (src ^ dest)) : ((result ^ dest) & (result ^ src));
+        OF = (overflow >> (m_arithmeticOpSize - 1)) & 1;
+        m_dirtyFlags &= ~Flag::OF;
+    }
+    return OF;
+}
+
+bool CPU::getAF() const
+{
+    if (m_dirtyFlags & Flag::AF) {
+        AF = ((m_arithmeticResult ^ (m_arithmeticSource ^ m_arithmeticDestination)) >> 4) & 1;
+        m_dirtyFlags &= ~Flag::AF;
+    }
+    return AF;
+}
+
+void CPU::recordArithmetic(QWORD result, DWORD dest, DWORD src, unsigned opSize, bool isSubtraction)
+{
+    m_dirtyFlags |= Flag::PF | Flag::ZF | Flag::SF | Flag::CF | Flag::OF | Flag::AF;
+    m_lastResult = result;
+    m_lastOpSize = opSize;
+    m_arithmeticResult = result;
+    m_arithmeticDestination = dest;
+    m_arithmeticSource = src;
+    m_arithmeticOpSize = opSize;
+    m_arithmeticIsSubtraction = isSubtraction;
 }
 
 void CPU::updateFlags32(DWORD data)
@@ -103,7 +142,7 @@ void CPU::_STI(Instruction&)
             if ((getIOPL() < getCPL()) && getCPL() == 3 && !getVIP())
                 setVIF(1);
             else
-                throw GeneralProtectionFault(0, "STI with VM=0");
+                leaveFaultPending(GeneralProtectionFault(0, "STI with VM=0"));
         }
     } else {
         if (getIOPL() == 3) {
@@ -112,7 +151,7 @@ void CPU::_STI(Instruction&)
             if (getIOPL() < 3 && !getVIP() && getVME()) {
                 setVIF(1);
             } else {
-                throw GeneralProtectionFault(0, "STI with VM=1");
+                leaveFaultPending(GeneralProtectionFault(0, "STI with VM=1"));
             }
         }
     }
@@ -132,7 +171,7 @@ void CPU::_CLI(Instruction&)
             if ((getIOPL() < getCPL()) && getCPL() == 3 && getPVI())
                 setVIF(0);
             else
-                throw GeneralProtectionFault(0, "CLI with VM=0");
+                leaveFaultPending(GeneralProtectionFault(0, "CLI with VM=0"));
         }
     } else {
         if (getIOPL() == 3) {
@@ -141,7 +180,7 @@ void CPU::_CLI(Instruction&)
             if (getIOPL() < 3 && getVME()) {
                 setVIF(0);
             } else {
-                throw GeneralProtectionFault(0, "CLI with VM=1");
+                leaveFaultPending(GeneralProtectionFault(0, "CLI with VM=1"));
             }
         }
     }
@@ -176,62 +215,42 @@ void CPU::_SAHF(Instruction&)
     setSF(getAH() & Flag::SF);
 }
 
-void CPU::mathFlags8(WORD result, BYTE dest, BYTE src)
+void CPU::recordIncDec(QWORD result, DWORD dest, unsigned opSize, bool isSubtraction)
 {
-    m_dirtyFlags |= Flag::PF | Flag::ZF | Flag::SF;
-    m_lastResult = result;
-    m_lastOpSize = ByteSize;
+    // INC and DEC leave CF alone, so pin it down before its operands are replaced.
+    getCF();
+    recordArithmetic(result, dest, 1, opSize, isSubtraction);
+    m_dirtyFlags &= ~Flag::CF;
+}
 
-    setCF(result & 0xFF00);
-    adjustFlag32(result, dest, src);
+void CPU::mathFlags8(WORD result, BYTE dest, BYTE src)
+{
+    recordArithmetic(result, dest, src, ByteSize, false);
 }
 
 void CPU::mathFlags16(DWORD result, WORD dest, WORD src)
 {
-    m_dirtyFlags |= Flag::PF | Flag::ZF | Flag::SF;
-    m_lastResult = result;
-    m_lastOpSize = WordSize;
-
-    setCF(result & 0xFFFF0000);
-    setSF(result & 0x8000);
-    adjustFlag32(result, dest, src);
+    recordArithmetic(result, dest, src, WordSize, false);
 }
 
 void CPU::mathFlags32(QWORD result, DWORD dest, DWORD src)
 {
-    m_dirtyFlags |= Flag::PF | Flag::ZF | Flag::SF;
-    m_lastResult = result;
-    m_lastOpSize = DWordSize;
-
-    setCF(result & 0xFFFFFFFF00000000ULL);
-    adjustFlag32(result, dest, src);
+    recordArithmetic(result, dest, src, DWordSize, false);
 }
 
 void CPU::cmpFlags8(DWORD result, BYTE dest, BYTE src)
 {
-    mathFlags8(result, dest, src);
-    setOF(((
-        ((result)^(dest)) &
-        ((src)^(dest))
-        )>>(7))&1);
+    recordArithmetic(result, dest, src, ByteSize, true);
 }
 
 void CPU::cmpFlags16(DWORD result, WORD dest, WORD src)
 {
-    mathFlags16(result, dest, src);
-    setOF(((
-        ((result)^(dest)) &
-        ((src)^(dest))
-        )>>(15))&1);
+    recordArithmetic(result, dest, src, WordSize, true);
 }
 
 void CPU::cmpFlags32(QWORD result, DWORD dest, DWORD src)
 {
-    mathFlags32(result, dest, src);
-    setOF(((
-        ((result)^(dest)) &
-        ((src)^(dest))
-        )>>(31))&1);
+    recordArithmetic(result, dest, src, DWordSize, true);
 }
 
 void CPU::setFlags(WORD flags)
@@ -28,14 +28,24 @@
 #include "debugger.h"
 #include "Tasking.h"
 
+// The INT instructions are IOPL-sensitive in VM86 mode. The single-step trap is not.
+void CPU::softwareInterrupt(BYTE isr)
+{
+    if (getPE() && getVM() && getIOPL() != 3) {
+        leaveFaultPending(GeneralProtectionFault(0, "Software INT in VM86 mode with IOPL != 3"));
+        return;
+    }
+    interrupt(isr, InterruptSource::Internal);
+}
+
 void CPU::_INT_imm8(Instruction& insn)
 {
-    interrupt(insn.imm8(), InterruptSource::Internal);
+    softwareInterrupt(insn.imm8());
 }
 
 void CPU::_INT3(Instruction&)
 {
-    interrupt(3, InterruptSource::Internal);
+    softwareInterrupt(3);
 }
 
 void CPU::_INTO(Instruction&)
@@ -44,13 +54,15 @@ void CPU::_INTO(Instruction&)
     vlog(LogAlert, "INTO used, can you believe it?");
 
     if (getOF())
-        interrupt(4, InterruptSource::Internal);
+        softwareInterrupt(4);
 }
 
 void CPU::iretFromVM86Mode()
 {
-    if (getIOPL() != 3)
-        throw GeneralProtectionFault(0, "IRET in VM86 mode with IOPL != 3");
+    if (getIOPL() != 3) {
+        leaveFaultPending(GeneralProtectionFault(0, "IRET in VM86 mode with IOPL != 3"));
+        return;
+    }
 
     BYTE originalCPL = getCPL();
 
@@ -195,10 +207,6 @@ void CPU::protectedModeInterrupt(BYTE isr, InterruptSource source, QVariant erro
 {
     ASSERT(getPE());
 
-    if (source == InterruptSource::Internal && getVM() && getIOPL() != 3) {
-        throw GeneralProtectionFault(0, "Software INT in VM86 mode with IOPL != 3");
-    }
-
     auto idtEntry = getInterruptDescriptor(isr);
     if (!idtEntry.isTaskGate() && !idtEntry.isTrapGate() && !idtEntry.isInterruptGate()) {
         throw GeneralProtectionFault(makeErrorCode(isr, 1, source), "Interrupt to invalid gate type");
@@ -207,7 +215,7 @@ void CPU::protectedModeInterrupt(BYTE isr, InterruptSource source, QVariant erro
 
     if (source == InterruptSource::Internal) {
         if (gate.DPL() < getCPL()) {
-            throw GeneralProtectionFault(makeErrorCode(isr, 1, source), QString("Software interrupt trying to escalate privilege (CPL=%1, DPL=%2, VM=%3)").arg(getCPL()).arg(gate.DPL()).arg(getVM()));
+            throw GeneralProtectionFault(makeErrorCode(isr, 1, source), ExceptionReason("Software interrupt trying to escalate privilege (CPL=%1, DPL=%2, VM=%3)", getCPL(), gate.DPL(), getVM()));
         }
     }
 
@@ -252,7 +260,7 @@ void CPU::protectedModeInterrupt(BYTE isr, InterruptSource source, QVariant erro
 
     auto& codeDescriptor = descriptor.asCodeSegmentDescriptor();
     if (codeDescriptor.DPL() > getCPL()) {
-        throw GeneralProtectionFault(makeErrorCode(gate.selector(), 0, source), QString("Interrupt gate to segment with DPL(%1)>CPL(%2)").arg(codeDescriptor.DPL()).arg(getCPL()));
+        throw GeneralProtectionFault(makeErrorCode(gate.selector(), 0, source), ExceptionReason("Interrupt gate to segment with DPL(%1)>CPL(%2)", codeDescriptor.DPL(), getCPL()));
     }
 
     if (!codeDescriptor.present()) {
@@ -304,7 +312,7 @@ void CPU::protectedModeInterrupt(BYTE isr, InterruptSource source, QVariant erro
         }
 
         if (newSSDescriptor.DPL() != descriptor.DPL()) {
-            throw InvalidTSS(makeErrorCode(newSS, 0, source), QString("New ss DPL(%1) != code segment DPL(%2)").arg(newSSDescriptor.DPL()).arg(descriptor.DPL()));
+            throw InvalidTSS(makeErrorCode(newSS, 0, source), ExceptionReason("New ss DPL(%1) != code segment DPL(%2)", newSSDescriptor.DPL(), descriptor.DPL()));
         }
 
         if (!newSSDescriptor.isData() || !newSSDescriptor.asDataSegmentDescriptor().writable()) {
@@ -387,11 +395,11 @@ void CPU::interruptFromVM86Mode(Gate& gate, DWORD offset, CodeSegmentDescriptor&
     }
 
     if ((newSS & 3) != 0) {
-        throw InvalidTSS(makeErrorCode(newSS, 0, source), QString("New ss RPL(%1) != 0").arg(newSS & 3));
+        throw InvalidTSS(makeErrorCode(newSS, 0, source), ExceptionReason("New ss RPL(%1) != 0", newSS & 3));
     }
 
     if (newSSDescriptor.DPL() != 0) {
-        throw InvalidTSS(makeErrorCode(newSS, 0, source), QString("New ss DPL(%1) != 0").arg(newSSDescriptor.DPL()));
+        throw InvalidTSS(makeErrorCode(newSS, 0, source), ExceptionReason("New ss DPL(%1) != 0", newSSDescriptor.DPL()));
     }
 
     if (!newSSDescriptor.isData() || !newSSDescriptor.asDataSegmentDescriptor().writable()) {
@@ -464,7 +472,7 @@ void CPU::protectedIRET(TransactionalPopper& popper, LogicalAddress address)
     auto descriptor = getDescriptor(selector, SegmentRegisterIndex::CS);
 
     if (!(selectorRPL >= getCPL())) {
-        throw GeneralProtectionFault(selector, QString("IRET with !(RPL(%1) >= CPL(%2))").arg(selectorRPL).arg(getCPL()));
+        throw GeneralProtectionFault(selector, ExceptionReason("IRET with !(RPL(%1) >= CPL(%2))", selectorRPL, getCPL()));
     }
     if (descriptor.isNull()) {
         throw GeneralProtectionFault(selector, "IRET to null selector");
@@ -31,91 +31,106 @@
 
 void CPU::_OUT_imm8_AL(Instruction& insn)
 {
-    out8(insn.imm8(), getAL());
+    if (checkIOAccess<BYTE>(insn.imm8()))
+        out8(insn.imm8(), getAL());
 }
 
 void CPU::_OUT_imm8_AX(Instruction& insn)
 {
-    out16(insn.imm8(), getAX());
+    if (checkIOAccess<WORD>(insn.imm8()))
+        out16(insn.imm8(), getAX());
 }
 
 void CPU::_OUT_imm8_EAX(Instruction& insn)
 {
-    out32(insn.imm8(), getEAX());
+    if (checkIOAccess<DWORD>(insn.imm8()))
+        out32(insn.imm8(), getEAX());
 }
 
 void CPU::_OUT_DX_AL(Instruction&)
 {
-    out8(getDX(), getAL());
+    if (checkIOAccess<BYTE>(getDX()))
+        out8(getDX(), getAL());
 }
 
 void CPU::_OUT_DX_AX(Instruction&)
 {
-    out16(getDX(), getAX());
+    if (checkIOAccess<WORD>(getDX()))
+        out16(getDX(), getAX());
 }
 
 void CPU::_OUT_DX_EAX(Instruction&)
 {
-    out32(getDX(), getEAX());
+    if (checkIOAccess<DWORD>(getDX()))
+        out32(getDX(), getEAX());
 }
 
 void CPU::_IN_AL_imm8(Instruction& insn)
 {
-    setAL(in8(insn.imm8()));
+    if (checkIOAccess<BYTE>(insn.imm8()))
+        setAL(in8(insn.imm8()));
 }
 
 void CPU::_IN_AX_imm8(Instruction& insn)
 {
-    setAX(in16(insn.imm8()));
+    if (checkIOAccess<WORD>(insn.imm8()))
+        setAX(in16(insn.imm8()));
 }
 
 void CPU::_IN_EAX_imm8(Instruction& insn)
 {
-    setEAX(in32(insn.imm8()));
+    if (checkIOAccess<DWORD>(insn.imm8()))
+        setEAX(in32(insn.imm8()));
 }
 
 void CPU::_IN_AL_DX(Instruction&)
 {
-    setAL(in8(getDX()));
+    if (checkIOAccess<BYTE>(getDX()))
+        setAL(in8(getDX()));
 }
 
 void CPU::_IN_AX_DX(Instruction&)
 {
-    setAX(in16(getDX()));
+    if (checkIOAccess<WORD>(getDX()))
+        setAX(in16(getDX()));
 }
 
 void CPU::_IN_EAX_DX(Instruction&)
 {
-    setEAX(in32(getDX()));
+    if (checkIOAccess<DWORD>(getDX()))
+        setEAX(in32(getDX()));
 }
 
+// The I/O instruction handlers check before touching any state. Returns false with a #GP
+// pending (see leaveFaultPending()) if the port is off limits.
 template<typename T>
-void CPU::validateIOAccess(WORD port)
+bool CPU::checkIOAccess(WORD port)
 {
     if (!getPE())
-        return;
+        return true;
     if (!getVM() && !(getCPL() > getIOPL()))
-        return;
+        return true;
     auto tss = currentTSS();
     if (!tss.is32Bit()) {
-        vlog(LogCPU, "validateIOAccess for 16-bit TSS, what do?");
+        vlog(LogCPU, "checkIOAccess for 16-bit TSS, what do?");
         ASSERT_NOT_REACHED();
     }
 
     if (TR.limit < 103)
-        throw GeneralProtectionFault(0, "TSS too small, I/O map missing");
+        return leaveFaultPending(GeneralProtectionFault(0, "TSS too small, I/O map missing"));
 
     WORD iomapBase = tss.getIOMapBase();
     WORD highPort = port + sizeof(T) - 1;
 
     if (TR.limit < (iomapBase + highPort / 8))
-        throw GeneralProtectionFault(0, "TSS I/O map too small");
+        return leaveFaultPending(GeneralProtectionFault(0, "TSS I/O map too small"));
 
     WORD mask = (1 << (sizeof(T) - 1)) << (port & 7);
     LinearAddress address(TR.base.get() + iomapBase + (port / 8));
     WORD perm = mask & 0xff00 ? readMemory16(address) : readMemory8(address);
     if (perm & mask)
-        throw GeneralProtectionFault(0, "I/O map disallowed access");
+        return leaveFaultPending(GeneralProtectionFault(0, "I/O map disallowed access"));
+    return true;
 }
 
 // Important note from IA32 manual, regarding string I/O instructions:
@@ -126,7 +141,7 @@ void CPU::validateIOAccess(WORD port)
 template<typename T>
 void CPU::out(WORD port, T data)
 {
-    validateIOAccess<T>(port);
+    ++m_stores;
 
     if (options.iopeek) {
         if (port != 0x00E6 && port != 0x0020 && port != 0x3D4 && port != 0x03d5 && port != 0xe2 && port != 0xe0 && port != 0x92) {
@@ -139,20 +154,18 @@ void CPU::out(WORD port, T data)
         return;
     }
 
-    if (!IODevice::shouldIgnorePort(port))
+    if (!machine().shouldIgnorePort(port))
         vlog(LogAlert, "Unhandled I/O write to port %03x, data %x", port, data);
 }
 
 
 template<typename T> T CPU::in(WORD port)
 {
-    validateIOAccess<T>(port);
-
     T data;
     if (auto* device = machine().inputDeviceForPort(port)) {
         data = device->in<T>(port);
     } else {
-        if (!IODevice::shouldIgnorePort(port))
+        if (!machine().shouldIgnorePort(port))
             vlog(LogAlert, "Unhandled I/O read from port %03x", port);
         data = IODevice::JunkValue;
     }
@@ -165,6 +178,31 @@ template<typename T> T CPU::in(WORD port)
     return data;
 }
 
+template<typename T>
+DWORD CPU::inString(WORD port, BYTE* destination, DWORD count)
+{
+    // --iopeek wants to see every element.
+    if (options.iopeek)
+        return 0;
+    auto* device = machine().inputDeviceForPort(port);
+    if (!device)
+        return 0;
+    return device->inString(port, sizeof(T), destination, count);
+}
+
+template<typename T>
+DWORD CPU::outString(WORD port, const BYTE* source, DWORD count)
+{
+    if (options.iopeek)
+        return 0;
+    auto* device = machine().outputDeviceForPort(port);
+    if (!device)
+        return 0;
+    DWORD done = device->outString(port, sizeof(T), source, count);
+    m_stores += done;
+    return done;
+}
+
 void CPU::out8(WORD port, BYTE data)
 {
     out<BYTE>(port, data);
@@ -201,3 +239,12 @@ template DWORD CPU::in<DWORD>(WORD port);
 template void CPU::out<BYTE>(WORD port, BYTE);
 template void CPU::out<WORD>(WORD port, WORD);
 template void CPU::out<DWORD>(WORD port, DWORD);
+template DWORD CPU::inString<BYTE>(WORD port, BYTE*, DWORD);
+template DWORD CPU::inString<WORD>(WORD port, BYTE*, DWORD);
+template DWORD CPU::inString<DWORD>(WORD port, BYTE*, DWORD);
+template DWORD CPU::outString<BYTE>(WORD port, const BYTE*, DWORD);
+template DWORD CPU::outString<WORD>(WORD port, const BYTE*, DWORD);
+template DWORD CPU::outString<DWORD>(WORD port, const BYTE*, DWORD);
+template bool CPU::checkIOAccess<BYTE>(WORD port);
+template bool CPU::checkIOAccess<WORD>(WORD port);
+template bool CPU::checkIOAccess<DWORD>(WORD port);
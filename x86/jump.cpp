@@ -53,6 +53,8 @@ void CPU::_JMP_imm16_imm32(Instruction& insn)
 void CPU::_JMP_short_imm8(Instruction& insn)
 {
     jumpRelative8(insn.imm8());
+    if (static_cast<SIGNED_BYTE>(insn.imm8()) < 0)
+        didTakeBackwardBranch();
 }
 
 void CPU::_JMP_RM16(Instruction& insn)
@@ -102,8 +104,11 @@ void CPU::_SETcc_RM8(Instruction& insn)
 
 void CPU::_Jcc_imm8(Instruction& insn)
 {
-    if (evaluate(insn.cc()))
-        jumpRelative8(insn.imm8());
+    if (!evaluate(insn.cc()))
+        return;
+    jumpRelative8(insn.imm8());
+    if (static_cast<SIGNED_BYTE>(insn.imm8()) < 0)
+        didTakeBackwardBranch();
 }
 
 void CPU::_Jcc_NEAR_imm(Instruction& insn)
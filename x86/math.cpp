@@ -41,10 +41,6 @@ QWORD CPU::doADD(T dest, T src)
 {
     QWORD result = (QWORD)dest + (QWORD)src;
     updateCpuMathFlags(*this, result, dest, src);
-    setOF(((
-          ((result)^(dest)) &
-          ((result)^(src))
-         )>>(TypeTrivia<T>::bits - 1))&1);
     return result;
 }
 
@@ -54,10 +50,6 @@ QWORD CPU::doADC(T dest, T src)
     QWORD result = (QWORD)dest + (QWORD)src + (QWORD)getCF();
 
     updateCpuMathFlags(*this, result, dest, src);
-    setOF(((
-          ((result)^(dest)) &
-          ((result)^(src))
-         )>>(TypeTrivia<T>::bits - 1))&1);
     return result;
 }
 
@@ -194,7 +186,7 @@ void CPU::doDIV(T dividendHigh, T dividendLow, T divisor, T& quotient, T& remain
     DT dividend = weld<DT>(dividendHigh, dividendLow);
     DT result = dividend / divisor;
     if (result > std::numeric_limits<T>::max() || result < std::numeric_limits<T>::min()) {
-        throw DivideError(QString("Divide overflow (%1 / %2 = %3 { range = %4 - %5 })").arg(dividend).arg(divisor).arg(result).arg(std::numeric_limits<T>::min()).arg(std::numeric_limits<T>::max()));
+        throw DivideError(ExceptionReason("Divide overflow (%1 / %2 = %3 { range = %4 - %5 })", dividend, divisor, result, std::numeric_limits<T>::min(), std::numeric_limits<T>::max()));
     }
 
     quotient = result;
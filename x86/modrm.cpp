@@ -47,7 +47,8 @@ FLATTEN void MemoryOrRegisterReference::resolve(CPU& cpu)
     return resolve16();
 }
 
-FLATTEN void MemoryOrRegisterReference::decode(InstructionStream& stream, bool a32)
+template<typename InstructionStreamType>
+FLATTEN void MemoryOrRegisterReference::decode(InstructionStreamType& stream, bool a32)
 {
     m_a32 = a32;
     m_rm = stream.readInstruction8();
@@ -61,7 +62,7 @@ FLATTEN void MemoryOrRegisterReference::decode(InstructionStream& stream, bool a
         default: ASSERT_NOT_REACHED(); break;
         }
     } else {
-        decode16(stream);
+        decode16();
         switch (m_displacementBytes) {
         case 0: break;
         case 1: m_displacement16 = signExtendedTo<WORD>(stream.readInstruction8()); break;
@@ -71,7 +72,7 @@ FLATTEN void MemoryOrRegisterReference::decode(InstructionStream& stream, bool a
     }
 }
 
-ALWAYS_INLINE void MemoryOrRegisterReference::decode16(InstructionStream&)
+ALWAYS_INLINE void MemoryOrRegisterReference::decode16()
 {
     ASSERT(!m_a32);
 
@@ -94,7 +95,8 @@ ALWAYS_INLINE void MemoryOrRegisterReference::decode16(InstructionStream&)
     }
 }
 
-ALWAYS_INLINE void MemoryOrRegisterReference::decode32(InstructionStream& stream)
+template<typename InstructionStreamType>
+ALWAYS_INLINE void MemoryOrRegisterReference::decode32(InstructionStreamType& stream)
 {
     ASSERT(m_a32);
 
@@ -128,6 +130,10 @@ ALWAYS_INLINE void MemoryOrRegisterReference::decode32(InstructionStream& stream
     }
 }
 
+template void MemoryOrRegisterReference::decode(InstructionStream&, bool a32);
+template void MemoryOrRegisterReference::decode(SimpleInstructionStream&, bool a32);
+template void MemoryOrRegisterReference::decode(InstructionFetchWindow&, bool a32);
+
 ALWAYS_INLINE void MemoryOrRegisterReference::resolve16()
 {
     ASSERT(m_cpu);
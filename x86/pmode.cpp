@@ -166,7 +166,7 @@ void CPU::_CLTS(Instruction&)
 {
     if (getPE()) {
         if (getCPL() != 0) {
-            throw GeneralProtectionFault(0, QString("CLTS with CPL!=0(%1)").arg(getCPL()));
+            throw GeneralProtectionFault(0, ExceptionReason("CLTS with CPL!=0(%1)", getCPL()));
         }
     }
     m_CR0 &= ~(1 << 3);
@@ -176,7 +176,7 @@ void CPU::_LMSW_RM16(Instruction& insn)
 {
     if (getPE()) {
         if (getCPL() != 0) {
-            throw GeneralProtectionFault(0, QString("LMSW with CPL!=0(%1)").arg(getCPL()));
+            throw GeneralProtectionFault(0, ExceptionReason("LMSW with CPL!=0(%1)", getCPL()));
         }
     }
 
@@ -195,6 +195,24 @@ void CPU::_SMSW_RM16(Instruction& insn)
     insn.modrm().writeClearing16(getCR0(), o32());
 }
 
+void CPU::_INVLPG(Instruction& insn)
+{
+    if (insn.modrm().isRegister())
+        throw InvalidOpcode("INVLPG with register operand");
+
+    if (getPE()) {
+        if (getCPL() != 0) {
+            throw GeneralProtectionFault(0, ExceptionReason("INVLPG with CPL!=0(%1)", getCPL()));
+        }
+    }
+
+    auto linearAddress = cachedDescriptor(insn.modrm().segment()).linearAddress(insn.modrm().offset());
+    invalidateTLBEntry(linearAddress);
+#ifdef PMODE_DEBUG
+    vlog(LogCPU, "INVLPG %08X", linearAddress.get());
+#endif
+}
+
 void CPU::_LAR_reg16_RM16(Instruction& insn)
 {
     if (!getPE() || getVM())
@@ -331,13 +349,14 @@ void CPU::raiseException(const Exception& e)
     }
 }
 
-Exception CPU::GeneralProtectionFault(WORD code, const QString& reason)
+Exception CPU::GeneralProtectionFault(WORD code, const ExceptionReason& reason)
 {
     WORD selector = code & 0xfff8;
     bool TI = code & 4;
     bool I = code & 2;
     bool EX = code & 1;
-    vlog(LogCPU, "Exception: #GP(%04x) selector=%04X, TI=%u, I=%u, EX=%u :: %s", code, selector, TI, I, EX, qPrintable(reason));
+    if (!options.novlog)
+        vlog(LogCPU, "Exception: #GP(%04x) selector=%04X, TI=%u, I=%u, EX=%u :: %s", code, selector, TI, I, EX, qPrintable(reason.toString()));
     if (options.crashOnGPF) {
         dumpAll();
         vlog(LogAlert, "CRASH ON GPF");
@@ -346,39 +365,45 @@ Exception CPU::GeneralProtectionFault(WORD code, const QString& reason)
     return Exception(0xd, code, reason);
 }
 
-Exception CPU::StackFault(WORD selector, const QString& reason)
+Exception CPU::StackFault(WORD selector, const ExceptionReason& reason)
 {
-    vlog(LogCPU, "Exception: #SS(%04x) :: %s", selector, qPrintable(reason));
+    if (!options.novlog)
+        vlog(LogCPU, "Exception: #SS(%04x) :: %s", selector, qPrintable(reason.toString()));
     return Exception(0xc, selector, reason);
 }
 
-Exception CPU::NotPresent(WORD selector, const QString& reason)
+Exception CPU::NotPresent(WORD selector, const ExceptionReason& reason)
 {
-    vlog(LogCPU, "Exception: #NP(%04x) :: %s", selector, qPrintable(reason));
+    if (!options.novlog)
+        vlog(LogCPU, "Exception: #NP(%04x) :: %s", selector, qPrintable(reason.toString()));
     return Exception(0xb, selector, reason);
 }
 
-Exception CPU::InvalidOpcode(const QString& reason)
+Exception CPU::InvalidOpcode(const ExceptionReason& reason)
 {
-    vlog(LogCPU, "Exception: #UD :: %s", qPrintable(reason));
+    if (!options.novlog)
+        vlog(LogCPU, "Exception: #UD :: %s", qPrintable(reason.toString()));
     return Exception(0x6, reason);
 }
 
-Exception CPU::BoundRangeExceeded(const QString& reason)
+Exception CPU::BoundRangeExceeded(const ExceptionReason& reason)
 {
-    vlog(LogCPU, "Exception: #BR :: %s", qPrintable(reason));
+    if (!options.novlog)
+        vlog(LogCPU, "Exception: #BR :: %s", qPrintable(reason.toString()));
     return Exception(0x5, reason);
 }
 
-Exception CPU::InvalidTSS(WORD selector, const QString& reason)
+Exception CPU::InvalidTSS(WORD selector, const ExceptionReason& reason)
 {
-    vlog(LogCPU, "Exception: #TS(%04x) :: %s", selector, qPrintable(reason));
+    if (!options.novlog)
+        vlog(LogCPU, "Exception: #TS(%04x) :: %s", selector, qPrintable(reason.toString()));
     return Exception(0xa, selector, reason);
 }
 
-Exception CPU::DivideError(const QString& reason)
+Exception CPU::DivideError(const ExceptionReason& reason)
 {
-    vlog(LogCPU, "Exception: #DE :: %s", qPrintable(reason));
+    if (!options.novlog)
+        vlog(LogCPU, "Exception: #DE :: %s", qPrintable(reason.toString()));
     return Exception(0x0, reason);
 }
 
@@ -398,13 +423,13 @@ void CPU::validateSegmentLoad(SegmentRegisterIndex reg, WORD selector, const Des
             throw GeneralProtectionFault(0, "ss loaded with null descriptor");
         }
         if (selectorRPL != getCPL()) {
-            throw GeneralProtectionFault(selector, QString("ss selector RPL(%1) != CPL(%2)").arg(selectorRPL).arg(getCPL()));
+            throw GeneralProtectionFault(selector, ExceptionReason("ss selector RPL(%1) != CPL(%2)", selectorRPL, getCPL()));
         }
         if (!descriptor.isData() || !descriptor.asDataSegmentDescriptor().writable()) {
             throw GeneralProtectionFault(selector, "ss loaded with something other than a writable data segment");
         }
         if (descriptor.DPL() != getCPL()) {
-            throw GeneralProtectionFault(selector, QString("ss selector leads to descriptor with DPL(%1) != CPL(%2)").arg(descriptor.DPL()).arg(getCPL()));
+            throw GeneralProtectionFault(selector, ExceptionReason("ss selector leads to descriptor with DPL(%1) != CPL(%2)", descriptor.DPL(), getCPL()));
         }
         if (!descriptor.present()) {
             throw StackFault(selector, "ss loaded with non-present segment");
@@ -420,24 +445,24 @@ void CPU::validateSegmentLoad(SegmentRegisterIndex reg, WORD selector, const Des
         || reg == SegmentRegisterIndex::FS
         || reg == SegmentRegisterIndex::GS) {
         if (!descriptor.isData() && (descriptor.isCode() && !descriptor.asCodeSegmentDescriptor().readable())) {
-            throw GeneralProtectionFault(selector, QString("%1 loaded with non-data or non-readable code segment").arg(registerName(reg)));
+            throw GeneralProtectionFault(selector, ExceptionReason("%1 loaded with non-data or non-readable code segment", registerName(reg)));
         }
         if (descriptor.isData() || descriptor.isNonconformingCode()) {
             if (selectorRPL > descriptor.DPL()) {
-                throw GeneralProtectionFault(selector, QString("%1 loaded with data or non-conforming code segment and RPL > DPL").arg(registerName(reg)));
+                throw GeneralProtectionFault(selector, ExceptionReason("%1 loaded with data or non-conforming code segment and RPL > DPL", registerName(reg)));
             }
             if (getCPL() > descriptor.DPL()) {
-                throw GeneralProtectionFault(selector, QString("%1 loaded with data or non-conforming code segment and CPL > DPL").arg(registerName(reg)));
+                throw GeneralProtectionFault(selector, ExceptionReason("%1 loaded with data or non-conforming code segment and CPL > DPL", registerName(reg)));
             }
         }
         if (!descriptor.present()) {
-            throw NotPresent(selector, QString("%1 loaded with non-present segment").arg(registerName(reg)));
+            throw NotPresent(selector, ExceptionReason("%1 loaded with non-present segment", registerName(reg)));
         }
     }
 
     if (!descriptor.isNull() && !descriptor.isSegmentDescriptor()) {
         dumpDescriptor(descriptor);
-        throw GeneralProtectionFault(0, QString("%1 loaded with system segment").arg(registerName(reg)));
+        throw GeneralProtectionFault(0, ExceptionReason("%1 loaded with system segment", registerName(reg)));
     }
 }
 
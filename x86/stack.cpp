@@ -197,7 +197,7 @@ void CPU::_PUSHFD(Instruction&)
     if (!getPE() || (getPE() && ((!getVM() || (getVM() && getIOPL() == 3)))))
         push32(getEFlags() & 0x00FCFFFF);
     else
-        throw GeneralProtectionFault(0, "PUSHFD");
+        leaveFaultPending(GeneralProtectionFault(0, "PUSHFD"));
 }
 
 void CPU::_PUSH_imm32(Instruction& insn)
@@ -210,7 +210,7 @@ void CPU::_PUSHF(Instruction&)
     if (!getPE() || (getPE() && ((!getVM() || (getVM() && getIOPL() == 3)))))
         push16(getFlags());
     else
-        throw GeneralProtectionFault(0, "PUSHF");
+        leaveFaultPending(GeneralProtectionFault(0, "PUSHF"));
 }
 
 void CPU::_POPF(Instruction&)
@@ -221,7 +221,8 @@ void CPU::_POPF(Instruction&)
 void CPU::_POPFD(Instruction&)
 {
     if (getVM() && getIOPL() < 3) {
-        throw GeneralProtectionFault(0, "POPFD with IOPL < 3");
+        leaveFaultPending(GeneralProtectionFault(0, "POPFD with IOPL < 3"));
+        return;
     }
     setEFlagsRespectfully(pop32(), getCPL());
 }
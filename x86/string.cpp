@@ -33,7 +33,7 @@ void CPU::doOnceOrRepeatedly(Instruction& insn, bool careAboutZF, F func)
         return;
     }
     while (readRegisterForAddressSize(RegisterCX)) {
-        if (getIF() && PIC::hasPendingIRQ() && !PIC::isIgnoringAllIRQs()) {
+        if ((pendingWork() & PendingWork::IRQ) && getIF() && !PIC::isIgnoringAllIRQs(machine())) {
             throw HardwareInterruptDuringREP();
         }
         func();
@@ -48,12 +48,89 @@ void CPU::doOnceOrRepeatedly(Instruction& insn, bool careAboutZF, F func)
     }
 }
 
+// Like doOnceOrRepeatedly(), for the string instructions that don't look at ZF.
+// Each round, bulk(count) may do up to count elements at once and returns how many it did.
+// When it can't do any, func does a single one the slow way, unless bulk left a fault pending
+// for the element it stopped at. A round never goes past the end of a page, so pending IRQs
+// still get in every few thousand bytes.
+template<typename F, typename B>
+void CPU::doOnceOrRepeatedlyInBulk(Instruction& insn, F func, B bulk)
+{
+    if (!insn.hasRepPrefix()) {
+        func();
+        return;
+    }
+    while (DWORD count = readRegisterForAddressSize(RegisterCX)) {
+        if ((pendingWork() & PendingWork::IRQ) && getIF() && !PIC::isIgnoringAllIRQs(machine())) {
+            throw HardwareInterruptDuringREP();
+        }
+        DWORD done = bulk(count);
+        if (!done) {
+            if (UNLIKELY(m_hasPendingFault))
+                return;
+            func();
+            done = 1;
+        }
+        m_cycle += done;
+        writeRegisterForAddressSize(RegisterCX, count - done);
+    }
+}
+
+// Host pointers to string runs point at the first element, which is the highest one when DF=1.
+template<typename T>
+static inline BYTE* lowestElement(BYTE* pointer, DWORD count, bool descending)
+{
+    return descending ? pointer - (count - 1) * sizeof(T) : pointer;
+}
+
+template<typename T>
+static void copyElements(BYTE* destination, BYTE* source, DWORD count, bool descending)
+{
+    DWORD size = count * sizeof(T);
+    BYTE* lowestDestination = lowestElement<T>(destination, count, descending);
+    BYTE* lowestSource = lowestElement<T>(source, count, descending);
+    if (lowestDestination + size <= lowestSource || lowestSource + size <= lowestDestination) {
+        memcpy(lowestDestination, lowestSource, size);
+        return;
+    }
+    // Overlapping runs have to be copied one element at a time, in order, so that
+    // patterns get replicated exactly like they do on a real CPU.
+    for (DWORD i = 0; i < count; ++i) {
+        memmove(destination, source, sizeof(T));
+        destination = descending ? destination - sizeof(T) : destination + sizeof(T);
+        source = descending ? source - sizeof(T) : source + sizeof(T);
+    }
+}
+
+template<typename T>
+static void fillElements(BYTE* destination, T value, DWORD count, bool descending)
+{
+    destination = lowestElement<T>(destination, count, descending);
+    if (sizeof(T) == 1) {
+        memset(destination, value, count);
+        return;
+    }
+    for (DWORD i = 0; i < count; ++i)
+        memcpy(destination + i * sizeof(T), &value, sizeof(T));
+}
+
 template<typename T>
 void CPU::doLODS(Instruction& insn)
 {
-    doOnceOrRepeatedly(insn, false, [this] () {
+    doOnceOrRepeatedlyInBulk(insn, [this] () {
         writeRegister<T>(RegisterAL, readMemory<T>(currentSegment(), readRegisterForAddressSize(RegisterSI)));
         stepRegisterForAddressSize(RegisterSI, sizeof(T));
+    }, [this] (DWORD count) -> DWORD {
+        BYTE* source;
+        count = stringRunLength<T>(currentSegment(), readRegisterForAddressSize(RegisterSI), MemoryAccessType::Read, count, source);
+        if (!count)
+            return 0;
+        // Only the last element loaded is ever seen.
+        T value;
+        memcpy(&value, getDF() ? source - (count - 1) * sizeof(T) : source + (count - 1) * sizeof(T), sizeof(T));
+        writeRegister<T>(RegisterAL, value);
+        stepRegisterForAddressSize(RegisterSI, count * sizeof(T));
+        return count;
     });
 }
 
@@ -75,9 +152,18 @@ void CPU::_LODSD(Instruction& insn)
 template<typename T>
 void CPU::doSTOS(Instruction& insn)
 {
-    doOnceOrRepeatedly(insn, false, [this] () {
+    doOnceOrRepeatedlyInBulk(insn, [this] () {
         writeMemory<T>(SegmentRegisterIndex::ES, readRegisterForAddressSize(RegisterDI), readRegister<T>(RegisterAL));
         stepRegisterForAddressSize(RegisterDI, sizeof(T));
+    }, [this] (DWORD count) -> DWORD {
+        BYTE* destination;
+        count = stringRunLength<T>(SegmentRegisterIndex::ES, readRegisterForAddressSize(RegisterDI), MemoryAccessType::Write, count, destination);
+        if (!count)
+            return 0;
+        fillElements<T>(destination, readRegister<T>(RegisterAL), count, getDF());
+        didWriteStringRun(destination, count, sizeof(T));
+        stepRegisterForAddressSize(RegisterDI, count * sizeof(T));
+        return count;
     });
 }
 
@@ -153,11 +239,24 @@ void CPU::_SCASD(Instruction& insn)
 template<typename T>
 void CPU::doMOVS(Instruction& insn)
 {
-    doOnceOrRepeatedly(insn, false, [this] () {
+    doOnceOrRepeatedlyInBulk(insn, [this] () {
         T tmp = readMemory<T>(currentSegment(), readRegisterForAddressSize(RegisterSI));
         writeMemory<T>(SegmentRegisterIndex::ES, readRegisterForAddressSize(RegisterDI), tmp);
         stepRegisterForAddressSize(RegisterSI, sizeof(T));
         stepRegisterForAddressSize(RegisterDI, sizeof(T));
+    }, [this] (DWORD count) -> DWORD {
+        BYTE* source;
+        BYTE* destination;
+        count = stringRunLength<T>(currentSegment(), readRegisterForAddressSize(RegisterSI), MemoryAccessType::Read, count, source);
+        if (count)
+            count = stringRunLength<T>(SegmentRegisterIndex::ES, readRegisterForAddressSize(RegisterDI), MemoryAccessType::Write, count, destination);
+        if (!count)
+            return 0;
+        copyElements<T>(destination, source, count, getDF());
+        didWriteStringRun(destination, count, sizeof(T));
+        stepRegisterForAddressSize(RegisterSI, count * sizeof(T));
+        stepRegisterForAddressSize(RegisterDI, count * sizeof(T));
+        return count;
     });
 }
 
@@ -179,10 +278,34 @@ void CPU::_MOVSD(Instruction& insn)
 template<typename T>
 void CPU::doOUTS(Instruction& insn)
 {
-    doOnceOrRepeatedly(insn, false, [this] () {
+    // DX doesn't change from one element to the next, so neither does I/O permission.
+    if ((!insn.hasRepPrefix() || readRegisterForAddressSize(RegisterCX)) && !checkIOAccess<T>(getDX()))
+        return;
+    doOnceOrRepeatedlyInBulk(insn, [this] () {
         T data = readMemory<T>(currentSegment(), readRegisterForAddressSize(RegisterSI));
         out<T>(getDX(), data);
         stepRegisterForAddressSize(RegisterSI, sizeof(T));
+    }, [this] (DWORD count) -> DWORD {
+        BYTE* source;
+        count = stringRunLength<T>(currentSegment(), readRegisterForAddressSize(RegisterSI), MemoryAccessType::Read, count, source);
+        if (!count)
+            return 0;
+        WORD port = getDX();
+        // An ascending run is laid out the way the device wants it. A device that takes part
+        // of it, like IDE at the end of a DRQ block, may have raised an IRQ there, so end the
+        // round and let the REP loop check for it before the rest.
+        DWORD done = getDF() ? 0 : outString<T>(port, source, count);
+        if (done)
+            count = done;
+        source += done * sizeof(T);
+        for (DWORD i = done; i < count; ++i) {
+            T data;
+            memcpy(&data, source, sizeof(T));
+            out<T>(port, data);
+            source = getDF() ? source - sizeof(T) : source + sizeof(T);
+        }
+        stepRegisterForAddressSize(RegisterSI, count * sizeof(T));
+        return count;
     });
 }
 
@@ -204,11 +327,33 @@ void CPU::_OUTSD(Instruction& insn)
 template<typename T>
 void CPU::doINS(Instruction& insn)
 {
-    doOnceOrRepeatedly(insn, false, [this] () {
+    // DX doesn't change from one element to the next, so neither does I/O permission.
+    if ((!insn.hasRepPrefix() || readRegisterForAddressSize(RegisterCX)) && !checkIOAccess<T>(getDX()))
+        return;
+    doOnceOrRepeatedlyInBulk(insn, [this] () {
         // FIXME: Should this really read the port without knowing that the destination memory is writable?
         T data = in<T>(getDX());
         writeMemory<T>(SegmentRegisterIndex::ES, readRegisterForAddressSize(RegisterDI), data);
         stepRegisterForAddressSize(RegisterDI, sizeof(T));
+    }, [this] (DWORD count) -> DWORD {
+        BYTE* destination;
+        count = stringRunLength<T>(SegmentRegisterIndex::ES, readRegisterForAddressSize(RegisterDI), MemoryAccessType::Write, count, destination);
+        if (!count)
+            return 0;
+        WORD port = getDX();
+        DWORD done = getDF() ? 0 : inString<T>(port, destination, count);
+        // See doOUTS().
+        if (done)
+            count = done;
+        BYTE* cursor = destination + done * sizeof(T);
+        for (DWORD i = done; i < count; ++i) {
+            T data = in<T>(port);
+            memcpy(cursor, &data, sizeof(T));
+            cursor = getDF() ? cursor - sizeof(T) : cursor + sizeof(T);
+        }
+        didWriteStringRun(destination, count, sizeof(T));
+        stepRegisterForAddressSize(RegisterDI, count * sizeof(T));
+        return count;
     });
 }
 